@@ -261,7 +261,7 @@ NSString* formatTime(QTTime qttime)
 			layerstream.strictSeek = NO;
 		}
 		if (newPos != layerPrev) {
-			[layerstream setPosition:newPos];
+			[layerstream scrubToPosition:newPos];
 			layerPrev = newPos;
 		}
 	}
@@ -272,7 +272,7 @@ NSString* formatTime(QTTime qttime)
 			viewstream.strictSeek = NO;
 		}
 		if (newPos != viewPrev) {
-			[viewstream setPosition:newPos];
+			[viewstream scrubToPosition:newPos];
 			viewPrev = newPos;
 		}
 	}
@@ -287,10 +287,12 @@ NSString* formatTime(QTTime qttime)
 {
 	NSSlider *pos = (NSSlider*) sender;
 	if ([pos window] == layerwindow && !layerstream.busy) {
+		[layerstream endScrubbing];
 		[layerstream setRate:prevRate];
 		layerstream.strictSeek = YES;
 	}
 	if ([pos window] == viewwindow && !viewstream.busy) {
+		[viewstream endScrubbing];
 		[viewstream setRate:prevRate];
 		viewstream.strictSeek = YES;
 	}
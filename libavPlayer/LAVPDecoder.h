@@ -30,27 +30,101 @@
 @interface LAVPDecoder : NSObject {
 @private	
 	VideoState *is;
-	CVPixelBufferRef pb;
+	id defaultConsumer;				// LAVPConsumer of the single-consumer API
+	NSMutableDictionary *consumers;	// LAVPConsumer keyed by the registered object
     double lastPosition;
+    NSMutableArray *seekCompletions;
+    int64_t openLatency;			// usec spent in initWithURL:
+	
+	// offline processing
+	OSType offlinePixelFormat;
+	VideoConsumer *offlineConsumer;		// used from the video thread only
+	CVPixelBufferPoolRef offlinePool;
+	void (^offlineVideoHandler)(CVPixelBufferRef pixelBuffer, double_t pts);
+	void (^offlineAudioHandler)(const int16_t *samples, NSUInteger frameCount, NSUInteger channels, double_t sampleRate, double_t pts);
+	dispatch_semaphore_t offlineDone;
+	int offlineResult;
 }
 
 - (id) initWithURL:(NSURL *)sourceURL error:(NSError **)errorPtr;
+- (id) initWithURL:(NSURL *)sourceURL options:(const StreamOptions *)options error:(NSError **)errorPtr;
+- (id) initWithURL:(NSURL *)sourceURL options:(const StreamOptions *)options pixelFormat:(OSType)format
+	  videoHandler:(void (^)(CVPixelBufferRef pixelBuffer, double_t pts))videoHandler
+	  audioHandler:(void (^)(const int16_t *samples, NSUInteger frameCount, NSUInteger channels, double_t sampleRate, double_t pts))audioHandler
+			 error:(NSError **)errorPtr;
++ (void) getCodecLockObtained:(int64_t *)obtained contended:(int64_t *)contended waitTime:(int64_t *)usec;
++ (void) getContextPoolHits:(int64_t *)hits misses:(int64_t *)misses;
++ (void) drainContextPool;
+- (int64_t) openLatency;
+- (int) waitUntilProcessed;
 - (void) invalidate;
 - (void) threadMain;
 
 - (BOOL) readyForPTS:(double_t)pts;
 - (CVPixelBufferRef) getPixelBufferForPTS:(double_t*)pts;
+- (CVPixelBufferRef) getPixelBufferForPTS:(double_t*)pts consumer:(id)key;
 - (BOOL) readyForCurrent;
 - (CVPixelBufferRef) getPixelBufferForCurrent:(double_t*)pts;
+- (CVPixelBufferRef) getPixelBufferForCurrent:(double_t*)pts consumer:(id)key;
 - (NSSize) frameSize;
 
 - (CGFloat) rate;
 - (void) setRate:(CGFloat)rate;
+- (void) stepForward;
+- (void) stepBackward;
 - (int64_t) duration;
 - (int64_t) position;
 - (int64_t) setPosition:(int64_t)pos blocking:(BOOL)blocking;
+- (void) setPosition:(int64_t)pos completion:(void (^)(int64_t position))completion;
+- (BOOL) scrubToPosition:(int64_t)pos;
+- (void) endScrub;
+- (double_t) lastScrubFrameRate;
+- (int64_t) lastScrubRefineLatency;
+- (BOOL) subtitleCache;
+- (void) setSubtitleCache:(BOOL)cache;
+- (void) getSubtitleRenderFrames:(int64_t *)frames time:(int64_t *)usec layouts:(int64_t *)layouts;
 - (Float32) volume;
 - (void) setVolume:(Float32)volume;
 
 - (BOOL) eof;
+- (BOOL) audioOnly;
+- (int64_t) wakeupCount;
+- (BOOL) getSoakReport:(SoakReport *)report;
+- (int) degradationLevel;
+- (double_t) liveLatency;
+- (int) latencyCatchUps;
+- (void) setLoopStart:(int64_t)start end:(int64_t)end;
+- (BOOL) getLoopStart:(int64_t *)start end:(int64_t *)end;
+- (BOOL) getTimeshiftStart:(int64_t *)start end:(int64_t *)end;
+- (void) seekToLive;
+- (int64_t) timeshiftIngestTime;
+- (int64_t) lastTimeshiftSeekLatency;
+- (BOOL) bufferAlternateTracks;
+- (void) setBufferAlternateTracks:(BOOL)buffer;
+- (NSArray *) audioTracks;
+- (NSArray *) subtitleTracks;
+- (int) audioTrack;
+- (int) subtitleTrack;
+- (BOOL) selectAudioTrack:(int)index;
+- (BOOL) selectSubtitleTrack:(int)index;
+- (int64_t) bufferedBytesForTrack:(int)index;
+- (int64_t) lastTrackSwitchLatency;
+- (void) getMemoryUsage:(MemoryUsage *)usage;
+- (int64_t) memoryBudget;
+- (void) setMemoryBudget:(int64_t)bytes;
++ (void) setDecodedPictureMemoryLimit:(int64_t)bytes;
++ (int64_t) decodedPictureMemory;
+- (int) chapterCount;
+- (int) currentChapter;
+- (void) seekChapter:(int)delta;
+- (BOOL) chapterPrefetch;
+- (void) setChapterPrefetch:(BOOL)prefetch;
+- (int64_t) lastChapterJumpLatency;
+- (NSSize) outputSize;
+- (void) setOutputSize:(NSSize)size;
+- (NSSize) outputSizeForConsumer:(id)key;
+- (void) setOutputSize:(NSSize)size forConsumer:(id)key;
+- (BOOL) addConsumer:(id)key pixelFormat:(OSType)format;
+- (void) removeConsumer:(id)key;
+- (NSUInteger) consumerCount;
 @end
@@ -27,38 +27,142 @@
 
 extern double get_master_clock(VideoState *is);
 extern double get_clock(Clock *c);
-extern void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes);
+extern int32_t stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes);
+extern int stream_seek_pending(VideoState *is);
 extern void stream_pause(VideoState *is);
 extern void stream_close(VideoState *is);
-extern VideoState* stream_open(id opaque, NSURL *sourceURL);
+extern VideoState* stream_open(id opaque, NSURL *sourceURL, const StreamOptions *options);
 extern void alloc_picture(void *opaque);
 extern void refresh_loop_wait_event(VideoState *is);
 extern int hasImage(void *opaque, double_t targetpts);
-extern int copyImage(void *opaque, double_t *targetpts, uint8_t* data, const int pitch) ;
+extern int copyImage(void *opaque, VideoConsumer *vc, double_t *targetpts, uint8_t* data, const int pitch, int width, int height) ;
 extern int hasImageCurrent(void *opaque);
-extern int copyImageCurrent(void *opaque, double_t *targetpts, uint8_t* data, int pitch) ;
+extern int copyImageCurrent(void *opaque, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height) ;
 extern AudioQueueParameterValue getVolume(VideoState *is);
 extern void setVolume(VideoState *is, AudioQueueParameterValue volume);
 extern double_t stream_playRate(VideoState *is);
 extern void stream_setPlayRate(VideoState *is, double_t newRate);
+extern void stream_step_to_next_frame(VideoState *is);
+extern void stream_step_to_prev_frame(VideoState *is);
+extern void reverse_set_rate(VideoState *is, double rate);
+extern double reverse_rate(VideoState *is);
+extern int video_degradation_level(VideoState *is);
+extern double stream_latency(VideoState *is);
+extern VideoConsumer *video_consumer_create(VideoState *is, uint32_t pixel_format);
+extern void video_consumer_destroy(VideoState *is, VideoConsumer *vc);
+extern void video_set_output_size(VideoConsumer *vc, int width, int height);
+extern void video_output_size(VideoState *is, VideoConsumer *vc, int *width, int *height);
+extern int loop_set(VideoState *is, int64_t start, int64_t end);
+extern void loop_clear(VideoState *is);
+extern int loop_get(VideoState *is, int64_t *start, int64_t *end);
+extern double loop_map(VideoState *is, double pts, double clock);
+extern double loop_unmap(VideoState *is, double pts);
+extern int timeshift_get(VideoState *is, int64_t *start, int64_t *end);
+extern int64_t timeshift_ingest_usec(VideoState *is);
+extern int64_t timeshift_seek_usec(VideoState *is);
+extern void track_set_buffering(VideoState *is, int enable);
+extern int track_get_buffering(VideoState *is);
+extern int track_list(VideoState *is, enum AVMediaType type, int *indexes, int max);
+extern int track_select(VideoState *is, enum AVMediaType type, int stream_index);
+extern int64_t track_buffered_bytes(VideoState *is, int stream_index);
+extern int64_t track_switch_latency(VideoState *is);
+extern void stream_lock_stats(int64_t *obtained, int64_t *contended, int64_t *wait_usec);
+extern void pool_stats(int64_t *hits, int64_t *misses);
+extern void pool_drain(void);
+extern void stream_memory_usage(VideoState *is, MemoryUsage *usage);
+extern void video_set_memory_limit(int64_t bytes);
+extern int64_t video_memory_total(void);
+extern void video_set_memory_budget(VideoState *is, int64_t bytes);
+extern int stream_getChapterCount(VideoState *is);
+extern int stream_getChapterCurrent(VideoState *is);
+extern void stream_seek_chapter(VideoState *is, int incr);
+extern void chapter_set_prefetch(VideoState *is, int enable);
+extern int chapter_get_prefetch(VideoState *is);
+extern int64_t chapter_jump_latency(VideoState *is);
+extern int scrub_request(VideoState *is, int64_t pos);
+extern void scrub_end(VideoState *is);
+extern void scrub_stop(VideoState *is);
+extern int64_t scrub_position(VideoState *is);
+extern double scrub_frame_rate(VideoState *is);
+extern int64_t scrub_refine_latency(VideoState *is);
+extern void text_set_cache(VideoState *is, int enable);
+extern void text_stats(VideoState *is, int64_t *frames, int64_t *usec, int64_t *layouts);
+extern void soak_report(VideoState *is, SoakReport *report);
+extern int video_copy_picture(VideoState *is, VideoConsumer *vc, AVFrame *pict, int src_w, int src_h,
+                              uint8_t *data, int pitch, int width, int height);
+
+#pragma mark -
+
+/* one presentation target; see VideoConsumer in LAVPvideo.m */
+@interface LAVPConsumer : NSObject {
+@public
+	VideoConsumer *vc;
+	CVPixelBufferRef pb;
+	int busy;		// copies in progress; guarded by @synchronized(consumers)
+	BOOL removed;	// removeConsumer: ran while busy; the last copy frees vc and pb
+}
+@end
+
+@implementation LAVPConsumer
+@end
 
 #pragma mark -
 
 @interface LAVPDecoder (internal)
 
 - (void) allocPicture;
+- (void) seekDidComplete:(NSNumber *)generation;
+- (LAVPConsumer *) beginConsumer:(id)key;
+- (BOOL) endConsumer:(LAVPConsumer *)consumer;
+- (void) disposeConsumer:(LAVPConsumer *)consumer;
+- (void) preparePixelBufferForConsumer:(LAVPConsumer *)consumer width:(int *)width height:(int *)height;
+- (void) offlinePicture:(AVFrame *)frame pts:(double_t)pts;
+- (void) offlineSamples:(const uint8_t *)buf size:(int)size params:(const struct AudioParams *)params pts:(double_t)pts;
+- (void) offlineFinished:(int)error;
++ (void) wakeUp;
 
 @end
 
+/* LAVP: offline processing callbacks from the core */
+static void offline_video_frame(VideoState *is, AVFrame *frame, double pts, int serial)
+{
+	LAVPDecoder *decoder = (__bridge LAVPDecoder *)is->decoder;
+	[decoder offlinePicture:frame pts:pts];
+}
+
+static void offline_audio_block(VideoState *is, const uint8_t *buf, int size, const struct AudioParams *params, double pts, int serial)
+{
+	LAVPDecoder *decoder = (__bridge LAVPDecoder *)is->decoder;
+	[decoder offlineSamples:buf size:size params:params pts:pts];
+}
+
+static void offline_finished(VideoState *is, int error)
+{
+	LAVPDecoder *decoder = (__bridge LAVPDecoder *)is->decoder;
+	[decoder offlineFinished:error];
+}
+
 
 @implementation LAVPDecoder
 
 - (id) initWithURL:(NSURL *)sourceURL error:(NSError **)errorPtr
+{
+	return [self initWithURL:sourceURL options:NULL error:errorPtr];
+}
+
+- (id) initWithURL:(NSURL *)sourceURL options:(const StreamOptions *)options error:(NSError **)errorPtr
 {
 	self = [super init];
 	if (self) {
-		is = stream_open(self, sourceURL);
+		int64_t start = av_gettime();
+		seekCompletions = [NSMutableArray array];
+		is = stream_open(self, sourceURL, options);
 		if (is) {
+			consumers = [NSMutableDictionary dictionary];
+			defaultConsumer = [[LAVPConsumer alloc] init];
+			defaultConsumer->vc = video_consumer_create(is, VIDEO_CONSUMER_2VUY);
+			video_set_output_size(defaultConsumer->vc, is->output_width, is->output_height);
+			
 			[NSThread detachNewThreadSelector:@selector(threadMain) toTarget:self withObject:nil];
 			
             int msec = 10;
@@ -66,13 +170,19 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 			while(retry--) {
 				usleep(msec*1000);
 				
-                if (!isnan(get_master_clock(is)) && is->pictq_size)
+                if (!isnan(get_master_clock(is)) && (is->pictq_size || is->audio_only))
+                    break;
+                // LAVP: a batch of opens shares one deadline
+                if (options && options->open_deadline && av_gettime() > options->open_deadline)
                     break;
 			}
 			if (retry < 0) 
 				NSLog(@"ERROR: stream_open timeout detected.");
 			stream_pause(is);
+			openLatency = av_gettime() - start;
 		} else {
+			if (errorPtr)
+				*errorPtr = [NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil];
             return nil;
         }
 	}
@@ -80,26 +190,163 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	return self;
 }
 
+/* offline processing: no pacing, every picture and PCM block goes to the handlers */
+- (id) initWithURL:(NSURL *)sourceURL options:(const StreamOptions *)options pixelFormat:(OSType)format
+	  videoHandler:(void (^)(CVPixelBufferRef pixelBuffer, double_t pts))videoHandler
+	  audioHandler:(void (^)(const int16_t *samples, NSUInteger frameCount, NSUInteger channels, double_t sampleRate, double_t pts))audioHandler
+			 error:(NSError **)errorPtr
+{
+	self = [super init];
+	if (self) {
+		StreamOptions offlineOptions = {0};
+		if (options)
+			offlineOptions = *options;
+		offlineOptions.offline = 1;
+		offlineOptions.offline_video = offline_video_frame;
+		offlineOptions.offline_audio = offline_audio_block;
+		offlineOptions.offline_finished = offline_finished;
+		
+		offlinePixelFormat = format ? format : kCVPixelFormatType_422YpCbCr8;
+		offlineVideoHandler = [videoHandler copy];
+		offlineAudioHandler = [audioHandler copy];
+		offlineDone = dispatch_semaphore_create(0);
+		seekCompletions = [NSMutableArray array];
+		consumers = [NSMutableDictionary dictionary];
+		
+		is = stream_open(self, sourceURL, &offlineOptions);
+		if (!is) {
+			if (errorPtr)
+				*errorPtr = [NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil];
+			return nil;
+		}
+		
+		// LAVP: no wait for the first picture and no pause; processing has started
+		[NSThread detachNewThreadSelector:@selector(threadMain) toTarget:self withObject:nil];
+	}
+	
+	return self;
+}
+
+/* process-wide contention on the libav lock manager, which serializes codec open/close */
++ (void) getCodecLockObtained:(int64_t *)obtained contended:(int64_t *)contended waitTime:(int64_t *)usec
+{
+	stream_lock_stats(obtained, contended, usec);
+}
+
+/* returns 0, or the AVERROR that stopped reading; AVERROR(EINVAL) unless opened for offline processing */
+- (int) waitUntilProcessed
+{
+	if (!offlineDone)
+		return AVERROR(EINVAL);
+	dispatch_semaphore_wait(offlineDone, DISPATCH_TIME_FOREVER);
+	return offlineResult;
+}
+
+- (void) offlinePicture:(AVFrame *)frame pts:(double_t)pts
+{
+	int width = frame->width, height = frame->height;
+	CVPixelBufferRef pb = NULL;
+	
+	if (!offlineVideoHandler)
+		return;
+	
+	if (!offlineConsumer)
+		offlineConsumer = video_consumer_create(is, offlinePixelFormat);
+	
+	// LAVP: handlers may keep buffers; the pool recycles the ones they release
+	if (offlinePool) {
+		NSDictionary *attr = (__bridge NSDictionary *)CVPixelBufferPoolGetPixelBufferAttributes(offlinePool);
+		if ([[attr objectForKey:(id)kCVPixelBufferWidthKey] intValue] != width ||
+			[[attr objectForKey:(id)kCVPixelBufferHeightKey] intValue] != height) {
+			CVPixelBufferPoolRelease(offlinePool);
+			offlinePool = NULL;
+		}
+	}
+	if (!offlinePool) {
+		NSDictionary *attr = @{(id)kCVPixelBufferWidthKey : @(width),
+							   (id)kCVPixelBufferHeightKey : @(height),
+							   (id)kCVPixelBufferPixelFormatTypeKey : @(offlinePixelFormat)};
+		CVPixelBufferPoolCreate(kCFAllocatorDefault, NULL, (__bridge CFDictionaryRef)attr, &offlinePool);
+	}
+	if (!offlinePool || CVPixelBufferPoolCreatePixelBuffer(kCFAllocatorDefault, offlinePool, &pb) != kCVReturnSuccess)
+		return;
+	
+	CVPixelBufferLockBaseAddress(pb, 0);
+	int result = video_copy_picture(is, offlineConsumer, frame, width, height,
+									CVPixelBufferGetBaseAddress(pb), (int)CVPixelBufferGetBytesPerRow(pb), width, height);
+	CVPixelBufferUnlockBaseAddress(pb, 0);
+	
+	if (result > 0)
+		offlineVideoHandler(pb, pts);
+	CVPixelBufferRelease(pb);
+}
+
+- (void) offlineSamples:(const uint8_t *)buf size:(int)size params:(const struct AudioParams *)params pts:(double_t)pts
+{
+	if (offlineAudioHandler)
+		offlineAudioHandler((const int16_t *)buf, size / params->frame_size, params->channels, params->freq, pts);
+}
+
+- (void) offlineFinished:(int)error
+{
+	offlineResult = error;
+	dispatch_semaphore_signal(offlineDone);
+}
+
 - (void) invalidate
 {
 	// perform clean up
 	if (is && is->decoderThread) {
 		NSThread *dt = (__bridge_transfer NSThread*)(is->decoderThread);
 		[dt cancel];
+		// LAVP: class target; self must not be retained from dealloc
+		[[self class] performSelector:@selector(wakeUp) onThread:dt withObject:nil waitUntilDone:NO];
 		while (![dt isFinished]) {
 			usleep(10*1000);
 		}
 		dt = NULL;
 		
-		stream_close(is);
+		stream_close(is);	// also frees the VideoConsumers
 		is = NULL;
+		offlineConsumer = NULL;
 	}
-	if (pb) {
-		CVPixelBufferRelease(pb);
-		pb = NULL;
+	if (offlinePool)
+		CVPixelBufferPoolRelease(offlinePool);
+	offlinePool = NULL;
+	
+	NSMutableArray *all = [NSMutableArray array];
+	@synchronized(consumers) {
+		[all addObjectsFromArray:[consumers allValues]];
+		[consumers removeAllObjects];
+	}
+	if (defaultConsumer)
+		[all addObject:defaultConsumer];
+	defaultConsumer = nil;
+	for (LAVPConsumer *consumer in all) {
+		if (consumer->pb)
+			CVPixelBufferRelease(consumer->pb);
+		consumer->pb = NULL;
+		consumer->vc = NULL;
 	}
 }
 
+/* process-wide; contexts taken from the pool versus created, and freeing what is parked */
++ (void) getContextPoolHits:(int64_t *)hits misses:(int64_t *)misses
+{
+	pool_stats(hits, misses);
+}
+
++ (void) drainContextPool
+{
+	pool_drain();
+}
+
+- (int64_t) openLatency
+{
+	// usec from initWithURL: to the first picture (or audio clock) being ready
+	return openLatency;
+}
+
 - (void) dealloc
 {
 	[self invalidate];
@@ -115,16 +362,21 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
         
         NSTimer *timer = [NSTimer scheduledTimerWithTimeInterval:1.0/120
                                                           target:self
-                                                        selector:@selector(refreshPicture)
+                                                        selector:@selector(refreshPicture:)
                                                         userInfo:nil
                                                          repeats:YES];
         [runLoop addTimer:timer forMode:NSRunLoopCommonModes];
         
+        // LAVP: keeps the runloop blocking once the timer is gone (audio only)
+        [runLoop addPort:[NSMachPort port] forMode:NSDefaultRunLoopMode];
+        
         //
         NSThread *dt = [NSThread currentThread];
         while ( ![dt isCancelled] ) {
             @autoreleasepool {
-                [runLoop runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+                // LAVP: audio only wakes for performSelector: requests; invalidate sends one
+                NSTimeInterval interval = is->audio_only ? 1.0 : 0.05;
+                [runLoop runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:interval]];
             }
         }
         
@@ -137,13 +389,47 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	alloc_picture(is);
 }
 
-- (void) refreshPicture
+- (void) seekDidComplete:(NSNumber *)generation
 {
+	// Called from read_thread via decoder thread. Requests up to generation are settled.
+	int32_t gen = [generation intValue];
+	NSMutableArray *done = [NSMutableArray array];
+	
+	@synchronized(seekCompletions) {
+		for (NSArray *entry in seekCompletions) {
+			if ([[entry objectAtIndex:0] intValue] <= gen)
+				[done addObject:entry];
+		}
+		[seekCompletions removeObjectsInArray:done];
+	}
+	if (![done count]) return;
+	
+	int64_t position = [self position];
+	dispatch_async(dispatch_get_main_queue(), ^{
+		for (NSArray *entry in done) {
+			void (^handler)(int64_t) = [entry objectAtIndex:1];
+			handler(position);
+		}
+	});
+}
+
+- (void) refreshPicture:(NSTimer *)timer
+{
+    // LAVP: nothing is presented without video; stop waking 120 times per sec
+    if (is->audio_only) {
+        [timer invalidate];
+        return;
+    }
+    OSAtomicIncrement64(&is->wakeups);
     refresh_loop_wait_event(is);
 }
 
-- (CVPixelBufferRef) createDummyCVPixelBufferWithSize:(NSSize)size {
-	OSType format = '2vuy';	//k422YpCbCr8CodecType
++ (void) wakeUp
+{
+	// runloop source only; the thread loop re-checks isCancelled
+}
+
+- (CVPixelBufferRef) createCVPixelBufferWithSize:(NSSize)size format:(OSType)format {
 	size_t width = size.width, height = size.height;
 	CFDictionaryRef attr = NULL;
 	CVPixelBufferRef pixelbuffer = NULL;
@@ -156,10 +442,69 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	return pixelbuffer;
 }
 
+/* pins the consumer so a concurrent removeConsumer: cannot free its vc or pb; pair with endConsumer: */
+- (LAVPConsumer *) beginConsumer:(id)key
+{
+	@synchronized(consumers) {
+		LAVPConsumer *consumer = defaultConsumer;
+		if (key)
+			consumer = [consumers objectForKey:[NSValue valueWithNonretainedObject:key]];
+		if (!consumer || !consumer->vc)
+			return nil;
+		consumer->busy++;
+		return consumer;
+	}
+}
+
+/* NO when the consumer was removed meanwhile; its pb must not be handed out */
+- (BOOL) endConsumer:(LAVPConsumer *)consumer
+{
+	BOOL dispose = NO;
+	
+	@synchronized(consumers) {
+		consumer->busy--;
+		if (!consumer->removed)
+			return YES;
+		dispose = (consumer->busy == 0);
+	}
+	if (dispose)
+		[self disposeConsumer:consumer];
+	return NO;
+}
+
+- (void) disposeConsumer:(LAVPConsumer *)consumer
+{
+	if (is && consumer->vc)
+		video_consumer_destroy(is, consumer->vc);
+	if (consumer->pb)
+		CVPixelBufferRelease(consumer->pb);
+	consumer->vc = NULL;
+	consumer->pb = NULL;
+}
+
+- (void) preparePixelBufferForConsumer:(LAVPConsumer *)consumer width:(int *)width height:(int *)height
+{
+	// LAVP: pixel buffer follows the requested output size
+	video_output_size(is, consumer->vc, width, height);
+	
+	CVPixelBufferRef pb = consumer->pb;
+	if (pb && (CVPixelBufferGetWidth(pb) != *width || CVPixelBufferGetHeight(pb) != *height)) {
+		CVPixelBufferRelease(pb);
+		consumer->pb = NULL;
+	}
+	if (!consumer->pb) {
+		consumer->pb = [self createCVPixelBufferWithSize:NSMakeSize(*width, *height)
+												  format:consumer->vc->pixel_format];
+	}
+}
+
 - (BOOL) readyForPTS:(double_t)pts
 {
 	// pts is in sec.
 	
+	// LAVP: A-B loop presents the region again on a continuous timeline
+	pts = loop_map(is, pts, get_master_clock(is));
+	
 	if (hasImage(is, pts)) {
 		return YES;
 	}
@@ -167,30 +512,42 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 }
 
 - (CVPixelBufferRef) getPixelBufferForPTS:(double_t*)pts
+{
+	return [self getPixelBufferForPTS:pts consumer:nil];
+}
+
+- (CVPixelBufferRef) getPixelBufferForPTS:(double_t*)pts consumer:(id)key
 {
 	// pts is in sec.
 	
-	if (!pb) {
-		pb = [self createDummyCVPixelBufferWithSize:NSMakeSize(is->width, is->height)];
-	}
+	LAVPConsumer *consumer = [self beginConsumer:key];
+	if (!consumer)
+		return NULL;
 	
-	double_t currentpts = *pts;
+	int width, height;
+	[self preparePixelBufferForConsumer:consumer width:&width height:&height];
+	CVPixelBufferRef pb = consumer->pb;
+	
+	double_t currentpts = loop_map(is, *pts, get_master_clock(is));
 	
 	// Get current buffer for pts
 	CVPixelBufferLockBaseAddress(pb, 0);
 	
 	uint8_t* data = CVPixelBufferGetBaseAddress(pb);
 	int pitch = CVPixelBufferGetBytesPerRow(pb);
-	int ret = copyImage(is, &currentpts, data, pitch);
+	int ret = copyImage(is, consumer->vc, &currentpts, data, pitch, width, height);
 	
 	CVPixelBufferUnlockBaseAddress(pb, 0);
 	
+	if (![self endConsumer:consumer])
+		return NULL;
+	
 	//
 	if (ret == 1) {
-		*pts = currentpts;
+		*pts = loop_unmap(is, currentpts);
 		return pb;
 	} else if (ret == 2) {
-		*pts = currentpts;
+		*pts = loop_unmap(is, currentpts);
 		return pb;
 	}
 	return NULL;
@@ -205,12 +562,21 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 }
 
 - (CVPixelBufferRef) getPixelBufferForCurrent:(double_t*)pts
+{
+	return [self getPixelBufferForCurrent:pts consumer:nil];
+}
+
+- (CVPixelBufferRef) getPixelBufferForCurrent:(double_t*)pts consumer:(id)key
 {
 	// returned pts is in sec.
 	
-	if (!pb) {
-		pb = [self createDummyCVPixelBufferWithSize:NSMakeSize(is->width, is->height)];
-	}
+	LAVPConsumer *consumer = [self beginConsumer:key];
+	if (!consumer)
+		return NULL;
+	
+	int width, height;
+	[self preparePixelBufferForConsumer:consumer width:&width height:&height];
+	CVPixelBufferRef pb = consumer->pb;
 	
 	double_t currentpts=0.0;
 	
@@ -219,16 +585,19 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	
 	uint8_t* data = CVPixelBufferGetBaseAddress(pb);
 	int pitch = CVPixelBufferGetBytesPerRow(pb);
-	int ret = copyImageCurrent(is, &currentpts, data, pitch);
+	int ret = copyImageCurrent(is, consumer->vc, &currentpts, data, pitch, width, height);
 	
 	CVPixelBufferUnlockBaseAddress(pb, 0);
 	
+	if (![self endConsumer:consumer])
+		return NULL;
+	
 	//
 	if (ret == 1) {
-		*pts = currentpts;
+		*pts = loop_unmap(is, currentpts);
 		return pb;
 	} else if (ret == 2) {
-		*pts = currentpts;
+		*pts = loop_unmap(is, currentpts);
 		return pb;
 	}
 	return NULL;
@@ -239,15 +608,19 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	NSSize size = NSMakeSize(is->width, is->height);
 	
 	if (is->video_st && is->video_st->codec) {
+		// LAVP: report the full size even when decoding at lowres
+		int lowres = av_codec_get_lowres(is->video_st->codec);
+		size = NSMakeSize(is->width << lowres, is->height << lowres);
+		
 		AVRational sRatio = is->video_st->sample_aspect_ratio;
 		AVRational cRatio = is->video_st->codec->sample_aspect_ratio;
 		
 		if (sRatio.num * sRatio.den) {
 			// Use stream aspect ratio
-			size = NSMakeSize(is->width * sRatio.num / sRatio.den, is->height);
+			size = NSMakeSize(size.width * sRatio.num / sRatio.den, size.height);
 		} else if (cRatio.num * cRatio.den) {
 			// Use codec aspect ratio
-			size = NSMakeSize(is->width * cRatio.num / cRatio.den, is->height);
+			size = NSMakeSize(size.width * cRatio.num / cRatio.den, size.height);
 		}
 	}
 	
@@ -261,6 +634,8 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	else if (is->ic && is->ic->duration <= 0)
 		return 0.0f;
 	
+	if (is->reverse)
+		return reverse_rate(is);
 	if (is->paused) 
 		return 0.0f;
 	else 
@@ -269,12 +644,19 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 
 - (void) setRate:(CGFloat)rate
 {
-	/* note: only accept 0.0 and positive */
-	if (!is || rate < 0.0) {
+	/* note: negative rate plays backward from the reverse cache */
+	if (!is) {
 		return;
 	}
 	
-	if (rate > 0) {
+	if (rate < 0) {
+		if (!is->paused) {
+			stream_pause(is);
+		}
+		stream_setPlayRate(is, rate);
+	} else if (rate == 0 && is->reverse) {
+		reverse_set_rate(is, 0.0);
+	} else if (rate > 0) {
         if ([self eof]) {
             [self setPosition:0.0 blocking:TRUE];
         }
@@ -290,6 +672,20 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	}
 }
 
+- (void) stepForward
+{
+	if (is) {
+		stream_step_to_next_frame(is);
+	}
+}
+
+- (void) stepBackward
+{
+	if (is) {
+		stream_step_to_prev_frame(is);
+	}
+}
+
 - (int64_t) duration
 {
 	// duration is in AV_TIME_BASE value.
@@ -307,7 +703,9 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	// avutil.h defines timebase for AVFormatContext - in usec.
 	
 	if (is && is->ic) {
-        double pos = get_master_clock(is) * 1e6;
+        if (is->scrubbing)
+            return scrub_position(is);
+        double pos = loop_unmap(is, get_master_clock(is)) * 1e6;
         if (!isnan(pos)) {
             lastPosition = pos;
         }
@@ -328,6 +726,17 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
             return now_s;
         };
         
+        if (is->timeshift) {
+            // LAVP: live source; pos is a stream time, served from the timeshift ring
+            stream_seek(is, pos, 0, 0);
+            for (int count = 0; count < 200 && stream_seek_pending(is); count++)
+                usleep(10*1000);
+            
+            double_t posFinal = now_s(); // in sec
+            lastPosition = isnan(posFinal) ? pos : posFinal*1.0e6; // in usec
+            return lastPosition;
+        }
+        
         if (is->seek_by_bytes || is->ic->duration <= 0) {
             double_t frac = (double_t)pos / (now_s() * 1.0e6);
             
@@ -349,7 +758,7 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 
                 // Wait till avformat_seek_file() is completed
                 for (; limit > count; count++) {
-                    if (!is->seek_req) break;
+                    if (!stream_seek_pending(is)) break;
                     usleep(unit*1000);
                 }
                 
@@ -372,7 +781,7 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
                 
                 // Wait till avformat_seek_file() is completed
                 for (; limit > count; count++) {
-                    if (!is->seek_req) break;
+                    if (!stream_seek_pending(is)) break;
                     usleep(unit*1000);
                 }
                 
@@ -456,6 +865,44 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	return 0;
 }
 
+- (void) setPosition:(int64_t)pos completion:(void (^)(int64_t position))completion
+{
+	// position is in AV_TIME_BASE value.
+	// Returns immediately. A newer request replaces the pending target; completion is
+	// called on main thread once read_thread has settled the request (or a newer one).
+	
+	if (!is || !is->ic)
+		return;
+	
+	int64_t ts;
+	if (is->timeshift) {
+		ts = pos;	// LAVP: stream time inside the timeshift window
+	} else if (is->seek_by_bytes || is->ic->duration <= 0) {
+		int64_t result = [self setPosition:pos blocking:NO];
+		if (completion) {
+			dispatch_async(dispatch_get_main_queue(), ^{
+				completion(result);
+			});
+		}
+		return;
+	} else {
+		ts = FFMIN(is->ic->duration , FFMAX(0, pos));
+		if (is->ic->start_time != AV_NOPTS_VALUE)
+			ts += is->ic->start_time;
+	}
+	
+	if (completion) {
+		@synchronized(seekCompletions) {
+			int32_t gen = stream_seek(is, ts, -10, 0);
+			[seekCompletions addObject:[NSArray arrayWithObjects:[NSNumber numberWithInt:gen], [completion copy], nil]];
+		}
+	} else {
+		stream_seek(is, ts, -10, 0);
+	}
+	
+	lastPosition = pos;
+}
+
 - (Float32) volume
 {
 	Float32 volume = 0.0;
@@ -473,9 +920,405 @@ extern void stream_setPlayRate(VideoState *is, double_t newRate);
 	}
 }
 
+- (BOOL) audioOnly
+{
+	// no video stream; the refresh timer is stopped and AudioQueue runs with deep buffers
+	return (is && is->audio_only ? YES : NO);
+}
+
+- (int64_t) wakeupCount
+{
+	// refresh ticks, AudioQueue callbacks and read_thread sleeps since open
+	return (is ? is->wakeups : 0);
+}
+
 - (BOOL) eof
 {
 	return (is->eof_flag ? YES : NO);
 }
 
+- (int) degradationLevel
+{
+	return (is ? video_degradation_level(is) : 0);
+}
+
+- (double_t) liveLatency
+{
+	// in sec; negative when unknown (not in low latency mode, or nothing read yet)
+	double_t latency = (is ? stream_latency(is) : NAN);
+	return (isnan(latency) ? -1.0 : latency);
+}
+
+- (int) latencyCatchUps
+{
+	return (is ? is->latency_catchups : 0);
+}
+
+- (void) setLoopStart:(int64_t)start end:(int64_t)end
+{
+	// start/end are in AV_TIME_BASE value, same as position.
+	
+	if (is && is->ic) {
+		if (end > start)
+			loop_set(is, start, end);
+		else
+			loop_clear(is);
+	}
+}
+
+- (BOOL) getLoopStart:(int64_t *)start end:(int64_t *)end
+{
+	if (is && is->ic) {
+		return (loop_get(is, start, end) ? YES : NO);
+	}
+	return NO;
+}
+
+- (BOOL) getTimeshiftStart:(int64_t *)start end:(int64_t *)end
+{
+	// start/end are in AV_TIME_BASE value, same as position.
+	
+	if (is && is->ic) {
+		return (timeshift_get(is, start, end) ? YES : NO);
+	}
+	return NO;
+}
+
+- (void) seekToLive
+{
+	int64_t start, end;
+	
+	if (is && is->ic && timeshift_get(is, &start, &end))
+		stream_seek(is, end, 0, 0);	// timeshift_seek() picks the newest keyframe
+}
+
+- (int64_t) timeshiftIngestTime
+{
+	// average usec per stored packet
+	return (is ? timeshift_ingest_usec(is) : 0);
+}
+
+- (int64_t) lastTimeshiftSeekLatency
+{
+	return (is ? timeshift_seek_usec(is) : 0);
+}
+
+- (BOOL) bufferAlternateTracks
+{
+	return (is && track_get_buffering(is) ? YES : NO);
+}
+
+- (void) setBufferAlternateTracks:(BOOL)buffer
+{
+	if (is && is->ic)
+		track_set_buffering(is, buffer ? 1 : 0);
+}
+
+- (NSArray *) tracksOfType:(enum AVMediaType)type
+{
+	NSMutableArray *tracks = [NSMutableArray array];
+	
+	if (is && is->ic) {
+		int count = track_list(is, type, NULL, 0);
+		int *indexes = av_malloc(count * sizeof(int));
+		if (indexes) {
+			int i;
+			track_list(is, type, indexes, count);
+			for (i = 0; i < count; i++)
+				[tracks addObject:[NSNumber numberWithInt:indexes[i]]];
+			av_free(indexes);
+		}
+	}
+	return tracks;
+}
+
+- (NSArray *) audioTracks
+{
+	return [self tracksOfType:AVMEDIA_TYPE_AUDIO];
+}
+
+- (NSArray *) subtitleTracks
+{
+	return [self tracksOfType:AVMEDIA_TYPE_SUBTITLE];
+}
+
+- (int) audioTrack
+{
+	return (is ? is->audio_stream : -1);
+}
+
+- (int) subtitleTrack
+{
+	return (is ? is->subtitle_stream : -1);
+}
+
+- (BOOL) selectAudioTrack:(int)index
+{
+	// index is the stream index as listed by audioTracks.
+	
+	if (is && is->ic)
+		return (track_select(is, AVMEDIA_TYPE_AUDIO, index) == 0 ? YES : NO);
+	return NO;
+}
+
+- (BOOL) selectSubtitleTrack:(int)index
+{
+	// -1 turns subtitles off.
+	
+	if (is && is->ic)
+		return (track_select(is, AVMEDIA_TYPE_SUBTITLE, index) == 0 ? YES : NO);
+	return NO;
+}
+
+- (int64_t) bufferedBytesForTrack:(int)index
+{
+	return (is ? track_buffered_bytes(is, index) : 0);
+}
+
+- (int64_t) lastTrackSwitchLatency
+{
+	return (is ? track_switch_latency(is) : 0);
+}
+
+- (void) getMemoryUsage:(MemoryUsage *)usage
+{
+	memset(usage, 0, sizeof(*usage));
+	if (!is || !is->ic)
+		return;
+	stream_memory_usage(is, usage);
+	
+	// LAVP: each consumer keeps one CVPixelBuffer of its last output size
+	NSMutableArray *all = [NSMutableArray array];
+	@synchronized(consumers) {
+		[all addObjectsFromArray:[consumers allValues]];
+		if (defaultConsumer)
+			[all addObject:defaultConsumer];
+		for (LAVPConsumer *consumer in all) {
+			VideoConsumer *vc = consumer->vc;
+			if (vc && consumer->pb)
+				usage->output += (int64_t)vc->width * vc->height * (vc->pixel_format == VIDEO_CONSUMER_BGRA ? 4 : 2);
+		}
+	}
+}
+
+- (int64_t) memoryBudget
+{
+	return (is ? is->memory_budget : 0);
+}
+
+- (void) setMemoryBudget:(int64_t)bytes
+{
+	if (is && is->ic)
+		video_set_memory_budget(is, bytes);
+}
+
+/* process-wide limit for decoded pictures waiting in the picture queues of all players */
++ (void) setDecodedPictureMemoryLimit:(int64_t)bytes
+{
+	video_set_memory_limit(bytes);
+}
+
++ (int64_t) decodedPictureMemory
+{
+	return video_memory_total();
+}
+
+- (int) chapterCount
+{
+	return (is && is->ic ? stream_getChapterCount(is) : 0);
+}
+
+- (int) currentChapter
+{
+	return (is && is->ic ? stream_getChapterCurrent(is) : -1);
+}
+
+- (void) seekChapter:(int)delta
+{
+	if (is && is->ic)
+		stream_seek_chapter(is, delta);
+}
+
+- (BOOL) chapterPrefetch
+{
+	return (is && chapter_get_prefetch(is) ? YES : NO);
+}
+
+- (void) setChapterPrefetch:(BOOL)prefetch
+{
+	if (is && is->ic)
+		chapter_set_prefetch(is, prefetch ? 1 : 0);
+}
+
+- (int64_t) lastChapterJumpLatency
+{
+	// usec from seekChapter: to the first picture of the chapter handed to a consumer
+	return (is ? chapter_jump_latency(is) : 0);
+}
+
+- (BOOL) scrubToPosition:(int64_t)pos
+{
+	// position is in AV_TIME_BASE value; shows the keyframe at or before pos.
+	// Returns NO when keyframe preview is not possible; use setPosition: instead.
+	
+	if (!is || !is->ic || is->seek_by_bytes || is->ic->duration <= 0)
+		return NO;
+	
+	int64_t ts = FFMIN(is->ic->duration , FFMAX(0, pos));
+	if (is->ic->start_time != AV_NOPTS_VALUE)
+		ts += is->ic->start_time;
+	
+	return (scrub_request(is, ts) == 0);
+}
+
+- (void) endScrub
+{
+	// seek to the last scrub position; its keyframe stays up until the exact picture is ready
+	
+	if (!is || !(is->scrubbing || is->scrub_failed))
+		return;
+	
+	int64_t ts = scrub_position(is);
+	if (is->ic->start_time != AV_NOPTS_VALUE)
+		ts -= is->ic->start_time;
+	
+	// the scrub decoder failed to open after the first request; nothing was previewed
+	if (!is->scrubbing) {
+		[self setPosition:ts blocking:YES];
+		return;
+	}
+	
+	scrub_end(is);
+	[self setPosition:ts blocking:YES];
+	scrub_stop(is);
+}
+
+- (double_t) lastScrubFrameRate
+{
+	// keyframes handed to consumers per second during the last drag
+	return (is ? scrub_frame_rate(is) : 0);
+}
+
+- (int64_t) lastScrubRefineLatency
+{
+	// usec from endScrub to the exact picture
+	return (is ? scrub_refine_latency(is) : 0);
+}
+
+- (BOOL) subtitleCache
+{
+	return (is && is->text_cache ? YES : NO);
+}
+
+- (void) setSubtitleCache:(BOOL)cache
+{
+	// NO lays out and rasterizes text subtitles on every frame
+	if (is)
+		text_set_cache(is, cache ? 1 : 0);
+}
+
+- (void) getSubtitleRenderFrames:(int64_t *)frames time:(int64_t *)usec layouts:(int64_t *)layouts
+{
+	// frames with a text cue drawn, usec spent drawing them, and layouts built since open
+	if (frames) *frames = 0;
+	if (usec) *usec = 0;
+	if (layouts) *layouts = 0;
+	if (is)
+		text_stats(is, frames, usec, layouts);
+}
+
+- (BOOL) getSoakReport:(SoakReport *)report
+{
+	// NO unless opened with StreamOptions.soak; the report is zeroed then
+	memset(report, 0, sizeof(*report));
+	if (!is || !is->soak)
+		return NO;
+	soak_report(is, report);
+	return YES;
+}
+
+- (NSSize) outputSize
+{
+	return [self outputSizeForConsumer:nil];
+}
+
+- (void) setOutputSize:(NSSize)size
+{
+	[self setOutputSize:size forConsumer:nil];
+}
+
+- (NSSize) outputSizeForConsumer:(id)key
+{
+	LAVPConsumer *consumer = [self beginConsumer:key];
+	
+	if (!consumer)
+		return NSZeroSize;
+	NSSize size = NSMakeSize(consumer->vc->output_width, consumer->vc->output_height);
+	[self endConsumer:consumer];
+	return size;
+}
+
+- (void) setOutputSize:(NSSize)size forConsumer:(id)key
+{
+	// size is in pixels; NSZeroSize restores full size output.
+	
+	LAVPConsumer *consumer = [self beginConsumer:key];
+	
+	if (consumer) {
+		video_set_output_size(consumer->vc, (int)ceil(size.width), (int)ceil(size.height));
+		[self endConsumer:consumer];
+	}
+}
+
+- (BOOL) addConsumer:(id)key pixelFormat:(OSType)format
+{
+	// key is not retained; call removeConsumer: before it goes away.
+	
+	if (!is || !key)
+		return NO;
+	if (format != kCVPixelFormatType_422YpCbCr8 && format != kCVPixelFormatType_32BGRA)
+		return NO;
+	
+	NSValue *value = [NSValue valueWithNonretainedObject:key];
+	@synchronized(consumers) {
+		if ([consumers objectForKey:value])
+			return YES;
+		
+		LAVPConsumer *consumer = [[LAVPConsumer alloc] init];
+		consumer->vc = video_consumer_create(is, format);
+		if (!consumer->vc)
+			return NO;
+		[consumers setObject:consumer forKey:value];
+	}
+	return YES;
+}
+
+- (void) removeConsumer:(id)key
+{
+	LAVPConsumer *consumer = nil;
+	
+	if (!key)
+		return;
+	
+	NSValue *value = [NSValue valueWithNonretainedObject:key];
+	@synchronized(consumers) {
+		consumer = [consumers objectForKey:value];
+		[consumers removeObjectForKey:value];
+		if (consumer) {
+			consumer->removed = YES;
+			if (consumer->busy)
+				return;		// endConsumer: of the last copy frees it
+		}
+	}
+	if (consumer)
+		[self disposeConsumer:consumer];
+}
+
+- (NSUInteger) consumerCount
+{
+	@synchronized(consumers) {
+		return [consumers count];
+	}
+}
+
 @end
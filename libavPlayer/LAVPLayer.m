@@ -34,6 +34,7 @@
 
 - (void) initOpenGL;
 - (void) drawImage;
+- (void) updateOutputSize;
 - (void) setCIContext;
 - (void) setFBO;
 - (void) renderCoreImageToFBO;
@@ -81,6 +82,7 @@ void MyDisplayReconfigurationCallBack(CGDirectDisplayID display,
 	// Release stream
 	if (_stream) {
 		[_stream stop];
+		[_stream removeConsumer:self];
 		_stream = NULL;
 	}
 	
@@ -275,6 +277,7 @@ void MyDisplayReconfigurationCallBack(CGDirectDisplayID display,
 	if (_stream && !NSEqualSizes([_stream frameSize], NSZeroSize) && !_stream.busy) {
 		if (!NSEqualRects(prevRect, [self bounds])) {
 			prevRect = [self bounds];
+			[self updateOutputSize];
         }
         
 		BOOL ready = NO;
@@ -289,9 +292,9 @@ void MyDisplayReconfigurationCallBack(CGDirectDisplayID display,
 			double_t pts = -2;
 			
 			if (!timeStamp) 
-				pb = [_stream getCVPixelBufferForCurrentAsPTS:&pts];
+				pb = [_stream getCVPixelBufferForCurrentAsPTS:&pts forConsumer:self];
 			else
-				pb = [_stream getCVPixelBufferForTime:timeStamp asPTS:&pts];
+				pb = [_stream getCVPixelBufferForTime:timeStamp asPTS:&pts forConsumer:self];
 			
 			if (pb) {
 				lastPTS = pts;
@@ -701,6 +704,18 @@ bail:
 #pragma mark -
 /* =============================================================================================== */
 
+/*
+ Ask the stream for pictures no larger than this layer
+ */
+- (void) updateOutputSize
+{
+	CGFloat scale = [self contentsScale];
+	NSSize size = NSMakeSize([self bounds].size.width * scale, [self bounds].size.height * scale);
+	
+	if (!NSEqualSizes([_stream outputSizeForConsumer:self], size))
+		[_stream setOutputSize:size forConsumer:self];
+}
+
 /*
  new CVPixelBuffer '2vuy' using specified size.
  Caller must call CVPixelBufferRelease() when available.
@@ -828,7 +843,9 @@ bail:
 	
 	//
 	[_stream stop];
+	[_stream removeConsumer:self];
 	_stream = newStream;
+	[_stream addConsumer:self pixelFormat:kCVPixelFormatType_422YpCbCr8];
 	
 	// Get the size of the image we are going to need throughout
 	if (_stream && [_stream frameSize].width && [_stream frameSize].height)
@@ -855,6 +872,9 @@ bail:
 		//NSLog(@"DEBUG: texture rect = %@", NSStringFromRect(textureRect));
 	}
 	
+	// Request pictures for this layer size on next draw
+	prevRect = NSZeroRect;
+	
 	// Try to update CAOpenGLLayer
 	lastPTS = -1;
 	[self setNeedsDisplay];
@@ -31,6 +31,54 @@ extern NSString * const LAVPStreamDidSeekNotification;
 extern NSString * const LAVPStreamStartSeekNotification;
 extern NSString * const LAVPStreamUpdateRateNotification;
 
+/* options for initWithURL:options:error: */
+extern NSString * const LAVPStreamOutputSizeKey;	// NSValue (NSSize) in pixels; small sizes may decode at lowres
+extern NSString * const LAVPStreamLowLatencyKey;	// NSNumber (BOOL); live source, minimal buffering
+extern NSString * const LAVPStreamTargetLatencyKey;	// NSNumber (double) in seconds; used with LAVPStreamLowLatencyKey
+extern NSString * const LAVPStreamTimeshiftBytesKey;	// NSNumber (long long); on-disk ring for pausing/seeking live sources
+extern NSString * const LAVPStreamColorMatrixKey;	// NSNumber (601, 709 or 2020); YUV->RGB matrix for BGRA consumers
+extern NSString * const LAVPStreamFullRangeKey;		// NSNumber (BOOL); YUV range for BGRA consumers
+extern NSString * const LAVPStreamMemoryBudgetKey;	// NSNumber (long long); bytes of decoded pictures waiting for presentation
+extern NSString * const LAVPStreamChapterPrefetchKey;	// NSNumber (BOOL); NO = do not decode neighbouring chapter starts ahead
+extern NSString * const LAVPStreamSubtitleCacheKey;	// NSNumber (BOOL); NO = lay out and rasterize text subtitles every frame
+extern NSString * const LAVPStreamLowPowerAudioKey;	// NSNumber (BOOL); NO = keep visualization and the refresh timer without video
+extern NSString * const LAVPStreamContextPoolKey;	// NSNumber (BOOL); take/park decoders, scalers and the AudioQueue in a shared pool
+extern NSString * const LAVPStreamValidationManifestKey;	// NSString (path); per-frame hashes written when the stream closes
+extern NSString * const LAVPStreamSoakKey;			// NSNumber (BOOL); record presentation timing, audio plays into a virtual device
+extern NSString * const LAVPStreamSoakLogKey;		// NSString (path); one line per presented picture, summary on close
+extern NSString * const LAVPStreamSoakCPUThreadsKey;	// NSNumber (int); workers competing for the CPU
+extern NSString * const LAVPStreamSoakCPUDutyKey;	// NSNumber (int); percent of the time each worker spins, default 100
+extern NSString * const LAVPStreamSoakStallKey;		// NSNumber (double) in seconds; reading sleeps this long ...
+extern NSString * const LAVPStreamSoakStallIntervalKey;	// NSNumber (double) in seconds; ... once per interval
+
+/* keys of soakReport; NSNumber (double) in seconds unless noted */
+extern NSString * const LAVPSoakDurationKey;
+extern NSString * const LAVPSoakFramesKey;			// NSNumber (long long)
+extern NSString * const LAVPSoakDroppedFramesKey;	// NSNumber (long long)
+extern NSString * const LAVPSoakRepeatedFramesKey;	// NSNumber (long long)
+extern NSString * const LAVPSoakJitterP50Key;		// |presented - scheduled| percentiles
+extern NSString * const LAVPSoakJitterP90Key;
+extern NSString * const LAVPSoakJitterP99Key;
+extern NSString * const LAVPSoakJitterP999Key;
+extern NSString * const LAVPSoakJitterMaxKey;
+extern NSString * const LAVPSoakOffsetMeanKey;		// A-V at presentation
+extern NSString * const LAVPSoakOffsetMaxKey;		// absolute
+extern NSString * const LAVPSoakDriftKey;			// mean A-V change per hour; absent before two intervals
+extern NSString * const LAVPSoakStallsKey;			// NSNumber (long long)
+
+/* handlers for processURL:; called on decoder threads, in decode order per stream */
+typedef void (^LAVPVideoFrameHandler)(CVPixelBufferRef pixelBuffer, double_t pts);
+typedef void (^LAVPAudioBlockHandler)(const int16_t *samples, NSUInteger frameCount, NSUInteger channels, double_t sampleRate, double_t pts);	// interleaved
+
+/* categories for memoryUsage: */
+typedef enum {
+	LAVPMemoryPackets,			// demuxed packets in the queues and caches
+	LAVPMemoryDecodedFrames,	// decoded pictures waiting or cached for presentation
+	LAVPMemoryOutputBuffers,	// pixel buffers of the consumers
+	LAVPMemoryAudio,			// AudioQueue, PCM conversion and visualization buffers
+	LAVPMemoryTotal
+} LAVPMemoryCategory;
+
 @class LAVPDecoder;
 
 @interface LAVPStream : NSObject {
@@ -44,6 +92,8 @@ extern NSString * const LAVPStreamUpdateRateNotification;
 	Float32 currentVol;
 	BOOL _busy;
 	BOOL _strictSeek;
+	NSUInteger _pendingSeeks;
+	BOOL _scrubbing;		// scrubToPosition: is showing keyframes
 }
 
 @property (retain, readonly) NSURL *url;
@@ -58,30 +108,83 @@ extern NSString * const LAVPStreamUpdateRateNotification;
 @property (readonly) BOOL busy;
 @property (readonly) BOOL eof;
 @property (assign) BOOL strictSeek;
+@property (readonly) NSInteger degradationLevel;
+@property (readonly) double_t liveLatency;
+@property (readonly) NSInteger latencyCatchUps;
+@property (readonly) double_t timeshiftIngestTime;
+@property (readonly) double_t lastTimeshiftSeekLatency;
+@property (assign) BOOL bufferAlternateTracks;
+@property (readonly) NSArray *audioTracks;
+@property (readonly) NSArray *subtitleTracks;
+@property (assign) NSInteger audioTrack;
+@property (assign) NSInteger subtitleTrack;
+@property (readonly) double_t lastTrackSwitchLatency;
+@property (readonly) NSInteger chapterCount;
+@property (readonly) NSInteger currentChapter;
+@property (assign) BOOL chapterPrefetch;
+@property (readonly) double_t lastChapterJumpLatency;
+@property (readonly) double_t lastScrubFrameRate;
+@property (readonly) double_t lastScrubRefineTime;
+@property (readonly) BOOL audioOnly;
+@property (assign) BOOL subtitleCache;
+@property (readonly) double_t subtitleRenderTime;
+@property (readonly) int64_t wakeupCount;
+@property (readonly) double_t openTime;
+@property (assign) NSSize outputSize;
+@property (assign) int64_t memoryBudget;
 
 - (id) initWithURL:(NSURL *)url error:(NSError **)errorPtr;
+- (id) initWithURL:(NSURL *)url options:(NSDictionary *)options error:(NSError **)errorPtr;
 + (id) streamWithURL:(NSURL *)url error:(NSError **)errorPtr;
++ (NSArray *) streamsWithURLs:(NSArray *)urls options:(NSDictionary *)options timeout:(NSTimeInterval)timeout;
++ (NSInteger) codecLockContentions;
++ (void) setDecodedPictureMemoryLimit:(int64_t)bytes;
++ (int64_t) decodedPictureMemory;
++ (double_t) codecLockWaitTime;
++ (NSInteger) contextPoolHits;
++ (NSInteger) contextPoolMisses;
++ (void) drainContextPool;
++ (BOOL) processURL:(NSURL *)url options:(NSDictionary *)options pixelFormat:(OSType)format
+	   videoHandler:(LAVPVideoFrameHandler)videoHandler audioHandler:(LAVPAudioBlockHandler)audioHandler
+			  error:(NSError **)errorPtr;
 
 - (BOOL) readyForCurrent;
 - (BOOL) readyForTime:(const CVTimeStamp*)ts;
 - (CVPixelBufferRef) getCVPixelBufferForCurrentAsPTS:(double_t *)pts;
 - (CVPixelBufferRef) getCVPixelBufferForTime:(const CVTimeStamp*)ts asPTS:(double_t *)pts;
 
+- (BOOL) addConsumer:(id)consumer pixelFormat:(OSType)format;
+- (void) removeConsumer:(id)consumer;
+- (NSUInteger) consumerCount;
+- (NSSize) outputSizeForConsumer:(id)consumer;
+- (void) setOutputSize:(NSSize)size forConsumer:(id)consumer;
+- (CVPixelBufferRef) getCVPixelBufferForCurrentAsPTS:(double_t *)pts forConsumer:(id)consumer;
+- (CVPixelBufferRef) getCVPixelBufferForTime:(const CVTimeStamp*)ts asPTS:(double_t *)pts forConsumer:(id)consumer;
+
 - (void) play;
 - (void) stop;
 - (void) gotoBeggining;
 - (void) gotoEnd;
+- (void) seekToPosition:(double_t)newPosition;
+- (void) scrubToPosition:(double_t)newPosition;
+- (void) endScrubbing;
+- (void) stepForward;
+- (void) stepBackward;
+- (void) setLoopStart:(QTTime)start end:(QTTime)end;
+- (void) clearLoop;
+- (BOOL) getLoopStart:(QTTime *)start end:(QTTime *)end;
+- (BOOL) getTimeshiftStart:(QTTime *)start end:(QTTime *)end;
+- (void) seekToLive;
+- (int64_t) bufferedBytesForTrack:(NSInteger)track;
+- (void) seekChapter:(NSInteger)delta;
+- (int64_t) memoryUsage:(LAVPMemoryCategory)category;
+- (NSDictionary *) soakReport;
 
 @end
 
 /* ================================ N/A ================================ */
 
 #if 0
-@interface LAVStream (control)
-- (void) stepForward;
-- (void) stepBackward;
-@end
-
 @interface LAVStream (attributes)
 - (id) attributeForKey:(NSString *)attributeKey;
 - (void) setAttribute:(id)attr ForKey:(id)key;
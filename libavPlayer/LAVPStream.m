@@ -31,19 +31,112 @@ NSString * const LAVPStreamDidSeekNotification = @"LAVPStreamDidSeekNotification
 NSString * const LAVPStreamStartSeekNotification = @"LAVPStreamStartSeekNotification";
 NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotification";
 
+NSString * const LAVPStreamOutputSizeKey = @"LAVPStreamOutputSizeKey";
+NSString * const LAVPStreamLowLatencyKey = @"LAVPStreamLowLatencyKey";
+NSString * const LAVPStreamTargetLatencyKey = @"LAVPStreamTargetLatencyKey";
+NSString * const LAVPStreamTimeshiftBytesKey = @"LAVPStreamTimeshiftBytesKey";
+NSString * const LAVPStreamColorMatrixKey = @"LAVPStreamColorMatrixKey";
+NSString * const LAVPStreamFullRangeKey = @"LAVPStreamFullRangeKey";
+NSString * const LAVPStreamMemoryBudgetKey = @"LAVPStreamMemoryBudgetKey";
+NSString * const LAVPStreamChapterPrefetchKey = @"LAVPStreamChapterPrefetchKey";
+NSString * const LAVPStreamLowPowerAudioKey = @"LAVPStreamLowPowerAudioKey";
+NSString * const LAVPStreamSubtitleCacheKey = @"LAVPStreamSubtitleCacheKey";
+NSString * const LAVPStreamContextPoolKey = @"LAVPStreamContextPoolKey";
+NSString * const LAVPStreamValidationManifestKey = @"LAVPStreamValidationManifestKey";
+NSString * const LAVPStreamSoakKey = @"LAVPStreamSoakKey";
+NSString * const LAVPStreamSoakLogKey = @"LAVPStreamSoakLogKey";
+NSString * const LAVPStreamSoakCPUThreadsKey = @"LAVPStreamSoakCPUThreadsKey";
+NSString * const LAVPStreamSoakCPUDutyKey = @"LAVPStreamSoakCPUDutyKey";
+NSString * const LAVPStreamSoakStallKey = @"LAVPStreamSoakStallKey";
+NSString * const LAVPStreamSoakStallIntervalKey = @"LAVPStreamSoakStallIntervalKey";
+
+NSString * const LAVPSoakDurationKey = @"LAVPSoakDurationKey";
+NSString * const LAVPSoakFramesKey = @"LAVPSoakFramesKey";
+NSString * const LAVPSoakDroppedFramesKey = @"LAVPSoakDroppedFramesKey";
+NSString * const LAVPSoakRepeatedFramesKey = @"LAVPSoakRepeatedFramesKey";
+NSString * const LAVPSoakJitterP50Key = @"LAVPSoakJitterP50Key";
+NSString * const LAVPSoakJitterP90Key = @"LAVPSoakJitterP90Key";
+NSString * const LAVPSoakJitterP99Key = @"LAVPSoakJitterP99Key";
+NSString * const LAVPSoakJitterP999Key = @"LAVPSoakJitterP999Key";
+NSString * const LAVPSoakJitterMaxKey = @"LAVPSoakJitterMaxKey";
+NSString * const LAVPSoakOffsetMeanKey = @"LAVPSoakOffsetMeanKey";
+NSString * const LAVPSoakOffsetMaxKey = @"LAVPSoakOffsetMaxKey";
+NSString * const LAVPSoakDriftKey = @"LAVPSoakDriftKey";
+NSString * const LAVPSoakStallsKey = @"LAVPSoakStallsKey";
+
 #define AV_TIME_BASE            1000000
 
 // class extension
 @interface LAVPStream ()
 @property (readwrite) BOOL busy;
+- (id) initWithURL:(NSURL *)sourceURL streamOptions:(const StreamOptions *)streamOptions error:(NSError **)errorPtr;
 @end
 
+/* strings referenced by streamOptions live in the current autorelease pool */
+static void LAVPStreamReadOptions(NSDictionary *options, StreamOptions *streamOptions)
+{
+	NSValue *outputSize = [options objectForKey:LAVPStreamOutputSizeKey];
+	if (outputSize) {
+		streamOptions->output_width = (int)ceil([outputSize sizeValue].width);
+		streamOptions->output_height = (int)ceil([outputSize sizeValue].height);
+	}
+	streamOptions->low_latency = [[options objectForKey:LAVPStreamLowLatencyKey] boolValue];
+	streamOptions->target_latency = [[options objectForKey:LAVPStreamTargetLatencyKey] doubleValue];
+	streamOptions->timeshift_bytes = [[options objectForKey:LAVPStreamTimeshiftBytesKey] longLongValue];
+	streamOptions->color_matrix = [[options objectForKey:LAVPStreamColorMatrixKey] intValue];
+	NSNumber *fullRange = [options objectForKey:LAVPStreamFullRangeKey];
+	if (fullRange)
+		streamOptions->color_range = [fullRange boolValue] ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+	streamOptions->memory_budget = [[options objectForKey:LAVPStreamMemoryBudgetKey] longLongValue];
+	NSNumber *chapterPrefetch = [options objectForKey:LAVPStreamChapterPrefetchKey];
+	if (chapterPrefetch)
+		streamOptions->no_chapter_prefetch = ![chapterPrefetch boolValue];
+	NSNumber *lowPowerAudio = [options objectForKey:LAVPStreamLowPowerAudioKey];
+	if (lowPowerAudio)
+		streamOptions->no_low_power_audio = ![lowPowerAudio boolValue];
+	NSNumber *subtitleCache = [options objectForKey:LAVPStreamSubtitleCacheKey];
+	if (subtitleCache)
+		streamOptions->no_subtitle_cache = ![subtitleCache boolValue];
+	NSNumber *contextPool = [options objectForKey:LAVPStreamContextPoolKey];
+	if (contextPool)
+		streamOptions->context_pool = [contextPool boolValue];
+	NSString *manifest = [options objectForKey:LAVPStreamValidationManifestKey];
+	streamOptions->validate_path = [manifest fileSystemRepresentation];
+	NSString *soakLog = [options objectForKey:LAVPStreamSoakLogKey];
+	streamOptions->soak_path = [soakLog fileSystemRepresentation];
+	streamOptions->soak = [[options objectForKey:LAVPStreamSoakKey] boolValue] || soakLog;
+	streamOptions->soak_cpu_threads = [[options objectForKey:LAVPStreamSoakCPUThreadsKey] intValue];
+	streamOptions->soak_cpu_duty = [[options objectForKey:LAVPStreamSoakCPUDutyKey] intValue];
+	streamOptions->soak_stall_ms = (int)([[options objectForKey:LAVPStreamSoakStallKey] doubleValue] * 1000);
+	streamOptions->soak_stall_interval_ms = (int)([[options objectForKey:LAVPStreamSoakStallIntervalKey] doubleValue] * 1000);
+}
+
 @implementation LAVPStream
 @synthesize url;
 @synthesize busy = _busy;
 @synthesize strictSeek = _strictSeek;
 
 - (id) initWithURL:(NSURL *)sourceURL error:(NSError **)errorPtr
+{
+	return [self initWithURL:sourceURL options:nil error:errorPtr];
+}
+
+- (id) initWithURL:(NSURL *)sourceURL options:(NSDictionary *)options error:(NSError **)errorPtr
+{
+	StreamOptions streamOptions = {0};
+	LAVPStreamReadOptions(options, &streamOptions);
+	
+	self = [self initWithURL:sourceURL streamOptions:&streamOptions error:errorPtr];
+	if (self) {
+        // Queue selector to make initial notification.
+        [self performSelector:@selector(setRate:) withObject:NULL afterDelay:0.0];
+	}
+	
+	return self;
+}
+
+/* may run on any thread; the caller queues the initial notification */
+- (id) initWithURL:(NSURL *)sourceURL streamOptions:(const StreamOptions *)streamOptions error:(NSError **)errorPtr
 {
 	self = [super init];
 	if (self) {
@@ -51,14 +144,10 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
 		currentVol = 1.0;
 		_strictSeek = YES;
 		
-		//
-		decoder = [[LAVPDecoder alloc] initWithURL:url error:errorPtr];
+		decoder = [[LAVPDecoder alloc] initWithURL:url options:streamOptions error:errorPtr];
 		if (!decoder) {
             return nil;
 		}
-        
-        // Queue selector to make initial notification.
-        [self performSelector:@selector(setRate:) withObject:NULL afterDelay:0.0];
 	}
 	
 	return self;
@@ -70,6 +159,129 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
 	return [[myClass alloc] initWithURL:sourceURL error:errorPtr];
 }
 
+/*
+ Opens the streams concurrently and returns when each one is open or has failed.
+ Opening and probing give up at a deadline shared by the batch, timeout seconds from
+ now (0 = none). The result has one entry per url: an LAVPStream, or NSNull.
+ */
++ (NSArray *) streamsWithURLs:(NSArray *)urls options:(NSDictionary *)options timeout:(NSTimeInterval)timeout
+{
+	NSMutableArray *streams = [NSMutableArray arrayWithCapacity:[urls count]];
+	int64_t deadline = (timeout > 0) ? av_gettime() + (int64_t)(timeout * 1.0e6) : 0;
+	dispatch_group_t group = dispatch_group_create();
+	dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+	Class myClass = [self class];
+	
+	for (NSUInteger i = 0; i < [urls count]; i++)
+		[streams addObject:[NSNull null]];
+	
+	[urls enumerateObjectsUsingBlock:^(NSURL *sourceURL, NSUInteger index, BOOL *stop) {
+		dispatch_group_async(group, queue, ^(void){
+			@autoreleasepool {
+				StreamOptions streamOptions = {0};
+				LAVPStreamReadOptions(options, &streamOptions);
+				streamOptions.open_deadline = deadline;
+				
+				LAVPStream *stream = [[myClass alloc] initWithURL:sourceURL streamOptions:&streamOptions error:NULL];
+				if (stream) {
+					@synchronized (streams) {
+						[streams replaceObjectAtIndex:index withObject:stream];
+					}
+				}
+			}
+		});
+	}];
+	dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+	
+	for (id stream in streams) {
+		if (stream != [NSNull null])
+			[stream performSelector:@selector(setRate:) withObject:NULL afterDelay:0.0];
+	}
+	return streams;
+}
+
+/* process-wide; how often players waited on each other inside avcodec_open2() and for how long */
++ (NSInteger) codecLockContentions
+{
+	int64_t contended = 0;
+	[LAVPDecoder getCodecLockObtained:NULL contended:&contended waitTime:NULL];
+	return (NSInteger)contended;
+}
+
++ (double_t) codecLockWaitTime
+{
+	int64_t usec = 0;
+	[LAVPDecoder getCodecLockObtained:NULL contended:NULL waitTime:&usec];
+	return usec / 1.0e6;
+}
+
+/*
+ Contexts handed out by the shared pool (LAVPStreamContextPoolKey) versus created anew.
+ drainContextPool frees whatever is parked, e.g. on memory pressure.
+ */
++ (NSInteger) contextPoolHits
+{
+	int64_t hits = 0;
+	[LAVPDecoder getContextPoolHits:&hits misses:NULL];
+	return (NSInteger)hits;
+}
+
++ (NSInteger) contextPoolMisses
+{
+	int64_t misses = 0;
+	[LAVPDecoder getContextPoolHits:NULL misses:&misses];
+	return (NSInteger)misses;
+}
+
++ (void) drainContextPool
+{
+	[LAVPDecoder drainContextPool];
+}
+
+/*
+ Limits decoded pictures waiting in the picture queues of all players together (0 = none).
+ Each player shrinks its queue to its share, down to two pictures, and grows back when
+ memory is released.
+ */
++ (void) setDecodedPictureMemoryLimit:(int64_t)bytes
+{
+	[LAVPDecoder setDecodedPictureMemoryLimit:bytes];
+}
+
++ (int64_t) decodedPictureMemory
+{
+	return [LAVPDecoder decodedPictureMemory];
+}
+
+/*
+ Decodes the whole file as fast as possible, without real-time pacing or drops, and
+ returns when every picture and PCM block has been passed to the handlers.
+ format is the CoreVideo pixel format of the pictures (2vuy or BGRA; 0 = 2vuy).
+ Throughput is logged at AV_LOG_INFO when done.
+ */
++ (BOOL) processURL:(NSURL *)sourceURL options:(NSDictionary *)options pixelFormat:(OSType)format
+	   videoHandler:(LAVPVideoFrameHandler)videoHandler audioHandler:(LAVPAudioBlockHandler)audioHandler
+			  error:(NSError **)errorPtr
+{
+	StreamOptions streamOptions = {0};
+	LAVPStreamReadOptions(options, &streamOptions);
+	
+	LAVPDecoder *offline = [[LAVPDecoder alloc] initWithURL:sourceURL options:&streamOptions pixelFormat:format
+											   videoHandler:videoHandler audioHandler:audioHandler error:errorPtr];
+	if (!offline)
+		return NO;
+	
+	int ret = [offline waitUntilProcessed];
+	[offline invalidate];
+	
+	if (ret < 0) {
+		if (errorPtr)
+			*errorPtr = [NSError errorWithDomain:NSPOSIXErrorDomain code:AVUNERROR(ret) userInfo:nil];
+		return NO;
+	}
+	return YES;
+}
+
 - (void) invalidate
 {
 	// perform clean up
@@ -115,13 +327,23 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
 }
 
 - (CVPixelBufferRef) getCVPixelBufferForCurrentAsPTS:(double_t *)pts;
+{
+	return [self getCVPixelBufferForCurrentAsPTS:pts forConsumer:nil];
+}
+
+- (CVPixelBufferRef) getCVPixelBufferForTime:(const CVTimeStamp*)ts asPTS:(double_t *)pts;
+{
+	return [self getCVPixelBufferForTime:ts asPTS:pts forConsumer:nil];
+}
+
+- (CVPixelBufferRef) getCVPixelBufferForCurrentAsPTS:(double_t *)pts forConsumer:(id)consumer
 {
 	*pts = -1.0;
-	CVPixelBufferRef pb = [decoder getPixelBufferForCurrent:pts];
+	CVPixelBufferRef pb = [decoder getPixelBufferForCurrent:pts consumer:consumer];
 	return pb;
 }
 
-- (CVPixelBufferRef) getCVPixelBufferForTime:(const CVTimeStamp*)ts asPTS:(double_t *)pts;
+- (CVPixelBufferRef) getCVPixelBufferForTime:(const CVTimeStamp*)ts asPTS:(double_t *)pts forConsumer:(id)consumer
 {
     /*
      LAVP: CVDisplayLink could be delayed by other issue. It will cause HostTime in CVTimeStamp expired.
@@ -140,7 +362,7 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
 	position = (position > duration ? duration : position);
 	
 	//
-	CVPixelBufferRef pb = [decoder getPixelBufferForPTS:&position];
+	CVPixelBufferRef pb = [decoder getPixelBufferForPTS:&position consumer:consumer];
 	if (pb) *pts = position;
 	return pb;
 }
@@ -232,6 +454,106 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
     }
 }
 
+- (void) seekToPosition:(double_t)newPosition
+{
+	// position uses double value between 0.0 and 1.0
+	// Non-blocking variant of setPosition: for scrubbing. Rapid requests are coalesced
+	// and LAVPStreamDidSeekNotification is posted once the latest one has settled.
+	
+	if (!_pendingSeeks) {
+		// Post notification
+		NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+		NSNotification *notification = [NSNotification notificationWithName:LAVPStreamStartSeekNotification
+																	 object:self];
+		[center postNotification:notification];
+	}
+	
+	int64_t	duration = [decoder duration];	//usec
+	
+	// clipping
+	newPosition = (newPosition<0.0 ? 0.0 : newPosition);
+	newPosition = (newPosition>1.0 ? 1.0 : newPosition);
+	
+	_pendingSeeks++;
+	[decoder setPosition:newPosition*duration completion:^(int64_t position) {
+		if (--_pendingSeeks) return;
+		
+		// Post notification
+		NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+		NSNotification *notification = [NSNotification notificationWithName:LAVPStreamDidSeekNotification
+																	 object:self];
+		[center postNotification:notification];
+	}];
+}
+
+- (void) scrubToPosition:(double_t)newPosition
+{
+	// position uses double value between 0.0 and 1.0
+	// Shows the nearest preceding keyframe without touching the playback pipeline;
+	// call endScrubbing on release to seek to the exact frame.
+	
+	int64_t	duration = [decoder duration];	//usec
+	
+	// clipping
+	newPosition = (newPosition<0.0 ? 0.0 : newPosition);
+	newPosition = (newPosition>1.0 ? 1.0 : newPosition);
+	
+	if (!_scrubbing && !_pendingSeeks) {
+		// Post notification
+		NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+		NSNotification *notification = [NSNotification notificationWithName:LAVPStreamStartSeekNotification
+																	 object:self];
+		[center postNotification:notification];
+	}
+	
+	if ([decoder scrubToPosition:newPosition*duration]) {
+		_scrubbing = YES;
+		return;
+	}
+	
+	// LAVP: live, byte-seeking or reverse playback, or no scrub decoder; fall back to coalesced seeks
+	_scrubbing = NO;
+	_pendingSeeks++;
+	[decoder setPosition:newPosition*duration completion:^(int64_t position) {
+		if (--_pendingSeeks || _scrubbing) return;
+		
+		// Post notification
+		NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+		NSNotification *notification = [NSNotification notificationWithName:LAVPStreamDidSeekNotification
+																	 object:self];
+		[center postNotification:notification];
+	}];
+}
+
+- (void) endScrubbing
+{
+	if (!_scrubbing) return;
+	_scrubbing = NO;
+	
+	BOOL muted = [self muted];
+	if (!muted) [self setMuted:YES];
+	
+	self.busy = YES;
+	
+	double_t prevRate = [self rate];
+	
+	[decoder endScrub];
+	
+	if (prevRate) [self setRate:prevRate];
+	
+	self.busy = NO;
+	
+	if (!muted) [self setMuted:NO];
+	
+	{
+		// Post notification
+		NSNotificationCenter *center = [NSNotificationCenter defaultCenter];
+		NSNotification *notification = [NSNotification notificationWithName:LAVPStreamDidSeekNotification
+																	 object:self];
+		[center postNotification:notification];
+	}
+}
+
 - (double_t) rate
 {
 	double_t rate = [decoder rate];
@@ -324,6 +646,71 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
 	[self setPosition:1.0];
 }
 
+- (void) stepForward
+{
+	[self setRate:0.0];
+	[decoder stepForward];
+}
+
+- (void) stepBackward
+{
+	[self setRate:0.0];
+	[decoder stepBackward];
+}
+
+- (void) setLoopStart:(QTTime)start end:(QTTime)end
+{
+	QTTime startInUsec = QTMakeTimeScaled(start, AV_TIME_BASE);
+	QTTime endInUsec = QTMakeTimeScaled(end, AV_TIME_BASE);
+	
+	[decoder setLoopStart:startInUsec.timeValue end:endInUsec.timeValue];
+}
+
+- (void) clearLoop
+{
+	[decoder setLoopStart:0 end:0];
+}
+
+- (BOOL) getLoopStart:(QTTime *)start end:(QTTime *)end
+{
+	int64_t s = 0, e = 0;
+	BOOL looping = [decoder getLoopStart:&s end:&e];
+	
+	if (start) *start = QTMakeTime(s, AV_TIME_BASE);
+	if (end) *end = QTMakeTime(e, AV_TIME_BASE);
+	return looping;
+}
+
+/*
+ Window kept by LAVPStreamTimeshiftBytesKey, in the same time base as currentTime.
+ Seek inside it with setCurrentTime:.
+ */
+- (BOOL) getTimeshiftStart:(QTTime *)start end:(QTTime *)end
+{
+	int64_t s = 0, e = 0;
+	BOOL active = [decoder getTimeshiftStart:&s end:&e];
+	
+	if (start) *start = QTMakeTime(s, AV_TIME_BASE);
+	if (end) *end = QTMakeTime(e, AV_TIME_BASE);
+	return active;
+}
+
+- (void) seekToLive
+{
+	[decoder seekToLive];
+}
+
+- (double_t) timeshiftIngestTime
+{
+	// average seconds spent to store one packet
+	return [decoder timeshiftIngestTime] / 1.0e6;
+}
+
+- (double_t) lastTimeshiftSeekLatency
+{
+	return [decoder lastTimeshiftSeekLatency] / 1.0e6;
+}
+
 - (Float32) volume
 {
 	return currentVol;
@@ -357,4 +744,240 @@ NSString * const LAVPStreamUpdateRateNotification = @"LAVPStreamUpdateRateNotifi
 	return [decoder eof];
 }
 
+- (NSInteger) degradationLevel
+{
+	return [decoder degradationLevel];
+}
+
+/*
+ Seconds between reading the newest packet and presenting it; negative when unknown.
+ Only measured with LAVPStreamLowLatencyKey. Encoder and network delay are not included.
+ */
+- (double_t) liveLatency
+{
+	return [decoder liveLatency];
+}
+
+- (NSInteger) latencyCatchUps
+{
+	return [decoder latencyCatchUps];
+}
+
+- (BOOL) bufferAlternateTracks
+{
+	return [decoder bufferAlternateTracks];
+}
+
+- (void) setBufferAlternateTracks:(BOOL)buffer
+{
+	[decoder setBufferAlternateTracks:buffer];
+}
+
+- (NSArray *) audioTracks
+{
+	return [decoder audioTracks];
+}
+
+- (NSArray *) subtitleTracks
+{
+	return [decoder subtitleTracks];
+}
+
+- (NSInteger) audioTrack
+{
+	return [decoder audioTrack];
+}
+
+- (void) setAudioTrack:(NSInteger)track
+{
+	[decoder selectAudioTrack:(int)track];
+}
+
+- (NSInteger) subtitleTrack
+{
+	return [decoder subtitleTrack];
+}
+
+- (void) setSubtitleTrack:(NSInteger)track
+{
+	[decoder selectSubtitleTrack:(int)track];
+}
+
+- (int64_t) bufferedBytesForTrack:(NSInteger)track
+{
+	return [decoder bufferedBytesForTrack:(int)track];
+}
+
+- (double_t) lastTrackSwitchLatency
+{
+	return [decoder lastTrackSwitchLatency] / 1.0e6;
+}
+
+- (int64_t) memoryBudget
+{
+	return [decoder memoryBudget];
+}
+
+- (void) setMemoryBudget:(int64_t)bytes
+{
+	[decoder setMemoryBudget:bytes];
+}
+
+/* resident bytes of this stream; estimates, without libav internal buffers */
+- (int64_t) memoryUsage:(LAVPMemoryCategory)category
+{
+	MemoryUsage usage;
+	[decoder getMemoryUsage:&usage];
+	
+	switch (category) {
+		case LAVPMemoryPackets:
+			return usage.packets;
+		case LAVPMemoryDecodedFrames:
+			return usage.frames;
+		case LAVPMemoryOutputBuffers:
+			return usage.output;
+		case LAVPMemoryAudio:
+			return usage.audio;
+		default:
+			return usage.packets + usage.frames + usage.output + usage.audio;
+	}
+}
+
+- (NSInteger) chapterCount
+{
+	return [decoder chapterCount];
+}
+
+- (NSInteger) currentChapter
+{
+	return [decoder currentChapter];
+}
+
+- (void) seekChapter:(NSInteger)delta
+{
+	[decoder seekChapter:(int)delta];
+}
+
+- (BOOL) chapterPrefetch
+{
+	return [decoder chapterPrefetch];
+}
+
+- (void) setChapterPrefetch:(BOOL)prefetch
+{
+	[decoder setChapterPrefetch:prefetch];
+}
+
+- (double_t) lastChapterJumpLatency
+{
+	return [decoder lastChapterJumpLatency] / 1.0e6;
+}
+
+- (double_t) lastScrubFrameRate
+{
+	return [decoder lastScrubFrameRate];
+}
+
+- (double_t) lastScrubRefineTime
+{
+	return [decoder lastScrubRefineLatency] / 1.0e6;
+}
+
+- (BOOL) audioOnly
+{
+	return [decoder audioOnly];
+}
+
+- (BOOL) subtitleCache
+{
+	return [decoder subtitleCache];
+}
+
+- (void) setSubtitleCache:(BOOL)cache
+{
+	[decoder setSubtitleCache:cache];
+}
+
+- (double_t) subtitleRenderTime
+{
+	// average seconds spent drawing text subtitles into a frame
+	int64_t frames = 0, usec = 0;
+	[decoder getSubtitleRenderFrames:&frames time:&usec layouts:NULL];
+	return frames ? usec / 1.0e6 / frames : 0;
+}
+
+- (int64_t) wakeupCount
+{
+	return [decoder wakeupCount];
+}
+
+- (double_t) openTime
+{
+	return [decoder openLatency] / 1.0e6;
+}
+
+/* nil unless opened with LAVPStreamSoakKey or LAVPStreamSoakLogKey */
+- (NSDictionary *) soakReport
+{
+	SoakReport r;
+	if (![decoder getSoakReport:&r])
+		return nil;
+	
+	NSMutableDictionary *report = [NSMutableDictionary dictionary];
+	[report setObject:[NSNumber numberWithDouble:r.duration] forKey:LAVPSoakDurationKey];
+	[report setObject:[NSNumber numberWithLongLong:r.frames] forKey:LAVPSoakFramesKey];
+	[report setObject:[NSNumber numberWithLongLong:r.drops_early + r.drops_late] forKey:LAVPSoakDroppedFramesKey];
+	[report setObject:[NSNumber numberWithLongLong:r.repeats] forKey:LAVPSoakRepeatedFramesKey];
+	[report setObject:[NSNumber numberWithDouble:r.jitter_p50] forKey:LAVPSoakJitterP50Key];
+	[report setObject:[NSNumber numberWithDouble:r.jitter_p90] forKey:LAVPSoakJitterP90Key];
+	[report setObject:[NSNumber numberWithDouble:r.jitter_p99] forKey:LAVPSoakJitterP99Key];
+	[report setObject:[NSNumber numberWithDouble:r.jitter_p999] forKey:LAVPSoakJitterP999Key];
+	[report setObject:[NSNumber numberWithDouble:r.jitter_max] forKey:LAVPSoakJitterMaxKey];
+	[report setObject:[NSNumber numberWithDouble:r.offset_mean] forKey:LAVPSoakOffsetMeanKey];
+	[report setObject:[NSNumber numberWithDouble:r.offset_max] forKey:LAVPSoakOffsetMaxKey];
+	if (!isnan(r.drift))
+		[report setObject:[NSNumber numberWithDouble:r.drift] forKey:LAVPSoakDriftKey];
+	[report setObject:[NSNumber numberWithLongLong:r.stalls] forKey:LAVPSoakStallsKey];
+	return report;
+}
+
+- (NSSize) outputSize
+{
+	return [decoder outputSize];
+}
+
+- (void) setOutputSize:(NSSize)size
+{
+	[decoder setOutputSize:size];
+}
+
+/*
+ Consumers share one decode; each gets its own picture size, format and
+ pixel buffer. The consumer object is not retained.
+ */
+- (BOOL) addConsumer:(id)consumer pixelFormat:(OSType)format
+{
+	return [decoder addConsumer:consumer pixelFormat:format];
+}
+
+- (void) removeConsumer:(id)consumer
+{
+	[decoder removeConsumer:consumer];
+}
+
+- (NSUInteger) consumerCount
+{
+	return [decoder consumerCount];
+}
+
+- (NSSize) outputSizeForConsumer:(id)consumer
+{
+	return [decoder outputSizeForConsumer:consumer];
+}
+
+- (void) setOutputSize:(NSSize)size forConsumer:(id)consumer
+{
+	[decoder setOutputSize:size forConsumer:consumer];
+}
+
 @end
@@ -36,6 +36,8 @@
 	NSLock *lock;
 	double_t lastPTS;
 	NSRect prevRect;
+	NSSize outputSize;		// backing pixels; kept by the main thread under lock
+	NSSize prevOutputSize;	// last one passed to the stream, display link only
 	
 	GLuint	FBOid;
 	GLuint	FBOTextureId;
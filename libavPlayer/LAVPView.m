@@ -38,6 +38,8 @@
 
 - (void) initOpenGL;
 - (void) drawImage;
+- (void) updateOutputSize;
+- (void) cacheOutputSize;
 - (void) setCIContext;
 - (void) setFBO;
 - (void) renderCoreImageToFBO;
@@ -133,6 +135,7 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 	// Release stream
 	if (_stream) {
 		[_stream stop];
+		[_stream removeConsumer:self];
 		_stream = NULL;
 	}
 	
@@ -227,6 +230,7 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 		//
 		lock = [[NSLock alloc] init];
 		lastPTS = -1;
+		[self cacheOutputSize];
 		
 		//
 		[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(invalidate:) name:NSApplicationWillTerminateNotification object:nil];
@@ -251,6 +255,18 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 #pragma mark -
 /* =============================================================================================== */
 
+- (void)setFrameSize:(NSSize)newSize
+{
+	[super setFrameSize:newSize];
+	[self cacheOutputSize];
+}
+
+- (void)viewDidChangeBackingProperties
+{
+	[super viewDidChangeBackingProperties];
+	[self cacheOutputSize];
+}
+
 - (void)drawRect:(NSRect)theRect
 {
 	if (_stream.busy) return;
@@ -272,6 +288,8 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 - (CVReturn)drawFrameForTime:(const CVTimeStamp*)timeStamp
 {
 	if (_stream && !NSEqualSizes([_stream frameSize], NSZeroSize) && !_stream.busy) {
+		[self updateOutputSize];
+		
 		BOOL ready = NO;
 		if (!timeStamp) 
 			;//ready = [_stream readyForCurrent];
@@ -284,9 +302,9 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 			double_t pts = -2;
 			
 			if (!timeStamp) 
-				;//pb = [_stream getCVPixelBufferForCurrentAsPTS:&pts];
+				;//pb = [_stream getCVPixelBufferForCurrentAsPTS:&pts forConsumer:self];
 			else
-				pb = [_stream getCVPixelBufferForTime:timeStamp asPTS:&pts];
+				pb = [_stream getCVPixelBufferForTime:timeStamp asPTS:&pts forConsumer:self];
 			
 			if (pb && lastPTS != pts) {
 				lastPTS = pts;
@@ -616,6 +634,34 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 #pragma mark -
 /* =============================================================================================== */
 
+/*
+ Ask the stream for pictures no larger than this view; called on the display link,
+ which must not touch view geometry
+ */
+- (void) updateOutputSize
+{
+	[lock lock];
+	NSSize size = outputSize;
+	[lock unlock];
+	
+	if (!NSEqualSizes(prevOutputSize, size)) {
+		prevOutputSize = size;
+		[_stream setOutputSize:size forConsumer:self];
+	}
+}
+
+/*
+ Size in backing pixels for updateOutputSize; main thread, on bounds or backing changes
+ */
+- (void) cacheOutputSize
+{
+	NSSize size = [self convertSizeToBacking:[self bounds].size];
+	
+	[lock lock];
+	outputSize = size;
+	[lock unlock];
+}
+
 /*
  new CVPixelBuffer '2vuy' using specified size.
  Caller must call CVPixelBufferRelease() when available.
@@ -743,7 +789,10 @@ static CVReturn MyDisplayLinkCallback(CVDisplayLinkRef displayLink,
 	
 	//
 	[_stream stop];
+	[_stream removeConsumer:self];
 	_stream = newStream;
+	[_stream addConsumer:self pixelFormat:kCVPixelFormatType_422YpCbCr8];
+	prevOutputSize = NSZeroSize;	// the new consumer starts at full size
 	
 	// Get the size of the image we are going to need throughout
 	if (_stream && [_stream frameSize].width && [_stream frameSize].height)
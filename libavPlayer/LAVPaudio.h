@@ -38,5 +38,8 @@ void LAVPAudioQueueStop(VideoState *is);
 void LAVPAudioQueueDealloc(VideoState *is);
 AudioQueueParameterValue getVolume(VideoState *is);
 void setVolume(VideoState *is, AudioQueueParameterValue volume);
+void audio_swr_cache_free(VideoState *is);
+int audio_decode_frame(VideoState *is);
+void audio_render(VideoState *is, uint8_t *stream, int len, int64_t callback_time);
 
 #endif
\ No newline at end of file
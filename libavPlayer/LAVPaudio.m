@@ -29,6 +29,11 @@
 #include "LAVPqueue.h"
 #include "LAVPsubs.h"
 #include "LAVPaudio.h"
+#include "LAVPtracks.h"
+#include "LAVPvalidate.h"
+#include "LAVPpool.h"
+
+#import <Accelerate/Accelerate.h>
 
 /* =========================================================== */
 
@@ -75,22 +80,33 @@ int audio_open(void *opaque, int64_t wanted_channel_layout, int wanted_nb_channe
 }
 
 /* copy samples for viewing in editor window */
+/* LAVP: single producer ring; LAVPvis reads it from its own queue. The copy stays:
+ the window vis renders is the one being heard, up to 2 * audio_hw_buf_size behind
+ what the callback decodes, and audio_buf is overwritten by the next block long
+ before that. It is one memcpy per block (about 190 KB/s for 48 kHz stereo); the
+ float conversion, windowing and drawing all happen on the vis queue. */
 static void update_sample_display(VideoState *is, short *samples, int samples_size)
 {
     int size, len;
+    int ring = SAMPLE_ARRAY_LIMIT(is->audio_tgt.channels);
+    int index = is->sample_array_index;
     
     size = samples_size / sizeof(short);
     while (size > 0) {
-        len = SAMPLE_ARRAY_SIZE - is->sample_array_index;
+        len = ring - index;
         if (len > size)
             len = size;
-        memcpy(is->sample_array + is->sample_array_index, samples, len * sizeof(short));
+        memcpy(is->sample_array + index, samples, len * sizeof(short));
         samples += len;
-        is->sample_array_index += len;
-        if (is->sample_array_index >= SAMPLE_ARRAY_SIZE)
-            is->sample_array_index = 0;
+        index += len;
+        if (index >= ring)
+            index = 0;
         size -= len;
     }
+    
+    /* publish the samples before the index */
+    OSMemoryBarrier();
+    is->sample_array_index = index;
 }
 
 /* return the wanted number of samples to get better sync if sync_type is video
@@ -100,7 +116,8 @@ static int synchronize_audio(VideoState *is, int nb_samples)
     int wanted_nb_samples = nb_samples;
     
     /* if not master, then we try to remove or add samples to correct the clock */
-    if (get_master_sync_type(is) != AV_SYNC_AUDIO_MASTER) {
+    /* LAVP: offline processing delivers the samples unchanged */
+    if (get_master_sync_type(is) != AV_SYNC_AUDIO_MASTER && !is->offline) {
         double diff, avg_diff;
         int min_nb_samples, max_nb_samples;
         
@@ -136,6 +153,152 @@ static int synchronize_audio(VideoState *is, int nb_samples)
     return wanted_nb_samples;
 }
 
+#pragma mark -
+
+/* LAVP: find or create a resampler from this source to is->audio_tgt */
+static struct SwrContext *audio_swr_lookup(VideoState *is, int64_t channel_layout, enum AVSampleFormat fmt, int freq)
+{
+    SwrCacheEntry *entry;
+    struct SwrContext *swr_ctx;
+    int i;
+    
+    for (i = 0; i < SWR_CACHE_SIZE; i++) {
+        entry = &is->swr_cache[i];
+        if (entry->swr_ctx &&
+            entry->src_channel_layout == channel_layout &&
+            entry->src_fmt            == fmt &&
+            entry->src_freq           == freq &&
+            entry->tgt_channel_layout == is->audio_tgt.channel_layout &&
+            entry->tgt_fmt            == is->audio_tgt.fmt &&
+            entry->tgt_freq           == is->audio_tgt.freq) {
+            /* drop the tail left over from its previous use */
+            int64_t delay = swr_get_delay(entry->swr_ctx, is->audio_tgt.freq);
+            if (delay > 0)
+                swr_drop_output(entry->swr_ctx, (int)delay);
+            return entry->swr_ctx;
+        }
+    }
+    
+    /* LAVP: a resampler parked by a closed stream of the same format */
+    swr_ctx = NULL;
+    if (is->context_pool) {
+        SwrCacheEntry params = {channel_layout, fmt, freq,
+                                is->audio_tgt.channel_layout, is->audio_tgt.fmt, is->audio_tgt.freq, NULL};
+        swr_ctx = pool_take_swr(&params);
+        if (swr_ctx) {
+            int64_t delay = swr_get_delay(swr_ctx, is->audio_tgt.freq);
+            if (delay > 0)
+                swr_drop_output(swr_ctx, (int)delay);
+        }
+    }
+    if (!swr_ctx) {
+        swr_ctx = swr_alloc_set_opts(NULL,
+                                     is->audio_tgt.channel_layout, is->audio_tgt.fmt, is->audio_tgt.freq,
+                                     channel_layout,               fmt,               freq,
+                                     0, NULL);
+        if (!swr_ctx || swr_init(swr_ctx) < 0) {
+            swr_free(&swr_ctx);
+            return NULL;
+        }
+    }
+    
+    /* replace round robin */
+    entry = &is->swr_cache[is->swr_cache_next];
+    is->swr_cache_next = (is->swr_cache_next + 1) % SWR_CACHE_SIZE;
+    if (entry->swr_ctx == is->swr_ctx)
+        is->swr_ctx = NULL;
+    swr_free(&entry->swr_ctx);
+    
+    entry->src_channel_layout = channel_layout;
+    entry->src_fmt            = fmt;
+    entry->src_freq           = freq;
+    entry->tgt_channel_layout = is->audio_tgt.channel_layout;
+    entry->tgt_fmt            = is->audio_tgt.fmt;
+    entry->tgt_freq           = is->audio_tgt.freq;
+    entry->swr_ctx            = swr_ctx;
+    return swr_ctx;
+}
+
+void audio_swr_cache_free(VideoState *is)
+{
+    int i;
+    
+    for (i = 0; i < SWR_CACHE_SIZE; i++) {
+        if (is->context_pool)
+            pool_put_swr(&is->swr_cache[i]);
+        swr_free(&is->swr_cache[i].swr_ctx);
+    }
+    is->swr_cache_next = 0;
+    is->swr_ctx = NULL;
+    av_freep(&is->audio_conv_buf);
+    is->audio_conv_buf_size = 0;
+}
+
+/* LAVP: same rate and layout into packed S16 without swr; returns 0 if not applicable */
+static int audio_convert_direct(VideoState *is, AVFrame *frame, int64_t dec_channel_layout, int wanted_nb_samples)
+{
+    int channels = av_frame_get_channels(frame);
+    int nb_samples = frame->nb_samples;
+    int out_size = nb_samples * channels * sizeof(int16_t);
+    int16_t *dst;
+    int ch, i;
+    
+    if (is->audio_tgt.fmt            != AV_SAMPLE_FMT_S16  ||
+        is->audio_tgt.freq           != frame->sample_rate ||
+        is->audio_tgt.channel_layout != dec_channel_layout ||
+        is->audio_tgt.channels       != channels           ||
+        wanted_nb_samples            != nb_samples)
+        return 0;
+    
+    /* a resampler still holding samples has to be drained through swr first */
+    if (is->swr_ctx && swr_get_delay(is->swr_ctx, is->audio_tgt.freq) > 0)
+        return 0;
+    
+    switch (frame->format) {
+        case AV_SAMPLE_FMT_S16:
+            is->audio_buf = frame->data[0];
+            return out_size;
+        case AV_SAMPLE_FMT_S16P:
+        case AV_SAMPLE_FMT_FLT:
+        case AV_SAMPLE_FMT_FLTP:
+            break;
+        default:
+            return 0;
+    }
+    
+    av_fast_malloc(&is->audio_buf1, &is->audio_buf1_size, out_size);
+    if (!is->audio_buf1)
+        return AVERROR(ENOMEM);
+    dst = (int16_t *)is->audio_buf1;
+    
+    if (frame->format == AV_SAMPLE_FMT_S16P) {
+        for (ch = 0; ch < channels; ch++) {
+            const int16_t *src = (const int16_t *)frame->extended_data[ch];
+            int16_t *out = dst + ch;
+            for (i = 0; i < nb_samples; i++, out += channels)
+                *out = src[i];
+        }
+    } else {
+        /* scale, clip and round like swr; planar input interleaves via the output stride */
+        int planar = frame->format == AV_SAMPLE_FMT_FLTP;
+        int planes = planar ? channels : 1;
+        int count  = planar ? nb_samples : nb_samples * channels;
+        float scale = 32768, lo = -32768, hi = 32767;
+        
+        av_fast_malloc(&is->audio_conv_buf, &is->audio_conv_buf_size, count * sizeof(float));
+        if (!is->audio_conv_buf)
+            return AVERROR(ENOMEM);
+        for (ch = 0; ch < planes; ch++) {
+            vDSP_vsmul((const float *)frame->extended_data[ch], 1, &scale, is->audio_conv_buf, 1, count);
+            vDSP_vclip(is->audio_conv_buf, 1, &lo, &hi, is->audio_conv_buf, 1, count);
+            vDSP_vfixr16(is->audio_conv_buf, 1, dst + ch, planar ? channels : 1, count);
+        }
+    }
+    
+    is->audio_buf = is->audio_buf1;
+    return out_size;
+}
+
 /**
  * Decode one audio frame and return its uncompressed size.
  *
@@ -206,6 +369,14 @@ int audio_decode_frame(VideoState *is)
                 if (is->frame->pts != AV_NOPTS_VALUE)
                     is->audio_frame_next_pts = is->frame->pts + is->frame->nb_samples;
                 
+                /* LAVP: after check_live_latency() skipped ahead, do not play what is already late */
+                if (is->low_latency && is->frame->pts != AV_NOPTS_VALUE &&
+                    get_master_sync_type(is) != AV_SYNC_AUDIO_MASTER) {
+                    double end = (is->frame->pts + is->frame->nb_samples) * av_q2d(tb);
+                    if (get_master_clock(is) - end > AV_SYNC_THRESHOLD_MAX)
+                        continue;
+                }
+                
 #if 0
                 // LAVP:
 #endif
@@ -223,16 +394,23 @@ int audio_decode_frame(VideoState *is)
                 is->frame->channel_layout : av_get_default_channel_layout(av_frame_get_channels(is->frame));
             wanted_nb_samples = synchronize_audio(is, is->frame->nb_samples);
             
-            if (is->frame->format        != is->audio_src.fmt            ||
-                dec_channel_layout       != is->audio_src.channel_layout ||
-                is->frame->sample_rate   != is->audio_src.freq           ||
-                (wanted_nb_samples       != is->frame->nb_samples && !is->swr_ctx)) {
-                swr_free(&is->swr_ctx);
-                is->swr_ctx = swr_alloc_set_opts(NULL,
-                                                 is->audio_tgt.channel_layout, is->audio_tgt.fmt, is->audio_tgt.freq,
-                                                 dec_channel_layout,           is->frame->format, is->frame->sample_rate,
-                                                 0, NULL);
-                if (!is->swr_ctx || swr_init(is->swr_ctx) < 0) {
+            /* LAVP: common conversions bypass swr */
+            resampled_data_size = audio_convert_direct(is, is->frame, dec_channel_layout, wanted_nb_samples);
+            if (resampled_data_size < 0)
+                return resampled_data_size;
+            if (resampled_data_size > 0) {
+                is->swr_ctx = NULL;
+                is->audio_src.channel_layout = dec_channel_layout;
+                is->audio_src.channels       = av_frame_get_channels(is->frame);
+                is->audio_src.freq = is->frame->sample_rate;
+                is->audio_src.fmt = is->frame->format;
+            } else if (is->frame->format        != is->audio_src.fmt            ||
+                       dec_channel_layout       != is->audio_src.channel_layout ||
+                       is->frame->sample_rate   != is->audio_src.freq           ||
+                       !is->swr_ctx) {
+                /* LAVP: resamplers are cached; switching back and forth does not rebuild them */
+                is->swr_ctx = audio_swr_lookup(is, dec_channel_layout, is->frame->format, is->frame->sample_rate);
+                if (!is->swr_ctx) {
                     av_log(NULL, AV_LOG_ERROR,
                            "Cannot create sample rate converter for conversion of %d Hz %s %d channels to %d Hz %s %d channels!\n",
                            is->frame->sample_rate, av_get_sample_fmt_name(is->frame->format), av_frame_get_channels(is->frame),
@@ -245,7 +423,9 @@ int audio_decode_frame(VideoState *is)
                 is->audio_src.fmt = is->frame->format;
             }
             
-            if (is->swr_ctx) {
+            if (resampled_data_size > 0) {
+                /* LAVP: already converted by audio_convert_direct() */
+            } else if (is->swr_ctx) {
                 const uint8_t **in = (const uint8_t **)is->frame->extended_data;
                 uint8_t **out = &is->audio_buf1;
                 int out_count = (int64_t)wanted_nb_samples * is->audio_tgt.freq / is->frame->sample_rate + 256;
@@ -288,6 +468,7 @@ int audio_decode_frame(VideoState *is)
             else
                 is->audio_clock = NAN;
             is->audio_clock_serial = is->audio_pkt_temp_serial;
+            track_audio_started(is);
 #ifdef DEBUG
             {
                 static double last_clock;
@@ -318,6 +499,8 @@ int audio_decode_frame(VideoState *is)
             return -1;
         
         if (pkt->data == is->audioq.flush_pkt.data) {
+            /* LAVP: a pending track switch takes effect here */
+            dec = track_audio_flushed(is);
             avcodec_flush_buffers(dec);
             is->audio_buf_frames_pending = 0;
             is->audio_frame_next_pts = AV_NOPTS_VALUE;
@@ -330,53 +513,58 @@ int audio_decode_frame(VideoState *is)
 }
 
 /* prepare a new audio buffer */
-/* LAVP: original: sdl_audio_callback() */
+/* LAVP: original: sdl_audio_callback(); callback_time is when the device asked for len bytes */
+void audio_render(VideoState *is, uint8_t *stream, int len, int64_t callback_time)
+{
+    int audio_size, len1;
+    
+    is->audio_callback_time = callback_time;
+    OSAtomicIncrement64(&is->wakeups);
+    
+    while (len > 0) {
+        if (is->audio_buf_index >= is->audio_buf_size) {
+            audio_size = audio_decode_frame(is);
+            if (audio_size < 0) {
+                /* if error, just output silence */
+                is->audio_buf      = is->silence_buf;
+                is->audio_buf_size = sizeof(is->silence_buf) / is->audio_tgt.frame_size * is->audio_tgt.frame_size;
+            } else {
+                if (is->vis_active)
+                    update_sample_display(is, (int16_t *)is->audio_buf, audio_size);
+                if (is->validate)
+                    validate_audio(is, is->audio_buf, audio_size, is->audio_clock, is->audio_clock_serial);
+                is->audio_buf_size = audio_size;
+            }
+            is->audio_buf_index = 0;
+        }
+        len1 = is->audio_buf_size - is->audio_buf_index;
+        if (len1 > len)
+            len1 = len;
+        memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
+        len -= len1;
+        stream += len1;
+        is->audio_buf_index += len1;
+    }
+    is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
+    
+    /* Let's assume the audio driver that is used by SDL has two periods. */
+    if (!isnan(is->audio_clock)) {
+        set_clock_at(&is->audclk, is->audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec, is->audio_clock_serial, is->audio_callback_time / 1000000.0);
+        sync_clock_to_slave(&is->extclk, &is->audclk);
+    }
+}
+
 static void inCallbackProc (void *inUserData, AudioQueueRef inAQ, AudioQueueBufferRef inBuffer)
 {
     @autoreleasepool {
         //NSLog(@"DEBUG: inCallbackProc");
         
-        uint8_t *stream = inBuffer->mAudioData;
-        int len = inBuffer->mAudioDataBytesCapacity;
-        
-        //
         VideoState *is = inUserData;
-        int audio_size, len1;
-        
-        is->audio_callback_time = av_gettime();
         
-        while (len > 0) {
-            if (is->audio_buf_index >= is->audio_buf_size) {
-                audio_size = audio_decode_frame(is);
-                if (audio_size < 0) {
-                    /* if error, just output silence */
-                    is->audio_buf      = is->silence_buf;
-                    is->audio_buf_size = sizeof(is->silence_buf) / is->audio_tgt.frame_size * is->audio_tgt.frame_size;
-                } else {
-                    if (is->show_mode != SHOW_MODE_VIDEO)
-                        update_sample_display(is, (int16_t *)is->audio_buf, audio_size);
-                    is->audio_buf_size = audio_size;
-                }
-                is->audio_buf_index = 0;
-            }
-            len1 = is->audio_buf_size - is->audio_buf_index;
-            if (len1 > len)
-                len1 = len;
-            memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
-            len -= len1;
-            stream += len1;
-            is->audio_buf_index += len1;
-        }
-        is->audio_write_buf_size = is->audio_buf_size - is->audio_buf_index;
-        
-        /* Let's assume the audio driver that is used by SDL has two periods. */
-        if (!isnan(is->audio_clock)) {
-            set_clock_at(&is->audclk, is->audio_clock - (double)(2 * is->audio_hw_buf_size + is->audio_write_buf_size) / is->audio_tgt.bytes_per_sec, is->audio_clock_serial, is->audio_callback_time / 1000000.0);
-            sync_clock_to_slave(&is->extclk, &is->audclk);
-        }
+        audio_render(is, inBuffer->mAudioData, inBuffer->mAudioDataBytesCapacity, av_gettime());
         
         /* LAVP: Enqueue LPCM result into Audio Queue */
-        inBuffer->mAudioDataByteSize = stream - (UInt8 *)inBuffer->mAudioData;
+        inBuffer->mAudioDataByteSize = inBuffer->mAudioDataBytesCapacity;
         OSStatus err = AudioQueueEnqueueBuffer(inAQ, inBuffer, 0, NULL);
         if (err) {
             NSString *errStr = @"kAudioQueueErr_???";
@@ -420,6 +608,20 @@ static void LAVPFillASBD(VideoState *is, AVCodecContext *avctx)
 	is->asbd.mBitsPerChannel = inValidBitsPerChannel;
 }
 
+static void LAVPAudioQueueEnqueueDummy(VideoState *is)
+{
+    for( int i = 0; i < AUDIO_QUEUE_BUFFERS; i++ ) {
+        AudioQueueBufferRef outBuffer = is->audio_queue_buffers[i];
+        
+        // Nullify data
+        memset(outBuffer->mAudioData, 0, outBuffer->mAudioDataBytesCapacity);
+        
+        // Enqueue dummy data to start queuing
+        outBuffer->mAudioDataByteSize=8; // dummy data
+        AudioQueueEnqueueBuffer(is->outAQ, outBuffer, 0, 0);
+    }
+}
+
 /* LAVP: original: audio_open() */
 void LAVPAudioQueueInit(VideoState *is, AVCodecContext *avctx)
 {
@@ -440,16 +642,38 @@ void LAVPAudioQueueInit(VideoState *is, AVCodecContext *avctx)
     // prepare Audio stream basic description
     LAVPFillASBD(is, avctx);
     
+    UInt32 inBufferByteSize = (is->asbd.mSampleRate / 50) * is->asbd.mBytesPerFrame;	// perform callback 50 times per sec
+    if (is->audio_only) {
+        // LAVP: nothing to lip-sync; one callback decodes and resamples AUDIO_ONLY_BUFFER_TIME at once
+        inBufferByteSize = (UInt32)(is->asbd.mSampleRate * AUDIO_ONLY_BUFFER_TIME) * is->asbd.mBytesPerFrame;
+        is->audio_hw_buf_size = inBufferByteSize;   // audio clock accounts for the deeper queue
+    }
+    is->audio_queue_buffer_size = inBufferByteSize;
+    
+    // LAVP: a parked AudioQueue of the same format comes with its buffers
+    if (is->context_pool && pool_take_audio_queue(is) == 0) {
+        LAVPAudioQueueEnqueueDummy(is);
+        return;
+    }
+    
     // prepare AudioQueue for Output
     OSStatus err = 0;
     AudioQueueRef outAQ = NULL;
 #if 1
     if (!is->audioDispatchQueue) {
+        // LAVP: the block reads its VideoState through owner, so a parked queue can change hands
+        VideoState * volatile *owner = av_mallocz(sizeof(*owner));
+        assert(owner);
+        *owner = is;
+        is->audio_owner = (void*)owner;
+        
         // using dispatch queue and block object
         void (^inCallbackBlock)() = ^(AudioQueueRef inAQ, AudioQueueBufferRef inBuffer)
         {
-            /* AudioQueue Callback should be ignored when closing */
-            if (is->abort_request) return;
+            VideoState *is = *owner;
+            
+            /* AudioQueue Callback should be ignored when closing or parked */
+            if (!is || is->abort_request) return;
             
             inCallbackProc(is, inAQ, inBuffer);
         };
@@ -476,20 +700,14 @@ void LAVPAudioQueueInit(VideoState *is, AVCodecContext *avctx)
     assert(err == 0);
     
     // prepare audio queue buffers for Output
-    UInt32 inBufferByteSize = (is->asbd.mSampleRate / 50) * is->asbd.mBytesPerFrame;	// perform callback 50 times per sec
-    for( int i = 0; i < 3; i++ ) {
+    for( int i = 0; i < AUDIO_QUEUE_BUFFERS; i++ ) {
         // Allocate Buffer
         AudioQueueBufferRef outBuffer = NULL;
         err = AudioQueueAllocateBuffer(is->outAQ, inBufferByteSize, &outBuffer);
         assert(err == 0 && outBuffer != NULL);
-        
-        // Nullify data
-        memset(outBuffer->mAudioData, 0, outBuffer->mAudioDataBytesCapacity);
-        
-        // Enqueue dummy data to start queuing
-        outBuffer->mAudioDataByteSize=8; // dummy data
-        AudioQueueEnqueueBuffer(is->outAQ, outBuffer, 0, 0);
+        is->audio_queue_buffers[i] = outBuffer;
     }
+    LAVPAudioQueueEnqueueDummy(is);
 }	
 
 void LAVPAudioQueueStart(VideoState *is)
@@ -596,6 +814,10 @@ void LAVPAudioQueueDealloc(VideoState *is)
     err = AudioQueueReset(is->outAQ);
     assert(err == 0);
 	
+    // LAVP: keep the queue, its buffers and dispatch queue for the next stream of this format
+    if (is->context_pool && pool_put_audio_queue(is) == 0)
+        return;
+    
     err = AudioQueueDispose(is->outAQ, NO);
 	assert(err == 0);
 	
@@ -607,6 +829,7 @@ void LAVPAudioQueueDealloc(VideoState *is)
         audioDispatchQueue = NULL; // ARC
         is->audioDispatchQueue = NULL;
     }
+    av_freep(&is->audio_owner);
     
 	//NSLog(@"DEBUG: LAVPAudioQueueDealloc done");
 }
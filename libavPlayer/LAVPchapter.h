@@ -0,0 +1,53 @@
+/*
+ *  LAVPchapter.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPchapter_h__
+#define __LAVPchapter_h__
+
+#include "LAVPcommon.h"
+
+void chapter_open(VideoState *is);
+void chapter_close(VideoState *is);
+int chapter_count(VideoState *is);
+int chapter_index_for(VideoState *is, int64_t pos);
+int64_t chapter_start(VideoState *is, int index);
+int chapter_container_index(VideoState *is, int index);
+
+void chapter_set_prefetch(VideoState *is, int enable);
+int chapter_get_prefetch(VideoState *is);
+int64_t chapter_jump_latency(VideoState *is);
+int64_t chapter_memory(VideoState *is);
+
+/* read_thread */
+void chapter_update(VideoState *is);
+
+/* stream_seek_chapter */
+void chapter_jump(VideoState *is, int index);
+
+/* presentation */
+int chapter_has_image(VideoState *is);
+int chapter_copy_image(VideoState *is, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height);
+void chapter_picture_queued(VideoState *is, int serial);
+void chapter_presented(VideoState *is, int serial);
+
+#endif
@@ -0,0 +1,617 @@
+/*
+ *  LAVPchapter.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPvideo.h"
+#include "LAVPchapter.h"
+
+/* =========================================================== */
+
+/*
+ Chapter navigation:
+ 
+ Chapter starts are kept sorted in AV_TIME_BASE, so finding the current chapter is
+ a binary search on the master clock. Indexes here are into the sorted starts;
+ chapter_container_index() maps one back to ic->chapters, whose order is the
+ container's and need not be ascending.
+ 
+ read_thread tells chapter_thread which chapters a jump would land on from the
+ current one. chapter_thread owns a private demuxer and decoder (like reverse_thread)
+ and decodes the picture shown at the start of each of them. On a jump that picture
+ is presented at once while the forward pipeline seeks and refills behind it;
+ copyImage() returns to pictq as soon as a picture of the new serial is queued.
+ A jump to a chapter which is not ready is a plain seek.
+ 
+ chapter_jump_latency() is the time from the last jump to the first picture of the
+ new chapter handed to a consumer, with or without prefetch.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+typedef struct ChapterStart {
+    int64_t start;
+    int index;              /* in ic->chapters */
+} ChapterStart;
+
+static int chapter_compare(const void *a, const void *b)
+{
+    const ChapterStart *x = a, *y = b;
+    if (x->start != y->start)
+        return (x->start > y->start) - (x->start < y->start);
+    return x->index - y->index;
+}
+
+static void chapter_free_frame(AVFrame **frame)
+{
+    if (*frame) {
+        av_freep(&(*frame)->data[0]);
+        av_frame_free(frame);
+    }
+}
+
+void chapter_open(VideoState *is)
+{
+    AVFormatContext *ic = is->ic;
+    
+    if (!ic->nb_chapters)
+        return;
+    ChapterStart *sorted = av_malloc(sizeof(ChapterStart) * ic->nb_chapters);
+    is->chap_starts = av_malloc(sizeof(int64_t) * ic->nb_chapters);
+    is->chap_order = av_malloc(sizeof(int) * ic->nb_chapters);
+    if (!sorted || !is->chap_starts || !is->chap_order) {
+        av_free(sorted);
+        av_freep(&is->chap_starts);
+        av_freep(&is->chap_order);
+        return;
+    }
+    
+    for (int i = 0; i < ic->nb_chapters; i++) {
+        AVChapter *ch = ic->chapters[i];
+        sorted[i].start = av_rescale_q(ch->start, ch->time_base, AV_TIME_BASE_Q);
+        sorted[i].index = i;
+    }
+    qsort(sorted, ic->nb_chapters, sizeof(ChapterStart), chapter_compare);
+    for (int i = 0; i < ic->nb_chapters; i++) {
+        is->chap_starts[i] = sorted[i].start;
+        is->chap_order[i] = sorted[i].index;
+    }
+    av_free(sorted);
+    is->chap_nb = ic->nb_chapters;
+    
+    for (int i = 0; i < CHAPTER_PREFETCH_SLOTS; i++) {
+        is->chap_want[i] = -1;
+        is->chap_cache[i].chapter = -1;
+    }
+    is->chap_mutex = LAVPCreateMutex();
+    is->chap_cond = LAVPCreateCond();
+}
+
+int chapter_count(VideoState *is)
+{
+    return is->chap_nb;
+}
+
+/* index of the chapter containing pos (largest start not after it), or -1 before the first one */
+int chapter_index_for(VideoState *is, int64_t pos)
+{
+    int lo = 0, hi = is->chap_nb - 1, found = -1;
+    
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (is->chap_starts[mid] <= pos) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+int64_t chapter_start(VideoState *is, int index)
+{
+    if (index < 0 || index >= is->chap_nb)
+        return AV_NOPTS_VALUE;
+    return is->chap_starts[index];
+}
+
+/* ic->chapters index of a sorted index; -1 stays -1 */
+int chapter_container_index(VideoState *is, int index)
+{
+    if (index < 0 || index >= is->chap_nb)
+        return -1;
+    return is->chap_order[index];
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+static int chapter_open_decoder(VideoState *is)
+{
+    AVFormatContext *ic = NULL;
+    AVCodecContext *avctx = NULL;
+    AVCodec *codec = NULL;
+    AVDictionary *opts = NULL;
+    
+    if (avformat_open_input(&ic, is->filename, is->iformat, NULL) < 0)
+        goto fail;
+    if (avformat_find_stream_info(ic, NULL) < 0)
+        goto fail;
+    if (is->video_stream < 0 || is->video_stream >= ic->nb_streams)
+        goto fail;
+    
+    codec = avcodec_find_decoder(ic->streams[is->video_stream]->codec->codec_id);
+    if (!codec)
+        goto fail;
+    avctx = avcodec_alloc_context3(codec);
+    if (!avctx || avcodec_copy_context(avctx, ic->streams[is->video_stream]->codec) < 0)
+        goto fail;
+    
+    /* same picture size as the forward decoder */
+    av_codec_set_lowres(avctx, av_codec_get_lowres(is->video_st->codec));
+    avctx->workaround_bugs = is->workaround_bugs;
+    avctx->error_concealment = is->error_concealment;
+    
+    av_dict_set(&opts, "threads", "auto", 0);
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if (avcodec_open2(avctx, codec, &opts) < 0)
+        goto fail;
+    av_dict_free(&opts);
+    
+    for (int i = 0; i < ic->nb_streams; i++)
+        ic->streams[i]->discard = (i == is->video_stream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    
+    is->chap_ic = ic;
+    is->chap_avctx = avctx;
+    return 0;
+    
+fail:
+    av_log(NULL, AV_LOG_WARNING, "%s: could not prepare chapter prefetch decoder\n", is->filename);
+    av_dict_free(&opts);
+    if (avctx) {
+        avcodec_close(avctx);
+        av_free(avctx);
+    }
+    if (ic)
+        avformat_close_input(&ic);
+    return -1;
+}
+
+/* YUV420P copy of src owned by the caller, or NULL */
+static AVFrame *chapter_copy_frame(VideoState *is, AVFrame *src)
+{
+    AVFrame *pict = av_frame_alloc();
+    
+    if (!pict)
+        return NULL;
+    if (av_image_alloc(pict->data, pict->linesize, src->width, src->height, PIX_FMT_YUV420P, 0x10) < 0) {
+        av_frame_free(&pict);
+        return NULL;
+    }
+    pict->width = src->width;
+    pict->height = src->height;
+    pict->format = PIX_FMT_YUV420P;
+    
+    if (src->format == PIX_FMT_YUV420P) {
+        av_image_copy(pict->data, pict->linesize, (const uint8_t **)src->data, src->linesize,
+                      PIX_FMT_YUV420P, src->width, src->height);
+    } else {
+        is->chap_convert_ctx = sws_getCachedContext(is->chap_convert_ctx,
+                                                    src->width, src->height, src->format,
+                                                    src->width, src->height, PIX_FMT_YUV420P,
+                                                    is->sws_flags, NULL, NULL, NULL);
+        if (!is->chap_convert_ctx) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot initialize the conversion context\n");
+            chapter_free_frame(&pict);
+            return NULL;
+        }
+        sws_scale(is->chap_convert_ctx, (const uint8_t * const *)src->data, src->linesize,
+                  0, src->height, pict->data, pict->linesize);
+    }
+    return pict;
+}
+
+/* the picture shown at start: the last one not after it, or the first one if all follow it */
+static AVFrame *chapter_decode(VideoState *is, int64_t start, double *pts)
+{
+    AVFormatContext *ic = is->chap_ic;
+    AVStream *st = ic->streams[is->video_stream];
+    AVFrame *frame = av_frame_alloc();
+    AVFrame *best = av_frame_alloc();
+    AVFrame *pict = NULL;
+    AVPacket pkt;
+    double target = start / (double)AV_TIME_BASE;
+    double best_pts = NAN;
+    int have = 0, got_picture;
+    
+    if (!frame || !best)
+        goto bail;
+    if (avformat_seek_file(ic, -1, INT64_MIN, start, INT64_MAX, 0) < 0)
+        goto bail;
+    avcodec_flush_buffers(is->chap_avctx);
+    
+    for (int packets = 0; packets < CHAPTER_PREFETCH_MAX_PACKETS && !is->chap_abort; packets++) {
+        int64_t ts;
+        double fpts;
+        int ret;
+        
+        if (av_read_frame(ic, &pkt) < 0)
+            break;
+        if (pkt.stream_index != is->video_stream) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        ret = avcodec_decode_video2(is->chap_avctx, frame, &got_picture, &pkt);
+        av_free_packet(&pkt);
+        if (ret < 0 || !got_picture)
+            continue;
+        
+        ts = av_frame_get_best_effort_timestamp(frame);
+        fpts = (ts == AV_NOPTS_VALUE) ? NAN : ts * av_q2d(st->time_base);
+        if (have && !isnan(fpts) && fpts > target) {
+            av_frame_unref(frame);
+            break;
+        }
+        av_frame_unref(best);
+        av_frame_move_ref(best, frame);
+        best_pts = fpts;
+        have = 1;
+        if (!isnan(fpts) && fpts >= target)
+            break;
+    }
+    
+    if (have && !is->chap_abort) {
+        pict = chapter_copy_frame(is, best);
+        *pts = isnan(best_pts) ? target : best_pts;
+    }
+    
+bail:
+    av_frame_free(&frame);
+    av_frame_free(&best);
+    return pict;
+}
+
+/* first wanted chapter without a cache slot, or -1; caller holds chap_mutex */
+static int chapter_missing(VideoState *is)
+{
+    for (int i = 0; i < CHAPTER_PREFETCH_SLOTS; i++) {
+        int want = is->chap_want[i], cached = 0;
+        if (want < 0)
+            continue;
+        for (int j = 0; j < CHAPTER_PREFETCH_SLOTS; j++)
+            cached |= (is->chap_cache[j].chapter == want);
+        if (!cached)
+            return want;
+    }
+    return -1;
+}
+
+/* a slot not holding a wanted chapter, or NULL; caller holds chap_mutex */
+static ChapterFrame *chapter_free_slot(VideoState *is)
+{
+    for (int j = 0; j < CHAPTER_PREFETCH_SLOTS; j++) {
+        ChapterFrame *cf = &is->chap_cache[j];
+        int wanted = 0;
+        for (int i = 0; i < CHAPTER_PREFETCH_SLOTS; i++)
+            wanted |= (cf->chapter >= 0 && cf->chapter == is->chap_want[i]);
+        if (!wanted)
+            return cf;
+    }
+    return NULL;
+}
+
+static void chapter_thread(VideoState *is)
+{
+    if (chapter_open_decoder(is) < 0) {
+        is->chap_prefetch = 0;
+        return;
+    }
+    
+    LAVPLockMutex(is->chap_mutex);
+    while (!is->chap_abort) {
+        @autoreleasepool {
+            int target = is->chap_prefetch ? chapter_missing(is) : -1;
+            ChapterFrame *cf;
+            AVFrame *pict;
+            double pts = NAN;
+            
+            if (target < 0) {
+                LAVPCondWait(is->chap_cond, is->chap_mutex);
+                continue;
+            }
+            LAVPUnlockMutex(is->chap_mutex);
+            
+            pict = chapter_decode(is, is->chap_starts[target], &pts);
+            
+            LAVPLockMutex(is->chap_mutex);
+            
+            /* a failed chapter keeps its slot with no frame so that it is not retried */
+            cf = chapter_free_slot(is);
+            if (cf) {
+                chapter_free_frame(&cf->frame);
+                cf->chapter = target;
+                cf->pts = pts;
+                cf->frame = pict;
+            } else {
+                chapter_free_frame(&pict);
+            }
+        }
+    }
+    LAVPUnlockMutex(is->chap_mutex);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+/* caller holds chap_mutex */
+static void chapter_want_around(VideoState *is, int current)
+{
+    /* the same targets as stream_seek_chapter(is, -1) and (is, +1) */
+    int prev = FFMAX(current - 1, 0);
+    int next = (current + 1 < is->chap_nb) ? current + 1 : -1;
+    
+    if (prev == next || prev == current)
+        prev = -1;
+    if (is->chap_want[0] == prev && is->chap_want[1] == next)
+        return;
+    is->chap_want[0] = prev;
+    is->chap_want[1] = next;
+    LAVPCondSignal(is->chap_cond);
+}
+
+void chapter_update(VideoState *is)
+{
+    double pos;
+    
+    if (!is->chap_nb || !is->chap_prefetch || is->chap_abort)
+        return;
+    if (!is->video_st || (is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        return;
+    if (is->realtime || is->timeshift || is->offline || is->reverse)
+        return;
+    
+    /* the clock still shows the old chapter until a jump has been presented */
+    if (is->chap_showing || stream_seek_pending(is))
+        return;
+    pos = get_master_clock(is);
+    if (isnan(pos))
+        return;
+    
+    LAVPLockMutex(is->chap_mutex);
+    if (!is->chapter_group) {
+        // LAVP: Using dispatch queue
+        dispatch_queue_t chapter_queue = dispatch_queue_create("chapter", NULL);
+        dispatch_group_t chapter_group = dispatch_group_create();
+        is->chapter_queue = (__bridge_retained void*)chapter_queue;
+        is->chapter_group = (__bridge_retained void*)chapter_group;
+        dispatch_group_async(chapter_group, chapter_queue, ^(void){chapter_thread(is);});
+    }
+    chapter_want_around(is, chapter_index_for(is, (int64_t)(pos * AV_TIME_BASE)));
+    LAVPUnlockMutex(is->chap_mutex);
+}
+
+void chapter_set_prefetch(VideoState *is, int enable)
+{
+    if (!is->chap_nb)
+        return;
+    
+    LAVPLockMutex(is->chap_mutex);
+    is->chap_prefetch = enable;
+    if (!enable) {
+        for (int i = 0; i < CHAPTER_PREFETCH_SLOTS; i++) {
+            chapter_free_frame(&is->chap_cache[i].frame);
+            is->chap_cache[i].chapter = -1;
+            is->chap_want[i] = -1;
+        }
+    }
+    LAVPCondSignal(is->chap_cond);
+    LAVPUnlockMutex(is->chap_mutex);
+}
+
+int chapter_get_prefetch(VideoState *is)
+{
+    return is->chap_prefetch;
+}
+
+/* bytes of the prefetched pictures and the one presented after a jump */
+int64_t chapter_memory(VideoState *is)
+{
+    int64_t bytes = 0;
+    
+    if (!is->chap_nb)
+        return 0;
+    
+    LAVPLockMutex(is->chap_mutex);
+    for (int i = 0; i < CHAPTER_PREFETCH_SLOTS; i++) {
+        AVFrame *f = is->chap_cache[i].frame;
+        if (f)
+            bytes += avpicture_get_size(f->format, f->width, f->height);
+    }
+    if (is->chap_frame)
+        bytes += avpicture_get_size(is->chap_frame->format, is->chap_frame->width, is->chap_frame->height);
+    LAVPUnlockMutex(is->chap_mutex);
+    return bytes;
+}
+
+int64_t chapter_jump_latency(VideoState *is)
+{
+    return is->chap_jump_latency;
+}
+
+/* called before the seek to the chapter start is requested */
+void chapter_jump(VideoState *is, int index)
+{
+    if (!is->chap_nb)
+        return;
+    
+    LAVPLockMutex(is->chap_mutex);
+    is->chap_jump_start = av_gettime();
+    is->chap_serial_min = is->videoq.serial + 1;
+    is->chap_jump_prefetched = 0;
+    is->chap_showing = 0;
+    chapter_free_frame(&is->chap_frame);
+    
+    for (int i = 0; i < CHAPTER_PREFETCH_SLOTS && !is->reverse; i++) {
+        ChapterFrame *cf = &is->chap_cache[i];
+        if (cf->chapter == index && cf->frame) {
+            is->chap_frame = cf->frame;
+            is->chap_frame_pts = cf->pts;
+            cf->frame = NULL;
+            cf->chapter = -1;
+            is->chap_jump_prefetched = 1;
+            is->chap_showing = 1;
+            break;
+        }
+    }
+    if (is->chap_prefetch)
+        chapter_want_around(is, index);
+    LAVPUnlockMutex(is->chap_mutex);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+static void chapter_jump_done(VideoState *is)
+{
+    int64_t start = is->chap_jump_start;
+    
+    if (!start)
+        return;
+    is->chap_jump_start = 0;
+    is->chap_jump_latency = av_gettime() - start;
+    av_log(NULL, AV_LOG_VERBOSE, "chapter jump: %.1f ms to the first picture (%s)\n",
+           is->chap_jump_latency / 1000.0, is->chap_jump_prefetched ? "prefetched" : "seek");
+}
+
+int chapter_has_image(VideoState *is)
+{
+    return is->chap_showing;
+}
+
+int chapter_copy_image(VideoState *is, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height)
+{
+    AVFrame *pict;
+    int result = 0;
+    
+    LAVPLockMutex(is->chap_mutex);
+    pict = is->chap_frame;
+    if (!is->chap_showing || !pict)
+        goto bail;
+    
+    if (is->chap_frame_pts == vc->lastPTScopied && width == vc->width && height == vc->height) {
+        result = 2;
+        goto bail;
+    }
+    
+    video_copy_picture(is, vc, pict, FFMIN(pict->width, is->width), FFMIN(pict->height, is->height),
+                       data, pitch, width, height);
+    
+    LAVPLockMutex(is->pictq_mutex);
+    consumer_copied(is, vc, is->chap_frame_pts, width, height);
+    LAVPUnlockMutex(is->pictq_mutex);
+    
+    chapter_jump_done(is);
+    *targetpts = is->chap_frame_pts;
+    result = 1;
+    
+bail:
+    LAVPUnlockMutex(is->chap_mutex);
+    return result;
+}
+
+/* queue_picture() published a picture; pictq takes over once it holds the new chapter */
+void chapter_picture_queued(VideoState *is, int serial)
+{
+    if (!is->chap_showing || serial < is->chap_serial_min)
+        return;
+    
+    LAVPLockMutex(is->chap_mutex);
+    if (is->chap_showing && serial >= is->chap_serial_min) {
+        is->chap_showing = 0;
+        chapter_free_frame(&is->chap_frame);
+    }
+    LAVPUnlockMutex(is->chap_mutex);
+}
+
+/* a picture from pictq was copied; caller holds pictq_mutex */
+void chapter_presented(VideoState *is, int serial)
+{
+    if (is->chap_jump_start && serial >= is->chap_serial_min)
+        chapter_jump_done(is);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+void chapter_close(VideoState *is)
+{
+    if (!is->chap_nb)
+        return;
+    
+    if (is->chapter_group) {
+        LAVPLockMutex(is->chap_mutex);
+        is->chap_abort = 1;
+        LAVPCondSignal(is->chap_cond);
+        LAVPUnlockMutex(is->chap_mutex);
+        
+        dispatch_group_wait((__bridge dispatch_group_t)is->chapter_group, DISPATCH_TIME_FOREVER);
+        {
+            dispatch_group_t chapter_group = (__bridge_transfer dispatch_group_t)is->chapter_group;
+            dispatch_queue_t chapter_queue = (__bridge_transfer dispatch_queue_t)is->chapter_queue;
+            chapter_group = NULL; // ARC
+            chapter_queue = NULL; // ARC
+            is->chapter_group = NULL;
+            is->chapter_queue = NULL;
+        }
+    }
+    
+    for (int i = 0; i < CHAPTER_PREFETCH_SLOTS; i++)
+        chapter_free_frame(&is->chap_cache[i].frame);
+    chapter_free_frame(&is->chap_frame);
+    is->chap_showing = 0;
+    
+    if (is->chap_avctx) {
+        avcodec_close(is->chap_avctx);
+        av_freep(&is->chap_avctx);
+    }
+    if (is->chap_ic)
+        avformat_close_input(&is->chap_ic);
+    if (is->chap_convert_ctx) {
+        sws_freeContext(is->chap_convert_ctx);
+        is->chap_convert_ctx = NULL;
+    }
+    av_freep(&is->chap_starts);
+    av_freep(&is->chap_order);
+    is->chap_nb = 0;
+    
+    LAVPDestroyMutex(is->chap_mutex);
+    LAVPDestroyCond(is->chap_cond);
+    is->chap_mutex = NULL;
+    is->chap_cond = NULL;
+}
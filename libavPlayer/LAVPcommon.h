@@ -82,6 +82,7 @@
 /* NOTE: the size must be big enough to compensate the hardware audio buffersize size */
 /* TODO: We assume that a decoded and resampled frame fits into this buffer */
 #define SAMPLE_ARRAY_SIZE (8 * 65536)
+#define SAMPLE_ARRAY_LIMIT(ch) (SAMPLE_ARRAY_SIZE - SAMPLE_ARRAY_SIZE % (ch)) /* LAVP: wrap on whole frames */
 
 #define CURSOR_HIDE_DELAY 1000000
 
@@ -89,6 +90,114 @@
 
 #define VIDEO_PICTURE_QUEUE_SIZE 15 /* LAVP: no-overrun patch in refresh_loop_wait_event() applied */
 #define SUBPICTURE_QUEUE_SIZE 4
+/* LAVP: fewest pictures queue_picture() lets wait when the memory budget is tight */
+#define VIDEO_PICTURE_QUEUE_MIN_DEPTH 2
+
+/* LAVP: AudioQueue buffers, each holding 1/50 sec */
+#define AUDIO_QUEUE_BUFFERS 3
+
+/* LAVP: audio-only playback without the refresh timer; see read_thread() */
+/* seconds held by each AudioQueue buffer */
+#define AUDIO_ONLY_BUFFER_TIME 0.5
+/* audio packets read ahead in one burst */
+#define AUDIO_ONLY_MIN_FRAMES 256
+/* msec read_thread sleeps while the queue is full */
+#define AUDIO_ONLY_READ_WAIT 500
+
+/* LAVP: reverse playback keeps decoded frames of the GOPs around the play head */
+#define REVERSE_CACHE_MAX_FRAMES 240
+#define REVERSE_CACHE_MAX_BYTES (256 * 1024 * 1024)
+/* start decoding the previous GOP when fewer seconds than this are cached below the play head */
+#define REVERSE_PREFETCH_TIME 1.0
+
+/* LAVP: chapter navigation; see LAVPchapter.m */
+/* neighbouring chapters whose first picture is decoded ahead */
+#define CHAPTER_PREFETCH_SLOTS 2
+/* packets read after a chapter start before prefetch gives up on it */
+#define CHAPTER_PREFETCH_MAX_PACKETS 600
+
+/* LAVP: scrub preview; see LAVPscrub.m */
+/* downscaled keyframes kept while scrubbing */
+#define SCRUB_CACHE_FRAMES 16
+#define SCRUB_MAX_WIDTH 640
+/* packets read after a seek before the scrub worker gives up on a keyframe */
+#define SCRUB_MAX_PACKETS 300
+
+/* LAVP: text subtitle rendering; see LAVPtext.m */
+/* A8 glyph atlas, TEXT_ATLAS_SIZE square */
+#define TEXT_ATLAS_SIZE 1024
+/* glyph hash slots; the atlas is reset when 3/4 are used */
+#define TEXT_GLYPH_SLOTS 2048
+/* cue layouts kept, one per cue and output size */
+#define TEXT_LAYOUT_CACHE 4
+/* font size and bottom margin relative to the output height */
+#define TEXT_FONT_SCALE 0.055
+#define TEXT_MARGIN_SCALE 0.05
+#define TEXT_MAX_LINES 8
+
+/* LAVP: contexts parked for the next stream of the same format; see LAVPpool.m */
+#define POOL_MAX_CODECS 4
+#define POOL_MAX_AUDIO_QUEUES 2
+#define POOL_MAX_SWS 8
+#define POOL_MAX_SWR 4
+
+/* LAVP: soak testing of the sync logic; see LAVPsoak.m */
+/* period of the virtual audio device in seconds, like the AudioQueue buffers */
+#define SOAK_AUDIO_PERIOD 0.02
+/* jitter histogram: SOAK_JITTER_BINS bins of SOAK_JITTER_BIN seconds, plus one for the rest */
+#define SOAK_JITTER_BINS 2000
+#define SOAK_JITTER_BIN 0.0001
+/* wall seconds the A-V offset is averaged over for the drift series */
+#define SOAK_DRIFT_INTERVAL 60
+/* CPU load workers spin for a duty share of this period, in usec */
+#define SOAK_CPU_PERIOD 10000
+
+/* LAVP: A-B loop keeps the demuxed packets of regions up to this size */
+#define LOOP_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+/* LAVP: packets of unselected audio/subtitle tracks kept for instant switching */
+#define ALT_TRACK_MAX_BYTES (2 * 1024 * 1024)
+#define ALT_TRACK_KEEP_BEHIND 1.0
+
+/* LAVP: small non-refcounted payloads are copied into per-queue slabs; see LAVPqueue.m */
+#define PACKET_SLAB_SIZE (256 * 1024)
+#define PACKET_ARENA_MAX_PACKET (32 * 1024)
+/* empty slabs an arena keeps for reuse */
+#define PACKET_ARENA_KEEP_SLABS 8
+/* unused list nodes a PacketQueue keeps for reuse */
+#define PACKET_QUEUE_KEEP_NODES 1024
+
+/* LAVP: timeshift ring for live sources; see LAVPtimeshift.m */
+#define TIMESHIFT_MIN_BYTES (16 * 1024 * 1024)
+/* records queued from the ring per read_thread iteration */
+#define TIMESHIFT_FEED_BATCH 32
+
+/* LAVP: validation mode; see LAVPvalidate.m */
+/* copies of pictures/PCM blocks allowed to wait for a hashing worker */
+#define VALIDATE_MAX_IN_FLIGHT 16
+/* PCM the AudioQueue callback can stage for hashing; preallocated, blocks that do not fit are dropped */
+#define VALIDATE_AUDIO_RING_BYTES (1024 * 1024)
+
+/* LAVP: decode-side degradation under load; see video_update_degradation() */
+#define VIDEO_DEGRADATION_MAX 4
+/* average lateness of decoded packets above which the level is raised */
+#define VIDEO_DEGRADATION_LATE 0.04
+/* average lateness below which the level is lowered again (frames are well ahead) */
+#define VIDEO_DEGRADATION_EARLY -0.10
+/* usec to wait between level changes */
+#define VIDEO_DEGRADATION_HOLD 500000
+
+/* LAVP: low latency mode for live sources; see check_live_latency() */
+#define LOW_LATENCY_PROBESIZE "32768"
+#define LOW_LATENCY_ANALYZEDURATION "100000" /* in microseconds */
+/* default for StreamOptions.target_latency, in seconds */
+#define LOW_LATENCY_TARGET 0.2
+/* decoded pictures queue_picture() lets wait for presentation */
+#define LOW_LATENCY_PICTURE_QUEUE_DEPTH 2
+/* fastest external clock speed used to catch up */
+#define LOW_LATENCY_SPEED_MAX 1.050
+/* latency above the target by more than this is skipped instead of played faster */
+#define LOW_LATENCY_JUMP 0.5
 
 /* =========================================================== */
 
@@ -140,6 +249,37 @@ typedef struct MyAVPacketList {
     volatile int serial;
 } MyAVPacketList;
 
+typedef struct AltTrack {
+    MyAVPacketList *first, *last;
+    int nb_packets;
+    int64_t bytes;
+} AltTrack;
+
+typedef struct TimeshiftEntry {
+    int64_t offset;         /* of the record in the ring file */
+    int64_t time;           /* AV_TIME_BASE; dts, or pts when there is none */
+    int size;               /* whole record */
+    int stream_index;
+    int flags;              /* AVPacket flags */
+} TimeshiftEntry;
+
+typedef struct PacketSlab {
+    struct PacketArena *arena;
+    struct PacketSlab *next;        /* in the arena's free list */
+    volatile int32_t refs;          /* packets using data, +1 while it is the current slab */
+    int used;
+    DECLARE_ALIGNED(16, uint8_t, data)[PACKET_SLAB_SIZE];
+} PacketSlab;
+
+typedef struct PacketArena {
+    LAVPmutex *mutex;
+    PacketSlab *current;            /* payloads are appended here */
+    PacketSlab *free;
+    int nb_free;
+    int nb_slabs;                   /* current, free and still referenced */
+    int closed;                     /* queue destroyed; the last slab frees the arena */
+} PacketArena;
+
 typedef struct PacketQueue {
 	MyAVPacketList *first_pkt, *last_pkt;
 	volatile int nb_packets;
@@ -150,6 +290,9 @@ typedef struct PacketQueue {
 	LAVPcond *cond;
 	
 	AVPacket flush_pkt; /* LAVP: assign queue specific flush packet */
+    MyAVPacketList *free_nodes; /* LAVP: recycled list nodes */
+    int nb_free_nodes;
+    PacketArena *arena;         /* LAVP: payload slabs */
 } PacketQueue;
 
 /* =========================================================== */
@@ -163,16 +306,113 @@ typedef struct VideoPicture {
 	volatile int allocated;
     volatile int reallocate;
     volatile int serial;
+    int bytes;              // LAVP: size of bmp, for memory accounting
     
     AVRational sar;
 } VideoPicture;
 
+/* LAVP: pixel formats a VideoConsumer can ask for (CoreVideo FourCC) */
+#define VIDEO_CONSUMER_2VUY 0x32767579 /* '2vuy' */
+#define VIDEO_CONSUMER_BGRA 0x42475241 /* 'BGRA' */
+
+typedef struct VideoConsumer {
+    uint32_t pixel_format;
+    volatile int output_width, output_height;  // requested presentation box; 0 = native size
+    int width, height;                       // size of the last copy
+    volatile double lastPTScopied;
+    volatile double next_pts;                // earliest queued pts after lastPTScopied; -INFINITY if unknown
+    LAVPseqlock seq;                         // guards lastPTScopied/next_pts for lock-free readers
+    struct SwsContext *sws;
+    int sws_src_w, sws_src_h, sws_dst_w, sws_dst_h;  // geometry sws was last set up for
+    int sws_matrix;                          // matrix * 2 + full range applied to sws; 0 = none yet
+    struct VideoConsumer *next;
+} VideoConsumer;
+
+typedef struct ReverseFrame {
+    double pts;
+    AVFrame *frame;         /* YUV420P copy owned by the reverse cache */
+    int64_t bytes;
+} ReverseFrame;
+
+typedef struct ChapterFrame {
+    int chapter;            /* -1 if unused; set with frame NULL when prefetch failed */
+    double pts;
+    AVFrame *frame;         /* YUV420P copy owned by the chapter cache */
+} ChapterFrame;
+
+typedef struct ScrubFrame {
+    int64_t key;            /* keyframe dts in stream time_base; AV_NOPTS_VALUE if unused */
+    double pts;
+    AVFrame *frame;         /* downscaled YUV420P copy owned by the scrub cache */
+    int64_t used;           /* scrub_clock at the last hit */
+} ScrubFrame;
+
+typedef struct MemoryUsage {   /* LAVP: resident bytes by category; see stream_memory_usage() */
+    int64_t packets;        /* demuxed packets in the queues, A-B loop and alternate track caches */
+    int64_t frames;         /* decoded pictures: pictq, reverse and chapter caches, visualization canvas */
+    int64_t output;         /* pixel buffers handed to consumers; filled in by LAVPDecoder */
+    int64_t audio;          /* AudioQueue buffers, PCM conversion buffers and visualization samples */
+} MemoryUsage;
+
+typedef struct SoakReport {     /* LAVP: see soak_report() */
+    double duration;            /* wall seconds since the stream was opened */
+    int64_t frames;             /* pictures presented by video_refresh() */
+    int64_t drops_early;        /* dropped before queue_picture() */
+    int64_t drops_late;         /* dropped in video_refresh() */
+    int64_t repeats;            /* pictures held longer than their duration to wait for the master */
+    double jitter_p50, jitter_p90, jitter_p99, jitter_p999, jitter_max;    /* |actual - scheduled| in seconds */
+    double offset_mean, offset_max;     /* A-V (or master-V) in seconds; max is absolute */
+    double drift;               /* seconds per hour the mean offset moves; NAN before two intervals */
+    int intervals;              /* complete SOAK_DRIFT_INTERVAL averages */
+    int64_t stalls;             /* injected read stalls */
+    int64_t audio_periods;      /* periods the virtual audio device consumed */
+} SoakReport;
+
+typedef struct ValidateEntry {
+    char kind;              /* 'V' picture, 'A' PCM block */
+    int seq;                /* submission order per kind */
+    int serial;
+    double pts;
+    int width, height;      /* pictures */
+    int size;               /* PCM bytes */
+    uint32_t crc[4];        /* Y, U, V, 2vuy; PCM uses crc[0] */
+} ValidateEntry;
+
+typedef struct ValidateAudioBlock { /* LAVP: PCM staged in validate_audio_ring */
+    struct VideoState *is;
+    int64_t offset;         /* into the ring, in bytes staged so far */
+    ValidateEntry entry;
+} ValidateAudioBlock;
+
 typedef struct SubPicture {
 	volatile double pts; /* presentation time stamp for this picture */
 	AVSubtitle sub;
     volatile int serial;
+    char *text;             /* LAVP: plain UTF-8 of a text/ASS cue, lines separated by '\n'; NULL for bitmaps */
+    uint32_t text_hash;     /* LAVP: identifies the cue for the layout cache */
 } SubPicture;
 
+typedef struct TextGlyph {  /* LAVP: rasterized glyph in the atlas */
+    uint32_t font;          /* hash of the PostScript name; 0 if the slot is unused */
+    uint16_t glyph, px;
+    int16_t left, top;      /* bitmap origin relative to the pen, top-down */
+    uint16_t w, h, ax, ay;  /* size and position in the atlas */
+} TextGlyph;
+
+typedef struct TextQuad {   /* LAVP: one glyph of a laid out cue */
+    int16_t x, y;           /* top-left in the output frame */
+    uint16_t w, h, ax, ay;
+} TextQuad;
+
+typedef struct TextLayout { /* LAVP: cue placed for one output size */
+    uint32_t hash;          /* SubPicture.text_hash; 0 if unused */
+    int width, height;
+    int atlas_gen;          /* atlas the quads point into */
+    int64_t used;
+    TextQuad *quads;
+    int count, capacity;
+} TextLayout;
+
 typedef struct AudioParams {
     volatile int freq;
     volatile int channels;
@@ -182,6 +422,36 @@ typedef struct AudioParams {
     volatile int bytes_per_sec;
 } AudioParams;
 
+#define SWR_CACHE_SIZE 4
+
+typedef struct SwrCacheEntry {
+    int64_t src_channel_layout;
+    enum AVSampleFormat src_fmt;
+    int src_freq;
+    int64_t tgt_channel_layout;
+    enum AVSampleFormat tgt_fmt;
+    int tgt_freq;
+    struct SwrContext *swr_ctx;
+} SwrCacheEntry;
+
+typedef struct PoolCodecKey {   /* LAVP: decoder configuration; memcmp'ed, so zero-filled first */
+    enum AVCodecID codec_id;
+    enum AVMediaType codec_type;
+    int width, height, pix_fmt;
+    int sample_rate, channels, sample_fmt;
+    uint64_t channel_layout;
+    int lowres, flags, flags2, low_latency;
+    int extradata_size;
+    uint32_t extradata_hash;
+} PoolCodecKey;
+
+typedef struct PoolBinding {    /* LAVP: decoder opened for a stream; see pool_take_codec() */
+    AVCodecContext *avctx;      /* NULL if none */
+    AVCodecContext *orig;       /* the stream's own context while a parked one replaces it */
+    int stream_index;
+    PoolCodecKey key;
+} PoolBinding;
+
 typedef struct Clock {
     volatile double pts;           /* clock base */
     volatile double pts_drift;     /* clock base minus time at which we updated the clock */
@@ -190,8 +460,50 @@ typedef struct Clock {
     volatile int serial;           /* clock is based on a packet with this serial */
     volatile int paused;
     volatile int *queue_serial;    /* pointer to the current packet queue serial, used for obsolete clock detection */
+    LAVPseqlock seq;               /* LAVP: writers bump this; readers use clock_snapshot() */
 } Clock;
 
+typedef struct ClockSnapshot {    /* LAVP: consistent copy of Clock fields */
+    double pts;
+    double pts_drift;
+    double last_updated;
+    double speed;
+    int serial;
+    int paused;
+} ClockSnapshot;
+
+/* LAVP: offline processing callbacks; is->decoder is the LAVPDecoder */
+struct VideoState;
+typedef void (*OfflineVideoCallback)(struct VideoState *is, AVFrame *frame, double pts, int serial);   /* YUV420P */
+typedef void (*OfflineAudioCallback)(struct VideoState *is, const uint8_t *buf, int size, const struct AudioParams *params, double pts, int serial);
+typedef void (*OfflineEndCallback)(struct VideoState *is, int error);
+
+typedef struct StreamOptions {    /* LAVP: settings which must be known before the streams are opened */
+    int output_width, output_height;    /* expected presentation size; 0 = native. Enables lowres */
+    int low_latency;                    /* live source: minimal probing and buffering, catch up to target_latency */
+    double target_latency;              /* in seconds; 0 = LOW_LATENCY_TARGET */
+    int64_t timeshift_bytes;            /* size of the on-disk timeshift ring; 0 = off */
+    int color_matrix;                   /* YUV->BGRA matrix: 601, 709 or 2020; 0 = from the stream */
+    int color_range;                    /* AVCOL_RANGE_MPEG or AVCOL_RANGE_JPEG; 0 = from the stream */
+    int64_t open_deadline;              /* av_gettime() at which opening and probing give up; 0 = none */
+    int64_t memory_budget;              /* bytes of decoded pictures in pictq; 0 = no limit */
+    int no_chapter_prefetch;            /* do not decode the pictures at the neighbouring chapter starts ahead */
+    int no_low_power_audio;             /* keep the visualization and the refresh timer for sources without video */
+    int no_subtitle_cache;              /* lay out and rasterize text subtitles on every frame */
+    int context_pool;                   /* park decoders, scalers, resamplers and the AudioQueue on close */
+    int soak;                           /* record presentation timing; audio plays into a virtual device */
+    const char *soak_path;              /* per-picture timing log; NULL = none */
+    int soak_cpu_threads;               /* workers competing for the CPU */
+    int soak_cpu_duty;                  /* percent of SOAK_CPU_PERIOD each worker spins; 0 = 100 */
+    int soak_stall_ms;                  /* read_thread sleeps this long ... */
+    int soak_stall_interval_ms;         /* ... once per interval; 0 = no stalls */
+    const char *validate_path;          /* manifest of per-frame hashes written on close; NULL = off */
+    int offline;                        /* no real-time pacing; everything decoded goes to the callbacks below */
+    OfflineVideoCallback offline_video;
+    OfflineAudioCallback offline_audio;
+    OfflineEndCallback offline_finished;
+} StreamOptions;
+
 /* =========================================================== */
 
 typedef struct VideoState {
@@ -227,13 +539,22 @@ typedef struct VideoState {
 	volatile int paused;
 	volatile int last_paused;
     volatile int queue_attachments_req;
-    volatile int seek_req;
+    volatile int32_t seek_req_gen;  /* LAVP: bumped by stream_seek() for each request */
+    volatile int32_t seek_done_gen; /* LAVP: last request generation handled by read_thread */
     volatile int seek_flags;
 	volatile int64_t seek_pos;
 	volatile int64_t seek_rel;
+    LAVPseqlock seek_seq;           /* LAVP: guards seek_flags/seek_pos/seek_rel */
 	volatile int read_pause_return;
 	AVFormatContext *ic;
+    volatile int64_t open_deadline; /* LAVP: StreamOptions.open_deadline; cleared once probing is done */
     volatile int realtime;
+    int low_latency;                /* LAVP: StreamOptions.low_latency */
+    double target_latency;          /* LAVP: seconds the presentation may trail the newest packet */
+    volatile double live_pts;       /* LAVP: newest audio/video packet pts read, in seconds */
+    volatile double live_time;      /* LAVP: wall clock when it was read; 0 = none yet */
+    LAVPseqlock live_seq;           /* LAVP: guards live_pts/live_time */
+    volatile int latency_catchups;  /* LAVP: times check_live_latency() skipped ahead */
     volatile int audio_finished; /* AVPacket serial */
     volatile int video_finished; /* AVPacket serial */
     //
@@ -308,13 +629,17 @@ typedef struct VideoState {
 #if 0
 #endif
     struct AudioParams audio_tgt;
-    struct SwrContext *swr_ctx;
+    struct SwrContext *swr_ctx;              /* LAVP: borrowed from swr_cache; NULL on direct conversion */
+    SwrCacheEntry swr_cache[SWR_CACHE_SIZE];
+    int swr_cache_next;
+    float *audio_conv_buf;                   /* LAVP: scratch for float to s16 conversion */
+    unsigned int audio_conv_buf_size;
     //
     AVFrame *frame;
     int64_t audio_frame_next_pts;
 
     /* video audio display support */
-    int16_t sample_array[SAMPLE_ARRAY_SIZE];
+    int16_t *sample_array;                   /* LAVP: SAMPLE_ARRAY_SIZE samples, allocated by vis_start() */
     int sample_array_index;
     int last_i_start;
     RDFTContext *rdft;
@@ -327,17 +652,50 @@ typedef struct VideoState {
 	AudioQueueRef outAQ;
 	AudioStreamBasicDescription asbd;
 	void* audioDispatchQueue; // dispatch_queue_t
+    UInt32 audio_queue_buffer_size;          /* bytes per AudioQueue buffer */
+    AudioQueueBufferRef audio_queue_buffers[AUDIO_QUEUE_BUFFERS];
+    void* audio_owner; // VideoState * volatile *, read by the AudioQueue callback; NULL while parked
+    int low_power_audio;                     /* StreamOptions.no_low_power_audio inverted */
+    volatile int audio_only;                 /* no video; no refresh timer, deep AudioQueue buffers */
+    volatile int64_t wakeups;                /* refresh ticks, audio callbacks and read_thread sleeps */
     
     /* =========================================================== */
     
 	// LAVPsubs
 
     /* same order as original struct */
-    SubPicture subpq[SUBPICTURE_QUEUE_SIZE];
+    SubPicture *subpq;                       /* LAVP: SUBPICTURE_QUEUE_SIZE entries, allocated with the subtitle stream */
 	volatile int subpq_size, subpq_rindex, subpq_windex;
 	LAVPmutex *subpq_mutex;
 	LAVPcond *subpq_cond;
     
+    /* =========================================================== */
+    
+	// LAVPpool
+    
+    int context_pool;                        /* StreamOptions.context_pool */
+    PoolBinding pool_bindings[AVMEDIA_TYPE_NB];
+    
+    /* =========================================================== */
+    
+	// LAVPtext
+    
+    LAVPmutex *text_mutex;                   /* guards the atlas, layouts and stats below */
+    int text_cache;                          /* keep glyphs and layouts between frames */
+    uint8_t *text_atlas;                     /* A8, TEXT_ATLAS_SIZE square */
+    void* text_atlas_ctx; // CGContextRef over text_atlas
+    int text_atlas_x, text_atlas_y, text_atlas_row;   /* shelf packing cursor */
+    int text_atlas_gen;                      /* bumped when the atlas is cleared */
+    TextGlyph *text_glyphs;                  /* TEXT_GLYPH_SLOTS entries */
+    int text_glyph_count;
+    TextLayout text_layouts[TEXT_LAYOUT_CACHE];
+    int64_t text_clock;
+    void* text_font; // CTFontRef at text_font_px
+    int text_font_px;
+    int64_t text_frames;                     /* frames a cue was composited into */
+    int64_t text_usec;                       /* time spent in text_composite() */
+    int64_t text_layouts_built;
+    
     /* =========================================================== */
 
 	// LAVPvideo
@@ -345,6 +703,11 @@ typedef struct VideoState {
     /* same order as original struct */
     int frame_drops_early;
     int frame_drops_late;
+    //
+    volatile int degradation_level;          // LAVP: 0..VIDEO_DEGRADATION_MAX applied to the decoder
+    double degradation_lateness;             // LAVP: moving average of master clock minus packet time
+    int64_t degradation_hold_until;          // LAVP: av_gettime() before which the level may not change
+    int degradation_drops_late;              // LAVP: frame_drops_late at the last evaluation
     //
 	volatile double frame_timer;
     volatile double frame_last_returned_time;
@@ -354,14 +717,233 @@ typedef struct VideoState {
     volatile double max_frame_duration;      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
 	VideoPicture pictq[VIDEO_PICTURE_QUEUE_SIZE];
 	volatile int pictq_size, pictq_rindex, pictq_windex;
+    int pictq_depth;                         // LAVP: pictures queue_picture() lets wait in pictq
+    volatile int pictq_depth_used;           // LAVP: pictq_depth reduced to the memory budget
+    volatile int64_t memory_budget;          // LAVP: bytes of decoded pictures in pictq; 0 = no limit
 	LAVPmutex *pictq_mutex;
 	LAVPcond *pictq_cond;
     struct SwsContext *img_convert_ctx;
     
     /* LAVP: extension */
-	volatile double lastPTScopied;
-	struct SwsContext *sws420to422;
+	volatile double lastPTScopied;           // most recent pts copied by any consumer
+    VideoConsumer *consumers;                // guarded by pictq_mutex
+    int output_width, output_height;         // presentation size hint from StreamOptions; selects lowres
+    int color_matrix, color_range;           // BGRA conversion overrides from StreamOptions; 0 = from the stream
 	
+    /* =========================================================== */
+    
+	// LAVPreverse
+    
+    volatile int reverse;                    /* frames are presented from the reverse cache */
+    volatile int reverse_at_start;           /* cache holds the first frame of the stream */
+    AVFormatContext *rev_ic;                 /* private demuxer; read_thread keeps using ic */
+    AVCodecContext *rev_avctx;
+    struct SwsContext *rev_convert_ctx;
+    ReverseFrame *rev_frames;                /* ascending pts order */
+    int rev_nb_frames;
+    int64_t rev_cache_bytes;
+    LAVPmutex *rev_mutex;
+    LAVPcond *rev_cond;
+	void* reverse_queue; // dispatch_queue_t
+	void* reverse_group; // dispatch_group_t
+    
+    /* =========================================================== */
+    
+	// LAVPchapter
+    
+    int64_t *chap_starts;                    /* ascending, AV_TIME_BASE */
+    int *chap_order;                         /* ic->chapters index of each entry of chap_starts */
+    int chap_nb;
+    volatile int chap_prefetch;              /* decode the first pictures of the neighbouring chapters */
+    volatile int chap_abort;
+    int chap_want[CHAPTER_PREFETCH_SLOTS];   /* chapters chapter_thread should have ready; -1 for none */
+    ChapterFrame chap_cache[CHAPTER_PREFETCH_SLOTS];
+    AVFormatContext *chap_ic;                /* private demuxer; read_thread keeps using ic */
+    AVCodecContext *chap_avctx;
+    struct SwsContext *chap_convert_ctx;
+    AVFrame *chap_frame;                     /* picture presented after a jump until pictq catches up */
+    double chap_frame_pts;
+    volatile int chap_showing;
+    int chap_serial_min;                     /* first videoq serial of the jump */
+    volatile int chap_jump_prefetched;
+    volatile int64_t chap_jump_start;        /* av_gettime() of the pending jump; 0 if none */
+    volatile int64_t chap_jump_latency;      /* usec from the last jump to its first presented picture */
+    LAVPmutex *chap_mutex;                   /* guards chap_want, chap_cache and chap_frame */
+    LAVPcond *chap_cond;
+	void* chapter_queue; // dispatch_queue_t
+	void* chapter_group; // dispatch_group_t
+    
+    /* =========================================================== */
+    
+	// LAVPscrub
+    
+    volatile int scrubbing;                  /* keyframes from scrub_cache are presented */
+    volatile int scrub_refining;             /* released; waiting for the exact seek */
+    volatile int64_t scrub_target;           /* AV_TIME_BASE */
+    volatile int32_t scrub_req_gen;          /* bumped by each request */
+    volatile int32_t scrub_work_gen;         /* request the worker is on */
+    volatile int scrub_abort;
+    volatile int scrub_failed;               /* the private demuxer or decoder could not be opened */
+    AVFormatContext *scrub_ic;               /* private demuxer; read_thread keeps using ic */
+    AVCodecContext *scrub_avctx;             /* keyframes only */
+    struct SwsContext *scrub_convert_ctx;
+    ScrubFrame scrub_cache[SCRUB_CACHE_FRAMES];
+    int64_t scrub_clock;
+    volatile int scrub_shown;                /* scrub_cache index on screen; -1 for none */
+    int scrub_serial_min;                    /* first videoq serial of the exact seek */
+    double scrub_exact_pts;                  /* pictq takes over at or after this pts */
+    int64_t scrub_begin_time;                /* av_gettime() of the first request */
+    int scrub_presented;                     /* keyframes copied while dragging */
+    double scrub_fps;                        /* of the last drag */
+    volatile int64_t scrub_refine_start;     /* av_gettime() of the release; 0 if none */
+    volatile int64_t scrub_refine_latency;   /* usec from the release to the exact picture */
+    LAVPmutex *scrub_mutex;                  /* guards scrub_cache and scrub_shown */
+    LAVPcond *scrub_cond;
+	void* scrub_queue; // dispatch_queue_t
+	void* scrub_group; // dispatch_group_t
+    
+    /* =========================================================== */
+    
+	// LAVPloop
+    
+    LAVPseqlock loop_seq;                    /* guards loop_a/loop_b/loop_active and the request */
+    volatile int loop_active;
+    volatile int64_t loop_a, loop_b;         /* AV_TIME_BASE, same base as the master clock */
+    int64_t loop_req_a, loop_req_b;          /* written by loop_set()/loop_clear() */
+    volatile int32_t loop_req_gen;
+    int32_t loop_done_gen;
+    int32_t loop_seek_gen;                   /* stream_seek() which starts the first pass */
+    int loop_state;
+    int loop_overflow;                       /* region exceeds LOOP_CACHE_MAX_BYTES */
+    int64_t loop_offset;                     /* added to packet timestamps; grows by B - A per pass */
+    int loop_passed;                         /* streams which reached B in this pass */
+    int loop_count;
+    int loop_seam_pending;
+    int64_t loop_last_end;
+    AVPacket *loop_pkts;                     /* demux order */
+    int loop_nb_pkts;
+    unsigned int loop_pkts_size;
+    int loop_replay_index;
+    volatile int64_t loop_cache_bytes;
+    
+    /* =========================================================== */
+    
+	// LAVPtracks
+    
+    volatile int alt_tracks;                 /* buffer unselected audio/subtitle tracks */
+    AltTrack *alt_track;                     /* nb_streams entries */
+    LAVPmutex *alt_mutex;                    /* guards alt_track and track switching against read_thread */
+    volatile int32_t track_switching;        /* track_lock() callers; read_thread then routes under alt_mutex */
+    volatile int track_routing;              /* read_thread is routing a packet without alt_mutex */
+    AVStream *volatile audio_switch_st;      /* decoder swap pending on the next audio flush packet */
+    int64_t track_switch_time;
+    int track_switch_serial;
+    volatile int64_t track_switch_latency;   /* usec from request to first decoded frame */
+    
+    /* =========================================================== */
+    
+	// LAVPtimeshift
+    
+    int timeshift;                           /* read_thread feeds the queues from the ring */
+    int ts_fd;
+    uint8_t *ts_map;
+    int64_t ts_capacity;
+    int64_t ts_write;                        /* offset of the next record */
+    TimeshiftEntry *ts_index;                /* oldest first, starting at ts_first */
+    unsigned int ts_index_size;
+    int ts_first, ts_count;
+    int64_t ts_base;                         /* sequence number of ts_index[ts_first] */
+    int64_t ts_cursor;                       /* sequence number of the next record to queue */
+    LAVPseqlock ts_seq;                      /* guards ts_start/ts_end */
+    volatile int64_t ts_start, ts_end;       /* window in AV_TIME_BASE, same base as the master clock */
+    volatile int64_t ts_ingest_usec;         /* spent writing records */
+    volatile int64_t ts_ingest_count;
+    volatile int64_t ts_seek_usec;           /* last reposition inside the window */
+    
+    /* =========================================================== */
+    
+	// LAVPvalidate
+    
+    int validate;                            /* hash presented pictures and PCM blocks */
+    FILE *validate_file;
+    void* validate_queue; // dispatch_queue_t, concurrent workers
+    void* validate_group; // dispatch_group_t
+    void* validate_sema;  // dispatch_semaphore_t, bounds copies in flight
+    void* validate_audio_queue; // dispatch_queue_t, serial; hashes the PCM ring in order
+    void* validate_audio_sema;  // dispatch_semaphore_t, free validate_audio_blocks
+    uint8_t *validate_audio_ring;            /* VALIDATE_AUDIO_RING_BYTES */
+    ValidateAudioBlock validate_audio_blocks[VALIDATE_MAX_IN_FLIGHT];
+    int validate_audio_slot;                 /* next block; AudioQueue callback only */
+    int64_t validate_audio_head;             /* bytes staged; AudioQueue callback only */
+    volatile int64_t validate_audio_tail;    /* bytes hashed; audio worker only */
+    volatile int32_t validate_audio_dropped; /* blocks not hashed because the ring was full */
+    LAVPmutex *validate_mutex;               /* guards validate_entries */
+    ValidateEntry *validate_entries;
+    int validate_nb_entries, validate_max_entries;
+    int validate_video_seq, validate_audio_seq;
+    volatile int64_t validate_hot_usec;      /* spent on the playback threads copying and queueing */
+    volatile int64_t validate_work_usec;     /* spent on the workers hashing */
+    volatile int64_t validate_bytes;
+    
+    /* =========================================================== */
+    
+	// LAVPoffline
+    
+    int offline;                             /* decoders feed the callbacks as fast as they can */
+    int offline_ended;                       /* offline_finished has been called */
+    OfflineVideoCallback offline_video;
+    OfflineAudioCallback offline_audio;
+    OfflineEndCallback offline_finished;
+    AVFrame *offline_frame;                  /* YUV420P conversion of other formats */
+    void* offline_audio_queue; // dispatch_queue_t, replaces the AudioQueue
+    void* offline_audio_group; // dispatch_group_t
+    int64_t offline_start;                   /* av_gettime() at open */
+    volatile int offline_frames, offline_blocks;
+    double offline_first_pts, offline_last_pts;
+    
+    /* =========================================================== */
+    
+	// LAVPsoak
+    
+    int soak;                                /* record presentation timing */
+    FILE *soak_file;
+    LAVPmutex *soak_mutex;                   /* guards the statistics below against soak_report() */
+    int64_t soak_start;                      /* av_gettime() at open */
+    int64_t soak_frames, soak_repeats;
+    int64_t *soak_jitter;                    /* SOAK_JITTER_BINS + 1 counts */
+    double soak_jitter_max;
+    double soak_offset_sum, soak_offset_max;
+    int64_t soak_offset_count;
+    double soak_interval_sum;                /* current drift interval */
+    int64_t soak_interval_count, soak_interval_start;
+    double *soak_drift;                      /* hours since open, mean offset; per complete interval */
+    int soak_nb_drift, soak_max_drift;
+    int soak_cpu_threads, soak_cpu_duty;
+    volatile int soak_cpu_stop;
+    void* soak_cpu_queue; // dispatch_queue_t, concurrent
+    void* soak_cpu_group; // dispatch_group_t
+    int64_t soak_stall_usec, soak_stall_interval, soak_next_stall;
+    volatile int64_t soak_stalls;
+    void* soak_audio_queue; // dispatch_queue_t
+    void* soak_audio_timer; // dispatch_source_t
+    uint8_t *soak_audio_buf;                 /* one period, discarded after rendering */
+    int soak_audio_frames;                   /* sample frames per period */
+    int64_t soak_audio_anchor;               /* av_gettime() of period 0; 0 = anchor on the next tick */
+    int64_t soak_audio_due;                  /* periods consumed since the anchor */
+    volatile int64_t soak_audio_periods;
+    
+    /* =========================================================== */
+    
+	// LAVPvis
+    
+    volatile int vis_active;                 /* AudioQueue callback feeds sample_array */
+    AVFrame *vis_frame;                      /* YUV420P canvas; keeps the spectrogram between ticks */
+    float *vis_window;                       /* RDFT window, 2 * nb_freq taps */
+    float *vis_buf;
+    unsigned int vis_buf_size;
+	void* vis_queue; // dispatch_queue_t
+	void* vis_timer; // dispatch_source_t
+    
     /* =========================================================== */
     
 } VideoState;
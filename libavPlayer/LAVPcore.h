@@ -29,27 +29,41 @@
 
 #include "LAVPcommon.h"
 
+double clock_snapshot(Clock *c, ClockSnapshot *snap);
 double get_clock(Clock *c);
 void set_clock_at(Clock *c, double pts, int serial, double time);
 void set_clock(Clock *c, double pts, int serial);
 void set_clock_speed(Clock *c, double speed);
+void set_clock_paused(Clock *c, int paused);
 void init_clock(Clock *c, volatile int *queue_serial);
 void sync_clock_to_slave(Clock *c, Clock *slave);
 int get_master_sync_type(VideoState *is);
 double get_master_clock(VideoState *is);
 void check_external_clock_speed(VideoState *is);
+void live_packet_arrived(VideoState *is, AVPacket *pkt);
+double stream_latency(VideoState *is);
+void check_live_latency(VideoState *is);
 
-void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes);
+void stream_queue_packet(VideoState *is, AVPacket *pkt, int in_play_range);
+int stream_component_open(VideoState *is, int stream_index);
+void stream_component_close(VideoState *is, int stream_index);
+
+int32_t stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes);
+int stream_seek_pending(VideoState *is);
 void stream_toggle_pause(VideoState *is);
 void toggle_pause(VideoState *is);
+void stream_step_to_next_frame(VideoState *is);
+void stream_step_to_prev_frame(VideoState *is);
 
 void stream_pause(VideoState *is);
 
 void stream_close(VideoState *is);
-VideoState* stream_open(id opaque, NSURL *sourceURL);
+VideoState* stream_open(id opaque, NSURL *sourceURL, const StreamOptions *options);
 double_t stream_playRate(VideoState *is);
 void stream_setPlayRate(VideoState *is, double_t newRate);
 
+void stream_lock_stats(int64_t *obtained, int64_t *contended, int64_t *wait_usec);
+void stream_memory_usage(VideoState *is, MemoryUsage *usage);
 int stream_getChapterCount(VideoState *is);
 int stream_getChapterCurrent(VideoState *is);
 void stream_seek_chapter(VideoState *is, int incr);
@@ -29,11 +29,21 @@
 #include "LAVPqueue.h"
 #include "LAVPsubs.h"
 #include "LAVPaudio.h"
+#include "LAVPreverse.h"
+#include "LAVPvis.h"
+#include "LAVPloop.h"
+#include "LAVPtracks.h"
+#include "LAVPtimeshift.h"
+#include "LAVPvalidate.h"
+#include "LAVPoffline.h"
+#include "LAVPchapter.h"
+#include "LAVPscrub.h"
+#include "LAVPtext.h"
+#include "LAVPpool.h"
+#include "LAVPsoak.h"
 
 /* =========================================================== */
 
-int stream_component_open(VideoState *is, int stream_index);
-void stream_component_close(VideoState *is, int stream_index);
 int is_realtime(AVFormatContext *s);
 int read_thread(void *arg);
 void step_to_next_frame(VideoState *is);
@@ -174,8 +184,18 @@ int stream_component_open(VideoState *is, int stream_index)
 		return -1;
     }
     
+    // LAVP: the subtitle queue only exists for files which show subtitles
+    if (avctx->codec_type == AVMEDIA_TYPE_SUBTITLE && !is->subpq) {
+        is->subpq = av_mallocz(sizeof(SubPicture) * SUBPICTURE_QUEUE_SIZE);
+        if (!is->subpq)
+            return AVERROR(ENOMEM);
+    }
+    
     avctx->codec_id = codec->id;
 	avctx->workaround_bugs = is->workaround_bugs;
+    // LAVP: decode at reduced size when the presentation is known to be small
+    if (!stream_lowres && avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        stream_lowres = video_lowres_for_output(is, ic->streams[stream_index], codec);
     if(stream_lowres > av_codec_get_max_lowres(codec)){
         av_log(avctx, AV_LOG_WARNING, "The maximum value for lowres supported by the decoder is %d\n",
                av_codec_get_max_lowres(codec));
@@ -186,6 +206,10 @@ int stream_component_open(VideoState *is, int stream_index)
 	
     if(stream_lowres) avctx->flags |= CODEC_FLAG_EMU_EDGE;
     if (is->fast)   avctx->flags2 |= CODEC_FLAG2_FAST;
+    if (is->low_latency) {
+        avctx->flags |= CODEC_FLAG_LOW_DELAY;
+        avctx->flags2 |= CODEC_FLAG2_FAST;
+    }
     if(codec->capabilities & CODEC_CAP_DR1)
         avctx->flags |= CODEC_FLAG_EMU_EDGE;
     
@@ -194,11 +218,18 @@ int stream_component_open(VideoState *is, int stream_index)
     opts = filter_codec_opts(codec_opts, avctx->codec_id, ic, ic->streams[stream_index], codec);
     if (!av_dict_get(opts, "threads", NULL, 0))
         av_dict_set(&opts, "threads", "auto", 0);
+    // LAVP: frame threading holds back one frame per thread
+    if (is->low_latency && !av_dict_get(opts, "thread_type", NULL, 0))
+        av_dict_set(&opts, "thread_type", "slice", 0);
     if (stream_lowres)
         av_dict_set(&opts, "lowres", av_asprintf("%d", stream_lowres), AV_DICT_DONT_STRDUP_VAL);
     if (avctx->codec_type == AVMEDIA_TYPE_VIDEO || avctx->codec_type == AVMEDIA_TYPE_AUDIO)
         av_dict_set(&opts, "refcounted_frames", "1", 0);
-    if (avcodec_open2(avctx, codec, &opts) < 0)
+    // LAVP: a parked decoder of the same configuration takes the place of st->codec
+    if (is->context_pool && pool_take_codec(is, stream_index, stream_lowres) == 0) {
+        av_dict_free(&opts);
+        avctx = ic->streams[stream_index]->codec;
+    } else if (avcodec_open2(avctx, codec, &opts) < 0)
         return -1;
     if ((t = av_dict_get(opts, "", NULL, AV_DICT_IGNORE_SUFFIX))) {
         av_log(NULL, AV_LOG_ERROR, "Option %s not found.\n", t->key);
@@ -238,7 +269,16 @@ int stream_component_open(VideoState *is, int stream_index)
             memset(&is->audio_pkt_temp, 0, sizeof(is->audio_pkt_temp));
             is->audio_pkt_temp.stream_index = -1;
 			
-            // LAVP: start AudioQueue
+            // LAVP: start AudioQueue; offline processing pulls the samples itself
+            if (is->offline) {
+                offline_audio_start(is);
+                break;
+            }
+            // LAVP: soak testing plays into a virtual device with an exact clock
+            if (is->soak) {
+                soak_audio_start(is);
+                break;
+            }
             LAVPAudioQueueInit(is, avctx);
 			LAVPAudioQueueStart(is);
 			
@@ -298,24 +338,27 @@ void stream_component_close(VideoState *is, int stream_index)
 			packet_queue_abort(&is->audioq);
 			
             // LAVP: Stop Audio Queue
-			LAVPAudioQueueStop(is);
-			LAVPAudioQueueDealloc(is);
+            if (is->offline) {
+                offline_audio_stop(is);
+            } else if (is->soak) {
+                soak_audio_stop(is);
+            } else {
+                LAVPAudioQueueStop(is);
+                LAVPAudioQueueDealloc(is);
+            }
+            track_audio_close(is);
 			
             //
 			packet_queue_flush(&is->audioq);
 			av_free_packet(&is->audio_pkt);
-            swr_free(&is->swr_ctx);
+            audio_swr_cache_free(is);
             av_freep(&is->audio_buf1);
             is->audio_buf1_size = 0;
             is->audio_buf = NULL;
             av_frame_free(&is->frame);
             
-            if (is->rdft) {
-                av_rdft_end(is->rdft);
-                av_freep(&is->rdft_data);
-                is->rdft = NULL;
-                is->rdft_bits = 0;
-            }
+            // LAVP: stop visualization; also releases rdft
+            vis_stop(is);
 #if 0
             // LAVP:
 #endif
@@ -367,8 +410,13 @@ void stream_component_close(VideoState *is, int stream_index)
 	}
 	
 	ic->streams[stream_index]->discard = AVDISCARD_ALL;
-	avcodec_close(avctx);
-	switch(avctx->codec_type) {
+    // LAVP: park the decoder; st->codec is replaced and avctx may be taken by another player
+    enum AVMediaType codec_type = avctx->codec_type;
+    if (is->context_pool)
+        pool_put_codec(is, stream_index);
+    else
+        avcodec_close(avctx);
+	switch(codec_type) {
 		case AVMEDIA_TYPE_AUDIO:
 			is->audio_st = NULL;
 			is->audio_stream = -1;
@@ -391,6 +439,9 @@ void stream_component_close(VideoState *is, int stream_index)
 static int decode_interrupt_cb(void *ctx)
 {
     VideoState *is = ctx;
+    // LAVP: opening and probing give up at the deadline shared by a batch of opens
+    if (is->open_deadline && av_gettime() > is->open_deadline)
+        return 1;
     return is->abort_request;
 }
 
@@ -410,6 +461,38 @@ int is_realtime(AVFormatContext *s)
     return 0;
 }
 
+static void stream_route_packet(VideoState *is, AVPacket *pkt, int in_play_range)
+{
+    if (pkt->stream_index == is->audio_stream && in_play_range) {
+        packet_queue_put(&is->audioq, pkt);
+    } else if (pkt->stream_index == is->video_stream && in_play_range && !(is->video_st && is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
+        packet_queue_put(&is->videoq, pkt);
+    } else if (pkt->stream_index == is->subtitle_stream && in_play_range) {
+        packet_queue_put(&is->subtitleq, pkt);
+    } else if (!track_buffer_packet(is, pkt)) {
+        av_free_packet(pkt);
+    }
+}
+
+/* LAVP: hand a demuxed packet to its decoder queue, or to the alternate track buffers */
+void stream_queue_packet(VideoState *is, AVPacket *pkt, int in_play_range)
+{
+    // LAVP: alt_mutex only while buffering alternate tracks or while track_lock() is held;
+    // track_lock() waits for track_routing to clear before it changes the selection
+    is->track_routing = 1;
+    OSMemoryBarrier();
+    if (is->alt_tracks || is->track_switching) {
+        is->track_routing = 0;
+        LAVPLockMutex(is->alt_mutex);
+        stream_route_packet(is, pkt, in_play_range);
+        LAVPUnlockMutex(is->alt_mutex);
+    } else {
+        stream_route_packet(is, pkt, in_play_range);
+        OSMemoryBarrier();
+        is->track_routing = 0;
+    }
+}
+
 /* this thread gets the stream from the disk or the network */
 int read_thread(void *arg)
 {
@@ -433,6 +516,11 @@ int read_thread(void *arg)
         
         // LAVP: show_status is in stream_open()
         
+        // LAVP: nothing to present; decode in large batches and let the refresh timer stop
+        if (st_index[AVMEDIA_TYPE_VIDEO] < 0 && st_index[AVMEDIA_TYPE_AUDIO] >= 0 && is->low_power_audio &&
+            !is->realtime && !is->low_latency && !is->timeshift && !is->offline && is->show_mode == SHOW_MODE_NONE)
+            is->audio_only = 1;
+        
         /* open the streams */
         if (st_index[AVMEDIA_TYPE_AUDIO] >= 0)
             stream_component_open(is, st_index[AVMEDIA_TYPE_AUDIO]);
@@ -444,6 +532,10 @@ int read_thread(void *arg)
         if (is->show_mode == SHOW_MODE_NONE)
             is->show_mode = ret >= 0 ? SHOW_MODE_VIDEO : SHOW_MODE_RDFT;
         
+        // LAVP: audio only; render spectrum/waves into pictq
+        if (is->show_mode != SHOW_MODE_VIDEO && !is->offline && !is->audio_only)
+            vis_start(is);
+        
         if (st_index[AVMEDIA_TYPE_SUBTITLE] >= 0)
             stream_component_open(is, st_index[AVMEDIA_TYPE_SUBTITLE]);
         
@@ -454,7 +546,7 @@ int read_thread(void *arg)
             goto bail;
         }
         
-        if (is->infinite_buffer < 0 && is->realtime)
+        if (is->infinite_buffer < 0 && (is->realtime || is->low_latency) && !is->timeshift)
             is->infinite_buffer = 1;
         
         /* ================================================================================== */
@@ -473,7 +565,10 @@ int read_thread(void *arg)
                 // Pause
                 if (is->paused != is->last_paused) {
                     is->last_paused = is->paused;
-                    if (is->paused)
+                    // LAVP: timeshift keeps ingesting while paused
+                    if (is->timeshift)
+                        ;
+                    else if (is->paused)
                         is->read_pause_return = av_read_pause(is->ic);
                     else
                         av_read_play(is->ic);
@@ -492,16 +587,39 @@ int read_thread(void *arg)
                     }
 #endif
                 
+                // LAVP: A-B loop requests turn into seeks below
+                loop_update(is);
+                
+                // LAVP: keep the pictures at the neighbouring chapter starts decoded
+                chapter_update(is);
+                
                 // Seek
-                if (is->seek_req) {
-                    is->lastPTScopied = -1;
-                    int64_t seek_target= is->seek_pos;
-                    int64_t seek_min= is->seek_rel > 0 ? seek_target - is->seek_rel + 2: INT64_MIN;
-                    int64_t seek_max= is->seek_rel < 0 ? seek_target - is->seek_rel - 2: INT64_MAX;
+                int32_t seek_gen = is->seek_req_gen;
+                if (seek_gen != is->seek_done_gen) {
+                    LAVPLockMutex(is->pictq_mutex);
+                    pictq_publish(is, -1);
+                    LAVPUnlockMutex(is->pictq_mutex);
+                    
+                    /* LAVP: only the latest request matters; earlier ones are coalesced */
+                    int64_t seek_target, seek_rel;
+                    int seek_flags;
+                    int32_t seq;
+                    do {
+                        seq = LAVPSeqReadBegin(&is->seek_seq);
+                        seek_target = is->seek_pos;
+                        seek_rel = is->seek_rel;
+                        seek_flags = is->seek_flags;
+                    } while (LAVPSeqReadRetry(&is->seek_seq, seq));
+                    
+                    int64_t seek_min= seek_rel > 0 ? seek_target - seek_rel + 2: INT64_MIN;
+                    int64_t seek_max= seek_rel < 0 ? seek_target - seek_rel - 2: INT64_MAX;
                     //FIXME the +-2 is due to rounding being not done in the correct direction in generation
                     //      of the seek_pos/seek_rel variables
                     
-                    ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, is->seek_flags);
+                    if (is->timeshift)
+                        ret = timeshift_seek(is, seek_target);
+                    else
+                        ret = avformat_seek_file(is->ic, -1, seek_min, seek_target, seek_max, seek_flags);
                     if (ret < 0) {
                         av_log(NULL, AV_LOG_ERROR,
                                "%s: error while seeking\n", is->ic->filename);
@@ -518,13 +636,15 @@ int read_thread(void *arg)
                             packet_queue_flush(&is->videoq);
                             packet_queue_put(&is->videoq, NULL);
                         }
-                        if (is->seek_flags & AVSEEK_FLAG_BYTE) {
+                        if (seek_flags & AVSEEK_FLAG_BYTE) {
                             set_clock(&is->extclk, NAN, 0);
                         } else {
                             set_clock(&is->extclk, seek_target / (double)AV_TIME_BASE, 0);
                         }
+                        loop_seek_done(is, seek_gen);
+                        track_flush_buffers(is);
                     }
-                    is->seek_req = 0;
+                    OSAtomicCompareAndSwap32Barrier(is->seek_done_gen, seek_gen, &is->seek_done_gen);
                     is->queue_attachments_req = 1;
                     eof = 0;
                     
@@ -533,6 +653,14 @@ int read_thread(void *arg)
                     
                     if (is->paused)
                         step_to_next_frame(is);
+                    
+                    // LAVP: report completion to LAVPDecoder asynchronously
+                    if (is->decoderThread) {
+                        id decoder = (__bridge id)is->decoder;
+                        NSThread *thread = (__bridge NSThread*)is->decoderThread;
+                        [decoder performSelector:@selector(seekDidComplete:) onThread:thread
+                                      withObject:[NSNumber numberWithInt:seek_gen] waitUntilDone:NO];
+                    }
                 }
                 
                 if (is->queue_attachments_req) {
@@ -547,22 +675,31 @@ int read_thread(void *arg)
                 }
                 
                 /* if the queue are full, no need to read more */
-                if (is->infinite_buffer<1 &&
+                /* LAVP: audio only reads ahead in bursts and sleeps longer between them */
+                int min_frames = is->audio_only ? AUDIO_ONLY_MIN_FRAMES : MIN_FRAMES;
+                int queues_full = (is->infinite_buffer<1 &&
                     (is->audioq.size + is->videoq.size + is->subtitleq.size > MAX_QUEUE_SIZE
-                     || (   (is->audioq   .nb_packets > MIN_FRAMES || is->audio_stream < 0 || is->audioq.abort_request)
+                     || (   (is->audioq   .nb_packets > min_frames || is->audio_stream < 0 || is->audioq.abort_request)
                          && (is->videoq   .nb_packets > MIN_FRAMES || is->video_stream < 0 || is->videoq.abort_request
                              || (is->video_st && is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
-                         && (is->subtitleq.nb_packets > MIN_FRAMES || is->subtitle_stream < 0 || is->subtitleq.abort_request)))) {
+                         && (is->subtitleq.nb_packets > MIN_FRAMES || is->subtitle_stream < 0 || is->subtitleq.abort_request))));
+                if (queues_full && !is->timeshift) {
                          /* wait 10 ms */
                          LAVPLockMutex(wait_mutex);
-                         LAVPCondWaitTimeout(is->continue_read_thread, wait_mutex, 10);
+                         LAVPCondWaitTimeout(is->continue_read_thread, wait_mutex, is->audio_only ? AUDIO_ONLY_READ_WAIT : 10);
                          LAVPUnlockMutex(wait_mutex);
+                         OSAtomicIncrement64(&is->wakeups);
                          continue;
                      }
                 
+                // LAVP: timeshift queues from the ring; reading below only ingests
+                if (!queues_full)
+                    timeshift_feed(is);
+                
                 // LAVP: EOF reached
                 if (is->eof_flag) {
-                    usleep(50*1000);
+                    usleep(is->audio_only ? AUDIO_ONLY_READ_WAIT*1000 : 50*1000);
+                    OSAtomicIncrement64(&is->wakeups);
                     continue;
                 }
                 if (!is->paused &&
@@ -574,8 +711,15 @@ int read_thread(void *arg)
                     // LAVP: finally mark end of stream flag (reset when seek performed)
                     is->eof_flag = 1;
                     
+                    // LAVP: every picture and PCM block has reached the offline callbacks
+                    offline_end(is, 0);
+                    
                     //NSLog(@"DEBUG: eof_flag = 1 on %f", get_master_clock(is));
                 }
+                // LAVP: A-B loop replays cached packets without reading
+                if (loop_replay_packet(is))
+                    continue;
+                
                 if(eof) {
                     if (is->video_stream >= 0)
                         packet_queue_put_nullpacket(&is->videoq, is->video_stream);
@@ -589,10 +733,16 @@ int read_thread(void *arg)
                 }
                 
                 // Read file
+                if (is->soak)
+                    soak_read_stall(is);
                 ret = av_read_frame(is->ic, pkt);
                 if (ret < 0) {
-                    if (ret == AVERROR_EOF || url_feof(is->ic->pb))
-                        eof=1;
+                    if (ret == AVERROR_EOF || url_feof(is->ic->pb)) {
+                        if (loop_input_eof(is))
+                            continue;
+                        if (!timeshift_input_eof(is))
+                            eof=1;
+                    }
                     if (is->ic->pb && is->ic->pb->error) {
                         break;
                     }
@@ -602,6 +752,18 @@ int read_thread(void *arg)
                     continue;
                 }
                 
+                if (is->low_latency &&
+                    (pkt->stream_index == is->audio_stream || pkt->stream_index == is->video_stream))
+                    live_packet_arrived(is, pkt);
+                
+                // LAVP: A-B loop queues packets itself
+                if (loop_input_packet(is, pkt))
+                    continue;
+                
+                // LAVP: timeshift stores every packet; timeshift_feed() queues them
+                if (timeshift_input_packet(is, pkt))
+                    continue;
+                
                 // Queue packet
                 int64_t start_time = AV_NOPTS_VALUE; // LAVP:
                 int64_t duration = AV_NOPTS_VALUE; // LAVP:
@@ -615,21 +777,17 @@ int read_thread(void *arg)
                 av_q2d(is->ic->streams[pkt->stream_index]->time_base) -
                 (double)(start_time != AV_NOPTS_VALUE ? start_time : 0) / 1000000
                 <= ((double)duration / 1000000);
-                if (pkt->stream_index == is->audio_stream && pkt_in_play_range) {
-                    packet_queue_put(&is->audioq, pkt);
-                } else if (pkt->stream_index == is->video_stream && pkt_in_play_range && !(is->video_st && is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)) {
-                    packet_queue_put(&is->videoq, pkt);
-                } else if (pkt->stream_index == is->subtitle_stream && pkt_in_play_range) {
-                    packet_queue_put(&is->subtitleq, pkt);
-                } else {
-                    av_free_packet(pkt);
-                }
+                stream_queue_packet(is, pkt, pkt_in_play_range);
                 
             }
         }
         
         /* ================================================================================== */
         
+        // LAVP: left the loop on a read error; nothing more reaches the offline callbacks
+        if (!is->abort_request)
+            offline_end(is, is->ic->pb ? is->ic->pb->error : AVERROR_EOF);
+        
         /* wait until the end */
         while (!is->abort_request) {
             usleep(10*1000);
@@ -639,6 +797,9 @@ int read_thread(void *arg)
         ret = 0;
         
     bail:
+        if (ret < 0)
+            offline_end(is, ret);
+        
         /* close each stream */
         if (is->audio_stream >= 0)
             stream_component_close(is, is->audio_stream);
@@ -657,6 +818,9 @@ int read_thread(void *arg)
 #pragma mark functions (main_thread)
 
 
+/* LAVP: libav serializes codec open/close of every player on these locks */
+static volatile int64_t lockmgr_obtained, lockmgr_contended, lockmgr_wait_usec;
+
 static int lockmgr(void **mtx, enum AVLockOp op)
 {
     switch(op) {
@@ -666,7 +830,13 @@ static int lockmgr(void **mtx, enum AVLockOp op)
                 return 1;
             return 0;
         case AV_LOCK_OBTAIN:
-            LAVPLockMutex(*mtx);
+            OSAtomicIncrement64Barrier(&lockmgr_obtained);
+            if (LAVPTryLockMutex(*mtx)) {
+                int64_t start = av_gettime();
+                LAVPLockMutex(*mtx);
+                OSAtomicIncrement64Barrier(&lockmgr_contended);
+                OSAtomicAdd64Barrier(av_gettime() - start, &lockmgr_wait_usec);
+            }
             return 0;
         case AV_LOCK_RELEASE:
             LAVPUnlockMutex(*mtx);
@@ -678,24 +848,62 @@ static int lockmgr(void **mtx, enum AVLockOp op)
     return 1;
 }
 
-double get_clock(Clock *c)
+/* LAVP: process-wide counters of the libav lock manager */
+void stream_lock_stats(int64_t *obtained, int64_t *contended, int64_t *wait_usec)
 {
-    if (*c->queue_serial != c->serial)
+    OSMemoryBarrier();
+    if (obtained)
+        *obtained = lockmgr_obtained;
+    if (contended)
+        *contended = lockmgr_contended;
+    if (wait_usec)
+        *wait_usec = lockmgr_wait_usec;
+}
+
+static double clock_value_at(const ClockSnapshot *s, int queue_serial, double time)
+{
+    if (queue_serial != s->serial)
         return NAN;
-    if (c->paused) {
-        return c->pts;
+    if (s->paused) {
+        return s->pts;
     } else {
-        double time = av_gettime() / 1000000.0;
-        return c->pts_drift + time - (time - c->last_updated) * (1.0 - c->speed);
+        return s->pts_drift + time - (time - s->last_updated) * (1.0 - s->speed);
     }
 }
 
+/* LAVP: clock fields are written by the audio callback and read everywhere else;
+ take a consistent copy without locking and return the clock value for it */
+double clock_snapshot(Clock *c, ClockSnapshot *snap)
+{
+    int32_t seq;
+    
+    do {
+        seq = LAVPSeqReadBegin(&c->seq);
+        snap->pts = c->pts;
+        snap->pts_drift = c->pts_drift;
+        snap->last_updated = c->last_updated;
+        snap->speed = c->speed;
+        snap->serial = c->serial;
+        snap->paused = c->paused;
+    } while (LAVPSeqReadRetry(&c->seq, seq));
+    
+    return clock_value_at(snap, *c->queue_serial, av_gettime() / 1000000.0);
+}
+
+double get_clock(Clock *c)
+{
+    ClockSnapshot snap;
+    return clock_snapshot(c, &snap);
+}
+
 void set_clock_at(Clock *c, double pts, int serial, double time)
 {
+    LAVPSeqWriteBegin(&c->seq);
     c->pts = pts;
     c->last_updated = time;
-    c->pts_drift = c->pts - time;
+    c->pts_drift = pts - time;
     c->serial = serial;
+    LAVPSeqWriteEnd(&c->seq);
 }
 
 void set_clock(Clock *c, double pts, int serial)
@@ -706,27 +914,48 @@ void set_clock(Clock *c, double pts, int serial)
 
 void set_clock_speed(Clock *c, double speed)
 {
-    set_clock(c, get_clock(c), c->serial);
+    /* LAVP: rebase and change speed in one write so readers never mix old base and new speed */
+    double time = av_gettime() / 1000000.0;
+    
+    LAVPSeqWriteBegin(&c->seq);
+    ClockSnapshot snap = {c->pts, c->pts_drift, c->last_updated, c->speed, c->serial, c->paused};
+    double pts = clock_value_at(&snap, *c->queue_serial, time);
+    c->pts = pts;
+    c->last_updated = time;
+    c->pts_drift = pts - time;
     c->speed = speed;
+    LAVPSeqWriteEnd(&c->seq);
+}
+
+void set_clock_paused(Clock *c, int paused)
+{
+    LAVPSeqWriteBegin(&c->seq);
+    c->paused = paused;
+    LAVPSeqWriteEnd(&c->seq);
 }
 
 void init_clock(Clock *c, volatile int *queue_serial)
 {
+    LAVPSeqWriteBegin(&c->seq);
     c->speed = 1.0;
     c->paused = 0;
     c->queue_serial = queue_serial;
+    LAVPSeqWriteEnd(&c->seq);
     set_clock(c, NAN, -1);
 }
 
 void sync_clock_to_slave(Clock *c, Clock *slave)
 {
+    ClockSnapshot slave_snap;
     double clock = get_clock(c);
-    double slave_clock = get_clock(slave);
+    double slave_clock = clock_snapshot(slave, &slave_snap);
     if (!isnan(slave_clock) && (isnan(clock) || fabs(clock - slave_clock) > AV_NOSYNC_THRESHOLD))
-        set_clock(c, slave_clock, slave->serial);
+        set_clock(c, slave_clock, slave_snap.serial);
 }
 
 int get_master_sync_type(VideoState *is) {
+    if (is->reverse) /* LAVP: reverse playback runs on the external clock */
+        return AV_SYNC_EXTERNAL_CLOCK;
     if (is->av_sync_type == AV_SYNC_VIDEO_MASTER) {
         if (is->video_st)
             return AV_SYNC_VIDEO_MASTER;
@@ -763,48 +992,138 @@ double get_master_clock(VideoState *is)
 }
 
 void check_external_clock_speed(VideoState *is) {
+    ClockSnapshot snap;
+    clock_snapshot(&is->extclk, &snap);
+    
     if ((is->video_stream >= 0 && is->videoq.nb_packets <= MIN_FRAMES / 2) ||
         (is->audio_stream >= 0 && is->audioq.nb_packets <= MIN_FRAMES / 2)) {
-        set_clock_speed(&is->extclk, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, is->extclk.speed - EXTERNAL_CLOCK_SPEED_STEP));
+        set_clock_speed(&is->extclk, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, snap.speed - EXTERNAL_CLOCK_SPEED_STEP));
     } else if ((is->video_stream < 0 || is->videoq.nb_packets > MIN_FRAMES * 2) &&
                (is->audio_stream < 0 || is->audioq.nb_packets > MIN_FRAMES * 2)) {
-        set_clock_speed(&is->extclk, FFMIN(EXTERNAL_CLOCK_SPEED_MAX, is->extclk.speed + EXTERNAL_CLOCK_SPEED_STEP));
+        set_clock_speed(&is->extclk, FFMIN(EXTERNAL_CLOCK_SPEED_MAX, snap.speed + EXTERNAL_CLOCK_SPEED_STEP));
     } else {
-        double speed = is->extclk.speed;
+        double speed = snap.speed;
         if (speed != 1.0)
             set_clock_speed(&is->extclk, speed + EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed));
     }
 }
 
+/* LAVP: remember the newest packet read from a live source for stream_latency() */
+void live_packet_arrived(VideoState *is, AVPacket *pkt)
+{
+    int64_t ts = (pkt->pts != AV_NOPTS_VALUE) ? pkt->pts : pkt->dts;
+    double pts;
+    
+    if (ts == AV_NOPTS_VALUE)
+        return;
+    pts = ts * av_q2d(is->ic->streams[pkt->stream_index]->time_base);
+    
+    /* audio and video interleave; keep the newest unless the timestamps jumped back */
+    if (is->live_time > 0 && pts < is->live_pts && is->live_pts - pts < AV_NOSYNC_THRESHOLD)
+        return;
+    
+    LAVPSeqWriteBegin(&is->live_seq);
+    is->live_pts = pts;
+    is->live_time = av_gettime() / 1000000.0;
+    LAVPSeqWriteEnd(&is->live_seq);
+}
+
+/* LAVP: seconds between the arrival of the newest packet and the presentation of its
+ timestamp, i.e. how far the output trails the source as seen by this player.
+ Upstream encoder and network delay are not included. NAN if unknown. */
+double stream_latency(VideoState *is)
+{
+    double pts, time, clock;
+    int32_t seq;
+    
+    do {
+        seq = LAVPSeqReadBegin(&is->live_seq);
+        pts = is->live_pts;
+        time = is->live_time;
+    } while (LAVPSeqReadRetry(&is->live_seq, seq));
+    
+    if (time <= 0)
+        return NAN;
+    clock = get_master_clock(is);
+    if (isnan(clock))
+        return NAN;
+    return (av_gettime() / 1000000.0 - time) + (pts - clock);
+}
+
+/* LAVP: low latency replacement for check_external_clock_speed(). Plays faster while
+ the latency is above the target and skips ahead when it is far above; pictures and
+ audio frames left behind by a skip are dropped as late. */
+void check_live_latency(VideoState *is)
+{
+    ClockSnapshot snap;
+    double latency = stream_latency(is);
+    
+    if (isnan(latency)) {
+        check_external_clock_speed(is);
+        return;
+    }
+    
+    clock_snapshot(&is->extclk, &snap);
+    if (latency > is->target_latency + LOW_LATENCY_JUMP) {
+        set_clock(&is->extclk, get_clock(&is->extclk) + latency - is->target_latency, snap.serial);
+        set_clock_speed(&is->extclk, 1.0);
+        is->latency_catchups++;
+    } else if (latency > is->target_latency) {
+        set_clock_speed(&is->extclk, FFMIN(LOW_LATENCY_SPEED_MAX, snap.speed + EXTERNAL_CLOCK_SPEED_STEP));
+    } else if ((is->video_stream >= 0 && is->videoq.nb_packets == 0) ||
+               (is->audio_stream >= 0 && is->audioq.nb_packets == 0)) {
+        /* about to run dry; give the source time */
+        set_clock_speed(&is->extclk, FFMAX(EXTERNAL_CLOCK_SPEED_MIN, snap.speed - EXTERNAL_CLOCK_SPEED_STEP));
+    } else if (snap.speed != 1.0) {
+        double speed = snap.speed;
+        set_clock_speed(&is->extclk, speed + EXTERNAL_CLOCK_SPEED_STEP * (1.0 - speed) / fabs(1.0 - speed));
+    }
+}
+
 /* seek in the stream */
-void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes)
+/* LAVP: a newer request always replaces the pending target; returns its generation */
+int32_t stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes)
 {
-	if (!is->seek_req) {
-		is->seek_pos = pos;
-		is->seek_rel = rel;
-		is->seek_flags &= ~AVSEEK_FLAG_BYTE;
-		if (seek_by_bytes)
-			is->seek_flags |= AVSEEK_FLAG_BYTE;
-		is->seek_req = 1;
-
-        is->remaining_time = 0.0; // LAVP: reset remaining time
-        
-        LAVPCondSignal(is->continue_read_thread);
-	}
+    LAVPSeqWriteBegin(&is->seek_seq);
+    is->seek_pos = pos;
+    is->seek_rel = rel;
+    is->seek_flags &= ~AVSEEK_FLAG_BYTE;
+    if (seek_by_bytes)
+        is->seek_flags |= AVSEEK_FLAG_BYTE;
+    LAVPSeqWriteEnd(&is->seek_seq);
+    
+    int32_t gen = OSAtomicIncrement32Barrier(&is->seek_req_gen);
+    
+    is->remaining_time = 0.0; // LAVP: reset remaining time
+    
+    LAVPCondSignal(is->continue_read_thread);
+    return gen;
+}
+
+int stream_seek_pending(VideoState *is)
+{
+    OSMemoryBarrier();
+    return is->seek_req_gen != is->seek_done_gen;
 }
 
 /* pause or resume the video */
 void stream_toggle_pause(VideoState *is)
 {
+    ClockSnapshot snap;
+    
     if (is->paused) {
-        is->frame_timer += av_gettime() / 1000000.0 + is->vidclk.pts_drift - is->vidclk.pts;
+        clock_snapshot(&is->vidclk, &snap);
+        is->frame_timer += av_gettime() / 1000000.0 + snap.pts_drift - snap.pts;
         if (is->read_pause_return != AVERROR(ENOSYS)) {
-            is->vidclk.paused = 0;
+            set_clock_paused(&is->vidclk, 0);
         }
-        set_clock(&is->vidclk, get_clock(&is->vidclk), is->vidclk.serial);
+        set_clock(&is->vidclk, clock_snapshot(&is->vidclk, &snap), snap.serial);
     }
-    set_clock(&is->extclk, get_clock(&is->extclk), is->extclk.serial);
-    is->paused = is->audclk.paused = is->vidclk.paused = is->extclk.paused = !is->paused;
+    set_clock(&is->extclk, clock_snapshot(&is->extclk, &snap), snap.serial);
+    is->paused = !is->paused;
+    set_clock_paused(&is->audclk, is->paused);
+    set_clock_paused(&is->vidclk, is->paused);
+    set_clock_paused(&is->extclk, is->paused);
 }
 
 void toggle_pause(VideoState *is)
@@ -821,6 +1140,28 @@ void step_to_next_frame(VideoState *is)
     is->step = 1;
 }
 
+/* LAVP: frame stepping for the decoder; backward steps use the reverse cache */
+void stream_step_to_next_frame(VideoState *is)
+{
+    if (is->reverse) {
+        if (reverse_step(is, 1) == 0)
+            return;
+        /* beyond the cache; read_thread steps once the seek has completed */
+        reverse_stop(is);
+        return;
+    }
+    if (!is->paused)
+        stream_pause(is);
+    step_to_next_frame(is);
+}
+
+void stream_step_to_prev_frame(VideoState *is)
+{
+    if (!is->reverse && !is->paused)
+        stream_pause(is);
+    reverse_step(is, -1);
+}
+
 /* pause or resume the video */
 void stream_pause(VideoState *is)
 {
@@ -854,6 +1195,16 @@ void stream_close(VideoState *is)
             is->parse_group = NULL;
             is->parse_queue = NULL;
         }
+        reverse_close(is);
+        chapter_close(is);
+        scrub_close(is);
+        text_close(is);
+        loop_close(is);
+        track_close(is);
+        timeshift_close(is);
+        validate_close(is);
+        offline_close(is);
+        soak_close(is);
         //
         packet_queue_destroy(&is->videoq);
         packet_queue_destroy(&is->audioq);
@@ -862,22 +1213,31 @@ void stream_close(VideoState *is)
 		/* free all pictures */
         for (i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++)
             free_picture(&is->pictq[i]);
-        for (i = 0; i < SUBPICTURE_QUEUE_SIZE; i++)
+        for (i = 0; is->subpq && i < SUBPICTURE_QUEUE_SIZE; i++)
             free_subpicture(&is->subpq[i]);
+        av_freep(&is->subpq);
+		
+		// LAVP: consumers left registered by the owner
+		while (is->consumers)
+			video_consumer_destroy(is, is->consumers);
 		
 		//
 		LAVPDestroyMutex(is->pictq_mutex);
 		LAVPDestroyCond(is->pictq_cond);
 		LAVPDestroyMutex(is->subpq_mutex);
 		LAVPDestroyCond(is->subpq_cond);
+		LAVPDestroyMutex(is->text_mutex);
 		LAVPDestroyCond(is->continue_read_thread);
 
 		// LAVP: free image converter
-		if (is->img_convert_ctx)
+		if (is->context_pool)
+			pool_put_sws(is->img_convert_ctx);
+		else if (is->img_convert_ctx)
 			sws_freeContext(is->img_convert_ctx);
 		
 		// LAVP: free format context
         if (is->ic) {
+            pool_unbind(is);
             avformat_close_input(&is->ic);
             is->ic = NULL;
         }
@@ -897,15 +1257,14 @@ void stream_close(VideoState *is)
 		free(is);
 		is = NULL;
 	}
-    av_lockmgr_register(NULL);
-    //
+    // LAVP: the lock manager stays registered; other players may be inside avcodec_open2()
     avformat_network_deinit();
     if (doLF)
         printf("\n");
     av_log(NULL, AV_LOG_QUIET, "%s", "");
 }
 
-VideoState* stream_open(id opaque, NSURL *sourceURL)
+VideoState* stream_open(id opaque, NSURL *sourceURL, const StreamOptions *options)
 {
     int err, i, ret;
 	
@@ -943,6 +1302,31 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
     
 	is->paused = 0;
 	is->playRate = 1.0;
+    is->chap_prefetch = 1;
+    is->low_power_audio = 1;
+    is->text_cache = 1;
+    
+    if (options) {
+        is->output_width = options->output_width;
+        is->output_height = options->output_height;
+        is->color_matrix = options->color_matrix;
+        is->color_range = options->color_range;
+        is->offline = options->offline;
+        is->offline_video = options->offline_video;
+        is->offline_audio = options->offline_audio;
+        is->offline_finished = options->offline_finished;
+        is->low_latency = options->low_latency;
+        is->target_latency = options->target_latency;
+        is->chap_prefetch = !options->no_chapter_prefetch;
+        is->low_power_audio = !options->no_low_power_audio;
+        is->text_cache = !options->no_subtitle_cache;
+        is->context_pool = options->context_pool;
+        is->memory_budget = options->memory_budget;
+        is->open_deadline = options->open_deadline;
+    }
+    if (is->target_latency <= 0)
+        is->target_latency = LOW_LATENCY_TARGET;
+    is->pictq_depth = is->low_latency ? LOW_LATENCY_PICTURE_QUEUE_DEPTH : VIDEO_PICTURE_QUEUE_SIZE / 2;
 
     is->last_video_stream = is->video_stream = -1;
     is->last_audio_stream = is->audio_stream = -1;
@@ -952,17 +1336,23 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
 	
     /* original: main() */
     {
-        av_log_set_flags(AV_LOG_SKIP_REPEATED);
-        
-        /* register all codecs, demux and protocols */
-        av_register_all();
-        avformat_network_init();
-        
-        //
-        if (av_lockmgr_register(lockmgr)) {
-            av_log(NULL, AV_LOG_FATAL, "Could not initialize lock manager!\n");
+        // LAVP: once per process; concurrent opens must not swap the lock manager under each other
+        static dispatch_once_t once;
+        static int lockmgr_failed;
+        dispatch_once(&once, ^{
+            av_log_set_flags(AV_LOG_SKIP_REPEATED);
+            
+            /* register all codecs, demux and protocols */
+            av_register_all();
+            
+            if (av_lockmgr_register(lockmgr)) {
+                av_log(NULL, AV_LOG_FATAL, "Could not initialize lock manager!\n");
+                lockmgr_failed = 1;
+            }
+        });
+        if (lockmgr_failed)
             goto bail;
-        }
+        avformat_network_init();
     }
     
     /* ======================================== */
@@ -991,6 +1381,12 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
         ic = avformat_alloc_context();
         ic->interrupt_callback.callback = decode_interrupt_cb;
         ic->interrupt_callback.opaque = is;
+        // LAVP: live sources start presenting as soon as the streams are known
+        if (is->low_latency) {
+            av_dict_set(&format_opts, "fflags", "nobuffer", 0);
+            av_dict_set(&format_opts, "probesize", LOW_LATENCY_PROBESIZE, 0);
+            av_dict_set(&format_opts, "analyzeduration", LOW_LATENCY_ANALYZEDURATION, 0);
+        }
         err = avformat_open_input(&ic, is->filename, is->iformat, &format_opts);
         if (err < 0) {
             // LAVP: inline for print_error(is->filename, err);
@@ -1002,14 +1398,18 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
                     errbuf_ptr = strerror(AVUNERROR(err));
                 av_log(NULL, AV_LOG_ERROR, "%s: %s\n", is->filename, errbuf_ptr);
             }
+            av_dict_free(&format_opts);
             ret = -1;
             goto bail;
         }
         if ((t = av_dict_get(format_opts, "", NULL, AV_DICT_IGNORE_SUFFIX))) {
             av_log(NULL, AV_LOG_ERROR, "Option %s not found.\n", t->key);
+            av_dict_free(&format_opts);
+            avformat_close_input(&ic);
             ret = AVERROR_OPTION_NOT_FOUND;
             goto bail;
         }
+        av_dict_free(&format_opts);
         is->ic = ic;
     }
     
@@ -1025,6 +1425,10 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
         opts = setup_find_stream_info_opts(is->ic, codec_opts);
         orig_nb_streams = is->ic->nb_streams;
         
+        // LAVP: probe decoders open without frame threads; avcodec_open2() holds the global lock meanwhile
+        for (i = 0; opts && i < orig_nb_streams; i++)
+            av_dict_set(&opts[i], "threads", "1", 0);
+        
         err = avformat_find_stream_info(is->ic, opts);
         if (err < 0) {
             av_log(NULL, AV_LOG_WARNING,
@@ -1050,6 +1454,24 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
     
     is->realtime = is_realtime(is->ic);
     
+    // LAVP: the deadline only applies to opening
+    is->open_deadline = 0;
+    
+    // LAVP: sorted chapter starts; prefetch starts from read_thread
+    chapter_open(is);
+    
+    // LAVP: packets go through the on-disk ring from the start
+    if (options && timeshift_open(is, options->timeshift_bytes) < 0)
+        av_log(NULL, AV_LOG_WARNING, "%s: playing without timeshift\n", is->filename);
+    
+    // LAVP: hash what is presented, for comparing runs
+    if (options && validate_open(is, options->validate_path) < 0)
+        av_log(NULL, AV_LOG_WARNING, "%s: playing without validation\n", is->filename);
+    
+    // LAVP: measure how well playback keeps its schedule, optionally under injected load
+    if (options && soak_open(is, options) < 0)
+        av_log(NULL, AV_LOG_WARNING, "%s: playing without soak log\n", is->filename);
+    
 	for (int i = 0; i < is->ic->nb_streams; i++)
 		is->ic->streams[i]->discard = AVDISCARD_ALL;
     
@@ -1070,6 +1492,10 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
         is->subpq_mutex = LAVPCreateMutex();
         is->subpq_cond = LAVPCreateCond();
 
+        is->text_mutex = LAVPCreateMutex();
+
+        is->alt_mutex = LAVPCreateMutex();
+
         packet_queue_init(&is->audioq);
         packet_queue_init(&is->videoq);
         packet_queue_init(&is->subtitleq);
@@ -1083,7 +1509,10 @@ VideoState* stream_open(id opaque, NSURL *sourceURL)
 
         is->audio_clock_serial = -1;
         is->audio_last_serial = -1;
-        is->av_sync_type = AV_SYNC_AUDIO_MASTER; // LAVP: fixed value
+        // LAVP: live sources follow the external clock so check_live_latency() can steer it
+        is->av_sync_type = is->low_latency ? AV_SYNC_EXTERNAL_CLOCK : AV_SYNC_AUDIO_MASTER;
+        // LAVP: offline processing runs on a virtual clock instead
+        offline_open(is);
 
         // LAVP: Using dispatch queue
         {
@@ -1118,8 +1547,19 @@ double_t stream_playRate(VideoState *is)
 
 void stream_setPlayRate(VideoState *is, double_t newRate)
 {
-	assert(newRate > 0.0);
+	assert(newRate != 0.0);
 	
+    /* LAVP: negative rate plays backward; forward pipeline and audio stay paused */
+    if (newRate < 0.0) {
+        if (reverse_start(is) < 0)
+            return;
+        is->playRate = newRate;
+        reverse_set_rate(is, -newRate);
+        return;
+    }
+    if (is->reverse)
+        reverse_stop(is);
+    
 	is->playRate = newRate;
     
     set_clock_speed(&is->vidclk, newRate);
@@ -1127,29 +1567,60 @@ void stream_setPlayRate(VideoState *is, double_t newRate)
     set_clock_speed(&is->extclk, newRate);
 }
 
+/* LAVP: resident bytes of this player by category; usage->output is left to LAVPDecoder */
+void stream_memory_usage(VideoState *is, MemoryUsage *usage)
+{
+    memset(usage, 0, sizeof(*usage));
+    
+    usage->packets = is->videoq.size + is->audioq.size + is->subtitleq.size + is->loop_cache_bytes;
+    for (int i = 0; is->ic && i < (int)is->ic->nb_streams; i++)
+        usage->packets += track_buffered_bytes(is, i);
+    
+    LAVPLockMutex(is->pictq_mutex);
+    usage->frames = video_pictq_bytes(is);
+    LAVPUnlockMutex(is->pictq_mutex);
+    if (is->rev_mutex) {
+        LAVPLockMutex(is->rev_mutex);
+        usage->frames += is->rev_cache_bytes;
+        LAVPUnlockMutex(is->rev_mutex);
+    }
+    usage->frames += chapter_memory(is);
+    if (is->vis_frame)
+        usage->frames += avpicture_get_size(PIX_FMT_YUV420P, is->vis_frame->width, is->vis_frame->height);
+    
+    if (is->outAQ)
+        usage->audio = AUDIO_QUEUE_BUFFERS * (int64_t)is->audio_queue_buffer_size;
+    usage->audio += is->audio_buf1_size + is->audio_conv_buf_size + is->vis_buf_size;
+    if (is->sample_array)
+        usage->audio += SAMPLE_ARRAY_SIZE * sizeof(int16_t);
+}
+
 int stream_getChapterCount(VideoState *is)
 {
-    return is->ic->nb_chapters;
+    return chapter_count(is);
 }
 
-int stream_getChapterCurrent(VideoState *is)
+/* LAVP: index into the sorted chapter starts of the chapter at the master clock; -1 before the first one */
+static int stream_chapter_at_clock(VideoState *is)
 {
-    int64_t pos = get_master_clock(is) * AV_TIME_BASE;
-    int i;
+    double pos = get_master_clock(is);
     
+    if (isnan(pos))
+        pos = 0.0;
+    return chapter_index_for(is, (int64_t)(pos * AV_TIME_BASE));
+}
+
+/*
+ ic->chapters index of the chapter at the master clock.
+ 0 when there are no chapters (as ffplay did), -1 before the first chapter start.
+ */
+int stream_getChapterCurrent(VideoState *is)
+{
     if (!stream_getChapterCount(is))
         return 0;
     
-    /* find the current chapter */
-    for (i = 0; i < is->ic->nb_chapters; i++) {
-        AVChapter *ch = is->ic->chapters[i];
-        if (av_compare_ts(pos, AV_TIME_BASE_Q, ch->start, ch->time_base) < 0) {
-            i--;
-            break;
-        }
-    }
-    
-    return i;
+    /* LAVP: binary search on the sorted chapter starts, mapped back to the container's order */
+    return chapter_container_index(is, stream_chapter_at_clock(is));
 }
 
 void stream_seek_chapter(VideoState *is, int incr)
@@ -1157,15 +1628,18 @@ void stream_seek_chapter(VideoState *is, int incr)
     if (!stream_getChapterCount(is))
         return;
     
-    int i = stream_getChapterCurrent(is);
+    /* LAVP: steps through the chapters in time order */
+    int i = stream_chapter_at_clock(is);
     
     i += incr;
     i = FFMAX(i, 0);
-    if (i >= is->ic->nb_chapters)
+    if (i >= stream_getChapterCount(is))
         return;
     
     av_log(NULL, AV_LOG_VERBOSE, "Seeking to chapter %d.\n", i);
-    stream_seek(is, av_rescale_q(is->ic->chapters[i]->start, is->ic->chapters[i]->time_base,
-                                 AV_TIME_BASE_Q), 0, 0);
+    
+    // LAVP: present the prefetched picture while the seek completes
+    chapter_jump(is, i);
+    stream_seek(is, chapter_start(is, i), 0, 0);
 }
 
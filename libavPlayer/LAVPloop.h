@@ -0,0 +1,44 @@
+/*
+ *  LAVPloop.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPloop_h__
+#define __LAVPloop_h__
+
+#include "LAVPcommon.h"
+
+int loop_set(VideoState *is, int64_t start, int64_t end);
+void loop_clear(VideoState *is);
+int loop_get(VideoState *is, int64_t *start, int64_t *end);
+int64_t loop_cache_bytes(VideoState *is);
+double loop_map(VideoState *is, double pts, double clock);
+double loop_unmap(VideoState *is, double pts);
+
+/* read_thread */
+void loop_update(VideoState *is);
+void loop_seek_done(VideoState *is, int32_t seek_gen);
+int loop_input_packet(VideoState *is, AVPacket *pkt);
+int loop_input_eof(VideoState *is);
+int loop_replay_packet(VideoState *is);
+void loop_close(VideoState *is);
+
+#endif
@@ -0,0 +1,430 @@
+/*
+ *  LAVPloop.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPqueue.h"
+#include "LAVPloop.h"
+
+/* =========================================================== */
+
+/*
+ A-B loop:
+ 
+ loop_set() makes read_thread seek to A. From then on read_thread keeps a copy of
+ every packet it queues until all streams have reached B. Video is kept from the
+ keyframe before A; audio and subtitles are kept from A. If the region fits into
+ LOOP_CACHE_MAX_BYTES, later passes are fed from that cache. The demuxer stays idle
+ and nothing is flushed. Otherwise, when B is read, only the demuxer is moved back
+ to A while the queues still hold the end of the region, and the region is demuxed
+ again.
+ 
+ Either way each pass adds B - A to the packet timestamps, so decoders and clocks
+ see one continuous timeline. loop_unmap() and loop_map() translate between that
+ timeline and positions in the file for LAVPDecoder.
+ */
+
+enum {
+    LOOP_OFF,
+    LOOP_FILL,      /* demuxing the region and caching its packets */
+    LOOP_STREAM,    /* demuxing the region without a cache */
+    LOOP_READY,     /* cache complete; demuxing elsewhere after a seek */
+    LOOP_REPLAY,    /* feeding the queues from the cache */
+};
+
+#define LOOP_PASSED_AUDIO 1
+#define LOOP_PASSED_VIDEO 2
+
+/* =========================================================== */
+
+#pragma mark -
+
+static void loop_free_cache(VideoState *is)
+{
+    int i;
+    
+    for (i = 0; i < is->loop_nb_pkts; i++)
+        av_free_packet(&is->loop_pkts[i]);
+    av_freep(&is->loop_pkts);
+    is->loop_nb_pkts = 0;
+    is->loop_pkts_size = 0;
+    is->loop_replay_index = 0;
+    is->loop_cache_bytes = 0;
+}
+
+static void loop_snapshot(VideoState *is, int *active, double *a, double *b)
+{
+    int32_t seq;
+    
+    do {
+        seq = LAVPSeqReadBegin(&is->loop_seq);
+        *active = is->loop_active;
+        *a = is->loop_a / (double)AV_TIME_BASE;
+        *b = is->loop_b / (double)AV_TIME_BASE;
+    } while (LAVPSeqReadRetry(&is->loop_seq, seq));
+}
+
+static PacketQueue *loop_queue_for(VideoState *is, int stream_index)
+{
+    if (stream_index == is->audio_stream)
+        return &is->audioq;
+    if (stream_index == is->video_stream && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        return &is->videoq;
+    if (stream_index == is->subtitle_stream)
+        return &is->subtitleq;
+    return NULL;
+}
+
+static int64_t loop_packet_time(VideoState *is, AVPacket *pkt)
+{
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    
+    if (ts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return av_rescale_q(ts, is->ic->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q);
+}
+
+static void loop_shift_packet(VideoState *is, AVPacket *pkt)
+{
+    int64_t shift;
+    
+    if (!is->loop_offset)
+        return;
+    shift = av_rescale_q(is->loop_offset, AV_TIME_BASE_Q, is->ic->streams[pkt->stream_index]->time_base);
+    if (pkt->pts != AV_NOPTS_VALUE)
+        pkt->pts += shift;
+    if (pkt->dts != AV_NOPTS_VALUE)
+        pkt->dts += shift;
+}
+
+/* log the media time skipped (+) or repeated (-) where a pass joins the next */
+static void loop_note_packet(VideoState *is, AVPacket *pkt, int64_t t)
+{
+    int master = is->audio_stream >= 0 ? is->audio_stream : is->video_stream;
+    
+    if (pkt->stream_index != master || t == AV_NOPTS_VALUE)
+        return;
+    if (is->loop_seam_pending) {
+        is->loop_seam_pending = 0;
+        av_log(NULL, AV_LOG_VERBOSE, "loop: pass %d seam %+.3f ms\n", is->loop_count,
+               ((is->loop_b - is->loop_last_end) + (t - is->loop_a)) / 1000.0);
+    }
+    is->loop_last_end = t + av_rescale_q(pkt->duration, is->ic->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q);
+}
+
+static int loop_all_passed(VideoState *is)
+{
+    int need = 0;
+    
+    if (is->audio_stream >= 0)
+        need |= LOOP_PASSED_AUDIO;
+    if (is->video_stream >= 0 && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        need |= LOOP_PASSED_VIDEO;
+    return (is->loop_passed & need) == need;
+}
+
+static void loop_wrap(VideoState *is)
+{
+    is->loop_offset += is->loop_b - is->loop_a;
+    is->loop_passed = 0;
+    is->loop_count++;
+    is->loop_seam_pending = 1;
+    
+    if (is->loop_nb_pkts &&
+        (is->loop_state == LOOP_FILL || is->loop_state == LOOP_READY || is->loop_state == LOOP_REPLAY)) {
+        is->loop_state = LOOP_REPLAY;
+        is->loop_replay_index = 0;
+        return;
+    }
+    
+    /* LAVP: move the demuxer only; queued packets of this pass keep playing */
+    if (avformat_seek_file(is->ic, -1, INT64_MIN, is->loop_a, is->loop_a, 0) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: error while seeking to loop start\n", is->ic->filename);
+    }
+    loop_free_cache(is);
+    is->loop_state = is->loop_overflow ? LOOP_STREAM : LOOP_FILL;
+}
+
+#pragma mark -
+
+int loop_set(VideoState *is, int64_t start, int64_t end)
+{
+    if (!is || !is->ic || end <= start)
+        return AVERROR(EINVAL);
+    if (is->timeshift)  /* the ring already serves repeated viewing */
+        return AVERROR(ENOSYS);
+    
+    LAVPSeqWriteBegin(&is->loop_seq);
+    is->loop_req_a = start;
+    is->loop_req_b = end;
+    LAVPSeqWriteEnd(&is->loop_seq);
+    
+    OSAtomicIncrement32Barrier(&is->loop_req_gen);
+    LAVPCondSignal(is->continue_read_thread);
+    return 0;
+}
+
+void loop_clear(VideoState *is)
+{
+    if (!is || !is->ic)
+        return;
+    
+    LAVPSeqWriteBegin(&is->loop_seq);
+    is->loop_req_a = 0;
+    is->loop_req_b = 0;
+    LAVPSeqWriteEnd(&is->loop_seq);
+    
+    OSAtomicIncrement32Barrier(&is->loop_req_gen);
+    LAVPCondSignal(is->continue_read_thread);
+}
+
+int loop_get(VideoState *is, int64_t *start, int64_t *end)
+{
+    int32_t seq;
+    int active;
+    
+    do {
+        seq = LAVPSeqReadBegin(&is->loop_seq);
+        active = is->loop_active;
+        *start = is->loop_a;
+        *end = is->loop_b;
+    } while (LAVPSeqReadRetry(&is->loop_seq, seq));
+    return active;
+}
+
+int64_t loop_cache_bytes(VideoState *is)
+{
+    return is->loop_cache_bytes;
+}
+
+/* timeline pts -> position in file */
+double loop_unmap(VideoState *is, double pts)
+{
+    double a, b;
+    int active;
+    
+    loop_snapshot(is, &active, &a, &b);
+    if (!active || isnan(pts) || pts < b)
+        return pts;
+    return a + fmod(pts - a, b - a);
+}
+
+/* position in file -> the timeline pts of the same picture nearest to clock */
+double loop_map(VideoState *is, double pts, double clock)
+{
+    double a, b, k;
+    int active;
+    
+    loop_snapshot(is, &active, &a, &b);
+    if (!active || isnan(pts) || isnan(clock) || clock < b)
+        return pts;
+    k = floor((clock - pts) / (b - a) + 0.5);
+    return pts + FFMAX(k, 0) * (b - a);
+}
+
+#pragma mark -
+
+/* LAVP: called from read_thread before it handles seek requests */
+void loop_update(VideoState *is)
+{
+    int32_t gen = is->loop_req_gen;
+    int64_t a, b;
+    int32_t seq;
+    int shifted;
+    double now;
+    
+    if (gen == is->loop_done_gen)
+        return;
+    
+    do {
+        seq = LAVPSeqReadBegin(&is->loop_seq);
+        a = is->loop_req_a;
+        b = is->loop_req_b;
+    } while (LAVPSeqReadRetry(&is->loop_seq, seq));
+    
+    shifted = is->loop_state != LOOP_OFF && (is->loop_offset || is->loop_state == LOOP_REPLAY);
+    now = loop_unmap(is, get_master_clock(is));
+    
+    loop_free_cache(is);
+    is->loop_overflow = 0;
+    is->loop_offset = 0;
+    is->loop_passed = 0;
+    is->loop_count = 0;
+    is->loop_seam_pending = 0;
+    
+    LAVPSeqWriteBegin(&is->loop_seq);
+    is->loop_active = b > a;
+    if (b > a) {
+        is->loop_a = a;
+        is->loop_b = b;
+    }
+    LAVPSeqWriteEnd(&is->loop_seq);
+    
+    if (b > a) {
+        /* packets are cached from this seek on; see loop_seek_done() */
+        is->loop_state = LOOP_STREAM;
+        is->loop_seek_gen = stream_seek(is, a, -10, 0);
+    } else {
+        is->loop_state = LOOP_OFF;
+        /* return to file timestamps and wake the idle demuxer */
+        if (shifted && !isnan(now))
+            stream_seek(is, (int64_t)(now * AV_TIME_BASE), -10, 0);
+    }
+    is->loop_done_gen = gen;
+}
+
+/* LAVP: called from read_thread after the queues were flushed for a seek */
+void loop_seek_done(VideoState *is, int32_t seek_gen)
+{
+    if (is->loop_state == LOOP_OFF)
+        return;
+    
+    is->loop_offset = 0;
+    is->loop_passed = 0;
+    is->loop_seam_pending = 0;
+    
+    if (seek_gen == is->loop_seek_gen) {
+        /* first pass of a new region */
+        loop_free_cache(is);
+        is->loop_state = LOOP_FILL;
+    } else if (is->loop_nb_pkts && (is->loop_state == LOOP_READY || is->loop_state == LOOP_REPLAY)) {
+        is->loop_state = LOOP_READY;
+    } else {
+        loop_free_cache(is);
+        is->loop_state = LOOP_STREAM;
+    }
+}
+
+/* returns 1 if the packet was queued or freed here */
+int loop_input_packet(VideoState *is, AVPacket *pkt)
+{
+    PacketQueue *q;
+    int64_t t;
+    int passed;
+    
+    if (is->loop_state == LOOP_OFF)
+        return 0;
+    
+    q = loop_queue_for(is, pkt->stream_index);
+    if (!q) {
+        av_free_packet(pkt);
+        return 1;
+    }
+    
+    t = loop_packet_time(is, pkt);
+    passed = (pkt->stream_index == is->audio_stream ? LOOP_PASSED_AUDIO :
+              pkt->stream_index == is->video_stream ? LOOP_PASSED_VIDEO : 0);
+    
+    if (t != AV_NOPTS_VALUE && t >= is->loop_b) {
+        av_free_packet(pkt);
+        is->loop_passed |= passed;
+        if (loop_all_passed(is))
+            loop_wrap(is);
+        return 1;
+    }
+    
+    /* audio and subtitles before A would be heard twice; video needs them to decode */
+    if ((is->loop_passed & passed) ||
+        (q != &is->videoq && t != AV_NOPTS_VALUE && t < is->loop_a)) {
+        av_free_packet(pkt);
+        return 1;
+    }
+    
+    if (is->loop_state == LOOP_FILL) {
+        AVPacket *pkts = NULL;
+        
+        if (is->loop_cache_bytes + pkt->size <= LOOP_CACHE_MAX_BYTES)
+            pkts = av_fast_realloc(is->loop_pkts, &is->loop_pkts_size, (is->loop_nb_pkts + 1) * sizeof(*pkts));
+        if (pkts)
+            is->loop_pkts = pkts;
+        
+        if (pkts && av_copy_packet(&pkts[is->loop_nb_pkts], pkt) >= 0) {
+            is->loop_nb_pkts++;
+            is->loop_cache_bytes += pkt->size;
+        } else {
+            /* region does not fit; demux it on every pass */
+            loop_free_cache(is);
+            is->loop_overflow = 1;
+            is->loop_state = LOOP_STREAM;
+        }
+    }
+    
+    loop_note_packet(is, pkt, t);
+    loop_shift_packet(is, pkt);
+    packet_queue_put(q, pkt);
+    return 1;
+}
+
+/* returns 1 if EOF ended the pass instead of the stream */
+int loop_input_eof(VideoState *is)
+{
+    if (is->loop_state == LOOP_OFF)
+        return 0;
+    
+    loop_wrap(is);
+    return 1;
+}
+
+/* returns 1 if a cached packet was queued instead of reading the demuxer */
+int loop_replay_packet(VideoState *is)
+{
+    AVPacket pkt;
+    AVPacket *cached;
+    PacketQueue *q;
+    
+    if (is->loop_state != LOOP_REPLAY)
+        return 0;
+    
+    if (is->loop_replay_index >= is->loop_nb_pkts)
+        loop_wrap(is);
+    if (is->loop_state != LOOP_REPLAY)
+        return 0;
+    
+    cached = &is->loop_pkts[is->loop_replay_index++];
+    q = loop_queue_for(is, cached->stream_index);
+    if (!q)
+        return 1;
+    if (!cached->side_data_elems) {
+        /* LAVP: borrow the cached payload; packet_queue_put() copies it into its arena,
+         or through av_dup_packet() when it is too large. That only copies a packet
+         without a destructor, and the cache is freed while the queue still holds it. */
+        pkt = *cached;
+        pkt.buf = NULL;
+#if FF_API_DESTRUCT_PACKET
+        pkt.destruct = NULL;
+#endif
+    } else if (av_copy_packet(&pkt, cached) < 0) {
+        return 1;
+    }
+    
+    loop_note_packet(is, &pkt, loop_packet_time(is, &pkt));
+    loop_shift_packet(is, &pkt);
+    packet_queue_put(q, &pkt);
+    return 1;
+}
+
+void loop_close(VideoState *is)
+{
+    loop_free_cache(is);
+    is->loop_state = LOOP_OFF;
+    is->loop_active = 0;
+}
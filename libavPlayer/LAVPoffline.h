@@ -0,0 +1,40 @@
+/*
+ *  LAVPoffline.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPoffline_h__
+#define __LAVPoffline_h__
+
+#include "LAVPcommon.h"
+
+void offline_open(VideoState *is);
+void offline_close(VideoState *is);
+
+/* decoder threads */
+int offline_picture(VideoState *is, AVFrame *src_frame, double pts, int serial);
+void offline_audio_start(VideoState *is);
+void offline_audio_stop(VideoState *is);
+
+/* read_thread */
+void offline_end(VideoState *is, int error);
+
+#endif
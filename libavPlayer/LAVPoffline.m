@@ -0,0 +1,212 @@
+/*
+ *  LAVPoffline.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPaudio.h"
+#include "LAVPvalidate.h"
+#include "LAVPoffline.h"
+
+/* =========================================================== */
+
+/*
+ Offline processing:
+ 
+ For batch analysis the real-time pacing of playback is only wasted wall-clock.
+ With StreamOptions.offline the decoders hand their output straight to callbacks:
+ queue_picture() passes every picture to offline_video instead of waiting for room
+ in pictq, and the AudioQueue is replaced by a pump that calls audio_decode_frame()
+ back to back and passes every PCM block to offline_audio. read_thread is only held
+ back by the packet queue limits, so the pipeline runs as fast as decoding allows.
+ 
+ Nothing is dropped: frame dropping is off, audio is never stretched to follow a
+ clock, and each callback sees its stream in decode order. The external clock is
+ the master; it is kept paused and set to the pts of the last delivered picture
+ (or PCM block for audio-only files), so position queries report the progress.
+ offline_end runs once both decoders have drained, or when reading fails.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+void offline_open(VideoState *is)
+{
+    if (!is->offline)
+        return;
+    
+    /* every frame reaches the callback, however late */
+    is->framedrop = 0;
+    is->av_sync_type = AV_SYNC_EXTERNAL_CLOCK;
+    set_clock_paused(&is->extclk, 1);
+    is->offline_start = av_gettime();
+    is->offline_first_pts = is->offline_last_pts = NAN;
+}
+
+void offline_close(VideoState *is)
+{
+    if (is->offline_frame) {
+        av_freep(&is->offline_frame->data[0]);
+        av_frame_free(&is->offline_frame);
+    }
+}
+
+/* the master of the virtual clock: video if there is any, otherwise audio */
+static void offline_advance(VideoState *is, double pts, int serial, int is_video)
+{
+    if (isnan(pts) || (!is_video && is->video_st))
+        return;
+    set_clock(&is->extclk, pts, serial);
+    if (isnan(is->offline_first_pts) || pts < is->offline_first_pts)
+        is->offline_first_pts = pts;
+    if (isnan(is->offline_last_pts) || pts > is->offline_last_pts)
+        is->offline_last_pts = pts;
+}
+
+#pragma mark -
+
+/* called by queue_picture() in place of pictq */
+int offline_picture(VideoState *is, AVFrame *src_frame, double pts, int serial)
+{
+    AVFrame *frame = src_frame;
+    
+    if (src_frame->format != PIX_FMT_YUV420P) {
+        /* LAVP: callbacks always see YUV420P, like pictq */
+        AVFrame *tmp = is->offline_frame;
+        if (!tmp || tmp->width != src_frame->width || tmp->height != src_frame->height) {
+            if (tmp) {
+                av_freep(&tmp->data[0]);
+                av_frame_free(&tmp);
+            }
+            tmp = av_frame_alloc();
+            if (!tmp || av_image_alloc(tmp->data, tmp->linesize, src_frame->width, src_frame->height, PIX_FMT_YUV420P, 0x10) < 0) {
+                av_frame_free(&tmp);
+                is->offline_frame = NULL;
+                return AVERROR(ENOMEM);
+            }
+            tmp->width = src_frame->width;
+            tmp->height = src_frame->height;
+            tmp->format = PIX_FMT_YUV420P;
+            is->offline_frame = tmp;
+        }
+        is->img_convert_ctx = sws_getCachedContext(is->img_convert_ctx,
+                                                   src_frame->width, src_frame->height, src_frame->format,
+                                                   tmp->width, tmp->height, AV_PIX_FMT_YUV420P,
+                                                   is->sws_flags, NULL, NULL, NULL);
+        if (!is->img_convert_ctx) {
+            av_log(NULL, AV_LOG_ERROR, "offline: cannot initialize the conversion context\n");
+            return -1;
+        }
+        sws_scale(is->img_convert_ctx, (void*)src_frame->data, src_frame->linesize,
+                  0, src_frame->height, tmp->data, tmp->linesize);
+        frame = tmp;
+    }
+    
+    if (is->offline_video)
+        is->offline_video(is, frame, pts, serial);
+    if (is->validate)
+        validate_picture(is, frame, frame->width, frame->height, pts, serial);
+    
+    is->offline_frames++;
+    offline_advance(is, pts, serial, 1);
+    return 0;
+}
+
+#pragma mark -
+
+static void offline_audio_thread(VideoState *is)
+{
+    while (!is->audioq.abort_request) {
+        @autoreleasepool {
+            int audio_size = audio_decode_frame(is);
+            if (audio_size < 0) {
+                /* paused at the end, or a conversion error; the abort ends the loop */
+                usleep(10*1000);
+                continue;
+            }
+            
+            /* audio_clock is the end of the block */
+            double pts = is->audio_clock - (double)audio_size / is->audio_tgt.bytes_per_sec;
+            
+            if (is->offline_audio)
+                is->offline_audio(is, is->audio_buf, audio_size, &is->audio_tgt, pts, is->audio_clock_serial);
+            if (is->validate)
+                validate_audio(is, is->audio_buf, audio_size, is->audio_clock, is->audio_clock_serial);
+            
+            is->offline_blocks++;
+            offline_advance(is, pts, is->audio_clock_serial, 0);
+        }
+    }
+}
+
+/* called by stream_component_open() in place of the AudioQueue */
+void offline_audio_start(VideoState *is)
+{
+    // LAVP: Using dispatch queue
+    {
+        dispatch_queue_t audio_queue = dispatch_queue_create("offline audio", NULL);
+        dispatch_group_t audio_group = dispatch_group_create();
+        is->offline_audio_queue = (__bridge_retained void*)audio_queue;
+        is->offline_audio_group = (__bridge_retained void*)audio_group;
+    }
+    dispatch_group_async((__bridge dispatch_group_t)is->offline_audio_group, (__bridge dispatch_queue_t)is->offline_audio_queue, ^(void){offline_audio_thread(is);});
+}
+
+/* audioq must be aborted before */
+void offline_audio_stop(VideoState *is)
+{
+    if (!is->offline_audio_group)
+        return;
+    
+    dispatch_group_wait((__bridge dispatch_group_t)is->offline_audio_group, DISPATCH_TIME_FOREVER);
+    {
+        dispatch_group_t audio_group = (__bridge_transfer dispatch_group_t)is->offline_audio_group;
+        dispatch_queue_t audio_queue = (__bridge_transfer dispatch_queue_t)is->offline_audio_queue;
+        audio_group = NULL; // ARC
+        audio_queue = NULL; // ARC
+        is->offline_audio_group = NULL;
+        is->offline_audio_queue = NULL;
+    }
+}
+
+#pragma mark -
+
+/* called by read_thread when every picture and PCM block has been delivered, or on a read error */
+void offline_end(VideoState *is, int error)
+{
+    double wall = (av_gettime() - is->offline_start) / 1000000.0;
+    double media = is->offline_last_pts - is->offline_first_pts;
+    
+    if (!is->offline || is->offline_ended)
+        return;
+    is->offline_ended = 1;
+    
+    av_log(NULL, AV_LOG_INFO, "offline: %s: %d pictures, %d PCM blocks in %.3f s (%.1f fps, %.1fx real time)\n",
+           is->filename, is->offline_frames, is->offline_blocks, wall,
+           wall > 0 ? is->offline_frames / wall : 0,
+           (wall > 0 && !isnan(media)) ? media / wall : 0);
+    
+    if (error < 0)
+        av_log(NULL, AV_LOG_ERROR, "offline: %s: stopped by a read error\n", is->filename);
+    if (is->offline_finished)
+        is->offline_finished(is, error);
+}
@@ -0,0 +1,42 @@
+/*
+ *  LAVPpool.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef __LAVPpool_h__
+#define __LAVPpool_h__
+
+#include "LAVPcommon.h"
+
+int pool_take_codec(VideoState *is, int stream_index, int lowres);
+void pool_put_codec(VideoState *is, int stream_index);
+void pool_unbind(VideoState *is);
+int pool_take_audio_queue(VideoState *is);
+int pool_put_audio_queue(VideoState *is);
+struct SwsContext *pool_take_sws(int src_w, int src_h, int src_fmt, int dst_w, int dst_h, int dst_fmt, int flags);
+void pool_put_sws(struct SwsContext *ctx);
+struct SwrContext *pool_take_swr(const SwrCacheEntry *params);
+void pool_put_swr(SwrCacheEntry *entry);
+void pool_drain(void);
+void pool_stats(int64_t *hits, int64_t *misses);
+
+#endif
@@ -0,0 +1,493 @@
+/*
+ *  LAVPpool.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "LAVPcore.h"
+#include "LAVPpool.h"
+
+/* =========================================================== */
+
+/*
+ Context pool:
+ 
+ With StreamOptions.context_pool, closing a stream parks what is expensive to set up
+ instead of freeing it: opened decoders, the AudioQueue with its buffers and dispatch
+ queue, swscale and swresample contexts. The next stream_open() of a compatible source
+ takes them back, so cutting between short clips of one format skips codec open, AudioQueue
+ creation and scaler initialization.
+ 
+ A decoder is keyed by its configuration, extradata included. Opened on the stream's own
+ AVCodecContext, it is detached on close and a parameter copy takes its place, since the
+ format context frees whatever st->codec points to. A parked decoder replaces st->codec of
+ the new stream until the stream is closed; the original goes back before
+ avformat_close_input().
+ 
+ The pool is process-wide; each kind keeps a few entries and evicts the least recently
+ parked one.
+ */
+
+/* =========================================================== */
+
+typedef struct PoolCodec {
+    PoolCodecKey key;
+    AVCodecContext *avctx;      /* NULL if unused */
+    int64_t used;
+} PoolCodec;
+
+typedef struct PoolAudioQueue {
+    AudioStreamBasicDescription asbd;
+    UInt32 buffer_size;
+    AudioQueueRef aq;           /* NULL if unused */
+    void* dispatch_queue; // dispatch_queue_t, retained
+    void* owner; // VideoState * volatile *, captured by the callback block
+    AudioQueueBufferRef buffers[AUDIO_QUEUE_BUFFERS];
+    int64_t used;
+} PoolAudioQueue;
+
+typedef struct PoolSws {
+    int src_w, src_h, src_fmt, dst_w, dst_h, dst_fmt, flags;
+    struct SwsContext *ctx;     /* NULL if unused */
+    int64_t used;
+} PoolSws;
+
+typedef struct PoolSwr {
+    SwrCacheEntry entry;        /* entry.swr_ctx NULL if unused */
+    int64_t used;
+} PoolSwr;
+
+static PoolCodec pool_codecs[POOL_MAX_CODECS];
+static PoolAudioQueue pool_audio_queues[POOL_MAX_AUDIO_QUEUES];
+static PoolSws pool_sws[POOL_MAX_SWS];
+static PoolSwr pool_swr[POOL_MAX_SWR];
+static int64_t pool_clock;
+static volatile int64_t pool_hits, pool_misses;
+
+static LAVPmutex *pool_mutex(void)
+{
+    static dispatch_once_t once;
+    static LAVPmutex *mutex;
+    dispatch_once(&once, ^{
+        mutex = LAVPCreateMutex();
+    });
+    return mutex;
+}
+
+static void pool_count(int hit)
+{
+    if (hit)
+        OSAtomicIncrement64Barrier(&pool_hits);
+    else
+        OSAtomicIncrement64Barrier(&pool_misses);
+}
+
+#pragma mark -
+
+static uint32_t pool_hash(const uint8_t *data, int size)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void pool_codec_key(const AVCodecContext *avctx, int lowres, int low_latency, PoolCodecKey *key)
+{
+    memset(key, 0, sizeof(*key));
+    key->codec_id = avctx->codec_id;
+    key->codec_type = avctx->codec_type;
+    key->width = avctx->width;
+    key->height = avctx->height;
+    key->pix_fmt = avctx->pix_fmt;
+    key->sample_rate = avctx->sample_rate;
+    key->channels = avctx->channels;
+    key->sample_fmt = avctx->sample_fmt;
+    key->channel_layout = avctx->channel_layout;
+    key->lowres = lowres;
+    key->flags = avctx->flags;
+    key->flags2 = avctx->flags2;
+    key->low_latency = low_latency;
+    key->extradata_size = avctx->extradata_size;
+    if (avctx->extradata && avctx->extradata_size > 0)
+        key->extradata_hash = pool_hash(avctx->extradata, avctx->extradata_size);
+}
+
+/* same as avformat frees a stream's codec context */
+static void pool_free_codec(AVCodecContext *avctx)
+{
+    if (!avctx)
+        return;
+    avcodec_close(avctx);
+    av_freep(&avctx->extradata);
+    av_freep(&avctx->subtitle_header);
+    av_free(avctx);
+}
+
+/* per-player state a decoder must not carry from one clip to the next */
+static void pool_reset_codec(AVCodecContext *avctx)
+{
+    /* video_apply_degradation(); the next player starts at level 0 */
+    avctx->skip_frame = AVDISCARD_DEFAULT;
+    avctx->skip_loop_filter = AVDISCARD_DEFAULT;
+    avctx->skip_idct = AVDISCARD_DEFAULT;
+}
+
+/*
+ before avcodec_open2() of an audio or video stream: on a hit a parked decoder with the same
+ configuration replaces st->codec and 0 is returned; the caller skips opening.
+ */
+int pool_take_codec(VideoState *is, int stream_index, int lowres)
+{
+    AVStream *st = is->ic->streams[stream_index];
+    AVCodecContext *orig = st->codec, *avctx = NULL;
+    PoolBinding *b;
+    PoolCodecKey key;
+    
+    if (orig->codec_type != AVMEDIA_TYPE_AUDIO && orig->codec_type != AVMEDIA_TYPE_VIDEO)
+        return -1;
+    b = &is->pool_bindings[orig->codec_type];
+    pool_codec_key(orig, lowres, is->low_latency, &key);
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_CODECS; i++) {
+        PoolCodec *pc = &pool_codecs[i];
+        if (pc->avctx && !memcmp(&pc->key, &key, sizeof(key))) {
+            avctx = pc->avctx;
+            pc->avctx = NULL;
+            break;
+        }
+    }
+    LAVPUnlockMutex(pool_mutex());
+    pool_count(avctx != NULL);
+    
+    b->stream_index = stream_index;
+    b->key = key;
+    b->orig = NULL;
+    b->avctx = orig;
+    if (!avctx)
+        return -1;
+    
+    /* rebind to the new input and player */
+    pool_reset_codec(avctx);
+    avctx->workaround_bugs = is->workaround_bugs;
+    avctx->error_concealment = is->error_concealment;
+    avctx->time_base = orig->time_base;
+    avctx->sample_aspect_ratio = orig->sample_aspect_ratio;
+    av_codec_set_pkt_timebase(avctx, st->time_base);
+    avcodec_flush_buffers(avctx);
+    
+    b->orig = orig;
+    b->avctx = avctx;
+    st->codec = avctx;
+    return 0;
+}
+
+/* instead of avcodec_close() when the stream closes; parks the decoder if it can be reused */
+void pool_put_codec(VideoState *is, int stream_index)
+{
+    AVStream *st = is->ic->streams[stream_index];
+    AVCodecContext *avctx = st->codec, *replacement;
+    PoolBinding *b = NULL;
+    PoolCodec *slot = NULL;
+    
+    if (avctx->codec_type == AVMEDIA_TYPE_AUDIO || avctx->codec_type == AVMEDIA_TYPE_VIDEO)
+        b = &is->pool_bindings[avctx->codec_type];
+    if (!b || b->avctx != avctx || b->stream_index != stream_index || !avcodec_is_open(avctx)) {
+        avcodec_close(avctx);
+        return;
+    }
+    
+    /* the format context needs a context to free in its place */
+    replacement = b->orig;
+    if (!replacement) {
+        replacement = avcodec_alloc_context3(NULL);
+        if (!replacement || avcodec_copy_context(replacement, avctx) < 0) {
+            pool_free_codec(replacement);
+            avcodec_close(avctx);
+            b->avctx = NULL;
+            return;
+        }
+    }
+    st->codec = replacement;
+    b->orig = NULL;
+    b->avctx = NULL;
+    avcodec_flush_buffers(avctx);
+    pool_reset_codec(avctx);
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_CODECS; i++) {
+        PoolCodec *pc = &pool_codecs[i];
+        if (!slot || !pc->avctx || (slot->avctx && pc->used < slot->used))
+            slot = pc;
+    }
+    AVCodecContext *evicted = slot->avctx;
+    slot->key = b->key;
+    slot->avctx = avctx;
+    slot->used = ++pool_clock;
+    LAVPUnlockMutex(pool_mutex());
+    
+    pool_free_codec(evicted);
+}
+
+/* before avformat_close_input(); gives streams back their own contexts */
+void pool_unbind(VideoState *is)
+{
+    for (int i = 0; i < AVMEDIA_TYPE_NB; i++) {
+        PoolBinding *b = &is->pool_bindings[i];
+        if (b->orig && is->ic && b->stream_index < is->ic->nb_streams &&
+            is->ic->streams[b->stream_index]->codec == b->avctx) {
+            is->ic->streams[b->stream_index]->codec = b->orig;
+            pool_free_codec(b->avctx);
+        }
+        b->orig = NULL;
+        b->avctx = NULL;
+    }
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+static void pool_dispose_audio_queue(PoolAudioQueue *pa)
+{
+    if (!pa->aq)
+        return;
+    AudioQueueDispose(pa->aq, YES);
+    pa->aq = NULL;
+    if (pa->dispatch_queue) {
+        dispatch_queue_t queue = (__bridge_transfer dispatch_queue_t)pa->dispatch_queue;
+        queue = NULL; // ARC
+        pa->dispatch_queue = NULL;
+    }
+    av_freep(&pa->owner);
+}
+
+/* after LAVPFillASBD() and the buffer size are set; on a hit is->outAQ and its buffers are ready */
+int pool_take_audio_queue(VideoState *is)
+{
+    PoolAudioQueue found = {0};
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_AUDIO_QUEUES; i++) {
+        PoolAudioQueue *pa = &pool_audio_queues[i];
+        if (pa->aq && pa->buffer_size == is->audio_queue_buffer_size &&
+            !memcmp(&pa->asbd, &is->asbd, sizeof(is->asbd))) {
+            found = *pa;
+            memset(pa, 0, sizeof(*pa));
+            break;
+        }
+    }
+    LAVPUnlockMutex(pool_mutex());
+    pool_count(found.aq != NULL);
+    if (!found.aq)
+        return -1;
+    
+    *(VideoState * volatile *)found.owner = is;
+    is->outAQ = found.aq;
+    is->audioDispatchQueue = found.dispatch_queue;
+    is->audio_owner = found.owner;
+    memcpy(is->audio_queue_buffers, found.buffers, sizeof(found.buffers));
+    AudioQueueSetParameter(is->outAQ, kAudioQueueParam_Volume, 1.0);
+    return 0;
+}
+
+/* after AudioQueueStop()/AudioQueueReset(); 0 if parked and is->outAQ must not be disposed */
+int pool_put_audio_queue(VideoState *is)
+{
+    PoolAudioQueue *slot = NULL, evicted;
+    
+    if (!is->outAQ || !is->audioDispatchQueue || !is->audio_owner)
+        return -1;
+    
+    /* the callback sees NULL from here on; let one already running finish */
+    *(VideoState * volatile *)is->audio_owner = NULL;
+    dispatch_sync((__bridge dispatch_queue_t)is->audioDispatchQueue, ^{});
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_AUDIO_QUEUES; i++) {
+        PoolAudioQueue *pa = &pool_audio_queues[i];
+        if (!slot || !pa->aq || (slot->aq && pa->used < slot->used))
+            slot = pa;
+    }
+    evicted = *slot;
+    slot->asbd = is->asbd;
+    slot->buffer_size = is->audio_queue_buffer_size;
+    slot->aq = is->outAQ;
+    slot->dispatch_queue = is->audioDispatchQueue;
+    slot->owner = is->audio_owner;
+    memcpy(slot->buffers, is->audio_queue_buffers, sizeof(slot->buffers));
+    slot->used = ++pool_clock;
+    LAVPUnlockMutex(pool_mutex());
+    
+    pool_dispose_audio_queue(&evicted);
+    
+    is->outAQ = NULL;
+    is->audioDispatchQueue = NULL;
+    is->audio_owner = NULL;
+    return 0;
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+/* a parked scaler built for exactly these parameters, or NULL */
+struct SwsContext *pool_take_sws(int src_w, int src_h, int src_fmt, int dst_w, int dst_h, int dst_fmt, int flags)
+{
+    struct SwsContext *ctx = NULL;
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_SWS; i++) {
+        PoolSws *ps = &pool_sws[i];
+        if (ps->ctx && ps->src_w == src_w && ps->src_h == src_h && ps->src_fmt == src_fmt &&
+            ps->dst_w == dst_w && ps->dst_h == dst_h && ps->dst_fmt == dst_fmt && ps->flags == flags) {
+            ctx = ps->ctx;
+            ps->ctx = NULL;
+            break;
+        }
+    }
+    LAVPUnlockMutex(pool_mutex());
+    pool_count(ctx != NULL);
+    return ctx;
+}
+
+/* instead of sws_freeContext(); the parameters are read back from the context */
+void pool_put_sws(struct SwsContext *ctx)
+{
+    PoolSws *slot = NULL;
+    struct SwsContext *evicted;
+    int64_t v[7];
+    static const char *names[7] = {"srcw", "srch", "src_format", "dstw", "dsth", "dst_format", "sws_flags"};
+    
+    if (!ctx)
+        return;
+    for (int i = 0; i < 7; i++) {
+        if (av_opt_get_int(ctx, names[i], 0, &v[i]) < 0) {
+            sws_freeContext(ctx);
+            return;
+        }
+    }
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_SWS; i++) {
+        PoolSws *ps = &pool_sws[i];
+        if (!slot || !ps->ctx || (slot->ctx && ps->used < slot->used))
+            slot = ps;
+    }
+    evicted = slot->ctx;
+    *slot = (PoolSws){(int)v[0], (int)v[1], (int)v[2], (int)v[3], (int)v[4], (int)v[5], (int)v[6], ctx, ++pool_clock};
+    LAVPUnlockMutex(pool_mutex());
+    
+    sws_freeContext(evicted);
+}
+
+/* a parked resampler for the conversion in params, or NULL */
+struct SwrContext *pool_take_swr(const SwrCacheEntry *params)
+{
+    struct SwrContext *ctx = NULL;
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_SWR; i++) {
+        SwrCacheEntry *e = &pool_swr[i].entry;
+        if (e->swr_ctx &&
+            e->src_channel_layout == params->src_channel_layout &&
+            e->src_fmt            == params->src_fmt &&
+            e->src_freq           == params->src_freq &&
+            e->tgt_channel_layout == params->tgt_channel_layout &&
+            e->tgt_fmt            == params->tgt_fmt &&
+            e->tgt_freq           == params->tgt_freq) {
+            ctx = e->swr_ctx;
+            e->swr_ctx = NULL;
+            break;
+        }
+    }
+    LAVPUnlockMutex(pool_mutex());
+    pool_count(ctx != NULL);
+    return ctx;
+}
+
+/* instead of swr_free() of a cache entry; takes entry->swr_ctx */
+void pool_put_swr(SwrCacheEntry *entry)
+{
+    PoolSwr *slot = NULL;
+    struct SwrContext *evicted;
+    
+    if (!entry->swr_ctx)
+        return;
+    
+    LAVPLockMutex(pool_mutex());
+    for (int i = 0; i < POOL_MAX_SWR; i++) {
+        PoolSwr *ps = &pool_swr[i];
+        if (!slot || !ps->entry.swr_ctx || (slot->entry.swr_ctx && ps->used < slot->used))
+            slot = ps;
+    }
+    evicted = slot->entry.swr_ctx;
+    slot->entry = *entry;
+    slot->used = ++pool_clock;
+    LAVPUnlockMutex(pool_mutex());
+    
+    entry->swr_ctx = NULL;
+    swr_free(&evicted);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+/* free everything parked */
+void pool_drain(void)
+{
+    PoolCodec codecs[POOL_MAX_CODECS];
+    PoolAudioQueue queues[POOL_MAX_AUDIO_QUEUES];
+    PoolSws sws[POOL_MAX_SWS];
+    PoolSwr swr[POOL_MAX_SWR];
+    
+    LAVPLockMutex(pool_mutex());
+    memcpy(codecs, pool_codecs, sizeof(codecs));
+    memcpy(queues, pool_audio_queues, sizeof(queues));
+    memcpy(sws, pool_sws, sizeof(sws));
+    memcpy(swr, pool_swr, sizeof(swr));
+    memset(pool_codecs, 0, sizeof(pool_codecs));
+    memset(pool_audio_queues, 0, sizeof(pool_audio_queues));
+    memset(pool_sws, 0, sizeof(pool_sws));
+    memset(pool_swr, 0, sizeof(pool_swr));
+    LAVPUnlockMutex(pool_mutex());
+    
+    for (int i = 0; i < POOL_MAX_CODECS; i++)
+        pool_free_codec(codecs[i].avctx);
+    for (int i = 0; i < POOL_MAX_AUDIO_QUEUES; i++)
+        pool_dispose_audio_queue(&queues[i]);
+    for (int i = 0; i < POOL_MAX_SWS; i++)
+        sws_freeContext(sws[i].ctx);
+    for (int i = 0; i < POOL_MAX_SWR; i++)
+        swr_free(&swr[i].entry.swr_ctx);
+}
+
+/* process-wide; a miss is a context that had to be created */
+void pool_stats(int64_t *hits, int64_t *misses)
+{
+    if (hits) *hits = pool_hits;
+    if (misses) *misses = pool_misses;
+}
@@ -32,6 +32,7 @@
 void packet_queue_init(PacketQueue *q);
 void packet_queue_start(PacketQueue *q);
 void packet_queue_flush(PacketQueue *q);
+MyAVPacketList *packet_queue_detach(PacketQueue *q);
 void packet_queue_abort(PacketQueue *q);
 void packet_queue_destroy(PacketQueue *q);
 int packet_queue_put(PacketQueue *q, AVPacket *pkt);
@@ -36,6 +36,182 @@ static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt);
 
 /* =========================================================== */
 
+/*
+ Packet arena:
+ 
+ Packets without their own buffer (pkt->buf == NULL) had their payload copied to
+ a fresh heap allocation by av_dup_packet() and freed one by one, e.g. thousands
+ at once when a seek flushes the queues. Small payloads are now appended to large
+ per-queue slabs instead. Each packet still gets an AVBufferRef, so decoders can
+ keep referencing the data, and each one holds a count on its slab. An empty slab
+ goes back to the arena's free list as a whole, and a flush or serial change
+ retires the current slab so the previous segment is released in bulk.
+ 
+ The list nodes of a queue are recycled as well.
+ */
+
+#pragma mark -
+
+static void packet_slab_unref(PacketSlab *slab)
+{
+    PacketArena *arena = slab->arena;
+    int last = 0;
+    
+    if (OSAtomicDecrement32Barrier(&slab->refs) > 0)
+        return;
+    
+    LAVPLockMutex(arena->mutex);
+    if (arena->closed || arena->nb_free >= PACKET_ARENA_KEEP_SLABS) {
+        av_free(slab);
+        arena->nb_slabs--;
+        last = arena->closed && !arena->nb_slabs;
+    } else {
+        slab->used = 0;
+        slab->next = arena->free;
+        arena->free = slab;
+        arena->nb_free++;
+    }
+    LAVPUnlockMutex(arena->mutex);
+    
+    if (last) {
+        LAVPDestroyMutex(arena->mutex);
+        av_free(arena);
+    }
+}
+
+static void packet_arena_buffer_free(void *opaque, uint8_t *data)
+{
+    packet_slab_unref(opaque);
+}
+
+/* stop appending to the current slab; it is reused once its packets are gone */
+static void packet_arena_retire(PacketArena *arena)
+{
+    PacketSlab *slab;
+    
+    if (!arena)
+        return;
+    LAVPLockMutex(arena->mutex);
+    slab = arena->current;
+    arena->current = NULL;
+    LAVPUnlockMutex(arena->mutex);
+    
+    if (slab)
+        packet_slab_unref(slab);
+}
+
+/* caller holds arena->mutex */
+static PacketSlab *packet_arena_new_slab(PacketArena *arena)
+{
+    PacketSlab *slab = arena->free;
+    
+    if (slab) {
+        arena->free = slab->next;
+        arena->nb_free--;
+    } else {
+        slab = av_malloc(sizeof(PacketSlab));
+        if (!slab)
+            return NULL;
+        slab->arena = arena;
+        arena->nb_slabs++;
+    }
+    slab->next = NULL;
+    slab->used = 0;
+    slab->refs = 1;
+    return slab;
+}
+
+/* av_dup_packet() replacement */
+static int packet_arena_dup(PacketArena *arena, AVPacket *pkt)
+{
+    int need = FFALIGN(pkt->size + FF_INPUT_BUFFER_PADDING_SIZE, 16);
+    PacketSlab *slab, *retired = NULL;
+    AVBufferRef *buf = NULL;
+    uint8_t *data;
+    
+    if (!arena || pkt->buf || !pkt->data || pkt->side_data_elems || need > PACKET_ARENA_MAX_PACKET)
+        return av_dup_packet(pkt);
+    
+    LAVPLockMutex(arena->mutex);
+    slab = arena->current;
+    if (!slab || slab->used + need > PACKET_SLAB_SIZE) {
+        retired = slab;
+        slab = arena->current = packet_arena_new_slab(arena);
+    }
+    if (slab) {
+        data = slab->data + slab->used;
+        buf = av_buffer_create(data, pkt->size + FF_INPUT_BUFFER_PADDING_SIZE, packet_arena_buffer_free, slab, 0);
+        if (buf) {
+            OSAtomicIncrement32Barrier(&slab->refs);
+            slab->used += need;
+        }
+    }
+    LAVPUnlockMutex(arena->mutex);
+    
+    if (retired)
+        packet_slab_unref(retired);
+    if (!buf)
+        return av_dup_packet(pkt);
+    
+    memcpy(data, pkt->data, pkt->size);
+    memset(data + pkt->size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    pkt->buf = buf;
+    pkt->data = data;
+    return 0;
+}
+
+static PacketArena *packet_arena_alloc(void)
+{
+    PacketArena *arena = av_mallocz(sizeof(PacketArena));
+    
+    if (arena)
+        arena->mutex = LAVPCreateMutex();
+    return arena;
+}
+
+static void packet_arena_close(PacketArena *arena)
+{
+    PacketSlab *slab;
+    int last;
+    
+    if (!arena)
+        return;
+    packet_arena_retire(arena);
+    
+    LAVPLockMutex(arena->mutex);
+    arena->closed = 1;
+    while ((slab = arena->free)) {
+        arena->free = slab->next;
+        av_free(slab);
+        arena->nb_slabs--;
+    }
+    arena->nb_free = 0;
+    last = !arena->nb_slabs;
+    LAVPUnlockMutex(arena->mutex);
+    
+    /* otherwise decoders still hold packets; the last one frees the arena */
+    if (last) {
+        LAVPDestroyMutex(arena->mutex);
+        av_free(arena);
+    }
+}
+
+/* caller holds q->mutex */
+static void packet_queue_free_node(PacketQueue *q, MyAVPacketList *node)
+{
+    if (q->nb_free_nodes < PACKET_QUEUE_KEEP_NODES) {
+        node->next = q->free_nodes;
+        q->free_nodes = node;
+        q->nb_free_nodes++;
+    } else {
+        av_free(node);
+    }
+}
+
+/* =========================================================== */
+
+#pragma mark -
+
 /* packet queue handling */
 void packet_queue_init(PacketQueue *q)
 {
@@ -47,6 +223,8 @@ void packet_queue_init(PacketQueue *q)
     /* LAVP: Queue specific flush packet */
     av_init_packet(&q->flush_pkt);
 	q->flush_pkt.data= (uint8_t *)strdup("FLUSH");
+    
+    q->arena = packet_arena_alloc();
 }
 
 void packet_queue_start(PacketQueue *q)
@@ -62,18 +240,41 @@ void packet_queue_start(PacketQueue *q)
 void packet_queue_flush(PacketQueue *q)
 {
 	MyAVPacketList *pkt, *pkt1;
+    int64_t start = av_gettime();
+    int count = q->nb_packets;
 	
 	LAVPLockMutex(q->mutex);
 	for(pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
 		pkt1 = pkt->next;
 		av_free_packet(&pkt->pkt);
-		av_freep(&pkt);
+		packet_queue_free_node(q, pkt);  // LAVP:
 	}
 	q->last_pkt = NULL;
 	q->first_pkt = NULL;
 	q->nb_packets = 0;
 	q->size = 0;
 	LAVPUnlockMutex(q->mutex);
+    
+    /* LAVP: what follows belongs to the next segment */
+    packet_arena_retire(q->arena);
+    if (count)
+        av_log(NULL, AV_LOG_DEBUG, "packet_queue_flush: %d packets in %lld us\n", count, av_gettime() - start);
+}
+
+/* LAVP: unlink every queued packet at once, so a concurrent packet_queue_get() sees all or none;
+ the caller owns the returned nodes and their packets */
+MyAVPacketList *packet_queue_detach(PacketQueue *q)
+{
+    MyAVPacketList *first;
+    
+    LAVPLockMutex(q->mutex);
+    first = q->first_pkt;
+    q->first_pkt = NULL;
+    q->last_pkt = NULL;
+    q->nb_packets = 0;
+    q->size = 0;
+    LAVPUnlockMutex(q->mutex);
+    return first;
 }
 
 void packet_queue_abort(PacketQueue *q)
@@ -89,12 +290,22 @@ void packet_queue_abort(PacketQueue *q)
 
 void packet_queue_destroy(PacketQueue *q)
 {
+    MyAVPacketList *node;
+    
 	packet_queue_flush(q);
 	LAVPDestroyMutex(q->mutex);
 	LAVPDestroyCond(q->cond);
     
     /* LAVP: Queue specific flush packet */
     av_free_packet(&q->flush_pkt);
+    
+    while ((node = q->free_nodes)) {
+        q->free_nodes = node->next;
+        av_free(node);
+    }
+    q->nb_free_nodes = 0;
+    packet_arena_close(q->arena);
+    q->arena = NULL;
 }
 
 static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt)
@@ -104,7 +315,14 @@ static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt)
     if (q->abort_request)
         return -1;
     
-	pkt1 = av_malloc(sizeof(MyAVPacketList));
+    // LAVP: reuse a node if possible
+    pkt1 = q->free_nodes;
+    if (pkt1) {
+        q->free_nodes = pkt1->next;
+        q->nb_free_nodes--;
+    } else {
+        pkt1 = av_malloc(sizeof(MyAVPacketList));
+    }
 	if (!pkt1)
 		return -1;
 
@@ -112,6 +330,7 @@ static int packet_queue_put_private(PacketQueue *q, AVPacket *pkt)
 	if (!pkt) {
 		pkt = &q->flush_pkt;
         q->serial++;
+        packet_arena_retire(q->arena);
 	}
 	
 	pkt1->pkt = *pkt;
@@ -137,7 +356,7 @@ int packet_queue_put(PacketQueue *q, AVPacket *pkt)
     int ret;
     
     /* duplicate the packet */
-    if (pkt && pkt != &q->flush_pkt && av_dup_packet(pkt) < 0) // LAVP:
+    if (pkt && pkt != &q->flush_pkt && packet_arena_dup(q->arena, pkt) < 0) // LAVP:
         return -1;
     
 	LAVPLockMutex(q->mutex);
@@ -184,7 +403,7 @@ int packet_queue_get(PacketQueue *q, AVPacket *pkt, int block, int *serial)
 			*pkt = pkt1->pkt;
             if (serial)
                 *serial = pkt1->serial;
-			av_free(pkt1);
+			packet_queue_free_node(q, pkt1);  // LAVP:
 			ret = 1;
 			break;
 		} else if (!block) {
@@ -0,0 +1,40 @@
+/*
+ *  LAVPreverse.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPreverse_h__
+#define __LAVPreverse_h__
+
+#include "LAVPcommon.h"
+
+int reverse_start(VideoState *is);
+void reverse_stop(VideoState *is);
+void reverse_close(VideoState *is);
+void reverse_set_rate(VideoState *is, double rate);
+double reverse_rate(VideoState *is);
+int reverse_step(VideoState *is, int dir);
+int64_t reverse_cache_bytes(VideoState *is);
+
+int reverse_has_image(VideoState *is);
+int reverse_copy_image(VideoState *is, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height);
+
+#endif
@@ -0,0 +1,587 @@
+/*
+ *  LAVPreverse.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPvideo.h"
+#include "LAVPreverse.h"
+
+/* =========================================================== */
+
+/*
+ Reverse playback:
+ 
+ The forward pipeline (read_thread, video_thread, AudioQueue) stays paused while
+ reverse is active. reverse_thread owns a private demuxer and decoder; it decodes
+ each GOP forward from its keyframe and keeps the frames in a bounded cache sorted
+ by pts. The external clock runs with negative speed and copyImage() picks frames
+ from the cache. Before the play head reaches the oldest cached frame, the previous
+ GOP is decoded. If a GOP does not fit the budget, only its newest frames are kept
+ and the same GOP is decoded again for the older part.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+static void reverse_free_frame(ReverseFrame *rf)
+{
+    if (rf->frame) {
+        av_freep(&rf->frame->data[0]);
+        av_frame_free(&rf->frame);
+    }
+    rf->bytes = 0;
+}
+
+/* caller holds rev_mutex */
+static void reverse_clear(VideoState *is)
+{
+    for (int i = 0; i < is->rev_nb_frames; i++)
+        reverse_free_frame(&is->rev_frames[i]);
+    is->rev_nb_frames = 0;
+    is->rev_cache_bytes = 0;
+    is->reverse_at_start = 0;
+}
+
+/* index of the frame shown at pts (largest pts not after it), or 0; caller holds rev_mutex */
+static int reverse_index_for(VideoState *is, double pts)
+{
+    int lo = 0, hi = is->rev_nb_frames - 1, found = 0;
+    
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (is->rev_frames[mid].pts <= pts) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+static int reverse_open(VideoState *is)
+{
+    AVFormatContext *ic = NULL;
+    AVCodecContext *avctx = NULL;
+    AVCodec *codec = NULL;
+    AVDictionary *opts = NULL;
+    
+    if (avformat_open_input(&ic, is->filename, is->iformat, NULL) < 0)
+        goto fail;
+    if (avformat_find_stream_info(ic, NULL) < 0)
+        goto fail;
+    if (is->video_stream < 0 || is->video_stream >= ic->nb_streams)
+        goto fail;
+    
+    codec = avcodec_find_decoder(ic->streams[is->video_stream]->codec->codec_id);
+    if (!codec)
+        goto fail;
+    avctx = avcodec_alloc_context3(codec);
+    if (!avctx || avcodec_copy_context(avctx, ic->streams[is->video_stream]->codec) < 0)
+        goto fail;
+    
+    /* same picture size as the forward decoder */
+    av_codec_set_lowres(avctx, av_codec_get_lowres(is->video_st->codec));
+    avctx->workaround_bugs = is->workaround_bugs;
+    avctx->error_concealment = is->error_concealment;
+    
+    av_dict_set(&opts, "threads", "auto", 0);
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if (avcodec_open2(avctx, codec, &opts) < 0)
+        goto fail;
+    av_dict_free(&opts);
+    
+    for (int i = 0; i < ic->nb_streams; i++)
+        ic->streams[i]->discard = (i == is->video_stream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    
+    is->rev_ic = ic;
+    is->rev_avctx = avctx;
+    is->rev_frames = av_mallocz(sizeof(ReverseFrame) * REVERSE_CACHE_MAX_FRAMES);
+    is->rev_mutex = LAVPCreateMutex();
+    is->rev_cond = LAVPCreateCond();
+    return 0;
+    
+fail:
+    av_log(NULL, AV_LOG_ERROR, "%s: could not prepare reverse decoder\n", is->filename);
+    av_dict_free(&opts);
+    if (avctx) {
+        avcodec_close(avctx);
+        av_free(avctx);
+    }
+    if (ic)
+        avformat_close_input(&ic);
+    return -1;
+}
+
+static int reverse_store_frame(VideoState *is, AVFrame *src, double pts, ReverseFrame *rf)
+{
+    AVFrame *pict = av_frame_alloc();
+    int size;
+    
+    if (!pict)
+        return -1;
+    size = av_image_alloc(pict->data, pict->linesize, src->width, src->height, PIX_FMT_YUV420P, 0x10);
+    if (size < 0) {
+        av_frame_free(&pict);
+        return -1;
+    }
+    pict->width = src->width;
+    pict->height = src->height;
+    pict->format = PIX_FMT_YUV420P;
+    
+    if (src->format == PIX_FMT_YUV420P) {
+        av_image_copy(pict->data, pict->linesize, (const uint8_t **)src->data, src->linesize,
+                      PIX_FMT_YUV420P, src->width, src->height);
+    } else {
+        is->rev_convert_ctx = sws_getCachedContext(is->rev_convert_ctx,
+                                                   src->width, src->height, src->format,
+                                                   src->width, src->height, PIX_FMT_YUV420P,
+                                                   is->sws_flags, NULL, NULL, NULL);
+        if (!is->rev_convert_ctx) {
+            av_log(NULL, AV_LOG_ERROR, "Cannot initialize the conversion context\n");
+            av_freep(&pict->data[0]);
+            av_frame_free(&pict);
+            return -1;
+        }
+        sws_scale(is->rev_convert_ctx, (const uint8_t * const *)src->data, src->linesize,
+                  0, src->height, pict->data, pict->linesize);
+    }
+    
+    rf->pts = pts;
+    rf->frame = pict;
+    rf->bytes = size;
+    return 0;
+}
+
+/* decode forward from the keyframe before bound and keep the newest frames before bound.
+ returns the number of frames stored in seg (ascending pts) */
+static int reverse_decode_segment(VideoState *is, AVFrame *frame, double bound,
+                                  int max_frames, int64_t max_bytes, ReverseFrame *seg, int *at_start)
+{
+    AVStream *st = is->rev_ic->streams[is->video_stream];
+    double tb = av_q2d(st->time_base);
+    double start = (st->start_time != AV_NOPTS_VALUE) ? st->start_time * tb : 0.0;
+    double backoff = 0.0;
+    int nb = 0;
+    
+    *at_start = 0;
+    for (;;) {
+        double seekpts = FFMAX(start, bound - backoff - tb);
+        int64_t bytes = 0;
+        int dropped = 0, done = 0, draining = 0;
+        AVPacket pkt;
+        
+        if (av_seek_frame(is->rev_ic, is->video_stream, (int64_t)(seekpts / tb), AVSEEK_FLAG_BACKWARD) < 0) {
+            av_log(NULL, AV_LOG_ERROR, "%s: error while seeking (reverse)\n", is->filename);
+            return 0;
+        }
+        avcodec_flush_buffers(is->rev_avctx);
+        
+        while (!done && is->reverse && !is->abort_request) {
+            int got_picture = 0;
+            
+            if (!draining && av_read_frame(is->rev_ic, &pkt) < 0)
+                draining = 1;
+            if (draining) {
+                av_init_packet(&pkt);
+                pkt.data = NULL;
+                pkt.size = 0;
+            } else if (pkt.stream_index != is->video_stream) {
+                av_free_packet(&pkt);
+                continue;
+            }
+            
+            int ret = avcodec_decode_video2(is->rev_avctx, frame, &got_picture, &pkt);
+            if (!draining)
+                av_free_packet(&pkt);
+            if (ret < 0 || !got_picture) {
+                if (draining)
+                    break;
+                continue;
+            }
+            
+            int64_t ts = av_frame_get_best_effort_timestamp(frame);
+            if (ts != AV_NOPTS_VALUE) {
+                double pts = ts * tb;
+                if (pts >= bound) {
+                    done = 1;
+                } else {
+                    /* keep the newest frames; older ones are decoded again on the next pass */
+                    int64_t need = avpicture_get_size(PIX_FMT_YUV420P, frame->width, frame->height);
+                    while (nb && (nb >= max_frames || bytes + need > max_bytes)) {
+                        bytes -= seg[0].bytes;
+                        reverse_free_frame(&seg[0]);
+                        memmove(seg, seg + 1, sizeof(ReverseFrame) * --nb);
+                        dropped = 1;
+                    }
+                    if (reverse_store_frame(is, frame, pts, &seg[nb]) == 0) {
+                        bytes += seg[nb].bytes;
+                        nb++;
+                    }
+                }
+            }
+            av_frame_unref(frame);
+        }
+        
+        if (nb || seekpts <= start || !is->reverse || is->abort_request) {
+            *at_start = (seekpts <= start && !dropped);
+            return nb;
+        }
+        
+        /* the demuxer found no keyframe before bound; look further back */
+        backoff = backoff ? backoff * 2 : 1.0;
+    }
+}
+
+/* decide what to decode next; caller holds rev_mutex */
+static int reverse_need_decode(VideoState *is, double target, double *bound, int *max_frames, int64_t *max_bytes)
+{
+    ClockSnapshot snap;
+    int cur;
+    
+    clock_snapshot(&is->extclk, &snap);
+    
+    if (is->rev_nb_frames) {
+        double lo = is->rev_frames[0].pts;
+        double hi = is->rev_frames[is->rev_nb_frames - 1].pts;
+        
+        /* the play head jumped (seek or decoding fell behind); start over around it */
+        if (target > hi + REVERSE_PREFETCH_TIME || target < lo - REVERSE_PREFETCH_TIME)
+            reverse_clear(is);
+    }
+    
+    if (!is->rev_nb_frames) {
+        *bound = nextafter(target, INFINITY);
+        *max_frames = REVERSE_CACHE_MAX_FRAMES;
+        *max_bytes = REVERSE_CACHE_MAX_BYTES;
+        return 1;
+    }
+    
+    /* frames above the one on screen have been presented; drop them when space runs short */
+    cur = reverse_index_for(is, target);
+    while (is->rev_nb_frames > cur + 2 &&
+           (is->rev_cache_bytes > REVERSE_CACHE_MAX_BYTES / 2 || is->rev_nb_frames > REVERSE_CACHE_MAX_FRAMES / 2)) {
+        ReverseFrame *rf = &is->rev_frames[--is->rev_nb_frames];
+        is->rev_cache_bytes -= rf->bytes;
+        reverse_free_frame(rf);
+    }
+    
+    if (is->reverse_at_start)
+        return 0;
+    if (target - is->rev_frames[0].pts >= REVERSE_PREFETCH_TIME * FFMAX(1.0, fabs(snap.speed)))
+        return 0;
+    
+    *bound = is->rev_frames[0].pts;
+    *max_frames = REVERSE_CACHE_MAX_FRAMES - is->rev_nb_frames;
+    *max_bytes = REVERSE_CACHE_MAX_BYTES - is->rev_cache_bytes;
+    return (*max_frames > 0 && *max_bytes > 0);
+}
+
+static void reverse_thread(VideoState *is)
+{
+    AVFrame *frame = av_frame_alloc();
+    ReverseFrame *seg = av_mallocz(sizeof(ReverseFrame) * REVERSE_CACHE_MAX_FRAMES);
+    
+    LAVPLockMutex(is->rev_mutex);
+    while (is->reverse && !is->abort_request) {
+        @autoreleasepool {
+            double target = get_master_clock(is);
+            double bound;
+            int max_frames, nb, at_start;
+            int64_t max_bytes;
+            
+            /* stop at the beginning of the stream */
+            if (!isnan(target) && is->reverse_at_start && is->rev_nb_frames &&
+                target <= is->rev_frames[0].pts && reverse_rate(is) != 0.0) {
+                ClockSnapshot snap;
+                reverse_set_rate(is, 0.0);
+                clock_snapshot(&is->extclk, &snap);
+                set_clock(&is->extclk, is->rev_frames[0].pts, snap.serial);
+                is->eof_flag = 1;
+            }
+            
+            if (isnan(target) || !reverse_need_decode(is, target, &bound, &max_frames, &max_bytes)) {
+                LAVPCondWaitTimeout(is->rev_cond, is->rev_mutex, 10);
+                continue;
+            }
+            LAVPUnlockMutex(is->rev_mutex);
+            
+            nb = reverse_decode_segment(is, frame, bound, max_frames, max_bytes, seg, &at_start);
+            
+            LAVPLockMutex(is->rev_mutex);
+            
+            /* every new frame precedes the cached ones */
+            memmove(is->rev_frames + nb, is->rev_frames, sizeof(ReverseFrame) * is->rev_nb_frames);
+            memcpy(is->rev_frames, seg, sizeof(ReverseFrame) * nb);
+            is->rev_nb_frames += nb;
+            for (int i = 0; i < nb; i++)
+                is->rev_cache_bytes += seg[i].bytes;
+            if (at_start)
+                is->reverse_at_start = 1;
+        }
+    }
+    LAVPUnlockMutex(is->rev_mutex);
+    
+    av_free(seg);
+    av_frame_free(&frame);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+/* enter reverse mode; the forward pipeline must be paused by the caller */
+int reverse_start(VideoState *is)
+{
+    ClockSnapshot snap;
+    double pos;
+    
+    if (is->reverse)
+        return 0;
+    if (!is->video_st || is->realtime)
+        return -1;
+    if (!is->rev_ic && reverse_open(is) < 0)
+        return -1;
+    
+    /* continue from the picture on screen */
+    pos = (is->lastPTScopied >= 0) ? is->lastPTScopied : get_master_clock(is);
+    if (isnan(pos))
+        pos = 0.0;
+    
+    clock_snapshot(&is->extclk, &snap);
+    set_clock(&is->extclk, pos, snap.serial);
+    set_clock_paused(&is->extclk, 1);
+    
+    is->eof_flag = 0;
+    is->reverse = 1;
+    
+    // LAVP: Using dispatch queue
+    {
+        dispatch_queue_t reverse_queue = dispatch_queue_create("reverse", NULL);
+        dispatch_group_t reverse_group = dispatch_group_create();
+        is->reverse_queue = (__bridge_retained void*)reverse_queue;
+        is->reverse_group = (__bridge_retained void*)reverse_group;
+    }
+    dispatch_group_async((__bridge dispatch_group_t)is->reverse_group, (__bridge dispatch_queue_t)is->reverse_queue, ^(void){reverse_thread(is);});
+    return 0;
+}
+
+static void reverse_join(VideoState *is)
+{
+    is->reverse = 0;
+    
+    LAVPLockMutex(is->rev_mutex);
+    LAVPCondSignal(is->rev_cond);
+    LAVPUnlockMutex(is->rev_mutex);
+    
+    dispatch_group_wait((__bridge dispatch_group_t)is->reverse_group, DISPATCH_TIME_FOREVER);
+    {
+        dispatch_group_t reverse_group = (__bridge_transfer dispatch_group_t)is->reverse_group;
+        dispatch_queue_t reverse_queue = (__bridge_transfer dispatch_queue_t)is->reverse_queue;
+        reverse_group = NULL; // ARC
+        reverse_queue = NULL; // ARC
+        is->reverse_group = NULL;
+        is->reverse_queue = NULL;
+    }
+    
+    LAVPLockMutex(is->rev_mutex);
+    reverse_clear(is);
+    LAVPUnlockMutex(is->rev_mutex);
+}
+
+/* leave reverse mode and seek the forward pipeline to where reverse playback stopped */
+void reverse_stop(VideoState *is)
+{
+    ClockSnapshot snap;
+    double pos;
+    
+    if (!is->reverse)
+        return;
+    
+    pos = (is->lastPTScopied >= 0) ? is->lastPTScopied : get_master_clock(is);
+    reverse_join(is);
+    
+    if (is->playRate < 0)
+        is->playRate = -is->playRate;
+    
+    clock_snapshot(&is->extclk, &snap);
+    set_clock_speed(&is->extclk, is->playRate);
+    set_clock(&is->extclk, pos, snap.serial);
+    set_clock_paused(&is->extclk, is->paused);
+    
+    if (!isnan(pos))
+        stream_seek(is, (int64_t)(pos * AV_TIME_BASE), 0, 0);
+}
+
+void reverse_close(VideoState *is)
+{
+    if (is->reverse)
+        reverse_join(is);
+    
+    if (is->rev_avctx) {
+        avcodec_close(is->rev_avctx);
+        av_freep(&is->rev_avctx);
+    }
+    if (is->rev_ic)
+        avformat_close_input(&is->rev_ic);
+    if (is->rev_convert_ctx) {
+        sws_freeContext(is->rev_convert_ctx);
+        is->rev_convert_ctx = NULL;
+    }
+    if (is->rev_frames)
+        av_freep(&is->rev_frames);
+    if (is->rev_mutex) {
+        LAVPDestroyMutex(is->rev_mutex);
+        LAVPDestroyCond(is->rev_cond);
+        is->rev_mutex = NULL;
+        is->rev_cond = NULL;
+    }
+}
+
+/* rate is the magnitude of reverse speed; 0.0 holds the current picture */
+void reverse_set_rate(VideoState *is, double rate)
+{
+    ClockSnapshot snap;
+    double pos = clock_snapshot(&is->extclk, &snap);
+    
+    set_clock(&is->extclk, pos, snap.serial);
+    if (rate > 0.0)
+        set_clock_speed(&is->extclk, -rate);
+    set_clock_paused(&is->extclk, !(rate > 0.0));
+    
+    if (is->rev_cond)
+        LAVPCondSignal(is->rev_cond);
+}
+
+double reverse_rate(VideoState *is)
+{
+    ClockSnapshot snap;
+    clock_snapshot(&is->extclk, &snap);
+    return snap.paused ? 0.0 : snap.speed;
+}
+
+/* move to the previous (dir < 0) or next (dir > 0) cached frame.
+ returns -1 if the request can not be served from the reverse cache */
+int reverse_step(VideoState *is, int dir)
+{
+    ClockSnapshot snap;
+    double cur, target = NAN;
+    
+    if (!is->reverse && (dir > 0 || reverse_start(is) < 0))
+        return -1;
+    reverse_set_rate(is, 0.0);
+    
+    cur = (is->lastPTScopied >= 0) ? is->lastPTScopied : clock_snapshot(&is->extclk, &snap);
+    
+    LAVPLockMutex(is->rev_mutex);
+    if (is->rev_nb_frames) {
+        int i = reverse_index_for(is, cur);
+        if (dir < 0) {
+            if (is->rev_frames[i].pts >= cur)
+                i--;
+            if (i >= 0)
+                target = is->rev_frames[i].pts;
+        } else {
+            if (is->rev_frames[i].pts <= cur)
+                i++;
+            if (i < is->rev_nb_frames)
+                target = is->rev_frames[i].pts;
+        }
+    }
+    LAVPUnlockMutex(is->rev_mutex);
+    
+    if (isnan(target)) {
+        if (dir > 0)
+            return -1;
+        if (is->reverse_at_start)
+            return 0;
+        /* previous GOP is not decoded yet; the picture follows once it is */
+        target = cur - 0.001;
+    }
+    
+    clock_snapshot(&is->extclk, &snap);
+    set_clock(&is->extclk, target, snap.serial);
+    
+    LAVPLockMutex(is->rev_mutex);
+    LAVPCondSignal(is->rev_cond);
+    LAVPUnlockMutex(is->rev_mutex);
+    return 0;
+}
+
+int64_t reverse_cache_bytes(VideoState *is)
+{
+    int64_t bytes = 0;
+    
+    if (is->rev_mutex) {
+        LAVPLockMutex(is->rev_mutex);
+        bytes = is->rev_cache_bytes;
+        LAVPUnlockMutex(is->rev_mutex);
+    }
+    return bytes;
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+int reverse_has_image(VideoState *is)
+{
+    int ret;
+    
+    LAVPLockMutex(is->rev_mutex);
+    ret = (is->rev_nb_frames > 0);
+    LAVPUnlockMutex(is->rev_mutex);
+    return ret;
+}
+
+int reverse_copy_image(VideoState *is, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height)
+{
+    ReverseFrame *rf;
+    AVFrame *pict;
+    int result = 0;
+    
+    LAVPLockMutex(is->rev_mutex);
+    if (!is->rev_nb_frames)
+        goto bail;
+    
+    rf = &is->rev_frames[reverse_index_for(is, *targetpts)];
+    if (rf->pts == vc->lastPTScopied && width == vc->width && height == vc->height) {
+        result = 2;
+        goto bail;
+    }
+    
+    pict = rf->frame;
+    video_copy_picture(is, vc, pict, FFMIN(pict->width, is->width), FFMIN(pict->height, is->height),
+                       data, pitch, width, height);
+    
+    LAVPLockMutex(is->pictq_mutex);
+    consumer_copied(is, vc, rf->pts, width, height);
+    LAVPUnlockMutex(is->pictq_mutex);
+    
+    *targetpts = rf->pts;
+    result = 1;
+    
+bail:
+    LAVPUnlockMutex(is->rev_mutex);
+    return result;
+}
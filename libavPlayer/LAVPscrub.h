@@ -0,0 +1,43 @@
+/*
+ *  LAVPscrub.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPscrub_h__
+#define __LAVPscrub_h__
+
+#include "LAVPcommon.h"
+
+int scrub_request(VideoState *is, int64_t pos);
+void scrub_end(VideoState *is);
+void scrub_stop(VideoState *is);
+void scrub_close(VideoState *is);
+int64_t scrub_position(VideoState *is);
+double scrub_frame_rate(VideoState *is);
+int64_t scrub_refine_latency(VideoState *is);
+
+/* presentation */
+int scrub_has_image(VideoState *is);
+int scrub_copy_image(VideoState *is, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height);
+void scrub_picture_queued(VideoState *is, int serial, double pts);
+void scrub_presented(VideoState *is, int serial, double pts);
+
+#endif
@@ -0,0 +1,528 @@
+/*
+ *  LAVPscrub.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPvideo.h"
+#include "LAVPscrub.h"
+
+/* =========================================================== */
+
+/*
+ Scrub preview:
+ 
+ While the scrubber is dragged the forward pipeline is left alone. scrub_thread owns
+ a private demuxer and a decoder which skips everything but keyframes; for each
+ request it seeks to the keyframe at or before the position, decodes that one packet,
+ downscales it to SCRUB_MAX_WIDTH and keeps it in a small LRU cache keyed by the
+ keyframe dts, so dragging back and forth over the same area only reads the index.
+ Only the newest request matters: a newer one interrupts the demuxer and the decode
+ of an older one.
+ 
+ On release the forward pipeline seeks to the exact position. The keyframe stays on
+ screen until pictq has a picture of that seek within one frame of the position.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+static void scrub_free_frame(ScrubFrame *sf)
+{
+    if (sf->frame) {
+        av_freep(&sf->frame->data[0]);
+        av_frame_free(&sf->frame);
+    }
+    sf->key = AV_NOPTS_VALUE;
+}
+
+/* while opening; the first request has already moved scrub_req_gen past scrub_work_gen */
+static int scrub_open_interrupt_cb(void *ctx)
+{
+    VideoState *is = ctx;
+    return is->scrub_abort;
+}
+
+/* once open, a newer request abandons the keyframe being read */
+static int scrub_interrupt_cb(void *ctx)
+{
+    VideoState *is = ctx;
+    return is->scrub_abort || is->scrub_work_gen != is->scrub_req_gen;
+}
+
+static int scrub_open(VideoState *is)
+{
+    AVFormatContext *ic = avformat_alloc_context();
+    AVCodecContext *avctx = NULL;
+    AVCodec *codec = NULL;
+    AVDictionary *opts = NULL;
+    
+    if (!ic)
+        goto fail;
+    ic->interrupt_callback.callback = scrub_open_interrupt_cb;
+    ic->interrupt_callback.opaque = is;
+    if (avformat_open_input(&ic, is->filename, is->iformat, NULL) < 0)
+        goto fail;
+    if (avformat_find_stream_info(ic, NULL) < 0)
+        goto fail;
+    ic->interrupt_callback.callback = scrub_interrupt_cb;
+    if (is->video_stream < 0 || is->video_stream >= ic->nb_streams)
+        goto fail;
+    
+    codec = avcodec_find_decoder(ic->streams[is->video_stream]->codec->codec_id);
+    if (!codec)
+        goto fail;
+    avctx = avcodec_alloc_context3(codec);
+    if (!avctx || avcodec_copy_context(avctx, ic->streams[is->video_stream]->codec) < 0)
+        goto fail;
+    
+    avctx->workaround_bugs = is->workaround_bugs;
+    avctx->error_concealment = is->error_concealment;
+    avctx->skip_frame = AVDISCARD_NONKEY;
+    
+    /* no frame threading, so that one keyframe in gives one picture out */
+    av_dict_set(&opts, "threads", "1", 0);
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if (avcodec_open2(avctx, codec, &opts) < 0)
+        goto fail;
+    av_dict_free(&opts);
+    
+    for (int i = 0; i < ic->nb_streams; i++)
+        ic->streams[i]->discard = (i == is->video_stream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    
+    is->scrub_ic = ic;
+    is->scrub_avctx = avctx;
+    return 0;
+    
+fail:
+    av_log(NULL, AV_LOG_WARNING, "%s: could not prepare scrub decoder\n", is->filename);
+    av_dict_free(&opts);
+    if (avctx) {
+        avcodec_close(avctx);
+        av_free(avctx);
+    }
+    if (ic)
+        avformat_close_input(&ic);
+    return -1;
+}
+
+/* cache index holding the keyframe, or -1; caller holds scrub_mutex */
+static int scrub_lookup(VideoState *is, int64_t key)
+{
+    for (int i = 0; i < SCRUB_CACHE_FRAMES; i++) {
+        ScrubFrame *sf = &is->scrub_cache[i];
+        if (sf->frame && sf->key == key) {
+            sf->used = ++is->scrub_clock;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* downscaled YUV420P copy of src, stored in place of the least recently used entry */
+static int scrub_store(VideoState *is, AVFrame *src, int64_t key, double pts)
+{
+    AVFrame *pict = av_frame_alloc();
+    int width = FFMIN(src->width, SCRUB_MAX_WIDTH) & ~1;
+    int height = (int)av_rescale(src->height, width, src->width) & ~1;
+    int index = -1;
+    
+    if (!pict || width <= 0 || height <= 0)
+        goto fail;
+    if (av_image_alloc(pict->data, pict->linesize, width, height, PIX_FMT_YUV420P, 0x10) < 0)
+        goto fail;
+    pict->width = width;
+    pict->height = height;
+    pict->format = PIX_FMT_YUV420P;
+    
+    is->scrub_convert_ctx = sws_getCachedContext(is->scrub_convert_ctx,
+                                                 src->width, src->height, src->format,
+                                                 width, height, PIX_FMT_YUV420P,
+                                                 SWS_FAST_BILINEAR, NULL, NULL, NULL);
+    if (!is->scrub_convert_ctx) {
+        av_log(NULL, AV_LOG_ERROR, "Cannot initialize the conversion context\n");
+        goto fail;
+    }
+    sws_scale(is->scrub_convert_ctx, (const uint8_t * const *)src->data, src->linesize,
+              0, src->height, pict->data, pict->linesize);
+    
+    LAVPLockMutex(is->scrub_mutex);
+    for (int i = 0; i < SCRUB_CACHE_FRAMES; i++) {
+        ScrubFrame *sf = &is->scrub_cache[i];
+        if (i == is->scrub_shown)
+            continue;
+        if (index < 0 || !sf->frame || (is->scrub_cache[index].frame && sf->used < is->scrub_cache[index].used))
+            index = i;
+    }
+    scrub_free_frame(&is->scrub_cache[index]);
+    is->scrub_cache[index].key = key;
+    is->scrub_cache[index].pts = pts;
+    is->scrub_cache[index].frame = pict;
+    is->scrub_cache[index].used = ++is->scrub_clock;
+    LAVPUnlockMutex(is->scrub_mutex);
+    return index;
+    
+fail:
+    if (pict) {
+        av_freep(&pict->data[0]);
+        av_frame_free(&pict);
+    }
+    return -1;
+}
+
+/* cache index of the keyframe at or before pos (AV_TIME_BASE), or -1 if failed or outdated */
+static int scrub_keyframe(VideoState *is, int64_t pos, int32_t gen)
+{
+    AVFormatContext *ic = is->scrub_ic;
+    AVStream *st = ic->streams[is->video_stream];
+    AVFrame *frame = NULL;
+    AVPacket pkt;
+    int index = -1, got_picture = 0;
+    int entry;
+    
+    /* keyframes already in the demuxer index need no I/O when cached */
+    entry = av_index_search_timestamp(st, av_rescale_q(pos, AV_TIME_BASE_Q, st->time_base), AVSEEK_FLAG_BACKWARD);
+    if (entry >= 0) {
+        LAVPLockMutex(is->scrub_mutex);
+        index = scrub_lookup(is, st->index_entries[entry].timestamp);
+        LAVPUnlockMutex(is->scrub_mutex);
+        if (index >= 0)
+            return index;
+    }
+    
+    if (avformat_seek_file(ic, -1, INT64_MIN, pos, pos, 0) < 0 &&
+        avformat_seek_file(ic, -1, INT64_MIN, pos, INT64_MAX, 0) < 0)
+        return -1;
+    avcodec_flush_buffers(is->scrub_avctx);
+    frame = av_frame_alloc();
+    if (!frame)
+        return -1;
+    
+    for (int packets = 0; packets < SCRUB_MAX_PACKETS && gen == is->scrub_req_gen && !is->scrub_abort; packets++) {
+        int64_t key;
+        
+        if (av_read_frame(ic, &pkt) < 0)
+            break;
+        if (pkt.stream_index != is->video_stream || !(pkt.flags & AV_PKT_FLAG_KEY)) {
+            av_free_packet(&pkt);
+            continue;
+        }
+        
+        key = (pkt.dts != AV_NOPTS_VALUE) ? pkt.dts : pkt.pts;
+        LAVPLockMutex(is->scrub_mutex);
+        index = scrub_lookup(is, key);
+        LAVPUnlockMutex(is->scrub_mutex);
+        if (index >= 0) {
+            av_free_packet(&pkt);
+            break;
+        }
+        
+        avcodec_decode_video2(is->scrub_avctx, frame, &got_picture, &pkt);
+        av_free_packet(&pkt);
+        if (!got_picture) {
+            /* drain the decoder's delay */
+            av_init_packet(&pkt);
+            pkt.data = NULL;
+            pkt.size = 0;
+            avcodec_decode_video2(is->scrub_avctx, frame, &got_picture, &pkt);
+        }
+        avcodec_flush_buffers(is->scrub_avctx);
+        
+        if (got_picture) {
+            int64_t ts = av_frame_get_best_effort_timestamp(frame);
+            double pts = (ts == AV_NOPTS_VALUE) ? pos / (double)AV_TIME_BASE : ts * av_q2d(st->time_base);
+            index = scrub_store(is, frame, key, pts);
+            av_frame_unref(frame);
+            break;
+        }
+    }
+    
+    av_frame_free(&frame);
+    return index;
+}
+
+static void scrub_thread(VideoState *is)
+{
+    if (scrub_open(is) < 0) {
+        /* LAVP: scrub_request() reports it, so the caller falls back to seeking */
+        LAVPLockMutex(is->scrub_mutex);
+        is->scrub_failed = 1;
+        is->scrubbing = 0;
+        LAVPUnlockMutex(is->scrub_mutex);
+        return;
+    }
+    
+    LAVPLockMutex(is->scrub_mutex);
+    while (!is->scrub_abort) {
+        @autoreleasepool {
+            int32_t gen = is->scrub_req_gen;
+            int64_t pos = is->scrub_target;
+            int index;
+            
+            if (gen == is->scrub_work_gen || !is->scrubbing || is->scrub_refining) {
+                LAVPCondWait(is->scrub_cond, is->scrub_mutex);
+                continue;
+            }
+            is->scrub_work_gen = gen;
+            LAVPUnlockMutex(is->scrub_mutex);
+            
+            index = scrub_keyframe(is, pos, gen);
+            
+            LAVPLockMutex(is->scrub_mutex);
+            /* an outdated keyframe is still closer than the one on screen */
+            if (index >= 0 && !is->scrub_refining)
+                is->scrub_shown = index;
+        }
+    }
+    LAVPUnlockMutex(is->scrub_mutex);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+/* show the keyframe at or before pos (AV_TIME_BASE, same base as the master clock); starts scrubbing */
+int scrub_request(VideoState *is, int64_t pos)
+{
+    if (!is->video_st || (is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC))
+        return -1;
+    if (is->realtime || is->timeshift || is->offline || is->reverse)
+        return -1;
+    
+    if (!is->scrub_mutex) {
+        is->scrub_mutex = LAVPCreateMutex();
+        is->scrub_cond = LAVPCreateCond();
+        for (int i = 0; i < SCRUB_CACHE_FRAMES; i++)
+            is->scrub_cache[i].key = AV_NOPTS_VALUE;
+    }
+    
+    LAVPLockMutex(is->scrub_mutex);
+    if (is->scrub_failed) {
+        LAVPUnlockMutex(is->scrub_mutex);
+        
+        /* the worker has returned; nothing restarts it for this file */
+        if (is->scrub_group) {
+            dispatch_group_wait((__bridge dispatch_group_t)is->scrub_group, DISPATCH_TIME_FOREVER);
+            {
+                dispatch_group_t scrub_group = (__bridge_transfer dispatch_group_t)is->scrub_group;
+                dispatch_queue_t scrub_queue = (__bridge_transfer dispatch_queue_t)is->scrub_queue;
+                scrub_group = NULL; // ARC
+                scrub_queue = NULL; // ARC
+                is->scrub_group = NULL;
+                is->scrub_queue = NULL;
+            }
+        }
+        return -1;
+    }
+    if (!is->scrubbing || is->scrub_refining) {
+        is->scrubbing = 1;
+        is->scrub_refining = 0;
+        is->scrub_refine_start = 0;
+        is->scrub_shown = -1;
+        is->scrub_presented = 0;
+        is->scrub_begin_time = av_gettime();
+    }
+    is->scrub_target = pos;
+    OSAtomicIncrement32Barrier(&is->scrub_req_gen);
+    
+    if (!is->scrub_group) {
+        // LAVP: Using dispatch queue
+        dispatch_queue_t scrub_queue = dispatch_queue_create("scrub", NULL);
+        dispatch_group_t scrub_group = dispatch_group_create();
+        is->scrub_queue = (__bridge_retained void*)scrub_queue;
+        is->scrub_group = (__bridge_retained void*)scrub_group;
+        dispatch_group_async(scrub_group, scrub_queue, ^(void){scrub_thread(is);});
+    }
+    LAVPCondSignal(is->scrub_cond);
+    LAVPUnlockMutex(is->scrub_mutex);
+    return 0;
+}
+
+/* the scrubber was released; the caller seeks the forward pipeline to scrub_position() */
+void scrub_end(VideoState *is)
+{
+    double tolerance = 0.04;
+    double elapsed;
+    
+    if (!is->scrubbing || is->scrub_refining)
+        return;
+    
+    if (is->video_st && is->video_st->avg_frame_rate.num && is->video_st->avg_frame_rate.den)
+        tolerance = av_q2d(av_inv_q(is->video_st->avg_frame_rate));
+    
+    LAVPLockMutex(is->scrub_mutex);
+    elapsed = (av_gettime() - is->scrub_begin_time) / 1.0e6;
+    is->scrub_fps = (elapsed > 0) ? is->scrub_presented / elapsed : 0.0;
+    is->scrub_serial_min = is->videoq.serial + 1;
+    is->scrub_exact_pts = is->scrub_target / (double)AV_TIME_BASE - tolerance;
+    is->scrub_refine_start = av_gettime();
+    is->scrub_refining = 1;
+    OSAtomicIncrement32Barrier(&is->scrub_req_gen);   /* abandon a keyframe still being read */
+    LAVPUnlockMutex(is->scrub_mutex);
+    
+    av_log(NULL, AV_LOG_VERBOSE, "scrub: %d pictures in %.2f s (%.1f fps)\n",
+           is->scrub_presented, elapsed, is->scrub_fps);
+}
+
+/* the exact seek has settled; pictq presents from now on */
+void scrub_stop(VideoState *is)
+{
+    if (!is->scrub_mutex)
+        return;
+    
+    LAVPLockMutex(is->scrub_mutex);
+    if (is->scrub_refine_start) {
+        is->scrub_refine_latency = av_gettime() - is->scrub_refine_start;
+        is->scrub_refine_start = 0;
+    }
+    is->scrubbing = 0;
+    is->scrub_refining = 0;
+    is->scrub_shown = -1;
+    LAVPUnlockMutex(is->scrub_mutex);
+}
+
+int64_t scrub_position(VideoState *is)
+{
+    return is->scrub_target;
+}
+
+double scrub_frame_rate(VideoState *is)
+{
+    return is->scrub_fps;
+}
+
+int64_t scrub_refine_latency(VideoState *is)
+{
+    return is->scrub_refine_latency;
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+int scrub_has_image(VideoState *is)
+{
+    return is->scrubbing && is->scrub_shown >= 0;
+}
+
+int scrub_copy_image(VideoState *is, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height)
+{
+    ScrubFrame *sf;
+    int result = 0;
+    
+    LAVPLockMutex(is->scrub_mutex);
+    if (!is->scrubbing || is->scrub_shown < 0)
+        goto bail;
+    
+    sf = &is->scrub_cache[is->scrub_shown];
+    if (sf->pts == vc->lastPTScopied && width == vc->width && height == vc->height) {
+        result = 2;
+        goto bail;
+    }
+    
+    video_copy_picture(is, vc, sf->frame, sf->frame->width, sf->frame->height, data, pitch, width, height);
+    
+    LAVPLockMutex(is->pictq_mutex);
+    consumer_copied(is, vc, sf->pts, width, height);
+    LAVPUnlockMutex(is->pictq_mutex);
+    
+    if (!is->scrub_refining)
+        is->scrub_presented++;
+    *targetpts = sf->pts;
+    result = 1;
+    
+bail:
+    LAVPUnlockMutex(is->scrub_mutex);
+    return result;
+}
+
+/* queue_picture() published a picture; pictq takes over at the exact one */
+void scrub_picture_queued(VideoState *is, int serial, double pts)
+{
+    if (!is->scrub_refining || serial < is->scrub_serial_min || pts < is->scrub_exact_pts)
+        return;
+    
+    LAVPLockMutex(is->scrub_mutex);
+    if (is->scrub_refining && serial >= is->scrub_serial_min)
+        is->scrubbing = 0;
+    LAVPUnlockMutex(is->scrub_mutex);
+}
+
+/* a picture from pictq was copied; caller holds pictq_mutex */
+void scrub_presented(VideoState *is, int serial, double pts)
+{
+    int64_t start = is->scrub_refine_start;
+    
+    if (!start || serial < is->scrub_serial_min || pts < is->scrub_exact_pts)
+        return;
+    is->scrub_refine_start = 0;
+    is->scrub_refine_latency = av_gettime() - start;
+    av_log(NULL, AV_LOG_VERBOSE, "scrub: exact picture after %.1f ms\n", is->scrub_refine_latency / 1000.0);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+void scrub_close(VideoState *is)
+{
+    if (!is->scrub_mutex)
+        return;
+    
+    if (is->scrub_group) {
+        LAVPLockMutex(is->scrub_mutex);
+        is->scrub_abort = 1;
+        LAVPCondSignal(is->scrub_cond);
+        LAVPUnlockMutex(is->scrub_mutex);
+        
+        dispatch_group_wait((__bridge dispatch_group_t)is->scrub_group, DISPATCH_TIME_FOREVER);
+        {
+            dispatch_group_t scrub_group = (__bridge_transfer dispatch_group_t)is->scrub_group;
+            dispatch_queue_t scrub_queue = (__bridge_transfer dispatch_queue_t)is->scrub_queue;
+            scrub_group = NULL; // ARC
+            scrub_queue = NULL; // ARC
+            is->scrub_group = NULL;
+            is->scrub_queue = NULL;
+        }
+    }
+    
+    for (int i = 0; i < SCRUB_CACHE_FRAMES; i++)
+        scrub_free_frame(&is->scrub_cache[i]);
+    is->scrubbing = 0;
+    is->scrub_shown = -1;
+    
+    if (is->scrub_avctx) {
+        avcodec_close(is->scrub_avctx);
+        av_freep(&is->scrub_avctx);
+    }
+    if (is->scrub_ic)
+        avformat_close_input(&is->scrub_ic);
+    if (is->scrub_convert_ctx) {
+        sws_freeContext(is->scrub_convert_ctx);
+        is->scrub_convert_ctx = NULL;
+    }
+    
+    LAVPDestroyMutex(is->scrub_mutex);
+    LAVPDestroyCond(is->scrub_cond);
+    is->scrub_mutex = NULL;
+    is->scrub_cond = NULL;
+}
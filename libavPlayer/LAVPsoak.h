@@ -0,0 +1,42 @@
+/*
+ *  LAVPsoak.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef __LAVPsoak_h__
+#define __LAVPsoak_h__
+
+#include "LAVPcommon.h"
+
+int soak_open(VideoState *is, const StreamOptions *options);
+void soak_close(VideoState *is);
+void soak_report(VideoState *is, SoakReport *report);
+
+/* playback threads */
+void soak_picture(VideoState *is, double pts, double scheduled, double actual, int repeat);
+void soak_read_stall(VideoState *is);
+
+/* stream_component_open()/close() in place of the AudioQueue */
+void soak_audio_start(VideoState *is);
+void soak_audio_stop(VideoState *is);
+
+#endif
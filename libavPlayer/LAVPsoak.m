@@ -0,0 +1,419 @@
+/*
+ *  LAVPsoak.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "LAVPcore.h"
+#include "LAVPaudio.h"
+#include "LAVPsoak.h"
+
+/* =========================================================== */
+
+/*
+ Soak testing:
+ 
+ compute_target_delay(), synchronize_audio() and check_external_clock_speed() are
+ only as good as they hold up over hours on a loaded machine. With StreamOptions.soak
+ video_refresh() reports every picture it presents: the time frame_timer scheduled it
+ for, the time it was actually taken off pictq, and the A-V offset at that moment.
+ Lateness goes into a histogram of SOAK_JITTER_BIN wide bins, so percentiles cost
+ the same after an hour as after a minute; the A-V offset is averaged per
+ SOAK_DRIFT_INTERVAL of wall time and a least squares fit over those averages gives
+ the drift. With soak_path every picture is also written to a log, one line each.
+ 
+ The AudioQueue is replaced by a virtual device with an exact clock: a timer renders
+ periods of SOAK_AUDIO_PERIOD through audio_render() and stamps each with the time
+ it was due, not the time the timer fired. A late timer catches up, so the device
+ consumes samples at exactly the nominal rate and runs are comparable across
+ machines and audio hardware.
+ 
+ Load is injected on demand: soak_cpu_threads workers spin for soak_cpu_duty percent
+ of every SOAK_CPU_PERIOD, and read_thread sleeps soak_stall_ms once every
+ soak_stall_interval_ms before reading, which drains the packet queues like a slow
+ network or disk would. The summary is logged when the stream closes and appended to
+ the log as '#' lines; soak_report() reads it at any time.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+static void soak_cpu_worker(VideoState *is)
+{
+    int64_t busy = SOAK_CPU_PERIOD * is->soak_cpu_duty / 100;
+    volatile uint32_t state = 1;
+    
+    while (!is->soak_cpu_stop) {
+        int64_t start = av_gettime();
+        while (av_gettime() - start < busy)
+            state = state * 1664525 + 1013904223;
+        if (busy < SOAK_CPU_PERIOD)
+            usleep((useconds_t)(SOAK_CPU_PERIOD - busy));
+    }
+}
+
+static void soak_cpu_start(VideoState *is)
+{
+    // LAVP: Using dispatch queue
+    {
+        dispatch_queue_t cpu_queue = dispatch_queue_create("soak load", DISPATCH_QUEUE_CONCURRENT);
+        dispatch_group_t cpu_group = dispatch_group_create();
+        is->soak_cpu_queue = (__bridge_retained void*)cpu_queue;
+        is->soak_cpu_group = (__bridge_retained void*)cpu_group;
+    }
+    for (int i = 0; i < is->soak_cpu_threads; i++)
+        dispatch_group_async((__bridge dispatch_group_t)is->soak_cpu_group, (__bridge dispatch_queue_t)is->soak_cpu_queue, ^(void){soak_cpu_worker(is);});
+}
+
+static void soak_cpu_stop(VideoState *is)
+{
+    if (!is->soak_cpu_group)
+        return;
+    
+    is->soak_cpu_stop = 1;
+    dispatch_group_wait((__bridge dispatch_group_t)is->soak_cpu_group, DISPATCH_TIME_FOREVER);
+    {
+        dispatch_group_t cpu_group = (__bridge_transfer dispatch_group_t)is->soak_cpu_group;
+        dispatch_queue_t cpu_queue = (__bridge_transfer dispatch_queue_t)is->soak_cpu_queue;
+        cpu_group = NULL; // ARC
+        cpu_queue = NULL; // ARC
+        is->soak_cpu_group = NULL;
+        is->soak_cpu_queue = NULL;
+    }
+}
+
+#pragma mark -
+
+int soak_open(VideoState *is, const StreamOptions *options)
+{
+    /* offline processing has no schedule to measure */
+    if (!options->soak || is->offline)
+        return 0;
+    
+    is->soak_jitter = av_mallocz((SOAK_JITTER_BINS + 1) * sizeof(*is->soak_jitter));
+    if (!is->soak_jitter)
+        return AVERROR(ENOMEM);
+    
+    if (options->soak_path && *options->soak_path) {
+        is->soak_file = fopen(options->soak_path, "w");
+        if (!is->soak_file) {
+            int ret = AVERROR(errno);
+            av_log(NULL, AV_LOG_ERROR, "soak: cannot create %s\n", options->soak_path);
+            av_freep(&is->soak_jitter);
+            return ret;
+        }
+        fprintf(is->soak_file, "# %s\n", is->filename);
+        fprintf(is->soak_file, "# pts scheduled actual offset repeat\n");
+    }
+    
+    is->soak = 1;
+    is->soak_mutex = LAVPCreateMutex();
+    is->soak_start = is->soak_interval_start = av_gettime();
+    
+    if (options->soak_stall_ms > 0 && options->soak_stall_interval_ms > 0) {
+        is->soak_stall_usec = options->soak_stall_ms * 1000LL;
+        is->soak_stall_interval = options->soak_stall_interval_ms * 1000LL;
+        is->soak_next_stall = is->soak_start + is->soak_stall_interval;
+    }
+    
+    is->soak_cpu_duty = av_clip(options->soak_cpu_duty ? options->soak_cpu_duty : 100, 1, 100);
+    is->soak_cpu_threads = FFMAX(0, options->soak_cpu_threads);
+    if (is->soak_cpu_threads)
+        soak_cpu_start(is);
+    return 0;
+}
+
+void soak_close(VideoState *is)
+{
+    SoakReport r;
+    
+    if (!is->soak)
+        return;
+    
+    soak_cpu_stop(is);
+    soak_report(is, &r);
+    
+    av_log(NULL, AV_LOG_INFO, "soak: %s: %"PRId64" pictures in %.1f s; jitter p50 %.2f p99 %.2f p99.9 %.2f max %.2f ms; "
+           "offset mean %+.2f max %.2f ms, drift %+.2f ms/h; %"PRId64" dropped, %"PRId64" repeated, %"PRId64" stalls\n",
+           is->filename, r.frames, r.duration,
+           r.jitter_p50 * 1000, r.jitter_p99 * 1000, r.jitter_p999 * 1000, r.jitter_max * 1000,
+           r.offset_mean * 1000, r.offset_max * 1000, r.drift * 1000,
+           r.drops_early + r.drops_late, r.repeats, r.stalls);
+    
+    if (is->soak_file) {
+        fprintf(is->soak_file, "# duration %.3f\n", r.duration);
+        fprintf(is->soak_file, "# frames %"PRId64"\n", r.frames);
+        fprintf(is->soak_file, "# drops %"PRId64" early %"PRId64" late\n", r.drops_early, r.drops_late);
+        fprintf(is->soak_file, "# repeats %"PRId64"\n", r.repeats);
+        fprintf(is->soak_file, "# jitter p50 %.6f p90 %.6f p99 %.6f p99.9 %.6f max %.6f\n",
+                r.jitter_p50, r.jitter_p90, r.jitter_p99, r.jitter_p999, r.jitter_max);
+        fprintf(is->soak_file, "# offset mean %+.6f max %.6f\n", r.offset_mean, r.offset_max);
+        fprintf(is->soak_file, "# drift %+.6f per hour over %d intervals\n", r.drift, r.intervals);
+        fprintf(is->soak_file, "# stalls %"PRId64"\n", r.stalls);
+        fprintf(is->soak_file, "# audio periods %"PRId64"\n", r.audio_periods);
+        fclose(is->soak_file);
+        is->soak_file = NULL;
+    }
+    
+    av_freep(&is->soak_jitter);
+    av_freep(&is->soak_drift);
+    is->soak_nb_drift = is->soak_max_drift = 0;
+    LAVPDestroyMutex(is->soak_mutex);
+    is->soak_mutex = NULL;
+    is->soak = 0;
+}
+
+#pragma mark -
+
+/* called by video_refresh() for each picture taken off pictq; times from av_gettime() in seconds */
+void soak_picture(VideoState *is, double pts, double scheduled, double actual, int repeat)
+{
+    double jitter = fabs(actual - scheduled);
+    double offset;
+    int64_t now = av_gettime();
+    int bin;
+    
+    if (!is->soak)
+        return;
+    
+    if (is->audio_st)
+        offset = get_clock(&is->audclk) - get_clock(&is->vidclk);
+    else
+        offset = get_master_clock(is) - get_clock(&is->vidclk);
+    
+    bin = jitter < SOAK_JITTER_BINS * SOAK_JITTER_BIN ? (int)(jitter / SOAK_JITTER_BIN) : SOAK_JITTER_BINS;
+    
+    LAVPLockMutex(is->soak_mutex);
+    is->soak_frames++;
+    if (repeat)
+        is->soak_repeats++;
+    is->soak_jitter[bin]++;
+    is->soak_jitter_max = FFMAX(is->soak_jitter_max, jitter);
+    
+    if (!isnan(offset)) {
+        is->soak_offset_sum += offset;
+        is->soak_offset_count++;
+        is->soak_offset_max = FFMAX(is->soak_offset_max, fabs(offset));
+        is->soak_interval_sum += offset;
+        is->soak_interval_count++;
+    }
+    
+    /* close the drift interval; one without pictures (paused) leaves no point */
+    if (now - is->soak_interval_start >= SOAK_DRIFT_INTERVAL * 1000000LL) {
+        if (is->soak_interval_count) {
+            if (is->soak_nb_drift >= is->soak_max_drift) {
+                int max = FFMAX(64, is->soak_max_drift * 2);
+                double *drift = av_realloc(is->soak_drift, max * 2 * sizeof(double));
+                if (drift) {
+                    is->soak_drift = drift;
+                    is->soak_max_drift = max;
+                }
+            }
+            if (is->soak_nb_drift < is->soak_max_drift) {
+                double *point = is->soak_drift + 2 * is->soak_nb_drift++;
+                point[0] = (is->soak_interval_start + now - 2 * is->soak_start) / 2 / 3600.0e6;
+                point[1] = is->soak_interval_sum / is->soak_interval_count;
+            }
+        }
+        is->soak_interval_start = now;
+        is->soak_interval_sum = 0;
+        is->soak_interval_count = 0;
+    }
+    LAVPUnlockMutex(is->soak_mutex);
+    
+    if (is->soak_file)
+        fprintf(is->soak_file, "%.6f %.6f %.6f %+.6f %d\n", pts,
+                scheduled - is->soak_start / 1000000.0, actual - is->soak_start / 1000000.0,
+                isnan(offset) ? 0.0 : offset, repeat);
+}
+
+/* called by read_thread before each av_read_frame() */
+void soak_read_stall(VideoState *is)
+{
+    int64_t now, end;
+    
+    if (!is->soak_stall_interval)
+        return;
+    
+    now = av_gettime();
+    if (now < is->soak_next_stall)
+        return;
+    is->soak_next_stall = now + is->soak_stall_interval;
+    is->soak_stalls++;
+    
+    for (end = now + is->soak_stall_usec; av_gettime() < end && !is->abort_request; )
+        usleep(10*1000);
+}
+
+#pragma mark -
+
+static void soak_audio_tick(VideoState *is)
+{
+    int64_t now = av_gettime();
+    int size = is->soak_audio_frames * is->audio_tgt.frame_size;
+    
+    /* a paused device consumes nothing; it starts over on resume */
+    if (is->paused || is->audioq.abort_request) {
+        is->soak_audio_anchor = 0;
+        return;
+    }
+    if (!is->soak_audio_anchor) {
+        is->soak_audio_anchor = now;
+        is->soak_audio_due = 0;
+    }
+    
+    @autoreleasepool {
+        for (;;) {
+            int64_t due = is->soak_audio_anchor + is->soak_audio_due * is->soak_audio_frames * 1000000LL / is->audio_tgt.freq;
+            if (due > now)
+                break;
+            
+            /* more than a second behind (e.g. the machine slept); the device starts over */
+            if (now - due > 1000000) {
+                is->soak_audio_anchor = due = now;
+                is->soak_audio_due = 0;
+            }
+            
+            audio_render(is, is->soak_audio_buf, size, due);
+            is->soak_audio_due++;
+            is->soak_audio_periods++;
+        }
+    }
+}
+
+/* called by stream_component_open() in place of the AudioQueue */
+void soak_audio_start(VideoState *is)
+{
+    int frames = (int)(is->audio_tgt.freq * SOAK_AUDIO_PERIOD);
+    
+    is->soak_audio_buf = av_malloc(frames * is->audio_tgt.frame_size);
+    if (!is->soak_audio_buf) {
+        // Audio clock is not available
+        if (is->av_sync_type == AV_SYNC_AUDIO_MASTER)
+            is->av_sync_type = AV_SYNC_VIDEO_MASTER;
+        return;
+    }
+    is->soak_audio_frames = frames;
+    is->soak_audio_anchor = 0;
+    
+    {
+        dispatch_queue_t audio_queue = dispatch_queue_create("soak audio", NULL);
+        dispatch_source_t audio_timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, audio_queue);
+        uint64_t interval = (uint64_t)frames * NSEC_PER_SEC / is->audio_tgt.freq;
+        
+        dispatch_source_set_timer(audio_timer, dispatch_time(DISPATCH_TIME_NOW, 0), interval, interval / 10);
+        dispatch_source_set_event_handler(audio_timer, ^(void){soak_audio_tick(is);});
+        
+        is->soak_audio_queue = (__bridge_retained void*)audio_queue;
+        is->soak_audio_timer = (__bridge_retained void*)audio_timer;
+        
+        dispatch_resume(audio_timer);
+    }
+}
+
+/* audioq must be aborted before */
+void soak_audio_stop(VideoState *is)
+{
+    if (!is->soak_audio_timer)
+        return;
+    
+    {
+        dispatch_source_t audio_timer = (__bridge_transfer dispatch_source_t)is->soak_audio_timer;
+        dispatch_queue_t audio_queue = (__bridge_transfer dispatch_queue_t)is->soak_audio_queue;
+        
+        dispatch_source_cancel(audio_timer);
+        dispatch_sync(audio_queue, ^(void){}); /* wait for a tick in flight */
+        
+        audio_timer = NULL;
+        audio_queue = NULL;
+        is->soak_audio_timer = NULL;
+        is->soak_audio_queue = NULL;
+    }
+    av_freep(&is->soak_audio_buf);
+}
+
+#pragma mark -
+
+/* upper edge of the bin holding quantile q, but never above the largest value seen */
+static double soak_percentile(VideoState *is, double q)
+{
+    int64_t target = (int64_t)ceil(q * is->soak_frames), sum = 0;
+    
+    for (int i = 0; i <= SOAK_JITTER_BINS; i++) {
+        sum += is->soak_jitter[i];
+        if (sum > 0 && sum >= target)
+            return i < SOAK_JITTER_BINS ? FFMIN((i + 1) * SOAK_JITTER_BIN, is->soak_jitter_max) : is->soak_jitter_max;
+    }
+    return is->soak_jitter_max;
+}
+
+/* least squares slope of the interval averages, in seconds of offset per hour */
+static double soak_drift(VideoState *is)
+{
+    double mx = 0, my = 0, sxy = 0, sxx = 0;
+    int n = is->soak_nb_drift;
+    
+    if (n < 2)
+        return NAN;
+    for (int i = 0; i < n; i++) {
+        mx += is->soak_drift[2 * i];
+        my += is->soak_drift[2 * i + 1];
+    }
+    mx /= n;
+    my /= n;
+    for (int i = 0; i < n; i++) {
+        double dx = is->soak_drift[2 * i] - mx;
+        sxy += dx * (is->soak_drift[2 * i + 1] - my);
+        sxx += dx * dx;
+    }
+    return sxx > 0 ? sxy / sxx : NAN;
+}
+
+void soak_report(VideoState *is, SoakReport *report)
+{
+    memset(report, 0, sizeof(*report));
+    report->drift = NAN;
+    if (!is->soak)
+        return;
+    
+    LAVPLockMutex(is->soak_mutex);
+    report->duration = (av_gettime() - is->soak_start) / 1000000.0;
+    report->frames = is->soak_frames;
+    report->drops_early = is->frame_drops_early;
+    report->drops_late = is->frame_drops_late;
+    report->repeats = is->soak_repeats;
+    if (is->soak_frames) {
+        report->jitter_p50 = soak_percentile(is, 0.50);
+        report->jitter_p90 = soak_percentile(is, 0.90);
+        report->jitter_p99 = soak_percentile(is, 0.99);
+        report->jitter_p999 = soak_percentile(is, 0.999);
+        report->jitter_max = is->soak_jitter_max;
+    }
+    if (is->soak_offset_count)
+        report->offset_mean = is->soak_offset_sum / is->soak_offset_count;
+    report->offset_max = is->soak_offset_max;
+    report->drift = soak_drift(is);
+    report->intervals = is->soak_nb_drift;
+    report->stalls = is->soak_stalls;
+    report->audio_periods = is->soak_audio_periods;
+    LAVPUnlockMutex(is->soak_mutex);
+}
@@ -29,6 +29,7 @@
 #include "LAVPqueue.h"
 #include "LAVPsubs.h"
 #include "LAVPaudio.h"
+#include "LAVPtext.h"
 
 /* =========================================================== */
 
@@ -40,6 +41,7 @@
 void free_subpicture(SubPicture *sp)
 {
 	avsubtitle_free(&sp->sub);
+	av_freep(&sp->text);
 }
 
 void blend_subrect(AVPicture *dst, const AVSubtitleRect *rect, int imgw, int imgh)
@@ -288,13 +290,17 @@ int subtitle_thread(void *arg)
             
             avcodec_decode_subtitle2(is->subtitle_st->codec, &sp->sub,
                                      &got_subtitle, pkt);
-            if (got_subtitle && sp->sub.format == 0) {
+            if (got_subtitle) {
                 if (sp->sub.pts != AV_NOPTS_VALUE)
                     pts = sp->sub.pts / (double)AV_TIME_BASE;
                 sp->pts = pts;
                 sp->serial = serial;
                 
-                for (i = 0; i < sp->sub.num_rects; i++)
+                /* LAVP: text/ASS cues are rasterized when presented; see LAVPtext.m */
+                if (sp->sub.format != 0)
+                    sp->text = text_from_subtitle(&sp->sub, &sp->text_hash);
+                
+                for (i = 0; sp->sub.format == 0 && i < sp->sub.num_rects; i++)
                 {
                     for (j = 0; j < sp->sub.rects[i]->nb_colors; j++)
                     {
@@ -312,8 +318,6 @@ int subtitle_thread(void *arg)
                 LAVPLockMutex(is->subpq_mutex);
                 is->subpq_size++;
                 LAVPUnlockMutex(is->subpq_mutex);
-            } else if (got_subtitle) {
-                avsubtitle_free(&sp->sub);
             }
             av_free_packet(pkt);
 		}
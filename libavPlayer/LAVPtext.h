@@ -0,0 +1,36 @@
+/*
+ *  LAVPtext.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef __LAVPtext_h__
+#define __LAVPtext_h__
+
+#include "LAVPcommon.h"
+
+char *text_from_subtitle(const AVSubtitle *sub, uint32_t *hash);
+void text_composite(VideoState *is, VideoConsumer *vc, double pts, uint8_t *data, int pitch, int width, int height);
+void text_set_cache(VideoState *is, int enable);
+void text_stats(VideoState *is, int64_t *frames, int64_t *usec, int64_t *layouts);
+void text_close(VideoState *is);
+
+#endif
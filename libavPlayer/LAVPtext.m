@@ -0,0 +1,534 @@
+/*
+ *  LAVPtext.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include <CoreText/CoreText.h>
+
+#include "LAVPcore.h"
+#include "LAVPtext.h"
+
+/* =========================================================== */
+
+/*
+ Text subtitles:
+ 
+ subtitle_thread() keeps text and ASS cues as plain UTF-8 (text_from_subtitle()) next to
+ the AVSubtitle. When a picture is copied to a consumer, text_composite() looks up the
+ layout of the cue on screen for that output size. A layout is a list of quads into an
+ A8 glyph atlas, so a cue which stays up only costs the alpha blend of its glyphs.
+ 
+ On a miss the cue is broken into lines with CoreText; glyphs not yet in the atlas are
+ rasterized into it by shelf packing. When the atlas or its hash table fills up, both
+ are cleared and the layouts referring to them are rebuilt on their next use.
+ 
+ Text is white with a black drop shadow, centered at the bottom. ASS styles and override
+ tags are dropped. Runs after copyImage() has released pictq_mutex, so a layout miss never
+ holds up queue_picture(); text_mutex serializes the consumers over the shared atlas.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+static uint32_t text_hash_bytes(uint32_t h, const char *s, size_t len)
+{
+    /* FNV-1a */
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* skip the ASS event fields; the text follows the ninth comma */
+static const char *text_ass_body(const char *ass)
+{
+    const char *p = ass;
+    int commas = 0;
+    
+    if (strncmp(p, "Dialogue:", 9))
+        return p;
+    while (*p && commas < 9) {
+        if (*p++ == ',')
+            commas++;
+    }
+    return p;
+}
+
+/* copy s to out without override blocks; \N and \n break lines, \h is a space */
+static char *text_append(char *out, const char *s)
+{
+    while (*s) {
+        if (*s == '{') {
+            const char *end = strchr(s, '}');
+            if (end) {
+                s = end + 1;
+                continue;
+            }
+        }
+        if (s[0] == '\\' && (s[1] == 'N' || s[1] == 'n')) {
+            *out++ = '\n';
+            s += 2;
+            continue;
+        }
+        if (s[0] == '\\' && s[1] == 'h') {
+            *out++ = ' ';
+            s += 2;
+            continue;
+        }
+        if (*s == '\r') {
+            s++;
+            continue;
+        }
+        *out++ = *s++;
+    }
+    return out;
+}
+
+/* plain UTF-8 of a text/ASS AVSubtitle, av_malloc'ed; NULL if it has no text */
+char *text_from_subtitle(const AVSubtitle *sub, uint32_t *hash)
+{
+    size_t size = 1;
+    char *text, *out;
+    
+    for (int i = 0; i < sub->num_rects; i++) {
+        const AVSubtitleRect *rect = sub->rects[i];
+        if (rect->type == SUBTITLE_TEXT && rect->text)
+            size += strlen(rect->text) + 1;
+        else if (rect->type == SUBTITLE_ASS && rect->ass)
+            size += strlen(rect->ass) + 1;
+    }
+    if (size == 1)
+        return NULL;
+    
+    text = out = av_malloc(size);
+    if (!text)
+        return NULL;
+    for (int i = 0; i < sub->num_rects; i++) {
+        const AVSubtitleRect *rect = sub->rects[i];
+        if (out > text && out[-1] != '\n')
+            *out++ = '\n';
+        if (rect->type == SUBTITLE_TEXT && rect->text)
+            out = text_append(out, rect->text);
+        else if (rect->type == SUBTITLE_ASS && rect->ass)
+            out = text_append(out, text_ass_body(rect->ass));
+    }
+    while (out > text && (out[-1] == '\n' || out[-1] == ' '))
+        out--;
+    *out = 0;
+    
+    if (!*text) {
+        av_free(text);
+        return NULL;
+    }
+    *hash = text_hash_bytes(2166136261u, text, out - text) | 1;   /* 0 marks unused layouts */
+    return text;
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+static void text_reset_atlas(VideoState *is)
+{
+    memset(is->text_atlas, 0, TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE);
+    memset(is->text_glyphs, 0, sizeof(TextGlyph) * TEXT_GLYPH_SLOTS);
+    is->text_glyph_count = 0;
+    is->text_atlas_x = is->text_atlas_y = is->text_atlas_row = 0;
+    is->text_atlas_gen++;
+}
+
+static int text_prepare(VideoState *is, int height)
+{
+    int px = FFMAX(12, (int)(height * TEXT_FONT_SCALE));
+    
+    if (!is->text_atlas) {
+        is->text_atlas = av_mallocz(TEXT_ATLAS_SIZE * TEXT_ATLAS_SIZE);
+        is->text_glyphs = av_mallocz(sizeof(TextGlyph) * TEXT_GLYPH_SLOTS);
+        if (!is->text_atlas || !is->text_glyphs)
+            return -1;
+        CGContextRef ctx = CGBitmapContextCreate(is->text_atlas, TEXT_ATLAS_SIZE, TEXT_ATLAS_SIZE, 8,
+                                                 TEXT_ATLAS_SIZE, NULL, (CGBitmapInfo)kCGImageAlphaOnly);
+        if (!ctx)
+            return -1;
+        CGContextSetRGBFillColor(ctx, 1, 1, 1, 1);
+        CGContextSetShouldAntialias(ctx, true);
+        CGContextSetShouldSmoothFonts(ctx, false);
+        is->text_atlas_ctx = ctx;
+    }
+    if (!is->text_font || is->text_font_px != px) {
+        if (is->text_font)
+            CFRelease(is->text_font);
+        is->text_font = (void*)CTFontCreateWithName(CFSTR("Helvetica-Bold"), px, NULL);
+        is->text_font_px = px;
+    }
+    return is->text_font ? 0 : -1;
+}
+
+/* atlas entry of glyph in font, rasterized on a miss; NULL if it does not fit */
+static TextGlyph *text_glyph(VideoState *is, CTFontRef font, uint32_t font_id, CGGlyph glyph)
+{
+    uint16_t px = (uint16_t)lrint(CTFontGetSize(font));
+    uint32_t h = (font_id ^ (glyph * 2654435761u) ^ (px << 16)) % TEXT_GLYPH_SLOTS;
+    TextGlyph *g;
+    CGRect bounds;
+    int x0, y0, x1, y1, w, h2;
+    
+    for (;;) {
+        g = &is->text_glyphs[h];
+        if (!g->font)
+            break;
+        if (g->font == font_id && g->glyph == glyph && g->px == px)
+            return g;
+        h = (h + 1) % TEXT_GLYPH_SLOTS;
+    }
+    if (is->text_glyph_count >= TEXT_GLYPH_SLOTS * 3 / 4)
+        return NULL;
+    
+    CTFontGetBoundingRectsForGlyphs(font, kCTFontOrientationDefault, &glyph, &bounds, 1);
+    x0 = (int)floor(bounds.origin.x) - 1;
+    y0 = (int)floor(bounds.origin.y) - 1;
+    x1 = (int)ceil(bounds.origin.x + bounds.size.width) + 1;
+    y1 = (int)ceil(bounds.origin.y + bounds.size.height) + 1;
+    w = x1 - x0;
+    h2 = y1 - y0;
+    if (w > TEXT_ATLAS_SIZE || h2 > TEXT_ATLAS_SIZE)
+        return NULL;
+    
+    /* next shelf */
+    if (is->text_atlas_x + w > TEXT_ATLAS_SIZE) {
+        is->text_atlas_x = 0;
+        is->text_atlas_y += is->text_atlas_row;
+        is->text_atlas_row = 0;
+    }
+    if (is->text_atlas_y + h2 > TEXT_ATLAS_SIZE)
+        return NULL;
+    
+    g->font = font_id;
+    g->glyph = glyph;
+    g->px = px;
+    g->left = x0;
+    g->top = y1;
+    g->w = w;
+    g->h = h2;
+    g->ax = is->text_atlas_x;
+    g->ay = is->text_atlas_y;
+    is->text_glyph_count++;
+    is->text_atlas_x += w;
+    is->text_atlas_row = FFMAX(is->text_atlas_row, h2);
+    
+    /* CG is bottom-up; atlas row 0 is the top of the bitmap */
+    if (bounds.size.width > 0 && bounds.size.height > 0) {
+        CGPoint pos = CGPointMake(g->ax - x0, TEXT_ATLAS_SIZE - g->ay - h2 - y0);
+        CTFontDrawGlyphs(font, &glyph, &pos, 1, (CGContextRef)is->text_atlas_ctx);
+    }
+    return g;
+}
+
+static int text_add_quad(TextLayout *layout, int x, int y, const TextGlyph *g)
+{
+    if (layout->count == layout->capacity) {
+        int capacity = FFMAX(64, layout->capacity * 2);
+        TextQuad *quads = av_realloc(layout->quads, capacity * sizeof(TextQuad));
+        if (!quads)
+            return -1;
+        layout->quads = quads;
+        layout->capacity = capacity;
+    }
+    layout->quads[layout->count++] = (TextQuad){x, y, g->w, g->h, g->ax, g->ay};
+    return 0;
+}
+
+/* break text into at most TEXT_MAX_LINES lines no wider than max_width */
+static int text_break_lines(VideoState *is, const char *text, double max_width, CTLineRef *lines)
+{
+    CFDictionaryRef attr;
+    const void *keys[] = {kCTFontAttributeName};
+    const void *values[] = {is->text_font};
+    int nb = 0;
+    
+    attr = CFDictionaryCreate(NULL, keys, values, 1, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    while (*text && nb < TEXT_MAX_LINES) {
+        const char *end = strchr(text, '\n');
+        size_t len = end ? (size_t)(end - text) : strlen(text);
+        CFStringRef str = CFStringCreateWithBytes(NULL, (const UInt8 *)text, len, kCFStringEncodingUTF8, false);
+        
+        if (str && CFStringGetLength(str)) {
+            CFAttributedStringRef astr = CFAttributedStringCreate(NULL, str, attr);
+            CTTypesetterRef ts = CTTypesetterCreateWithAttributedString(astr);
+            CFIndex start = 0, length = CFStringGetLength(str);
+            
+            while (start < length && nb < TEXT_MAX_LINES) {
+                CFIndex count = CTTypesetterSuggestLineBreak(ts, start, max_width);
+                if (count <= 0)
+                    break;
+                lines[nb++] = CTTypesetterCreateLine(ts, CFRangeMake(start, count));
+                start += count;
+            }
+            CFRelease(ts);
+            CFRelease(astr);
+        }
+        if (str)
+            CFRelease(str);
+        text += len;
+        if (*text == '\n')
+            text++;
+    }
+    CFRelease(attr);
+    return nb;
+}
+
+/* place the glyphs of text, bottom centered in width x height */
+static int text_layout(VideoState *is, TextLayout *layout, const char *text, int width, int height)
+{
+    CTFontRef base = is->text_font;
+    CTLineRef lines[TEXT_MAX_LINES];
+    double line_height = CTFontGetAscent(base) + CTFontGetDescent(base) + CTFontGetLeading(base);
+    double baseline;
+    int nb, ret = 0;
+    
+    layout->count = 0;
+    nb = text_break_lines(is, text, width * 0.9, lines);
+    baseline = height - height * TEXT_MARGIN_SCALE - CTFontGetDescent(base) - (nb - 1) * line_height;
+    
+    for (int l = 0; l < nb; l++, baseline += line_height) {
+        double line_width = CTLineGetTypographicBounds(lines[l], NULL, NULL, NULL);
+        double x = (width - line_width) / 2;
+        CFArrayRef runs = CTLineGetGlyphRuns(lines[l]);
+        
+        for (CFIndex r = 0; r < CFArrayGetCount(runs) && ret == 0; r++) {
+            CTRunRef run = CFArrayGetValueAtIndex(runs, r);
+            CTFontRef font = CFDictionaryGetValue(CTRunGetAttributes(run), kCTFontAttributeName);
+            CFIndex count = CTRunGetGlyphCount(run);
+            uint32_t font_id;
+            
+            if (count <= 0)
+                continue;
+            CGGlyph glyphs[count];
+            CGPoint positions[count];
+            if (!font)
+                font = base;
+            CFStringRef name = CTFontCopyPostScriptName(font);
+            font_id = (uint32_t)CFHash(name) | 1;
+            CFRelease(name);
+            
+            CTRunGetGlyphs(run, CFRangeMake(0, 0), glyphs);
+            CTRunGetPositions(run, CFRangeMake(0, 0), positions);
+            for (CFIndex i = 0; i < count; i++) {
+                TextGlyph *g = text_glyph(is, font, font_id, glyphs[i]);
+                if (!g) {
+                    ret = AVERROR(ENOSPC);
+                    break;
+                }
+                if (text_add_quad(layout, lrint(x + positions[i].x) + g->left,
+                                  lrint(baseline - positions[i].y) - g->top, g) < 0) {
+                    ret = AVERROR(ENOMEM);
+                    break;
+                }
+            }
+        }
+        CFRelease(lines[l]);
+    }
+    
+    layout->width = width;
+    layout->height = height;
+    layout->atlas_gen = is->text_atlas_gen;
+    is->text_layouts_built++;
+    return ret;
+}
+
+/* cached layout of the cue for this output size; NULL on a miss */
+static TextLayout *text_cached_layout(VideoState *is, uint32_t hash, int width, int height)
+{
+    if (!is->text_cache)
+        return NULL;
+    for (int i = 0; i < TEXT_LAYOUT_CACHE; i++) {
+        TextLayout *l = &is->text_layouts[i];
+        if (l->hash == hash && l->width == width && l->height == height &&
+            l->atlas_gen == is->text_atlas_gen) {
+            l->used = ++is->text_clock;
+            return l;
+        }
+    }
+    return NULL;
+}
+
+/* lay out the cue into the least recently used slot; NULL on failure */
+static TextLayout *text_build_layout(VideoState *is, uint32_t hash, const char *text, int width, int height)
+{
+    TextLayout *layout = NULL;
+    int ret;
+    
+    for (int i = 0; i < TEXT_LAYOUT_CACHE; i++) {
+        TextLayout *l = &is->text_layouts[i];
+        if (!layout || l->used < layout->used)
+            layout = l;
+    }
+    
+    if (text_prepare(is, height) < 0)
+        return NULL;
+    if (!is->text_cache)
+        text_reset_atlas(is);
+    
+    ret = text_layout(is, layout, text, width, height);
+    if (ret == AVERROR(ENOSPC)) {
+        /* atlas full; start over with only this cue */
+        text_reset_atlas(is);
+        ret = text_layout(is, layout, text, width, height);
+    }
+    if (ret < 0) {
+        layout->hash = 0;
+        return NULL;
+    }
+    layout->hash = hash;
+    layout->used = ++is->text_clock;
+    return layout;
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+static inline uint8_t text_blend(int dst, int src, int a)
+{
+    return dst + (((src - dst) * a + 127) / 255);
+}
+
+static void text_blit(VideoState *is, const TextLayout *layout, uint32_t pixel_format,
+                      uint8_t *data, int pitch, int width, int height, int offset, int luma)
+{
+    /* luma: 235 for the text, 16 for its shadow; BGRA uses the full range */
+    int rgb = (luma > 128) ? 255 : 0;
+    
+    for (int q = 0; q < layout->count; q++) {
+        const TextQuad *quad = &layout->quads[q];
+        int x0 = FFMAX(0, quad->x + offset), x1 = FFMIN(width, quad->x + offset + quad->w);
+        int y0 = FFMAX(0, quad->y + offset), y1 = FFMIN(height, quad->y + offset + quad->h);
+        
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *src = is->text_atlas + (quad->ay + y - quad->y - offset) * TEXT_ATLAS_SIZE
+                               + quad->ax - quad->x - offset;
+            uint8_t *row = data + y * pitch;
+            
+            if (pixel_format == VIDEO_CONSUMER_BGRA) {
+                for (int x = x0; x < x1; x++) {
+                    int a = src[x];
+                    if (!a)
+                        continue;
+                    uint8_t *p = row + x * 4;
+                    p[0] = text_blend(p[0], rgb, a);
+                    p[1] = text_blend(p[1], rgb, a);
+                    p[2] = text_blend(p[2], rgb, a);
+                }
+            } else {
+                /* 2vuy: U0 Y0 V0 Y1 */
+                for (int x = x0; x < x1; x++) {
+                    int a = src[x];
+                    if (!a)
+                        continue;
+                    uint8_t *p = row + (x & ~1) * 2;
+                    p[(x & 1) ? 3 : 1] = text_blend(p[(x & 1) ? 3 : 1], luma, a);
+                    p[0] = text_blend(p[0], 128, a);
+                    p[2] = text_blend(p[2], 128, a);
+                }
+            }
+        }
+    }
+}
+
+/* draw the text cue shown at pts over a copied picture; called without pictq_mutex */
+void text_composite(VideoState *is, VideoConsumer *vc, double pts, uint8_t *data, int pitch, int width, int height)
+{
+    SubPicture *sp;
+    TextLayout *layout = NULL;
+    char *text = NULL;
+    uint32_t hash = 0;
+    int64_t start;
+    
+    if (!is->subtitle_st || !is->subpq || !is->subpq_size)
+        return;
+    
+    start = av_gettime();
+    LAVPLockMutex(is->text_mutex);
+    
+    /* snapshot the cue; subtitle_thread is only held off for the lookup */
+    LAVPLockMutex(is->subpq_mutex);
+    sp = &is->subpq[is->subpq_rindex];
+    if (is->subpq_size > 0 && sp->text && sp->serial == is->subtitleq.serial &&
+        pts >= sp->pts + sp->sub.start_display_time / 1000.0 &&
+        pts <= sp->pts + sp->sub.end_display_time / 1000.0) {
+        hash = sp->text_hash;
+        layout = text_cached_layout(is, hash, width, height);
+        if (!layout)
+            text = av_strdup(sp->text);
+    }
+    LAVPUnlockMutex(is->subpq_mutex);
+    
+    if (text) {
+        layout = text_build_layout(is, hash, text, width, height);
+        av_free(text);
+    }
+    
+    if (layout && layout->count) {
+        int shadow = FFMAX(1, height / 360);
+        text_blit(is, layout, vc->pixel_format, data, pitch, width, height, shadow, 16);
+        text_blit(is, layout, vc->pixel_format, data, pitch, width, height, 0, 235);
+        
+        is->text_frames++;
+        is->text_usec += av_gettime() - start;
+    }
+    LAVPUnlockMutex(is->text_mutex);
+}
+
+/* NO lays out and rasterizes every frame; for measuring the caches */
+void text_set_cache(VideoState *is, int enable)
+{
+    LAVPLockMutex(is->text_mutex);
+    is->text_cache = enable;
+    LAVPUnlockMutex(is->text_mutex);
+}
+
+void text_stats(VideoState *is, int64_t *frames, int64_t *usec, int64_t *layouts)
+{
+    LAVPLockMutex(is->text_mutex);
+    if (frames) *frames = is->text_frames;
+    if (usec) *usec = is->text_usec;
+    if (layouts) *layouts = is->text_layouts_built;
+    LAVPUnlockMutex(is->text_mutex);
+}
+
+void text_close(VideoState *is)
+{
+    for (int i = 0; i < TEXT_LAYOUT_CACHE; i++) {
+        av_freep(&is->text_layouts[i].quads);
+        is->text_layouts[i].hash = 0;
+    }
+    if (is->text_atlas_ctx)
+        CGContextRelease((CGContextRef)is->text_atlas_ctx);
+    is->text_atlas_ctx = NULL;
+    if (is->text_font)
+        CFRelease(is->text_font);
+    is->text_font = NULL;
+    av_freep(&is->text_atlas);
+    av_freep(&is->text_glyphs);
+}
@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <mach/mach_time.h>
 #include <sys/time.h>
+#include <sched.h>
 
 void LAVPCondWait(LAVPcond *cond, LAVPmutex *mutex)
 {
@@ -93,6 +94,13 @@ void LAVPLockMutex(LAVPmutex *mutex){
 	pthread_mutex_lock(mutex);
 }
 
+int LAVPTryLockMutex(LAVPmutex *mutex)
+{
+	//assert(mutex);
+	
+	return pthread_mutex_trylock(mutex);
+}
+
 void LAVPUnlockMutex(LAVPmutex *mutex)
 {
 	//assert(mutex);
@@ -116,3 +124,35 @@ LAVPmutex* LAVPCreateMutex()
 	return mutex;
 }
 
+/* =========================================================== */
+
+void LAVPSeqWriteBegin(LAVPseqlock *seq)
+{
+	// Writers may come from several threads; only one may hold the odd count
+	for (;;) {
+		int32_t start = seq->sequence;
+		if (!(start & 1) && OSAtomicCompareAndSwap32Barrier(start, start + 1, &seq->sequence))
+			break;
+		sched_yield();
+	}
+}
+
+void LAVPSeqWriteEnd(LAVPseqlock *seq)
+{
+	OSAtomicIncrement32Barrier(&seq->sequence);
+}
+
+int32_t LAVPSeqReadBegin(LAVPseqlock *seq)
+{
+	int32_t start;
+	while ((start = seq->sequence) & 1)
+		sched_yield();
+	OSMemoryBarrier();
+	return start;
+}
+
+int LAVPSeqReadRetry(LAVPseqlock *seq, int32_t start)
+{
+	OSMemoryBarrier();
+	return seq->sequence != start;
+}
@@ -27,6 +27,8 @@
 #define __LAVPthread_h__
 
 #include <pthread.h>
+#include <stdint.h>
+#include <libkern/OSAtomic.h>
 
 typedef pthread_cond_t LAVPcond;
 typedef pthread_mutex_t LAVPmutex;
@@ -40,6 +42,17 @@ void LAVPCondSignal(LAVPcond *cond);
 LAVPmutex* LAVPCreateMutex(void);
 void LAVPDestroyMutex(LAVPmutex *mutex);
 void LAVPLockMutex(LAVPmutex *mutex);
+int LAVPTryLockMutex(LAVPmutex *mutex);    /* 0 if the lock was taken */
 void LAVPUnlockMutex(LAVPmutex *mutex);
 
+/* LAVP: sequence lock for lock-free readers of small published values */
+typedef struct LAVPseqlock {
+    volatile int32_t sequence;     /* odd while a writer is active */
+} LAVPseqlock;
+
+void LAVPSeqWriteBegin(LAVPseqlock *seq);
+void LAVPSeqWriteEnd(LAVPseqlock *seq);
+int32_t LAVPSeqReadBegin(LAVPseqlock *seq);
+int LAVPSeqReadRetry(LAVPseqlock *seq, int32_t start);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,41 @@
+/*
+ *  LAVPtimeshift.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPtimeshift_h__
+#define __LAVPtimeshift_h__
+
+#include "LAVPcommon.h"
+
+int timeshift_open(VideoState *is, int64_t bytes);
+int timeshift_get(VideoState *is, int64_t *start, int64_t *end);
+int64_t timeshift_ingest_usec(VideoState *is);
+int64_t timeshift_seek_usec(VideoState *is);
+
+/* read_thread */
+int timeshift_input_packet(VideoState *is, AVPacket *pkt);
+int timeshift_input_eof(VideoState *is);
+int timeshift_feed(VideoState *is);
+int timeshift_seek(VideoState *is, int64_t target);
+void timeshift_close(VideoState *is);
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ *  LAVPtimeshift.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "LAVPcore.h"
+#include "LAVPqueue.h"
+#include "LAVPtimeshift.h"
+
+/* =========================================================== */
+
+/*
+ Timeshift:
+ 
+ For live sources read_thread no longer queues what it demuxes. Every packet is
+ appended as a record to a fixed-size ring in an unlinked, memory-mapped temporary
+ file, and a TimeshiftEntry (offset, time, stream, flags) is added to an in-memory
+ index. The oldest records are overwritten once the ring is full, so the window
+ is bounded by the file size rather than by RAM.
+ 
+ The decoder queues are fed from a cursor into the index under the usual queue
+ limits. Pausing stops the consumption while the ingest continues, seeking moves
+ the cursor to the keyframe before the target (binary search over the index), and
+ seeking past the end returns to the newest keyframe, i.e. live.
+ 
+ All of it runs on read_thread; only the window bounds are published for readers.
+ */
+
+typedef struct TimeshiftRecord {
+    int64_t pts, dts, pos;
+    int32_t size, stream_index, flags, duration;
+} TimeshiftRecord;
+
+#define TIMESHIFT_ALIGN(x) (((x) + 7) & ~(int64_t)7)
+
+/* =========================================================== */
+
+#pragma mark -
+
+static int64_t timeshift_packet_time(VideoState *is, AVPacket *pkt)
+{
+    int64_t ts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+    
+    if (ts == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+    return av_rescale_q(ts, is->ic->streams[pkt->stream_index]->time_base, AV_TIME_BASE_Q);
+}
+
+static void timeshift_publish(VideoState *is, int64_t end)
+{
+    LAVPSeqWriteBegin(&is->ts_seq);
+    is->ts_start = is->ts_count ? is->ts_index[is->ts_first].time : end;
+    is->ts_end = end;
+    LAVPSeqWriteEnd(&is->ts_seq);
+}
+
+static void timeshift_drop_oldest(VideoState *is)
+{
+    is->ts_first++;
+    is->ts_count--;
+    is->ts_base++;
+}
+
+static TimeshiftEntry *timeshift_index_push(VideoState *is)
+{
+    TimeshiftEntry *index;
+    
+    /* reuse the room left by dropped entries before growing */
+    if (is->ts_first && is->ts_first >= is->ts_count) {
+        memmove(is->ts_index, is->ts_index + is->ts_first, is->ts_count * sizeof(*index));
+        is->ts_first = 0;
+    }
+    index = av_fast_realloc(is->ts_index, &is->ts_index_size,
+                            (is->ts_first + is->ts_count + 1) * sizeof(*index));
+    if (!index)
+        return NULL;
+    is->ts_index = index;
+    return &index[is->ts_first + is->ts_count++];
+}
+
+#pragma mark -
+
+int timeshift_open(VideoState *is, int64_t bytes)
+{
+    char path[PATH_MAX];
+    uint8_t *map;
+    int fd, ret;
+    
+    if (bytes <= 0)
+        return 0;
+    bytes = FFMAX(bytes, TIMESHIFT_MIN_BYTES);
+    
+    snprintf(path, sizeof(path), "%s/LAVPtimeshift.XXXXXX", [NSTemporaryDirectory() fileSystemRepresentation]);
+    fd = mkstemp(path);
+    if (fd < 0) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "timeshift: cannot create %s\n", path);
+        return ret;
+    }
+    /* the ring lives only as long as the stream */
+    unlink(path);
+    
+    if (ftruncate(fd, bytes) < 0 ||
+        (map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "timeshift: cannot map %lld bytes\n", bytes);
+        close(fd);
+        return ret;
+    }
+    
+    is->ts_fd = fd;
+    is->ts_map = map;
+    is->ts_capacity = bytes;
+    is->ts_write = 0;
+    is->ts_first = is->ts_count = 0;
+    is->ts_base = is->ts_cursor = 0;
+    is->timeshift = 1;
+    return 0;
+}
+
+/* window in AV_TIME_BASE; returns 1 if timeshift is active */
+int timeshift_get(VideoState *is, int64_t *start, int64_t *end)
+{
+    int32_t seq;
+    
+    if (!is->timeshift)
+        return 0;
+    do {
+        seq = LAVPSeqReadBegin(&is->ts_seq);
+        *start = is->ts_start;
+        *end = is->ts_end;
+    } while (LAVPSeqReadRetry(&is->ts_seq, seq));
+    return 1;
+}
+
+/* average usec spent to store one packet */
+int64_t timeshift_ingest_usec(VideoState *is)
+{
+    int64_t count = is->ts_ingest_count;
+    
+    return count ? is->ts_ingest_usec / count : 0;
+}
+
+int64_t timeshift_seek_usec(VideoState *is)
+{
+    return is->ts_seek_usec;
+}
+
+#pragma mark -
+
+/* returns 1 if the packet was stored or freed here */
+int timeshift_input_packet(VideoState *is, AVPacket *pkt)
+{
+    TimeshiftRecord rec;
+    TimeshiftEntry *e;
+    int64_t t0, t, offset, size;
+    
+    if (!is->timeshift)
+        return 0;
+    
+    t0 = av_gettime();
+    size = TIMESHIFT_ALIGN(sizeof(rec) + pkt->size);
+    if (size > is->ts_capacity / 4) {
+        av_log(NULL, AV_LOG_WARNING, "timeshift: %d bytes packet dropped\n", pkt->size);
+        av_free_packet(pkt);
+        return 1;
+    }
+    
+    t = timeshift_packet_time(is, pkt);
+    if (t == AV_NOPTS_VALUE)
+        t = is->ts_count ? is->ts_index[is->ts_first + is->ts_count - 1].time : 0;
+    
+    offset = is->ts_write;
+    if (offset + size > is->ts_capacity) {
+        /* the records after the write position are the oldest; the tail is skipped */
+        while (is->ts_count && is->ts_index[is->ts_first].offset >= offset)
+            timeshift_drop_oldest(is);
+        offset = 0;
+    }
+    while (is->ts_count) {
+        TimeshiftEntry *oldest = &is->ts_index[is->ts_first];
+        if (oldest->offset + oldest->size <= offset || oldest->offset >= offset + size)
+            break;
+        timeshift_drop_oldest(is);
+    }
+    
+    e = timeshift_index_push(is);
+    if (!e) {
+        av_free_packet(pkt);
+        return 1;
+    }
+    
+    rec.pts = pkt->pts;
+    rec.dts = pkt->dts;
+    rec.pos = pkt->pos;
+    rec.size = pkt->size;
+    rec.stream_index = pkt->stream_index;
+    rec.flags = pkt->flags;
+    rec.duration = pkt->duration;
+    memcpy(is->ts_map + offset, &rec, sizeof(rec));
+    memcpy(is->ts_map + offset + sizeof(rec), pkt->data, pkt->size);
+    
+    e->offset = offset;
+    e->time = t;
+    e->size = (int)size;
+    e->stream_index = pkt->stream_index;
+    e->flags = pkt->flags;
+    is->ts_write = offset + size;
+    
+    timeshift_publish(is, FFMAX(is->ts_end, t));
+    av_free_packet(pkt);
+    
+    is->ts_ingest_usec += av_gettime() - t0;
+    is->ts_ingest_count++;
+    return 1;
+}
+
+/* returns 1 while stored packets remain to be queued after the input ended */
+int timeshift_input_eof(VideoState *is)
+{
+    return is->timeshift && is->ts_cursor < is->ts_base + is->ts_count;
+}
+
+/* queue up to TIMESHIFT_FEED_BATCH stored packets; returns the number queued */
+int timeshift_feed(VideoState *is)
+{
+    int n;
+    
+    if (!is->timeshift)
+        return 0;
+    
+    if (is->ts_cursor < is->ts_base) {
+        /* paused longer than the window; what comes next was overwritten */
+        av_log(NULL, AV_LOG_WARNING, "timeshift: fell behind the window, restarting at its start\n");
+        is->ts_cursor = is->ts_base + is->ts_count;
+        stream_seek(is, is->ts_start, 0, 0);
+        return 0;
+    }
+    
+    for (n = 0; n < TIMESHIFT_FEED_BATCH && is->ts_cursor < is->ts_base + is->ts_count; n++) {
+        TimeshiftEntry *e = &is->ts_index[is->ts_first + (int)(is->ts_cursor - is->ts_base)];
+        TimeshiftRecord rec;
+        AVPacket pkt;
+        
+        is->ts_cursor++;
+        memcpy(&rec, is->ts_map + e->offset, sizeof(rec));
+        
+        /* borrowed from the ring; the queue copies it into its packet arena */
+        av_init_packet(&pkt);
+        pkt.data = is->ts_map + e->offset + sizeof(rec);
+        pkt.size = rec.size;
+        pkt.pts = rec.pts;
+        pkt.dts = rec.dts;
+        pkt.pos = rec.pos;
+        pkt.stream_index = rec.stream_index;
+        pkt.flags = rec.flags;
+        pkt.duration = rec.duration;
+        
+        stream_queue_packet(is, &pkt, 1);
+    }
+    return n;
+}
+
+/* LAVP: called from read_thread instead of avformat_seek_file() */
+int timeshift_seek(VideoState *is, int64_t target)
+{
+    TimeshiftEntry *index = is->ts_index + is->ts_first;
+    int64_t t0 = av_gettime();
+    int lo = 0, hi = is->ts_count, i;
+    int key_stream;
+    
+    if (!is->timeshift || !is->ts_count)
+        return -1;
+    
+    /* first record later than the target */
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (index[mid].time <= target)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    
+    key_stream = (is->video_st && !(is->video_st->disposition & AV_DISPOSITION_ATTACHED_PIC)) ?
+                 is->video_stream : is->audio_stream;
+    for (i = lo - 1; i >= 0; i--)
+        if (index[i].stream_index == key_stream && (index[i].flags & AV_PKT_FLAG_KEY))
+            break;
+    if (i < 0) {
+        /* before the window; start at its first keyframe */
+        for (i = 0; i < is->ts_count; i++)
+            if (index[i].stream_index == key_stream && (index[i].flags & AV_PKT_FLAG_KEY))
+                break;
+        if (i == is->ts_count)
+            i = 0;
+    }
+    
+    is->ts_cursor = is->ts_base + i;
+    is->ts_seek_usec = av_gettime() - t0;
+    return 0;
+}
+
+void timeshift_close(VideoState *is)
+{
+    if (is->ts_map) {
+        munmap(is->ts_map, is->ts_capacity);
+        close(is->ts_fd);
+    }
+    is->ts_map = NULL;
+    is->ts_capacity = 0;
+    av_freep(&is->ts_index);
+    is->ts_index_size = 0;
+    is->ts_first = is->ts_count = 0;
+    is->timeshift = 0;
+}
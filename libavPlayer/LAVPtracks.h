@@ -0,0 +1,44 @@
+/*
+ *  LAVPtracks.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPtracks_h__
+#define __LAVPtracks_h__
+
+#include "LAVPcommon.h"
+
+void track_set_buffering(VideoState *is, int enable);
+int track_get_buffering(VideoState *is);
+int track_list(VideoState *is, enum AVMediaType type, int *indexes, int max);
+int track_select(VideoState *is, enum AVMediaType type, int stream_index);
+int64_t track_buffered_bytes(VideoState *is, int stream_index);
+int64_t track_switch_latency(VideoState *is);
+
+/* read_thread / audio */
+int track_buffer_packet(VideoState *is, AVPacket *pkt);
+void track_flush_buffers(VideoState *is);
+AVCodecContext *track_audio_flushed(VideoState *is);
+void track_audio_started(VideoState *is);
+void track_audio_close(VideoState *is);
+void track_close(VideoState *is);
+
+#endif
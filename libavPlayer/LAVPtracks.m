@@ -0,0 +1,435 @@
+/*
+ *  LAVPtracks.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPqueue.h"
+#include "LAVPtracks.h"
+
+/* =========================================================== */
+
+/*
+ Alternate tracks:
+ 
+ With buffering enabled, read_thread keeps the packets of audio and subtitle
+ streams which are not selected in short per-stream lists instead of freeing them.
+ Packets are dropped once they end ALT_TRACK_KEEP_BEHIND seconds before the master
+ clock or the list exceeds ALT_TRACK_MAX_BYTES. The lists therefore span from just
+ before the play head to the demuxer position, which is what the selected track
+ has in its PacketQueue.
+ 
+ Switching audio moves the old track's queued packets into its list, queues a flush
+ packet and then the new track's packets from the current audio clock. The decoder
+ is swapped by audio_decode_frame() on the flush packet, so the AudioQueue and video
+ keep running and no seek is needed; the swr cache adapts to the new source format.
+ Subtitles simply reopen their component and are fed the same way. Without
+ buffered packets an audio switch falls back to seeking to the current position.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+static double track_packet_end(AVStream *st, AVPacket *pkt)
+{
+    int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+    
+    if (ts == AV_NOPTS_VALUE)
+        return INFINITY;
+    return (ts + pkt->duration) * av_q2d(st->time_base);
+}
+
+static void track_buffer_pop(AltTrack *at)
+{
+    MyAVPacketList *node = at->first;
+    
+    at->first = node->next;
+    if (!at->first)
+        at->last = NULL;
+    at->nb_packets--;
+    at->bytes -= node->pkt.size + sizeof(*node);
+    av_free_packet(&node->pkt);
+    av_free(node);
+}
+
+static void track_buffer_free(AltTrack *at)
+{
+    while (at->first)
+        track_buffer_pop(at);
+}
+
+static void track_buffer_trim(VideoState *is, int stream_index, double clock)
+{
+    AltTrack *at = &is->alt_track[stream_index];
+    AVStream *st = is->ic->streams[stream_index];
+    
+    while (at->first &&
+           (at->bytes > ALT_TRACK_MAX_BYTES ||
+            (!isnan(clock) && track_packet_end(st, &at->first->pkt) < clock - ALT_TRACK_KEEP_BEHIND)))
+        track_buffer_pop(at);
+}
+
+/* takes ownership of pkt; caller holds alt_mutex */
+static void track_buffer_append(VideoState *is, int stream_index, AVPacket *pkt)
+{
+    AltTrack *at = &is->alt_track[stream_index];
+    MyAVPacketList *node;
+    
+    if (av_dup_packet(pkt) < 0 || !(node = av_malloc(sizeof(*node)))) {
+        av_free_packet(pkt);
+        return;
+    }
+    node->pkt = *pkt;
+    node->next = NULL;
+    node->serial = 0;
+    
+    if (!at->last)
+        at->first = node;
+    else
+        at->last->next = node;
+    at->last = node;
+    at->nb_packets++;
+    at->bytes += node->pkt.size + sizeof(*node);
+    
+    track_buffer_trim(is, stream_index, get_master_clock(is));
+}
+
+/* move buffered packets which are still audible at clock into q; returns the count */
+static int track_buffer_take(VideoState *is, int stream_index, double clock, PacketQueue *q)
+{
+    AltTrack *at = &is->alt_track[stream_index];
+    AVStream *st = is->ic->streams[stream_index];
+    int count = 0;
+    
+    while (at->first) {
+        MyAVPacketList *node = at->first;
+        
+        if (!isnan(clock) && track_packet_end(st, &node->pkt) < clock) {
+            track_buffer_pop(at);
+            continue;
+        }
+        at->first = node->next;
+        if (!at->first)
+            at->last = NULL;
+        at->nb_packets--;
+        at->bytes -= node->pkt.size + sizeof(*node);
+        packet_queue_put(q, &node->pkt);
+        av_free(node);
+        count++;
+    }
+    return count;
+}
+
+/* keep what the old track still had queued; switching back is then instant too.
+ The queue is unlinked in one step: the AudioQueue callback keeps pulling from audioq,
+ and packet by packet it would play some of what should be kept. */
+static void track_buffer_drain(VideoState *is, int stream_index, PacketQueue *q)
+{
+    MyAVPacketList *node = packet_queue_detach(q), *next;
+    
+    for (; node; node = next) {
+        next = node->next;
+        if (node->pkt.data != q->flush_pkt.data) {
+            if (is->alt_tracks)
+                track_buffer_append(is, stream_index, &node->pkt);
+            else
+                av_free_packet(&node->pkt);
+        }
+        av_free(node);
+    }
+}
+
+static int track_open_codec(VideoState *is, int stream_index)
+{
+    AVCodecContext *avctx = is->ic->streams[stream_index]->codec;
+    AVDictionary *opts = NULL;
+    AVCodec *codec;
+    int ret;
+    
+    codec = avcodec_find_decoder(avctx->codec_id);
+    if (!codec) {
+        av_log(NULL, AV_LOG_WARNING, "No codec could be found with id %d\n", avctx->codec_id);
+        return -1;
+    }
+    avctx->codec_id = codec->id;
+    avctx->workaround_bugs = is->workaround_bugs;
+    avctx->error_concealment = is->error_concealment;
+    if (is->fast)
+        avctx->flags2 |= CODEC_FLAG2_FAST;
+    
+    av_dict_set(&opts, "threads", "auto", 0);
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    ret = avcodec_open2(avctx, codec, &opts);
+    av_dict_free(&opts);
+    return ret;
+}
+
+#pragma mark -
+
+static int track_switch_audio(VideoState *is, int stream_index)
+{
+    int old = is->audio_stream;
+    double now = get_clock(&is->audclk);
+    int moved = 0;
+    
+    if (old < 0 || !is->audioDispatchQueue)
+        return stream_component_open(is, stream_index);
+    if (is->audio_switch_st)
+        return AVERROR(EAGAIN);
+    
+    if (track_open_codec(is, stream_index) < 0)
+        return -1;
+    
+    /* LAVP: read_thread is held off by alt_mutex; route the new stream from here on */
+    track_buffer_drain(is, old, &is->audioq);
+    if (!is->alt_tracks)
+        is->ic->streams[old]->discard = AVDISCARD_ALL;
+    is->ic->streams[stream_index]->discard = AVDISCARD_DEFAULT;
+    is->audio_stream = stream_index;
+    
+    /* the decoder is swapped by the AudioQueue callback when it reaches the flush packet */
+    is->audio_switch_st = is->ic->streams[stream_index];
+    is->track_switch_time = av_gettime();
+    packet_queue_put(&is->audioq, NULL);
+    is->track_switch_serial = is->audioq.serial;
+    if (is->alt_tracks)
+        moved = track_buffer_take(is, stream_index, now, &is->audioq);
+    
+    if (!moved && !isnan(now))
+        stream_seek(is, (int64_t)(now * AV_TIME_BASE), -10, 0);
+    return 0;
+}
+
+static int track_switch_subtitle(VideoState *is, int stream_index)
+{
+    int old = is->subtitle_stream;
+    double now = get_master_clock(is);
+    
+    if (old >= 0) {
+        track_buffer_drain(is, old, &is->subtitleq);
+        stream_component_close(is, old);
+        if (is->alt_tracks)
+            is->ic->streams[old]->discard = AVDISCARD_DEFAULT;
+    }
+    if (stream_index < 0)
+        return 0;
+    
+    if (stream_component_open(is, stream_index) < 0)
+        return -1;
+    /* without buffered packets the next subtitle event shows up as demuxed, like ffplay */
+    if (is->alt_tracks)
+        track_buffer_take(is, stream_index, now, &is->subtitleq);
+    return 0;
+}
+
+/* alt_mutex, with read_thread sent to it: a packet it routes without the lock finishes first */
+static void track_lock(VideoState *is)
+{
+    OSAtomicIncrement32Barrier(&is->track_switching);
+    while (is->track_routing)
+        usleep(100);
+    LAVPLockMutex(is->alt_mutex);
+}
+
+static void track_unlock(VideoState *is)
+{
+    LAVPUnlockMutex(is->alt_mutex);
+    OSAtomicDecrement32Barrier(&is->track_switching);
+}
+
+#pragma mark -
+
+void track_set_buffering(VideoState *is, int enable)
+{
+    int i;
+    
+    if (!is || !is->ic)
+        return;
+    
+    track_lock(is);
+    if (enable && !is->alt_track)
+        is->alt_track = av_mallocz(is->ic->nb_streams * sizeof(AltTrack));
+    is->alt_tracks = enable && is->alt_track;
+    
+    for (i = 0; i < is->ic->nb_streams; i++) {
+        AVStream *st = is->ic->streams[i];
+        if (i == is->audio_stream || i == is->subtitle_stream || i == is->video_stream)
+            continue;
+        if (st->codec->codec_type != AVMEDIA_TYPE_AUDIO && st->codec->codec_type != AVMEDIA_TYPE_SUBTITLE)
+            continue;
+        st->discard = is->alt_tracks ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+        if (!is->alt_tracks && is->alt_track)
+            track_buffer_free(&is->alt_track[i]);
+    }
+    track_unlock(is);
+}
+
+int track_get_buffering(VideoState *is)
+{
+    return is->alt_tracks;
+}
+
+int track_list(VideoState *is, enum AVMediaType type, int *indexes, int max)
+{
+    int i, count = 0;
+    
+    for (i = 0; i < is->ic->nb_streams; i++) {
+        if (is->ic->streams[i]->codec->codec_type != type)
+            continue;
+        if (count < max)
+            indexes[count] = i;
+        count++;
+    }
+    return count;
+}
+
+int track_select(VideoState *is, enum AVMediaType type, int stream_index)
+{
+    int64_t start = av_gettime();
+    int ret;
+    
+    if (!is || !is->ic)
+        return -1;
+    if (stream_index >= (int)is->ic->nb_streams)
+        return -1;
+    if (stream_index >= 0 && is->ic->streams[stream_index]->codec->codec_type != type)
+        return -1;
+    
+    track_lock(is);
+    if (type == AVMEDIA_TYPE_AUDIO) {
+        if (stream_index < 0 || stream_index == is->audio_stream)
+            ret = 0;
+        else
+            ret = track_switch_audio(is, stream_index);
+    } else if (type == AVMEDIA_TYPE_SUBTITLE) {
+        ret = stream_index == is->subtitle_stream ? 0 : track_switch_subtitle(is, stream_index);
+    } else {
+        ret = -1;
+    }
+    track_unlock(is);
+    
+    av_log(NULL, AV_LOG_VERBOSE, "track: selected #%d in %.3f ms\n",
+           stream_index, (av_gettime() - start) / 1000.0);
+    return ret;
+}
+
+int64_t track_buffered_bytes(VideoState *is, int stream_index)
+{
+    int64_t bytes = 0;
+    
+    if (!is || !is->ic || stream_index < 0 || stream_index >= (int)is->ic->nb_streams)
+        return 0;
+    
+    LAVPLockMutex(is->alt_mutex);
+    if (is->alt_track)
+        bytes = is->alt_track[stream_index].bytes;
+    LAVPUnlockMutex(is->alt_mutex);
+    return bytes;
+}
+
+int64_t track_switch_latency(VideoState *is)
+{
+    return is->track_switch_latency;
+}
+
+#pragma mark -
+
+/* LAVP: called from read_thread, with alt_mutex held whenever alt_tracks is set; returns 1 if the packet was kept */
+int track_buffer_packet(VideoState *is, AVPacket *pkt)
+{
+    enum AVMediaType type;
+    
+    if (!is->alt_tracks)
+        return 0;
+    type = is->ic->streams[pkt->stream_index]->codec->codec_type;
+    if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_SUBTITLE)
+        return 0;
+    
+    track_buffer_append(is, pkt->stream_index, pkt);
+    return 1;
+}
+
+/* LAVP: buffered packets belong to the old position after a seek */
+void track_flush_buffers(VideoState *is)
+{
+    int i;
+    
+    LAVPLockMutex(is->alt_mutex);
+    if (is->alt_track) {
+        for (i = 0; i < is->ic->nb_streams; i++)
+            track_buffer_free(&is->alt_track[i]);
+    }
+    LAVPUnlockMutex(is->alt_mutex);
+}
+
+/* LAVP: called from audio_decode_frame() on a flush packet; returns the codec to decode with */
+AVCodecContext *track_audio_flushed(VideoState *is)
+{
+    AVStream *st = is->audio_switch_st;
+    
+    if (st) {
+        avcodec_close(is->audio_st->codec);
+        is->audio_st = st;
+        is->audio_switch_st = NULL;
+    }
+    return is->audio_st->codec;
+}
+
+/* LAVP: called from stream_component_close(); a switch may not have reached the callback */
+void track_audio_close(VideoState *is)
+{
+    AVStream *st = is->audio_switch_st;
+    
+    if (st) {
+        is->audio_switch_st = NULL;
+        if (is->audio_st && is->audio_st != st)
+            avcodec_close(is->audio_st->codec);
+        is->audio_st = st;
+    }
+}
+
+/* LAVP: called from audio_decode_frame() for each decoded frame */
+void track_audio_started(VideoState *is)
+{
+    if (is->track_switch_time && is->audio_clock_serial == is->track_switch_serial) {
+        is->track_switch_latency = av_gettime() - is->track_switch_time;
+        is->track_switch_time = 0;
+        av_log(NULL, AV_LOG_VERBOSE, "track: new audio decoded after %.3f ms\n",
+               is->track_switch_latency / 1000.0);
+    }
+}
+
+void track_close(VideoState *is)
+{
+    int i;
+    
+    if (is->alt_track) {
+        for (i = 0; i < is->ic->nb_streams; i++)
+            track_buffer_free(&is->alt_track[i]);
+        av_freep(&is->alt_track);
+    }
+    is->alt_tracks = 0;
+    if (is->alt_mutex) {
+        LAVPDestroyMutex(is->alt_mutex);
+        is->alt_mutex = NULL;
+    }
+}
@@ -27,6 +27,7 @@
 #include <assert.h>
 #import <Accelerate/Accelerate.h>
 #include "string.h"
+#include <math.h>
 
 #define ENABLEFASTER 1
 #define USESIMD 1
@@ -169,6 +170,122 @@ void copy_planar_YUV420_to_2vuy(size_t width, size_t height,
 #endif
 }
 
+// Fixed point coefficients for copy_YUV420_to_BGRA.
+// matrix is 601, 709 or 2020. coeffs[] = { y offset, y gain, v->r, u->g, v->g, u->b } in Q13.
+void make_YUV_to_BGRA_coeffs(int matrix, int full_range, int16_t coeffs[6])
+{
+	double kr = 0.299, kb = 0.114;				// BT.601
+	if (matrix == 709) {
+		kr = 0.2126; kb = 0.0722;
+	} else if (matrix == 2020) {
+		kr = 0.2627; kb = 0.0593;
+	}
+	double kg = 1.0 - kr - kb;
+	double ygain = full_range ? 1.0 : 255.0 / 219.0;
+	double cgain = full_range ? 1.0 : 255.0 / 224.0;
+	
+	coeffs[0] = full_range ? 0 : 16;
+	coeffs[1] = (int16_t)lrint(ygain * 8192);
+	coeffs[2] = (int16_t)lrint(cgain * 2 * (1 - kr) * 8192);
+	coeffs[3] = (int16_t)lrint(cgain * 2 * (1 - kb) * kb / kg * 8192);
+	coeffs[4] = (int16_t)lrint(cgain * 2 * (1 - kr) * kr / kg * 8192);
+	coeffs[5] = (int16_t)lrint(cgain * 2 * (1 - kb) * 8192);
+}
+
+// Samples are scaled by 128 and multiplied by Q13 coefficients keeping the high 16 bits,
+// which leaves 4 fractional bits. The scalar loop does the same math as _mm_mulhi_epi16
+// so both paths produce identical pixels.
+static inline int mulhi16(int a, int b) { return (a * b) >> 16; }
+static inline uint8_t clip8(int v) { return (v < 0) ? 0 : ((v > 255) ? 255 : v); }
+
+// Util to convert YUV420 into chunky BGRA in a single pass
+// For bitmap transfer : AVFrame -> CVPixelBuffer (kCVPixelFormatType_32BGRA).
+// step_uv is 1 for planar YUV420P, or 2 for NV12 with baseAddr_v = baseAddr_u + 1.
+void copy_YUV420_to_BGRA(size_t width, size_t height, 
+						 const uint8_t *baseAddr_y, size_t rowBytes_y, 
+						 const uint8_t *baseAddr_u, size_t rowBytes_u, 
+						 const uint8_t *baseAddr_v, size_t rowBytes_v, size_t step_uv, 
+						 uint8_t *baseAddr_bgra, size_t rowBytes_bgra, 
+						 const int16_t coeffs[6])
+{
+	const int yoff = coeffs[0], cy = coeffs[1], crv = coeffs[2], cgu = coeffs[3], cgv = coeffs[4], cbu = coeffs[5];
+	
+#if USESIMD
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i alpha = _mm_set1_epi8(-1);
+	const __m128i lomask = _mm_set1_epi16(0xff);
+	const __m128i c128 = _mm_set1_epi16(128), round = _mm_set1_epi16(8);
+	const __m128i vyoff = _mm_set1_epi16(yoff), vcy = _mm_set1_epi16(cy);
+	const __m128i vcrv = _mm_set1_epi16(crv), vcgu = _mm_set1_epi16(cgu);
+	const __m128i vcgv = _mm_set1_epi16(cgv), vcbu = _mm_set1_epi16(cbu);
+#endif
+	
+	size_t y = 0;
+	
+	for (y = 0; y < height; y++) {
+		
+		size_t x = 0;
+		const uint8_t *py = y * rowBytes_y + baseAddr_y;
+		const uint8_t *pu = (y/2) * rowBytes_u + baseAddr_u;
+		const uint8_t *pv = (y/2) * rowBytes_v + baseAddr_v;
+		uint8_t *pd = y * rowBytes_bgra + baseAddr_bgra;
+		
+#if USESIMD
+		for( ; x + 16 <= width; x += 16 ) {			// process W16xH1 pixels concurrently
+			__m128i u, v;
+			if (step_uv == 2) {
+				__m128i uv = _mm_loadu_si128((const __m128i*)(x+pu));
+				u = _mm_and_si128(uv, lomask);
+				v = _mm_srli_epi16(uv, 8);
+			} else {
+				u = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(x/2+pu)), zero);
+				v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(x/2+pv)), zero);
+			}
+			u = _mm_slli_epi16(_mm_sub_epi16(u, c128), 7);
+			v = _mm_slli_epi16(_mm_sub_epi16(v, c128), 7);
+			
+			// chroma terms for 8 pixel pairs
+			__m128i rc = _mm_mulhi_epi16(v, vcrv);
+			__m128i gc = _mm_add_epi16(_mm_mulhi_epi16(u, vcgu), _mm_mulhi_epi16(v, vcgv));
+			__m128i bc = _mm_mulhi_epi16(u, vcbu);
+			
+			__m128i yy = _mm_loadu_si128((const __m128i*)(x+py));
+			__m128i y0 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(yy, zero), vyoff), 7);
+			__m128i y1 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(yy, zero), vyoff), 7);
+			y0 = _mm_add_epi16(_mm_mulhi_epi16(y0, vcy), round);
+			y1 = _mm_add_epi16(_mm_mulhi_epi16(y1, vcy), round);
+			
+			__m128i r = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(rc, rc)), 4),
+										 _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(rc, rc)), 4));
+			__m128i g = _mm_packus_epi16(_mm_srai_epi16(_mm_sub_epi16(y0, _mm_unpacklo_epi16(gc, gc)), 4),
+										 _mm_srai_epi16(_mm_sub_epi16(y1, _mm_unpackhi_epi16(gc, gc)), 4));
+			__m128i b = _mm_packus_epi16(_mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(bc, bc)), 4),
+										 _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(bc, bc)), 4));
+			
+			__m128i bg0 = _mm_unpacklo_epi8(b, g), bg1 = _mm_unpackhi_epi8(b, g);
+			__m128i ra0 = _mm_unpacklo_epi8(r, alpha), ra1 = _mm_unpackhi_epi8(r, alpha);
+			
+			_mm_storeu_si128((__m128i*)( 0+x*4+pd), _mm_unpacklo_epi16(bg0, ra0) );
+			_mm_storeu_si128((__m128i*)(16+x*4+pd), _mm_unpackhi_epi16(bg0, ra0) );
+			_mm_storeu_si128((__m128i*)(32+x*4+pd), _mm_unpacklo_epi16(bg1, ra1) );
+			_mm_storeu_si128((__m128i*)(48+x*4+pd), _mm_unpackhi_epi16(bg1, ra1) );
+		}	// for(x + 16 <= width)
+#endif	//USESIMD
+		
+		for (; x < width; x++) {
+			int u = (pu[(x/2)*step_uv] - 128) * 128;
+			int v = (pv[(x/2)*step_uv] - 128) * 128;
+			int ys = mulhi16((py[x] - yoff) * 128, cy) + 8;
+			
+			pd[x*4+0] = clip8((ys + mulhi16(u, cbu)) >> 4);
+			pd[x*4+1] = clip8((ys - (mulhi16(u, cgu) + mulhi16(v, cgv))) >> 4);
+			pd[x*4+2] = clip8((ys + mulhi16(v, crv)) >> 4);
+			pd[x*4+3] = 0xff;
+		}	// for(x < width)
+		
+	}	// for(y < height)
+}
+
 #define CVF_INLINE static inline
 
 CVF_INLINE int CVF_MIN(int a, int b) { return ((a > b) ? b : a); }
@@ -0,0 +1,36 @@
+/*
+ *  LAVPvalidate.h
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __LAVPvalidate_h__
+#define __LAVPvalidate_h__
+
+#include "LAVPcommon.h"
+
+int validate_open(VideoState *is, const char *path);
+void validate_close(VideoState *is);
+
+/* playback threads */
+void validate_picture(VideoState *is, AVFrame *pict, int width, int height, double pts, int serial);
+void validate_audio(VideoState *is, const uint8_t *buf, int size, double pts, int serial);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ *  LAVPvalidate.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPvalidate.h"
+#include "libavutil/crc.h"
+
+/* =========================================================== */
+
+/*
+ Validation:
+ 
+ A deterministic fingerprint of what the player presents, for diffing runs across
+ library upgrades. Every picture queue_picture() stores in pictq is copied and handed
+ to a concurrent dispatch queue; every PCM block the AudioQueue callback takes from
+ audio_decode_frame() is copied into a preallocated ring hashed by a serial queue.
+ Workers compute CRC-32 of the visible Y/U/V planes, of the same picture run through
+ copy_planar_YUV420_to_2vuy(), and of the PCM bytes.
+ 
+ Results are tagged with pts and serial and numbered per kind in submission order,
+ so the order the workers finish in does not matter. The manifest is written sorted
+ when the stream closes. Lines starting with '#' carry the cost of the mode and are
+ not part of the fingerprint; compare runs with diff -I '^#'.
+ 
+ Frame dropping is disabled while validating, otherwise the set of pictures would
+ depend on timing. At most VALIDATE_MAX_IN_FLIGHT pictures wait for a worker; beyond
+ that video_thread blocks, which shows up in the reported overhead. The AudioQueue
+ callback never blocks or allocates: a PCM block that finds the ring or all block
+ slots busy is dropped, keeps its seq, and is counted in the manifest.
+ */
+
+#if ALLOW_GPL_CODE
+extern void copy_planar_YUV420_to_2vuy(size_t width, size_t height, 
+									   uint8_t *baseAddr_y, size_t rowBytes_y, 
+									   uint8_t *baseAddr_u, size_t rowBytes_u, 
+									   uint8_t *baseAddr_v, size_t rowBytes_v, 
+									   uint8_t *baseAddr_2vuy, size_t rowBytes_2vuy);
+#endif
+
+/* =========================================================== */
+
+#pragma mark -
+
+static uint32_t validate_crc(const uint8_t *data, int linesize, int width, int height)
+{
+    const AVCRC *table = av_crc_get_table(AV_CRC_32_IEEE_LE);
+    uint32_t crc = UINT32_MAX;
+    
+    for (int y = 0; y < height; y++)
+        crc = av_crc(table, crc, data + y * linesize, width);
+    return crc ^ UINT32_MAX;
+}
+
+static void validate_add(VideoState *is, const ValidateEntry *entry)
+{
+    LAVPLockMutex(is->validate_mutex);
+    if (is->validate_nb_entries >= is->validate_max_entries) {
+        int max = FFMAX(1024, is->validate_max_entries * 2);
+        ValidateEntry *entries = av_realloc(is->validate_entries, max * sizeof(ValidateEntry));
+        if (!entries) {
+            LAVPUnlockMutex(is->validate_mutex);
+            av_log(NULL, AV_LOG_ERROR, "validate: out of memory, entry %c %d lost\n", entry->kind, entry->seq);
+            return;
+        }
+        is->validate_entries = entries;
+        is->validate_max_entries = max;
+    }
+    is->validate_entries[is->validate_nb_entries++] = *entry;
+    LAVPUnlockMutex(is->validate_mutex);
+}
+
+static int validate_compare(const void *a, const void *b)
+{
+    const ValidateEntry *ea = a, *eb = b;
+    
+    if (ea->kind != eb->kind)
+        return ea->kind > eb->kind ? -1 : 1; /* pictures first */
+    return ea->seq - eb->seq;
+}
+
+/* audio worker; blocks are hashed in the order they were staged */
+static void validate_audio_work(void *context)
+{
+    ValidateAudioBlock *block = context;
+    VideoState *is = block->is;
+    const AVCRC *table = av_crc_get_table(AV_CRC_32_IEEE_LE);
+    int64_t work = av_gettime();
+    ValidateEntry e = block->entry;
+    int pos = (int)(block->offset % VALIDATE_AUDIO_RING_BYTES);
+    int first = FFMIN(e.size, VALIDATE_AUDIO_RING_BYTES - pos);
+    uint32_t crc;
+    
+    crc = av_crc(table, UINT32_MAX, is->validate_audio_ring + pos, first);
+    crc = av_crc(table, crc, is->validate_audio_ring, e.size - first);
+    e.crc[0] = crc ^ UINT32_MAX;
+    
+    validate_add(is, &e);
+    OSAtomicAdd64Barrier(e.size, &is->validate_audio_tail);
+    OSAtomicAdd64Barrier(e.size, &is->validate_bytes);
+    OSAtomicAdd64Barrier(av_gettime() - work, &is->validate_work_usec);
+    dispatch_semaphore_signal((__bridge dispatch_semaphore_t)is->validate_audio_sema);
+}
+
+#pragma mark -
+
+int validate_open(VideoState *is, const char *path)
+{
+    FILE *file;
+    
+    if (!path || !*path)
+        return 0;
+    
+    file = fopen(path, "w");
+    if (!file) {
+        int ret = AVERROR(errno);
+        av_log(NULL, AV_LOG_ERROR, "validate: cannot create %s\n", path);
+        return ret;
+    }
+    is->validate_audio_ring = av_malloc(VALIDATE_AUDIO_RING_BYTES);
+    if (!is->validate_audio_ring) {
+        fclose(file);
+        return AVERROR(ENOMEM);
+    }
+    
+    is->validate_file = file;
+    is->validate_mutex = LAVPCreateMutex();
+    is->validate_nb_entries = is->validate_max_entries = 0;
+    is->validate_video_seq = is->validate_audio_seq = 0;
+    is->validate_audio_slot = 0;
+    is->validate_audio_head = is->validate_audio_tail = 0;
+    is->validate_audio_dropped = 0;
+    
+    // LAVP: Using dispatch queue
+    {
+        dispatch_queue_t validate_queue = dispatch_queue_create("validate", DISPATCH_QUEUE_CONCURRENT);
+        dispatch_group_t validate_group = dispatch_group_create();
+        dispatch_semaphore_t validate_sema = dispatch_semaphore_create(VALIDATE_MAX_IN_FLIGHT);
+        is->validate_queue = (__bridge_retained void*)validate_queue;
+        is->validate_group = (__bridge_retained void*)validate_group;
+        is->validate_sema = (__bridge_retained void*)validate_sema;
+        
+        dispatch_queue_t validate_audio_queue = dispatch_queue_create("validate.audio", DISPATCH_QUEUE_SERIAL);
+        dispatch_semaphore_t validate_audio_sema = dispatch_semaphore_create(VALIDATE_MAX_IN_FLIGHT);
+        is->validate_audio_queue = (__bridge_retained void*)validate_audio_queue;
+        is->validate_audio_sema = (__bridge_retained void*)validate_audio_sema;
+    }
+    
+    /* the set of presented pictures must not depend on timing */
+    is->framedrop = 0;
+    is->validate = 1;
+    return 0;
+}
+
+void validate_close(VideoState *is)
+{
+    FILE *file = is->validate_file;
+    
+    if (!is->validate)
+        return;
+    is->validate = 0;
+    
+    dispatch_group_wait((__bridge dispatch_group_t)is->validate_group, DISPATCH_TIME_FOREVER);
+    {
+        dispatch_group_t validate_group = (__bridge_transfer dispatch_group_t)is->validate_group;
+        dispatch_queue_t validate_queue = (__bridge_transfer dispatch_queue_t)is->validate_queue;
+        dispatch_semaphore_t validate_sema = (__bridge_transfer dispatch_semaphore_t)is->validate_sema;
+        dispatch_queue_t validate_audio_queue = (__bridge_transfer dispatch_queue_t)is->validate_audio_queue;
+        dispatch_semaphore_t validate_audio_sema = (__bridge_transfer dispatch_semaphore_t)is->validate_audio_sema;
+        validate_group = NULL; // ARC
+        validate_queue = NULL; // ARC
+        validate_sema = NULL; // ARC
+        validate_audio_queue = NULL; // ARC
+        validate_audio_sema = NULL; // ARC
+        is->validate_group = NULL;
+        is->validate_queue = NULL;
+        is->validate_sema = NULL;
+        is->validate_audio_queue = NULL;
+        is->validate_audio_sema = NULL;
+    }
+    av_freep(&is->validate_audio_ring);
+    
+    qsort(is->validate_entries, is->validate_nb_entries, sizeof(ValidateEntry), validate_compare);
+    
+    fprintf(file, "# LAVP validation manifest 1\n");
+    fprintf(file, "# V seq serial pts WxH crcY crcU crcV crc2vuy\n");
+    fprintf(file, "# A seq serial pts bytes crcPCM\n");
+    for (int i = 0; i < is->validate_nb_entries; i++) {
+        ValidateEntry *e = &is->validate_entries[i];
+        if (e->kind == 'V')
+            fprintf(file, "V %d %d %.6f %dx%d %08x %08x %08x %08x\n", e->seq, e->serial, e->pts,
+                    e->width, e->height, e->crc[0], e->crc[1], e->crc[2], e->crc[3]);
+        else
+            fprintf(file, "A %d %d %.6f %d %08x\n", e->seq, e->serial, e->pts, e->size, e->crc[0]);
+    }
+    fprintf(file, "# pictures %d blocks %d dropped %d bytes %lld playback_usec %lld worker_usec %lld\n",
+            is->validate_video_seq, is->validate_audio_seq, is->validate_audio_dropped, is->validate_bytes,
+            is->validate_hot_usec, is->validate_work_usec);
+    fclose(file);
+    
+    if (is->validate_audio_dropped)
+        av_log(NULL, AV_LOG_WARNING, "validate: %d of %d PCM blocks not hashed, the manifest is incomplete\n",
+               is->validate_audio_dropped, is->validate_audio_seq);
+    av_log(NULL, AV_LOG_INFO, "validate: %d pictures, %d PCM blocks; %.3f s on playback threads, %.3f s hashing\n",
+           is->validate_video_seq, is->validate_audio_seq,
+           is->validate_hot_usec / 1000000.0, is->validate_work_usec / 1000000.0);
+    
+    is->validate_file = NULL;
+    av_freep(&is->validate_entries);
+    is->validate_nb_entries = is->validate_max_entries = 0;
+    LAVPDestroyMutex(is->validate_mutex);
+    is->validate_mutex = NULL;
+}
+
+#pragma mark -
+
+/* called by queue_picture() once the picture is in pictq */
+void validate_picture(VideoState *is, AVFrame *pict, int width, int height, double pts, int serial)
+{
+    int64_t start = av_gettime();
+    uint8_t *data[4];
+    int linesize[4];
+    
+    if (!is->validate)
+        return;
+    
+    dispatch_semaphore_t sema = (__bridge dispatch_semaphore_t)is->validate_sema;
+    dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+    
+    /* even size: copy_planar_YUV420_to_2vuy works on 2x2 blocks */
+    if (av_image_alloc(data, linesize, FFALIGN(width, 2), FFALIGN(height, 2), PIX_FMT_YUV420P, 0x10) < 0) {
+        dispatch_semaphore_signal(sema);
+        return;
+    }
+    av_image_copy(data, linesize, (const uint8_t **)pict->data, pict->linesize, PIX_FMT_YUV420P, width, height);
+    
+    ValidateEntry entry = {0};
+    entry.kind = 'V';
+    entry.seq = is->validate_video_seq++;
+    entry.serial = serial;
+    entry.pts = pts;
+    entry.width = width;
+    entry.height = height;
+    
+    uint8_t *y = data[0], *u = data[1], *v = data[2];
+    int ys = linesize[0], us = linesize[1], vs = linesize[2];
+    
+    dispatch_group_async((__bridge dispatch_group_t)is->validate_group, (__bridge dispatch_queue_t)is->validate_queue, ^(void){
+        int64_t work = av_gettime();
+        ValidateEntry e = entry;
+        int cw = (width + 1) >> 1, ch = (height + 1) >> 1;
+        
+        e.crc[0] = validate_crc(y, ys, width, height);
+        e.crc[1] = validate_crc(u, us, cw, ch);
+        e.crc[2] = validate_crc(v, vs, cw, ch);
+#if ALLOW_GPL_CODE
+        size_t rowBytes = FFALIGN(width * 2, 16);
+        uint8_t *buf = av_mallocz(rowBytes * FFALIGN(height, 2));
+        if (buf) {
+            copy_planar_YUV420_to_2vuy(width, height, y, ys, u, us, v, vs, buf, rowBytes);
+            e.crc[3] = validate_crc(buf, (int)rowBytes, width * 2, height);
+            av_free(buf);
+        }
+#endif
+        av_free(y);
+        
+        validate_add(is, &e);
+        OSAtomicAdd64Barrier((int64_t)width * height * 3 / 2, &is->validate_bytes);
+        OSAtomicAdd64Barrier(av_gettime() - work, &is->validate_work_usec);
+        dispatch_semaphore_signal(sema);
+    });
+    
+    OSAtomicAdd64Barrier(av_gettime() - start, &is->validate_hot_usec);
+}
+
+/* called by the AudioQueue callback for each block from audio_decode_frame(); never blocks or allocates */
+void validate_audio(VideoState *is, const uint8_t *buf, int size, double pts, int serial)
+{
+    int64_t start = av_gettime();
+    
+    if (!is->validate || size <= 0)
+        return;
+    
+    int seq = is->validate_audio_seq++;
+    dispatch_semaphore_t sema = (__bridge dispatch_semaphore_t)is->validate_audio_sema;
+    
+    OSMemoryBarrier(); /* validate_audio_tail */
+    if (size > VALIDATE_AUDIO_RING_BYTES - (is->validate_audio_head - is->validate_audio_tail)
+        || dispatch_semaphore_wait(sema, DISPATCH_TIME_NOW)) {
+        OSAtomicIncrement32(&is->validate_audio_dropped);
+        return;
+    }
+    
+    int pos = (int)(is->validate_audio_head % VALIDATE_AUDIO_RING_BYTES);
+    int first = FFMIN(size, VALIDATE_AUDIO_RING_BYTES - pos);
+    memcpy(is->validate_audio_ring + pos, buf, first);
+    memcpy(is->validate_audio_ring, buf + first, size - first);
+    
+    /* the serial worker frees slots in the order they are taken */
+    ValidateAudioBlock *block = &is->validate_audio_blocks[is->validate_audio_slot];
+    is->validate_audio_slot = (is->validate_audio_slot + 1) % VALIDATE_MAX_IN_FLIGHT;
+    memset(block, 0, sizeof(*block));
+    block->is = is;
+    block->offset = is->validate_audio_head;
+    block->entry.kind = 'A';
+    block->entry.seq = seq;
+    block->entry.serial = serial;
+    block->entry.pts = pts;
+    block->entry.size = size;
+    is->validate_audio_head += size;
+    
+    dispatch_group_async_f((__bridge dispatch_group_t)is->validate_group, (__bridge dispatch_queue_t)is->validate_audio_queue,
+                           block, validate_audio_work);
+    
+    OSAtomicAdd64Barrier(av_gettime() - start, &is->validate_hot_usec);
+}
@@ -34,6 +34,23 @@ int video_open(VideoState *is, VideoPicture *vp);
 double get_video_clock(VideoState *is);
 void refresh_loop_wait_event(VideoState *is);
 void alloc_picture(void *opaque);
+void video_account_picture(VideoPicture *vp, int bytes);
+void video_set_memory_limit(int64_t bytes);
+int64_t video_memory_total(void);
+void video_set_memory_budget(VideoState *is, int64_t bytes);
+int64_t video_pictq_bytes(VideoState *is);
+void pictq_publish(VideoState *is, double lastPTScopied);
+int video_degradation_level(VideoState *is);
+void consumer_copied(VideoState *is, VideoConsumer *vc, double pts, int width, int height);
+VideoConsumer *video_consumer_create(VideoState *is, uint32_t pixel_format);
+void video_consumer_destroy(VideoState *is, VideoConsumer *vc);
+int video_consumer_count(VideoState *is);
+void video_set_output_size(VideoConsumer *vc, int width, int height);
+void video_output_size(VideoState *is, VideoConsumer *vc, int *width, int *height);
+int video_lowres_for_output(VideoState *is, AVStream *st, AVCodec *codec);
+int video_color_matrix(VideoState *is, int *full_range);
+int video_copy_picture(VideoState *is, VideoConsumer *vc, AVFrame *pict, int src_w, int src_h,
+                       uint8_t *data, int pitch, int width, int height);
 int video_thread(void *arg);
 
 #endif
\ No newline at end of file
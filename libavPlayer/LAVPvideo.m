@@ -26,9 +26,17 @@
 
 #include "LAVPcore.h"
 #include "LAVPvideo.h"
+#include "LAVPvalidate.h"
+#include "LAVPoffline.h"
 #include "LAVPqueue.h"
 #include "LAVPsubs.h"
 #include "LAVPaudio.h"
+#include "LAVPreverse.h"
+#include "LAVPchapter.h"
+#include "LAVPscrub.h"
+#include "LAVPtext.h"
+#include "LAVPpool.h"
+#include "LAVPsoak.h"
 
 /* =========================================================== */
 
@@ -54,12 +62,23 @@ extern void copy_planar_YUV420_to_2vuy(size_t width, size_t height,
 									   uint8_t *baseAddr_v, size_t rowBytes_v, 
 									   uint8_t *baseAddr_2vuy, size_t rowBytes_2vuy);
 extern void CVF_CopyPlane(const UInt8* Sbase, int Sstride, int Srow, UInt8* Dbase, int Dstride, int Drow);
+extern void make_YUV_to_BGRA_coeffs(int matrix, int full_range, int16_t coeffs[6]);
+extern void copy_YUV420_to_BGRA(size_t width, size_t height, 
+                                const uint8_t *baseAddr_y, size_t rowBytes_y, 
+                                const uint8_t *baseAddr_u, size_t rowBytes_u, 
+                                const uint8_t *baseAddr_v, size_t rowBytes_v, size_t step_uv, 
+                                uint8_t *baseAddr_bgra, size_t rowBytes_bgra, 
+                                const int16_t coeffs[6]);
 #endif
 
 /* =========================================================== */
 
 #pragma mark -
 
+/* LAVP: bytes of pictq pictures of every player, and the process-wide limit for them */
+static volatile int64_t video_memory_used;
+static volatile int64_t video_memory_limit;
+
 void free_picture(VideoPicture *vp)
 {
     if (vp->bmp) {
@@ -67,6 +86,129 @@ void free_picture(VideoPicture *vp)
         av_free(vp->bmp);
         vp->bmp = NULL;
     }
+    if (vp->bytes) {
+        OSAtomicAdd64Barrier(-vp->bytes, &video_memory_used);
+        vp->bytes = 0;
+    }
+}
+
+/* LAVP: record the size of a newly allocated vp->bmp */
+void video_account_picture(VideoPicture *vp, int bytes)
+{
+    vp->bytes = bytes;
+    OSAtomicAdd64Barrier(bytes, &video_memory_used);
+}
+
+void video_set_memory_limit(int64_t bytes)
+{
+    video_memory_limit = bytes;
+    OSMemoryBarrier();
+}
+
+int64_t video_memory_total(void)
+{
+    OSMemoryBarrier();
+    return video_memory_used;
+}
+
+void video_set_memory_budget(VideoState *is, int64_t bytes)
+{
+    is->memory_budget = bytes;
+    
+    /* let a waiting queue_picture() pick up a larger depth */
+    LAVPLockMutex(is->pictq_mutex);
+    LAVPCondSignal(is->pictq_cond);
+    LAVPUnlockMutex(is->pictq_mutex);
+}
+
+/* bytes held by this player's pictq; caller holds pictq_mutex */
+int64_t video_pictq_bytes(VideoState *is)
+{
+    int64_t bytes = 0;
+    
+    for (int i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++)
+        bytes += is->pictq[i].bytes;
+    return bytes;
+}
+
+/*
+ LAVP: pictq depth which fits the player's budget and its share of the process-wide
+ limit (what it holds now plus what nobody uses). One more picture than the depth
+ stays allocated for the one on screen. Caller holds pictq_mutex.
+ */
+static int video_picture_depth(VideoState *is, int picture_bytes)
+{
+    int64_t budget = is->memory_budget;
+    int64_t limit = video_memory_limit;
+    int depth = is->pictq_depth;
+    
+    if (limit > 0) {
+        int64_t share = limit - video_memory_used + video_pictq_bytes(is);
+        if (!budget || share < budget)
+            budget = share;
+    }
+    if (budget < 0 || (budget == 0 && limit > 0))
+        depth = FFMIN(VIDEO_PICTURE_QUEUE_MIN_DEPTH, depth);    /* the process is over its limit */
+    else if (budget > 0 && picture_bytes > 0)
+        depth = av_clip((int)FFMIN(budget / picture_bytes - 1, INT_MAX), VIDEO_PICTURE_QUEUE_MIN_DEPTH, depth);
+    
+    is->pictq_depth_used = depth;
+    return depth;
+}
+
+/* LAVP: slot is neither queued nor the picture shown before pictq_rindex; caller holds pictq_mutex */
+static int pictq_slot_unused(VideoState *is, int index)
+{
+    int offset = (index - is->pictq_rindex + VIDEO_PICTURE_QUEUE_SIZE) % VIDEO_PICTURE_QUEUE_SIZE;
+    
+    return index != is->pictq_windex && offset >= is->pictq_size && offset != VIDEO_PICTURE_QUEUE_SIZE - 1;
+}
+
+/* LAVP: give vp the buffer of an unused slot of the same size instead of allocating; caller holds pictq_mutex */
+static void pictq_reuse_picture(VideoState *is, VideoPicture *vp, int width, int height)
+{
+    for (int i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++) {
+        VideoPicture *src = &is->pictq[i];
+        if (src == vp || !src->bmp || !src->allocated || !pictq_slot_unused(is, i))
+            continue;
+        if (src->width != width || src->height != height)
+            continue;
+        
+        vp->bmp = src->bmp;
+        vp->bytes = src->bytes;
+        vp->width = width;
+        vp->height = height;
+        vp->pts = -1;
+        vp->reallocate = 0;
+        vp->allocated = 1;
+        src->bmp = NULL;
+        src->bytes = 0;
+        src->pts = -1;
+        src->allocated = 0;
+        return;
+    }
+}
+
+/* LAVP: free buffers of unused slots beyond depth plus the one on screen and the one being written;
+ caller holds pictq_mutex */
+static void pictq_trim(VideoState *is, int depth)
+{
+    int count = 0;
+    
+    for (int i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++)
+        count += (is->pictq[i].bmp != NULL);
+    
+    /* farthest from pictq_windex first; those are reused last */
+    for (int n = 1; n < VIDEO_PICTURE_QUEUE_SIZE && count > depth + 2; n++) {
+        int index = (is->pictq_windex + VIDEO_PICTURE_QUEUE_SIZE - n) % VIDEO_PICTURE_QUEUE_SIZE;
+        VideoPicture *vp = &is->pictq[index];
+        if (!vp->bmp || !pictq_slot_unused(is, index))
+            continue;
+        free_picture(vp);
+        vp->pts = -1;
+        vp->allocated = 0;
+        count--;
+    }
 }
 
 /*
@@ -76,7 +218,6 @@ void free_picture(VideoPicture *vp)
  calculate_display_rect()
  video_image_display()
  compute_mod()
- video_audio_display()
  */
 
 /* display the current picture, if any */
@@ -85,7 +226,7 @@ void video_display(VideoState *is)
     if (0 == is->width * is->height ) // LAVP: zero rect is not allowed
         video_open(is, NULL);
     if (is->audio_st && is->show_mode != SHOW_MODE_VIDEO) {
-        //video_audio_display(is); /* TODO */
+        // LAVP: rendered by vis_refresh() on its own queue (LAVPvis.m)
     } else if (is->video_st) {
         //video_image_display(is); /* TODO */
     }
@@ -216,8 +357,12 @@ void video_refresh(void *opaque, double *remaining_time)
 	
 	SubPicture *sp, *sp2;
 	
-    if (!is->paused && get_master_sync_type(is) == AV_SYNC_EXTERNAL_CLOCK && is->realtime)
-        check_external_clock_speed(is);
+    if (!is->paused && get_master_sync_type(is) == AV_SYNC_EXTERNAL_CLOCK) {
+        if (is->low_latency && !is->reverse && !is->timeshift)
+            check_live_latency(is);
+        else if (is->realtime)
+            check_external_clock_speed(is);
+    }
     
     if (!is->display_disable && is->show_mode != SHOW_MODE_VIDEO && is->audio_st) {
         time = av_gettime() / 1000000.0;
@@ -237,6 +382,8 @@ void video_refresh(void *opaque, double *remaining_time)
             // nothing to do, no picture to display in the queue
         } else {
             double last_duration, duration, delay;
+            double scheduled = NAN;     // LAVP: soak testing; NAN = not presented on schedule
+            int repeat = 0;
             VideoPicture *vp, *lastvp;
             
             LAVPLockMutex(is->pictq_mutex);
@@ -276,6 +423,10 @@ void video_refresh(void *opaque, double *remaining_time)
             }
             
             is->frame_timer += delay;
+            if (!redisplay) {
+                scheduled = is->frame_timer;
+                repeat = delay > last_duration;     /* the previous picture was held for the master */
+            }
             if (delay > 0 && time - is->frame_timer > AV_SYNC_THRESHOLD_MAX)
                 is->frame_timer = time;
             
@@ -297,6 +448,9 @@ void video_refresh(void *opaque, double *remaining_time)
             LAVPUnlockMutex(is->pictq_mutex);
 			
 			if(is->subtitle_st) {
+                ClockSnapshot vidsnap;
+                clock_snapshot(&is->vidclk, &vidsnap);
+                
                 LAVPLockMutex(is->subpq_mutex);
                 while (is->subpq_size > 0) {
                     sp = &is->subpq[is->subpq_rindex];
@@ -307,8 +461,8 @@ void video_refresh(void *opaque, double *remaining_time)
                         sp2 = NULL;
                     
                     if (sp->serial != is->subtitleq.serial
-                        || (is->vidclk.pts > (sp->pts + ((float) sp->sub.end_display_time / 1000)))
-                        || (sp2 && is->vidclk.pts > (sp2->pts + ((float) sp2->sub.start_display_time / 1000))))
+                        || (vidsnap.pts > (sp->pts + ((float) sp->sub.end_display_time / 1000)))
+                        || (sp2 && vidsnap.pts > (sp2->pts + ((float) sp2->sub.start_display_time / 1000))))
                     {
                         free_subpicture(sp);
                         
@@ -329,6 +483,8 @@ display:
             /* display picture */
             if (!is->display_disable && is->show_mode == SHOW_MODE_VIDEO)
                 video_display(is);
+            if (is->soak && !isnan(scheduled))
+                soak_picture(is, vp->pts, scheduled, av_gettime() / 1000000.0, repeat);
             
             pictq_next_picture(is);
             
@@ -408,7 +564,9 @@ void alloc_picture(void *opaque)
 	vp->width   = is->video_st->codec->width;
 	vp->height  = is->video_st->codec->height;
 	vp->bmp = picture;
+	video_account_picture(vp, ret);
 	vp->allocated = 1;
+	pictq_publish(is, is->lastPTScopied);
 	
 	LAVPCondSignal(is->pictq_cond);
 	LAVPUnlockMutex(is->pictq_mutex);
@@ -417,22 +575,34 @@ void alloc_picture(void *opaque)
 int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)
 {
 	VideoPicture *vp;
+    int depth;
     
 #if defined(DEBUG_SYNC) && 0
     printf("frame_type=%c pts=%0.3f\n",
            av_get_picture_type_char(src_frame->pict_type), pts);
 #endif
 	
+    /* LAVP: offline processing hands every picture over instead of pacing it through pictq */
+    if (is->offline)
+        return offline_picture(is, src_frame, pts, serial);
+    
 	/* wait until we have space to put a new picture */
 	LAVPLockMutex(is->pictq_mutex);
 	
     /* keep the last already displayed picture in the queue */
-	while (is->pictq_size >= VIDEO_PICTURE_QUEUE_SIZE / 2 && // LAVP: keep some picts left in queue
+    // LAVP: keep some picts left in queue, as many as the memory budget allows
+    depth = video_picture_depth(is, avpicture_get_size(PIX_FMT_YUV420P, src_frame->width, src_frame->height));
+	while (is->pictq_size >= depth &&
 		   !is->videoq.abort_request) {
 		LAVPCondWait(is->pictq_cond, is->pictq_mutex);
+        depth = video_picture_depth(is, avpicture_get_size(PIX_FMT_YUV420P, src_frame->width, src_frame->height));
 	}
     
 	vp = &is->pictq[is->pictq_windex];
+    
+    // LAVP: take over a buffer which is no longer shown rather than allocating one per slot
+    if (!vp->bmp)
+        pictq_reuse_picture(is, vp, is->video_st->codec->width, is->video_st->codec->height);
 	
 	LAVPUnlockMutex(is->pictq_mutex);
 	
@@ -510,6 +680,9 @@ int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duratio
 #endif
 		} else {
             /* convert image format */
+            if (!is->img_convert_ctx && is->context_pool)
+                is->img_convert_ctx = pool_take_sws(vp->width, vp->height, src_frame->format,
+                                                    vp->width, vp->height, AV_PIX_FMT_YUV420P, is->sws_flags);
 			is->img_convert_ctx = sws_getCachedContext(is->img_convert_ctx,
 													   vp->width, vp->height, src_frame->format,
 													   vp->width, vp->height, AV_PIX_FMT_YUV420P,
@@ -532,11 +705,69 @@ int queue_picture(VideoState *is, AVFrame *src_frame, double pts, double duratio
 			is->pictq_windex = 0;
         
 		is->pictq_size++;
+		pictq_publish(is, is->lastPTScopied);
+        pictq_trim(is, depth);
 		LAVPUnlockMutex(is->pictq_mutex);
+        
+        /* LAVP: only this thread writes the slot, so it can be read after publishing */
+        if (is->validate)
+            validate_picture(is, vp->bmp, vp->width, vp->height, pts, serial);
+        
+        /* LAVP: the first picture after a chapter jump replaces the prefetched one */
+        chapter_picture_queued(is, serial);
+        
+        /* LAVP: after scrubbing the keyframe stays up until the exact picture arrives */
+        if (is->scrubbing)
+            scrub_picture_queued(is, serial, pts);
 	}
 	return 0;
 }
 
+/* LAVP: map a degradation level onto the decoder's discard settings */
+static void video_apply_degradation(AVCodecContext *avctx, int level)
+{
+    avctx->skip_loop_filter = level >= 2 ? AVDISCARD_ALL : (level >= 1 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+    avctx->skip_idct        = level >= 2 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    avctx->skip_frame       = level >= 4 ? AVDISCARD_NONKEY : (level >= 3 ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+}
+
+/* LAVP: raise the level while packets reach the decoder late or frames get dropped at display,
+ lower it once they are comfortably ahead of the master clock again. Judged per packet and
+ held in wall time: at the highest level only keyframes give pictures, and waiting for those
+ would take many GOPs to step down. */
+static void video_update_degradation(VideoState *is, double dts)
+{
+    double late = get_master_clock(is) - dts;
+    int level = is->degradation_level;
+    int drops;
+    
+    if (isnan(late) || fabs(late) >= AV_NOSYNC_THRESHOLD)
+        return;
+    
+    is->degradation_lateness = 0.9 * is->degradation_lateness + 0.1 * late;
+    if (av_gettime() < is->degradation_hold_until)
+        return;
+    
+    drops = is->frame_drops_late - is->degradation_drops_late;
+    is->degradation_drops_late = is->frame_drops_late;
+    
+    if ((is->degradation_lateness > VIDEO_DEGRADATION_LATE || drops > 1) && level < VIDEO_DEGRADATION_MAX)
+        level++;
+    else if (is->degradation_lateness < VIDEO_DEGRADATION_EARLY && !drops && level > 0)
+        level--;
+    
+    if (level != is->degradation_level) {
+        video_apply_degradation(is->video_st->codec, level);
+        is->degradation_level = level;
+        is->degradation_hold_until = av_gettime() + VIDEO_DEGRADATION_HOLD;
+    }
+}
+
+int video_degradation_level(VideoState *is)
+{
+    return is->degradation_level;
+}
+
 int get_video_frame(VideoState *is, AVFrame *frame, AVPacket *pkt, int *serial)
 {
 	int got_picture;
@@ -547,9 +778,23 @@ int get_video_frame(VideoState *is, AVFrame *frame, AVPacket *pkt, int *serial)
     /* LAVP: Queue specific flush packet */
 	if (pkt->data == is->videoq.flush_pkt.data) {
 		avcodec_flush_buffers(is->video_st->codec);
+        /* LAVP: lateness before a seek says nothing about the new position */
+        is->degradation_lateness = 0;
+        is->degradation_hold_until = av_gettime() + VIDEO_DEGRADATION_HOLD;
 		return 0;
 	}
 	
+    /* LAVP: a newer seek has flushed the queue; do not decode outdated packets */
+    if (*serial != is->videoq.serial)
+        return 0;
+    
+    /* LAVP: skip work inside the decoder before dropping whole frames */
+    if ((is->framedrop>0 || (is->framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)) && !is->step && pkt->data) {
+        int64_t ts = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+        if (ts != AV_NOPTS_VALUE)
+            video_update_degradation(is, av_q2d(is->video_st->time_base) * ts);
+    }
+    
     if(avcodec_decode_video2(is->video_st->codec, frame, &got_picture, pkt) < 0)
         return 0;
 	
@@ -575,10 +820,12 @@ int get_video_frame(VideoState *is, AVFrame *frame, AVPacket *pkt, int *serial)
         
         if (is->framedrop>0 || (is->framedrop && get_master_sync_type(is) != AV_SYNC_VIDEO_MASTER)) {
             if (frame->pts != AV_NOPTS_VALUE) {
+                ClockSnapshot vidsnap;
+                clock_snapshot(&is->vidclk, &vidsnap);
                 double diff = dpts - get_master_clock(is);
                 if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD &&
                     diff - is->frame_last_filter_delay < 0 &&
-                    *serial == is->vidclk.serial &&
+                    *serial == vidsnap.serial &&
                     is->videoq.nb_packets) {
                     is->frame_drops_early++;
                     av_frame_unref(frame);
@@ -636,13 +883,6 @@ the_end:
     av_free_packet(&pkt);
     av_frame_free(&frame);
     
-    /* LAVP: free up 420422 converter */
-#if !ALLOW_GPL_CODE
-	if (is->sws420to422) {
-		sws_freeContext(is->sws420to422);
-        is->sws420to422 = NULL;
-    }
-#endif
 	return 0;
 }
 
@@ -650,85 +890,342 @@ the_end:
 
 #pragma mark -
 
-int hasImage(void *opaque, double_t targetpts)
+/* LAVP: recompute the earliest queued pts after the consumer's cursor. Caller must hold pictq_mutex. */
+static void consumer_publish(VideoState *is, VideoConsumer *vc)
 {
-	VideoState *is = opaque;
-	
-	LAVPLockMutex(is->pictq_mutex);
-	
-	if (is->pictq_size > 0) {
-		VideoPicture *vp = NULL;
-		VideoPicture *tmp = NULL;
-		
-        if (1) {
-            int index = is->pictq_windex;
-            while (index != is->pictq_rindex) {
-                VideoPicture *tmp = &is->pictq[index];
-                if (tmp && tmp->bmp && tmp->allocated) {
-                    if (0.0 <= tmp->pts && tmp->pts <= targetpts) {
-                        if (!vp) {
-                            vp = tmp;
-                        } else if (vp->pts < tmp->pts) {
-                            vp = tmp;
-                        }
-                    }
-                }
-                index = (++index) % VIDEO_PICTURE_QUEUE_SIZE;
-            }
-        }
-        if (!is->paused) { // LAVP: No advance while paused
-            for (int offset = 0; offset < is->pictq_size; offset++) {
-                int index = (is->pictq_rindex + offset) % VIDEO_PICTURE_QUEUE_SIZE;
-                tmp = &is->pictq[index];
-                
-                if (0.0 <= tmp->pts && tmp->pts <= targetpts) {
-                    if (!vp) {
-                        vp = tmp;
-                    } else if (vp->pts < tmp->pts) {
-                        vp = tmp;
-                    }
-                }
-            }
+    double next = INFINITY;
+    int found = 0;
+    
+    for (int i = 0; i < VIDEO_PICTURE_QUEUE_SIZE; i++) {
+        VideoPicture *vp = &is->pictq[i];
+        if (!vp->bmp || !vp->allocated || !(vp->pts >= 0))
+            continue;
+        if (vp->pts == vc->lastPTScopied)
+            found = 1;
+        else if (vp->pts > vc->lastPTScopied && vp->pts < next)
+            next = vp->pts;
+    }
+    
+    /* the copied picture was recycled; readers must take the slow path */
+    if (vc->lastPTScopied < 0 || !found)
+        next = -INFINITY;
+    
+    LAVPSeqWriteBegin(&vc->seq);
+    vc->next_pts = next;
+    LAVPSeqWriteEnd(&vc->seq);
+}
+
+/* LAVP: publish lastPTScopied and each consumer's next pts for lock-free readers.
+ A negative lastPTScopied resets every consumer's cursor. Caller must hold pictq_mutex. */
+void pictq_publish(VideoState *is, double lastPTScopied)
+{
+    VideoConsumer *vc;
+    
+    is->lastPTScopied = lastPTScopied;
+    for (vc = is->consumers; vc; vc = vc->next) {
+        if (lastPTScopied < 0)
+            vc->lastPTScopied = -1;
+        consumer_publish(is, vc);
+    }
+}
+
+/* LAVP: returns 1 if copyImage() would only find the consumer's last picture again (no lock taken) */
+static int pictq_unchanged(VideoState *is, VideoConsumer *vc, double_t targetpts, int width, int height)
+{
+    double last, next;
+    int32_t seq;
+    
+    if (is->paused || is->reverse || is->pictq_size <= 0)
+        return 0;
+    if (width != vc->width || height != vc->height)
+        return 0;
+    
+    do {
+        seq = LAVPSeqReadBegin(&vc->seq);
+        last = vc->lastPTScopied;
+        next = vc->next_pts;
+    } while (LAVPSeqReadRetry(&vc->seq, seq));
+    
+    return (last >= 0 && last <= targetpts && targetpts < next);
+}
+
+/* LAVP: mark the consumer's copy as current. Caller must hold pictq_mutex. */
+void consumer_copied(VideoState *is, VideoConsumer *vc, double pts, int width, int height)
+{
+    vc->width = width;
+    vc->height = height;
+    vc->lastPTScopied = pts;
+    pictq_publish(is, pts);
+}
+
+/* ========================================================================= */
+
+#pragma mark -
+
+/*
+ Consumers:
+ 
+ Every presentation target of a VideoState (LAVPDecoder's own pixel buffer, each
+ LAVPLayer/LAVPView sharing the stream, ...) is a VideoConsumer with its own cursor,
+ output size, pixel format and converter. They all read the same pictq, so the
+ stream is demuxed and decoded once; each consumer converts only the pictures it
+ presents, at its own size.
+ */
+
+VideoConsumer *video_consumer_create(VideoState *is, uint32_t pixel_format)
+{
+    VideoConsumer *vc = av_mallocz(sizeof(VideoConsumer));
+    
+    if (!vc)
+        return NULL;
+    vc->pixel_format = (pixel_format == VIDEO_CONSUMER_BGRA) ? VIDEO_CONSUMER_BGRA : VIDEO_CONSUMER_2VUY;
+    vc->lastPTScopied = -1;
+    vc->next_pts = -INFINITY;
+    
+    LAVPLockMutex(is->pictq_mutex);
+    vc->next = is->consumers;
+    is->consumers = vc;
+    LAVPUnlockMutex(is->pictq_mutex);
+    return vc;
+}
+
+void video_consumer_destroy(VideoState *is, VideoConsumer *vc)
+{
+    VideoConsumer **p;
+    
+    if (!vc)
+        return;
+    
+    LAVPLockMutex(is->pictq_mutex);
+    for (p = &is->consumers; *p; p = &(*p)->next) {
+        if (*p == vc) {
+            *p = vc->next;
+            break;
         }
-        if (!vp) {
-            // Workaround: When all pictures in pictq are later time stamp then targetpts
-            vp = &is->pictq[is->pictq_rindex];
+    }
+    LAVPUnlockMutex(is->pictq_mutex);
+    
+    if (is->context_pool)
+        pool_put_sws(vc->sws);
+    else if (vc->sws)
+        sws_freeContext(vc->sws);
+    av_free(vc);
+}
+
+int video_consumer_count(VideoState *is)
+{
+    VideoConsumer *vc;
+    int count = 0;
+    
+    LAVPLockMutex(is->pictq_mutex);
+    for (vc = is->consumers; vc; vc = vc->next)
+        count++;
+    LAVPUnlockMutex(is->pictq_mutex);
+    return count;
+}
+
+/* LAVP: fraction of the decoded size which covers the requested output box */
+static double video_output_scale(VideoState *is, AVStream *st, int box_w, int box_h, int w, int h)
+{
+    AVRational sar = {0, 1};
+    double dw, scale;
+    
+    if (box_w <= 0 || box_h <= 0 || w <= 0 || h <= 0)
+        return 1.0;
+    if (st)
+        sar = av_guess_sample_aspect_ratio(is->ic, st, NULL);
+    dw = (sar.num > 0 && sar.den > 0) ? w * av_q2d(sar) : w;
+    
+    /* gravities which fill the layer need the larger of both ratios */
+    scale = FFMAX(box_w / dw, box_h / (double)h);
+    return FFMIN(scale, 1.0);
+}
+
+void video_set_output_size(VideoConsumer *vc, int width, int height)
+{
+    vc->output_width = FFMAX(width, 0);
+    vc->output_height = FFMAX(height, 0);
+}
+
+/* LAVP: size of the picture copyImage() should produce for this consumer */
+void video_output_size(VideoState *is, VideoConsumer *vc, int *width, int *height)
+{
+    int w = is->width, h = is->height;
+    double scale = video_output_scale(is, is->video_st, vc->output_width, vc->output_height, w, h);
+    
+    if (scale < 1.0) {
+        w = FFMIN(FFALIGN((int)ceil(w * scale), 2), w);
+        h = FFMIN(FFALIGN((int)ceil(h * scale), 2), h);
+    }
+    *width = FFMAX(w, 2);
+    *height = FFMAX(h, 2);
+}
+
+/* LAVP: largest lowres level which still decodes at least the size hinted at open */
+int video_lowres_for_output(VideoState *is, AVStream *st, AVCodec *codec)
+{
+    double scale = video_output_scale(is, st, is->output_width, is->output_height,
+                                      st->codec->width, st->codec->height);
+    int lowres = 0;
+    
+    while (lowres < av_codec_get_max_lowres(codec) && scale * (2 << lowres) <= 1.0)
+        lowres++;
+    return lowres;
+}
+
+/* LAVP: YUV->RGB matrix (601, 709 or 2020) and range for BGRA consumers */
+int video_color_matrix(VideoState *is, int *full_range)
+{
+    AVCodecContext *avctx = is->video_st ? is->video_st->codec : NULL;
+    int matrix = is->color_matrix;
+    
+    if (!matrix && avctx) {
+        switch (avctx->colorspace) {
+            case AVCOL_SPC_BT709:
+            case AVCOL_SPC_SMPTE240M:
+                matrix = 709;
+                break;
+            case AVCOL_SPC_BT2020_NCL:
+            case AVCOL_SPC_BT2020_CL:
+                matrix = 2020;
+                break;
+            case AVCOL_SPC_BT470BG:
+            case AVCOL_SPC_SMPTE170M:
+            case AVCOL_SPC_FCC:
+                matrix = 601;
+                break;
+            default:
+                /* untagged: HD sizes are BT.709 in practice */
+                matrix = (avctx->height >= 720) ? 709 : 601;
+                break;
         }
-		
-		if (vp) {
-            //NSLog(@"DEBUG: hasImage(%.3lf) => (%.3lf); delta=%.3lf)", *targetpts, vp->pts, vp->pts - *targetpts);
-            
-			LAVPUnlockMutex(is->pictq_mutex);
-			return 1;
-		}
-	} else {
-		//NSLog(@"ERROR: is->pictq_size == 0 (%s)", __FUNCTION__);
-	}
-	
-bail:
-	LAVPUnlockMutex(is->pictq_mutex);
-	return 0;
+    }
+    if (!matrix)
+        matrix = 601;
+    
+    if (full_range) {
+        /* pictq holds the decoder samples untouched only for YUV420P; other formats went through swscale */
+        if (is->color_range)
+            *full_range = (is->color_range == AVCOL_RANGE_JPEG);
+        else
+            *full_range = (avctx && avctx->pix_fmt == PIX_FMT_YUV420P && avctx->color_range == AVCOL_RANGE_JPEG);
+    }
+    return matrix;
+}
+
+/* LAVP: YUV420P picture into a width x height buffer of the consumer's format.
+ Scaling and packing are a single sws pass, so no full size intermediate is written. */
+int video_copy_picture(VideoState *is, VideoConsumer *vc, AVFrame *pict, int src_w, int src_h,
+                       uint8_t *data, int pitch, int width, int height)
+{
+    const uint8_t *in[4] = {pict->data[0], pict->data[1], pict->data[2], pict->data[3]};
+    uint8_t *out[4] = {data};
+    enum AVPixelFormat dst_fmt = (vc->pixel_format == VIDEO_CONSUMER_BGRA) ? PIX_FMT_BGRA : PIX_FMT_UYVY422;
+    int full_range = 0;
+    int matrix = 0;
+    
+    if (dst_fmt == PIX_FMT_BGRA)
+        matrix = video_color_matrix(is, &full_range);
+    
+#if ALLOW_GPL_CODE
+    if (dst_fmt == PIX_FMT_UYVY422 && width == src_w && height == src_h) {
+        copy_planar_YUV420_to_2vuy(src_w, src_h,
+                                   pict->data[0], pict->linesize[0],
+                                   pict->data[1], pict->linesize[1],
+                                   pict->data[2], pict->linesize[2],
+                                   data, pitch);
+        return 1;
+    }
+    if (dst_fmt == PIX_FMT_BGRA && width == src_w && height == src_h) {
+        /* LAVP: single pass YUV->BGRA, no intermediate 2vuy or CoreImage step */
+        int16_t coeffs[6];
+        make_YUV_to_BGRA_coeffs(matrix, full_range, coeffs);
+        copy_YUV420_to_BGRA(src_w, src_h,
+                            pict->data[0], pict->linesize[0],
+                            pict->data[1], pict->linesize[1],
+                            pict->data[2], pict->linesize[2], 1,
+                            data, pitch, coeffs);
+        return 1;
+    }
+#endif
+    
+    /* a context new to this consumer has not got its matrix yet */
+    if (vc->sws && (vc->sws_src_w != src_w || vc->sws_src_h != src_h ||
+                    vc->sws_dst_w != width || vc->sws_dst_h != height))
+        vc->sws_matrix = 0;     /* sws_getCachedContext() replaces it */
+    if (!vc->sws) {
+        vc->sws_matrix = 0;
+        if (is->context_pool)
+            vc->sws = pool_take_sws(src_w, src_h, PIX_FMT_YUV420P, width, height, dst_fmt, SWS_BILINEAR);
+    }
+    vc->sws = sws_getCachedContext(vc->sws,
+                                   src_w, src_h, PIX_FMT_YUV420P,
+                                   width, height, dst_fmt,
+                                   SWS_BILINEAR, NULL, NULL, NULL);
+    if (!vc->sws)
+        return 0;
+    vc->sws_src_w = src_w;
+    vc->sws_src_h = src_h;
+    vc->sws_dst_w = width;
+    vc->sws_dst_h = height;
+    if (dst_fmt == PIX_FMT_BGRA && vc->sws_matrix != matrix * 2 + full_range) {
+        /* LAVP: scaled BGRA uses the same matrix as the fused path */
+        int colorspace = (matrix == 709) ? SWS_CS_ITU709 : SWS_CS_ITU601;
+#ifdef SWS_CS_BT2020
+        if (matrix == 2020)
+            colorspace = SWS_CS_BT2020;
+#endif
+        sws_setColorspaceDetails(vc->sws, sws_getCoefficients(colorspace), full_range,
+                                 sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+        vc->sws_matrix = matrix * 2 + full_range;
+    }
+    return sws_scale(vc->sws, in, pict->linesize, 0, src_h, out, &pitch);
 }
 
-int copyImage(void *opaque, double_t *targetpts, uint8_t* data, int pitch) 
+int hasImage(void *opaque, double_t targetpts)
 {
 	VideoState *is = opaque;
-	uint8_t * out[4] = {0};
-	out[0] = data;
-	assert(data);
 	
-#if !ALLOW_GPL_CODE
-    /* LAVP: Prepare 420422 converter */
-	if (!is->sws420to422) {
-		is->sws420to422 = sws_getContext(is->width, is->height,
-										 PIX_FMT_YUV420P,
-										 is->width, is->height,
-										 PIX_FMT_UYVY422,
-										 SWS_BILINEAR,NULL, NULL, NULL);
-		assert (is->sws420to422);
-	}
-#endif
+    /* LAVP: a chapter jump shows its prefetched picture until pictq catches up */
+    if (is->chap_showing)
+        return chapter_has_image(is);
+    
+    /* LAVP: while scrubbing the latest decoded keyframe is presented */
+    if (is->scrubbing && scrub_has_image(is))
+        return 1;
+    
+    /* LAVP: reverse playback presents frames from its own cache */
+    if (is->reverse)
+        return reverse_has_image(is);
+    
+    /* LAVP: display link polls every vsync; any queued picture can be presented.
+     copyImage() picks the one matching targetpts, falling back to pictq_rindex */
+    return is->pictq_size > 0;
+}
+
+int copyImage(void *opaque, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height) 
+{
+	VideoState *is = opaque;
+	assert(data && vc);
 	
+    if (is->chap_showing) {
+        int ret = chapter_copy_image(is, vc, targetpts, data, pitch, width, height);
+        if (ret)
+            return ret;
+    }
+    
+    if (is->scrubbing) {
+        int ret = scrub_copy_image(is, vc, targetpts, data, pitch, width, height);
+        if (ret)
+            return ret;
+    }
+    
+    if (pictq_unchanged(is, vc, *targetpts, width, height))
+        return 2;
+    
+    if (is->reverse)
+        return reverse_copy_image(is, vc, targetpts, data, pitch, width, height);
+    
 	LAVPLockMutex(is->pictq_mutex);
 	
 	if (is->pictq_size > 0) {
@@ -781,36 +1278,29 @@ int copyImage(void *opaque, double_t *targetpts, uint8_t* data, int pitch)
             //    NSLog(@"DEBUG: %8.3f %s %8.3f", vp->pts, (vp->pts <= *targetpts?" =<":">  "), *targetpts);
             //}
             
-            if (vp->pts >= 0 && vp->pts == is->lastPTScopied) {
+            if (vp->pts >= 0 && vp->pts == vc->lastPTScopied &&
+                width == vc->width && height == vc->height) {
 				LAVPUnlockMutex(is->pictq_mutex);
 				return 2;
 			}
 			
             // TODO Add support to call blend_subrect() for subq (original:video_image_display())
             
-#if ALLOW_GPL_CODE
-			uint8_t *in[4] = {vp->bmp->data[0], vp->bmp->data[1], vp->bmp->data[2], vp->bmp->data[3]};
-			size_t inpitch[4] = {vp->bmp->linesize[0], vp->bmp->linesize[1], vp->bmp->linesize[2], vp->bmp->linesize[3]};
-			copy_planar_YUV420_to_2vuy(vp->width, vp->height, 
-									   in[0], inpitch[0], 
-									   in[1], inpitch[1], 
-									   in[2], inpitch[2], 
-									   data, pitch);
-			result = 1;
-#else
-			const uint8_t *in[4] = {vp->bmp->data[0], vp->bmp->data[1], vp->bmp->data[2], vp->bmp->data[3]};
-			result = sws_scale(is->sws420to422, 
-							   in, vp->bmp->linesize, 0, vp->height, 
-							   out, &pitch);
-#endif
+			result = video_copy_picture(is, vc, vp->bmp, vp->width, vp->height, data, pitch, width, height);
 			
 			if (result > 0) {
 				//NSLog(@"DEBUG: copyImage(%.3lf) => (%.3lf); delta=%.3lf)", *targetpts, vp->pts, vp->pts - *targetpts);
                 
-				is->lastPTScopied = vp->pts;
+				consumer_copied(is, vc, vp->pts, width, height);
+				chapter_presented(is, vp->serial);
+				scrub_presented(is, vp->serial, vp->pts);
 				*targetpts = vp->pts;
 				
 				LAVPUnlockMutex(is->pictq_mutex);
+				
+				/* LAVP: text subtitles are drawn over the consumer's copy; pictq stays clean.
+				   Outside pictq_mutex: a layout miss must not hold up queue_picture() */
+				text_composite(is, vc, *targetpts, data, pitch, width, height);
 				return 1;
 			} else {
 				NSLog(@"ERROR: result != 0 (%s)", __FUNCTION__);
@@ -831,6 +1321,16 @@ int hasImageCurrent(void *opaque)
 {
 	VideoState *is = opaque;
 	
+    if (is->chap_showing)
+        return chapter_has_image(is);
+    
+    /* LAVP: while scrubbing the latest decoded keyframe is presented */
+    if (is->scrubbing && scrub_has_image(is))
+        return 1;
+    
+    if (is->reverse)
+        return reverse_has_image(is);
+    
 	LAVPLockMutex(is->pictq_mutex);
 	
 	if (is->pictq_size > 0) {
@@ -865,24 +1365,28 @@ bail:
 	return 0;
 }
 
-int copyImageCurrent(void *opaque, double_t *targetpts, uint8_t* data, int pitch) 
+int copyImageCurrent(void *opaque, VideoConsumer *vc, double_t *targetpts, uint8_t* data, int pitch, int width, int height) 
 {
 	VideoState *is = opaque;
-	uint8_t * out[4] = {0};
-	out[0] = data;
-	assert(data);
-	
-#if !ALLOW_GPL_CODE
-	if (!is->sws420to422) {
-		is->sws420to422 = sws_getContext(is->width, is->height,
-										 PIX_FMT_YUV420P,
-										 is->width, is->height,
-										 PIX_FMT_UYVY422,
-										 SWS_BICUBIC,NULL, NULL, NULL);
-		assert (is->sws420to422);
-	}
-#endif
+	assert(data && vc);
 	
+    if (is->chap_showing) {
+        int ret = chapter_copy_image(is, vc, targetpts, data, pitch, width, height);
+        if (ret)
+            return ret;
+    }
+    
+    if (is->scrubbing) {
+        int ret = scrub_copy_image(is, vc, targetpts, data, pitch, width, height);
+        if (ret)
+            return ret;
+    }
+    
+    if (is->reverse) {
+        *targetpts = get_master_clock(is);
+        return reverse_copy_image(is, vc, targetpts, data, pitch, width, height);
+    }
+    
 	LAVPLockMutex(is->pictq_mutex);
 	
 	if (is->pictq_size > 0) {
@@ -904,36 +1408,29 @@ int copyImageCurrent(void *opaque, double_t *targetpts, uint8_t* data, int pitch
 		if (vp) {
 			int result = 0;
 			
-			if (vp->pts >= 0 && vp->pts == is->lastPTScopied) {
+			if (vp->pts >= 0 && vp->pts == vc->lastPTScopied &&
+			    width == vc->width && height == vc->height) {
 				LAVPUnlockMutex(is->pictq_mutex);
 				return 2;
 			}
 			
             // TODO Add support to call blend_subrect() for subq (original:video_image_display())
             
-#if ALLOW_GPL_CODE
-			uint8_t *in[4] = {vp->bmp->data[0], vp->bmp->data[1], vp->bmp->data[2], vp->bmp->data[3]};
-			size_t inpitch[4] = {vp->bmp->linesize[0], vp->bmp->linesize[1], vp->bmp->linesize[2], vp->bmp->linesize[3]};
-			copy_planar_YUV420_to_2vuy(vp->width, vp->height, 
-									   in[0], inpitch[0], 
-									   in[1], inpitch[1], 
-									   in[2], inpitch[2], 
-									   data, pitch);
-			result = 1;
-#else
-			const uint8_t *in[4] = {vp->bmp->data[0], vp->bmp->data[1], vp->bmp->data[2], vp->bmp->data[3]};
-			result = sws_scale(is->sws420to422, 
-							   in, vp->bmp->linesize, 0, vp->height, 
-							   out, &pitch);
-#endif
+			result = video_copy_picture(is, vc, vp->bmp, vp->width, vp->height, data, pitch, width, height);
 			
 			if (result > 0) {
 				//NSLog(@"DEBUG: copyImageCurrent() => (%.3lf)", vp->pts);
                 
-				is->lastPTScopied = vp->pts;
+				consumer_copied(is, vc, vp->pts, width, height);
+				chapter_presented(is, vp->serial);
+				scrub_presented(is, vp->serial, vp->pts);
 				*targetpts = vp->pts;
 				
 				LAVPUnlockMutex(is->pictq_mutex);
+				
+				/* LAVP: text subtitles are drawn over the consumer's copy; pictq stays clean.
+				   Outside pictq_mutex: a layout miss must not hold up queue_picture() */
+				text_composite(is, vc, *targetpts, data, pitch, width, height);
 				return 1;
 			} else {
 				NSLog(@"ERROR: result != 0 (%s)", __FUNCTION__);
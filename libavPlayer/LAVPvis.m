@@ -0,0 +1,387 @@
+/*
+ *  LAVPvis.m
+ *  libavPlayer
+ *
+ */
+/*
+ This file is part of livavPlayer.
+ 
+ livavPlayer is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+ 
+ livavPlayer is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with libavPlayer; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "LAVPcore.h"
+#include "LAVPvideo.h"
+#include "LAVPvis.h"
+
+#import <Accelerate/Accelerate.h>
+
+/* =========================================================== */
+
+extern void free_picture(VideoPicture *vp);
+
+/*
+ Audio visualization:
+ 
+ The AudioQueue callback only appends decoded samples to is->sample_array while
+ a visualization is active. A dispatch timer on the "vis" queue fires every
+ rdftspeed seconds, takes the window which is audible right now, renders a
+ min/max waveform (SHOW_MODE_WAVES) or one column of a scrolling spectrogram
+ (SHOW_MODE_RDFT) into a YUV420P canvas and queues a copy into pictq. For
+ audio-only files copyImage() then serves these pictures like decoded video.
+ */
+
+/* =========================================================== */
+
+#pragma mark -
+
+/* deinterleave nb samples of channel ch; start is frame aligned within the ring */
+static void vis_gather(VideoState *is, int ring, int start, int ch, int channels, float *dst, int nb)
+{
+    int pos = start + ch;
+    int n1 = (ring - pos + channels - 1) / channels;
+    
+    if (n1 > nb)
+        n1 = nb;
+    vDSP_vflt16(is->sample_array + pos, channels, dst, 1, n1);
+    if (nb > n1)
+        vDSP_vflt16(is->sample_array + ch, channels, dst + n1, 1, nb - n1);
+}
+
+/* returns the ring index of the first frame of the nb frames being heard now */
+static int vis_window_start(VideoState *is, int ring, int channels, int nb)
+{
+    int64_t delay, time_diff, start;
+    int index = is->sample_array_index;
+    
+    OSMemoryBarrier();
+    
+    /* LAVP: samples still queued in AudioQueue buffers have not been heard yet */
+    delay = (2 * is->audio_hw_buf_size + is->audio_write_buf_size) / (channels * sizeof(int16_t));
+    time_diff = av_gettime() - is->audio_callback_time;
+    delay -= time_diff * is->audio_tgt.freq / 1000000;
+    delay += nb;
+    if (delay < nb)
+        delay = nb;
+    if (delay * channels > ring)
+        delay = ring / channels;
+    
+    start = index - delay * channels;
+    if (start < 0)
+        start += ring;
+    is->last_i_start = (int)start;
+    return (int)start;
+}
+
+static void vis_clear(AVFrame *canvas)
+{
+    int y;
+    
+    for (y = 0; y < canvas->height; y++)
+        memset(canvas->data[0] + y * canvas->linesize[0], 16, canvas->width);
+    for (y = 0; y < (canvas->height + 1) / 2; y++) {
+        memset(canvas->data[1] + y * canvas->linesize[1], 128, (canvas->width + 1) / 2);
+        memset(canvas->data[2] + y * canvas->linesize[2], 128, (canvas->width + 1) / 2);
+    }
+}
+
+#pragma mark -
+
+static int vis_draw_waves(VideoState *is, AVFrame *canvas, int ring, int channels)
+{
+    int w = canvas->width, h = canvas->height;
+    int nb = FFMAX(w, (int)(is->audio_tgt.freq * is->rdftspeed));
+    int band = h / channels;
+    int start, ch, x, y;
+    
+    if (band < 2)
+        return -1;
+    av_fast_malloc(&is->vis_buf, &is->vis_buf_size, nb * sizeof(float));
+    if (!is->vis_buf)
+        return AVERROR(ENOMEM);
+    
+    start = vis_window_start(is, ring, channels, nb);
+    vis_clear(canvas);
+    
+    for (ch = 0; ch < channels; ch++) {
+        float *buf = is->vis_buf;
+        float scale = -(float)(band / 2) / 32768;
+        float center = ch * band + band / 2;
+        
+        /* map samples to rows of this channel's band at once */
+        vis_gather(is, ring, start, ch, channels, buf, nb);
+        vDSP_vsmsa(buf, 1, &scale, &center, buf, 1, nb);
+        
+        for (x = 0; x < w; x++) {
+            int i0 = (int)((int64_t)x * nb / w);
+            int i1 = (int)((int64_t)(x + 1) * nb / w);
+            float lo, hi;
+            int y0, y1;
+            
+            vDSP_minv(buf + i0, 1, &lo, FFMAX(i1 - i0, 1));
+            vDSP_maxv(buf + i0, 1, &hi, FFMAX(i1 - i0, 1));
+            y0 = av_clip((int)lo, ch * band, ch * band + band - 1);
+            y1 = av_clip((int)hi, ch * band, ch * band + band - 1);
+            for (y = y0; y <= y1; y++)
+                canvas->data[0][y * canvas->linesize[0] + x] = 235;
+        }
+        
+        if (ch > 0)
+            memset(canvas->data[0] + ch * band * canvas->linesize[0], 80, w);
+    }
+    return 0;
+}
+
+static int vis_draw_spectrum(VideoState *is, AVFrame *canvas, int ring, int channels)
+{
+    int w = canvas->width, h = canvas->height;
+    int nb_display_channels = FFMIN(channels, 2);
+    int rdft_bits, nb_freq, start, ch, x, y, i;
+    float *mag[2];
+    
+    for (rdft_bits = 1; (1 << rdft_bits) < 2 * h; rdft_bits++)
+        ;
+    nb_freq = 1 << (rdft_bits - 1);
+    
+    if (rdft_bits != is->rdft_bits) {
+        av_rdft_end(is->rdft);
+        av_freep(&is->rdft_data);
+        av_freep(&is->vis_window);
+        is->rdft = av_rdft_init(rdft_bits, DFT_R2C);
+        is->rdft_bits = rdft_bits;
+        is->rdft_data = av_malloc(4 * nb_freq * sizeof(*is->rdft_data));
+        is->vis_window = av_malloc(2 * nb_freq * sizeof(float));
+        if (is->vis_window) {
+            for (i = 0; i < 2 * nb_freq; i++) {
+                float t = (i - nb_freq) / (float)nb_freq;
+                is->vis_window[i] = 1 - t * t;
+            }
+        }
+    }
+    if (!is->rdft || !is->rdft_data || !is->vis_window) {
+        av_log(NULL, AV_LOG_ERROR, "Failed to allocate buffers for RDFT, switching to waves display\n");
+        is->show_mode = SHOW_MODE_WAVES;
+        return -1;
+    }
+    av_fast_malloc(&is->vis_buf, &is->vis_buf_size, 2 * nb_freq * sizeof(float));
+    if (!is->vis_buf)
+        return AVERROR(ENOMEM);
+    
+    start = vis_window_start(is, ring, channels, 2 * nb_freq);
+    
+    for (ch = 0; ch < nb_display_channels; ch++) {
+        FFTSample *data = is->rdft_data + 2 * nb_freq * ch;
+        DSPSplitComplex z = { is->vis_buf, is->vis_buf + nb_freq };
+        float weight = 1 / sqrtf(nb_freq), zero = 0, full = 255;
+        int count = h;
+        
+        vis_gather(is, ring, start, ch, channels, data, 2 * nb_freq);
+        vDSP_vmul(data, 1, is->vis_window, 1, data, 1, 2 * nb_freq);
+        av_rdft_calc(is->rdft, data);
+        data[1] = 0; /* packed Nyquist bin */
+        
+        /* magnitude of the lowest h bins, then ffplay's sqrt(w * |X|) scale */
+        vDSP_ctoz((const DSPComplex *)data, 2, &z, 1, nb_freq);
+        vDSP_zvabs(&z, 1, data, 1, h);
+        vDSP_vsmul(data, 1, &weight, data, 1, h);
+        vvsqrtf(data, data, &count);
+        vDSP_vclip(data, 1, &zero, &full, data, 1, h);
+        mag[ch] = data;
+    }
+    if (nb_display_channels == 1)
+        mag[1] = mag[0];
+    
+    x = is->xpos;
+    for (y = 0; y < h; y++) {
+        int row = h - 1 - y;
+        int a = (int)mag[0][y];
+        int b = (int)mag[1][y];
+        int r = a, g = b, bl = (a + b) >> 1;
+        
+        canvas->data[0][row * canvas->linesize[0] + x] = RGB_TO_Y_CCIR(r, g, bl);
+        if (!(x & 1) && !(row & 1)) {
+            canvas->data[1][(row >> 1) * canvas->linesize[1] + (x >> 1)] = RGB_TO_U_CCIR(r, g, bl, 0);
+            canvas->data[2][(row >> 1) * canvas->linesize[2] + (x >> 1)] = RGB_TO_V_CCIR(r, g, bl, 0);
+        }
+    }
+    if (++is->xpos >= w)
+        is->xpos = 0;
+    return 0;
+}
+
+#pragma mark -
+
+static void vis_queue_picture(VideoState *is, AVFrame *canvas, double pts)
+{
+    VideoPicture *vp;
+    
+    LAVPLockMutex(is->pictq_mutex);
+    
+    /* LAVP: video_refresh() does not consume pictq without a video stream; retire the oldest here */
+    while (is->pictq_size >= is->pictq_depth) {
+        if (++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE)
+            is->pictq_rindex = 0;
+        is->pictq_size--;
+    }
+    
+    vp = &is->pictq[is->pictq_windex];
+    
+    /* LAVP: no video_thread competes for pictq here, so allocate in place */
+    if (!vp->bmp || !vp->allocated || vp->width != canvas->width || vp->height != canvas->height) {
+        int size = -1;
+        free_picture(vp);
+        vp->allocated = 0;
+        vp->bmp = av_frame_alloc();
+        if (!vp->bmp || (size = av_image_alloc(vp->bmp->data, vp->bmp->linesize,
+                                               canvas->width, canvas->height, PIX_FMT_YUV420P, 0x10)) < 0) {
+            av_free(vp->bmp);
+            vp->bmp = NULL;
+            LAVPUnlockMutex(is->pictq_mutex);
+            return;
+        }
+        video_account_picture(vp, size);
+        vp->width = canvas->width;
+        vp->height = canvas->height;
+        vp->reallocate = 0;
+        vp->allocated = 1;
+    }
+    
+    av_image_copy(vp->bmp->data, vp->bmp->linesize, (const uint8_t **)canvas->data, canvas->linesize,
+                  PIX_FMT_YUV420P, canvas->width, canvas->height);
+    vp->sar = (AVRational){1, 1};
+    vp->pts = pts;
+    vp->duration = is->rdftspeed;
+    vp->pos = -1;
+    vp->serial = is->videoq.serial;
+    
+    if (++is->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE)
+        is->pictq_windex = 0;
+    is->pictq_size++;
+    pictq_publish(is, is->lastPTScopied);
+    
+    LAVPCondSignal(is->pictq_cond);
+    LAVPUnlockMutex(is->pictq_mutex);
+}
+
+/* LAVP: called on is->vis_queue every rdftspeed seconds */
+static void vis_refresh(VideoState *is)
+{
+    int channels = is->audio_tgt.channels;
+    int ring, w, h, ret;
+    double pts;
+    
+    if (!is->vis_active || is->paused || is->abort_request || channels <= 0)
+        return;
+    
+    if (0 == is->width * is->height) // LAVP: zero rect is not allowed
+        video_open(is, NULL);
+    w = is->width;
+    h = is->height;
+    
+    if (!is->vis_frame || is->vis_frame->width != w || is->vis_frame->height != h) {
+        if (is->vis_frame) {
+            av_freep(&is->vis_frame->data[0]);
+            av_frame_free(&is->vis_frame);
+        }
+        is->vis_frame = av_frame_alloc();
+        if (!is->vis_frame || av_image_alloc(is->vis_frame->data, is->vis_frame->linesize,
+                                             w, h, PIX_FMT_YUV420P, 0x10) < 0) {
+            av_frame_free(&is->vis_frame);
+            return;
+        }
+        is->vis_frame->width = w;
+        is->vis_frame->height = h;
+        is->vis_frame->format = PIX_FMT_YUV420P;
+        vis_clear(is->vis_frame);
+        is->xpos = 0;
+    }
+    
+    pts = get_master_clock(is);
+    ring = SAMPLE_ARRAY_LIMIT(channels);
+    
+    if (is->show_mode == SHOW_MODE_RDFT)
+        ret = vis_draw_spectrum(is, is->vis_frame, ring, channels);
+    else
+        ret = vis_draw_waves(is, is->vis_frame, ring, channels);
+    
+    if (ret >= 0 && !isnan(pts))
+        vis_queue_picture(is, is->vis_frame, pts);
+}
+
+#pragma mark -
+
+void vis_start(VideoState *is)
+{
+    if (is->vis_timer || is->display_disable || !is->audio_st || is->show_mode == SHOW_MODE_VIDEO)
+        return;
+    
+    /* LAVP: files with video never need the sample ring */
+    is->sample_array = av_mallocz(SAMPLE_ARRAY_SIZE * sizeof(int16_t));
+    if (!is->sample_array)
+        return;
+    is->sample_array_index = 0;
+    
+    {
+        dispatch_queue_t vis_queue = dispatch_queue_create("vis", NULL);
+        dispatch_source_t vis_timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, vis_queue);
+        uint64_t interval = (uint64_t)(is->rdftspeed * NSEC_PER_SEC);
+        
+        dispatch_source_set_timer(vis_timer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, interval / 10);
+        dispatch_source_set_event_handler(vis_timer, ^(void){vis_refresh(is);});
+        
+        is->vis_queue = (__bridge_retained void*)vis_queue;
+        is->vis_timer = (__bridge_retained void*)vis_timer;
+        is->vis_active = 1;
+        
+        dispatch_resume(vis_timer);
+    }
+}
+
+void vis_stop(VideoState *is)
+{
+    if (!is->vis_timer)
+        return;
+    
+    is->vis_active = 0;
+    
+    {
+        dispatch_source_t vis_timer = (__bridge_transfer dispatch_source_t)is->vis_timer;
+        dispatch_queue_t vis_queue = (__bridge_transfer dispatch_queue_t)is->vis_queue;
+        
+        dispatch_source_cancel(vis_timer);
+        dispatch_sync(vis_queue, ^(void){}); /* wait for a refresh in flight */
+        
+        vis_timer = NULL;
+        vis_queue = NULL;
+        is->vis_timer = NULL;
+        is->vis_queue = NULL;
+    }
+    
+    if (is->vis_frame) {
+        av_freep(&is->vis_frame->data[0]);
+        av_frame_free(&is->vis_frame);
+    }
+    if (is->rdft) {
+        av_rdft_end(is->rdft);
+        is->rdft = NULL;
+        is->rdft_bits = 0;
+    }
+    av_freep(&is->rdft_data);
+    av_freep(&is->vis_window);
+    av_freep(&is->vis_buf);
+    is->vis_buf_size = 0;
+    
+    /* the AudioQueue callback has been stopped by stream_component_close() */
+    av_freep(&is->sample_array);
+}